@@ -68,6 +68,467 @@ fn placement(addr: u32) -> Option<&'static str> {
     }
 }
 
+/// Extract the clock divisor from a clock select caption such as
+/// "Running, CLK/64" or "Running, No Prescaling".  Returns 0 for the
+/// stopped and external clock settings.
+fn caption_to_prescaler(caption: &str) -> u32 {
+    let caption = caption.to_ascii_lowercase();
+    if caption.contains("ext") || caption.contains("stop") {
+        return 0;
+    }
+    if caption.contains("no prescal") {
+        return 1;
+    }
+    match caption.rfind('/') {
+        Some(idx) => {
+            let digits: String = caption[idx + 1..]
+                .chars()
+                .take_while(|c| c.is_ascii_digit())
+                .collect();
+            digits.parse().unwrap_or(0)
+        }
+        None => 0,
+    }
+}
+
+/// Emit a TimerDesc<N> specialization for a Timer/Counter register
+/// group such as TC1.  This gives flutterby/HwTimer.h the width,
+/// prescaler table, channel count and register addresses of each
+/// timer so that it can configure any of them without per-timer code.
+fn gen_timer_desc(
+    mcu_def: &mut File,
+    group: &avr_mcu::RegisterGroup,
+    value_group_by_name: &HashMap<&String, &avr_mcu::ValueGroup>,
+    instance: Option<&&avr_mcu::Instance>,
+    port_reg_addr: &HashMap<String, u32>,
+) -> std::io::Result<()> {
+    if !group.name.starts_with("TC") {
+        return Ok(());
+    }
+    let num: u8 = match group.name[2..].parse() {
+        Ok(num) => num,
+        Err(_) => return Ok(()),
+    };
+
+    let find = |name: String| group.registers.iter().find(|r| r.name == name);
+    let addr = |name: String| find(name).map(|r| r.offset).unwrap_or(0);
+
+    let tccrb = match find(format!("TCCR{}B", num)) {
+        Some(reg) => reg,
+        None => return Ok(()),
+    };
+    let tcnt = match find(format!("TCNT{}", num)) {
+        Some(reg) => reg,
+        None => return Ok(()),
+    };
+
+    // Build the prescaler table from the clock select value group,
+    // indexed by the value of the CSn bits
+    let mut prescalers = Vec::new();
+    if let Some(cs) = tccrb.bitfields.iter().find(|f| f.name == format!("CS{}", num)) {
+        prescalers.resize(1 << cs.mask.count_ones(), 0);
+        if let Some(vg) = cs.values.as_ref().and_then(|vg| value_group_by_name.get(vg)) {
+            for value in vg.values.iter() {
+                let idx = value.value as usize;
+                if idx < prescalers.len() {
+                    prescalers[idx] =
+                        caption_to_prescaler(or_name(&value.caption, &value.name));
+                }
+            }
+        }
+    }
+    if prescalers.is_empty() {
+        return Ok(());
+    }
+
+    // Timer4 on the atmega32u4 is a 10-bit timer with 8-bit registers
+    // plus a shared high byte register
+    let width = if find(format!("TC{}H", num)).is_some() {
+        10
+    } else {
+        tcnt.size * 8
+    };
+
+    let channel_names: Vec<&str> = ["A", "B", "C", "D"]
+        .iter()
+        .cloned()
+        .filter(|ch| find(format!("OCR{}{}", num, ch)).is_some())
+        .collect();
+    let channels = channel_names.len();
+
+    // Locate the output compare pins from the instance signals.  The
+    // signal group is named either OCA or OC1A depending on the device.
+    // Pads are named like PB1; the result is the DDR and PORT address
+    // for the pin and its bit number.
+    let compare_pin = |ch: &str| -> (u32, u32, u32) {
+        let signal = instance.and_then(|inst| {
+            inst.signals.iter().find(|sig| match sig.group {
+                Some(ref g) => *g == format!("OC{}", ch) || *g == format!("OC{}{}", num, ch),
+                None => false,
+            })
+        });
+        let pad = match signal {
+            Some(sig) => sig.pad.as_bytes(),
+            None => return (0, 0, 0),
+        };
+        if pad.len() != 3 || pad[0] != b'P' || !pad[2].is_ascii_digit() {
+            return (0, 0, 0);
+        }
+        let port = pad[1] as char;
+        match (
+            port_reg_addr.get(&format!("DDR{}", port)),
+            port_reg_addr.get(&format!("PORT{}", port)),
+        ) {
+            (Some(&ddr), Some(&port)) => (ddr, port, (pad[2] - b'0') as u32),
+            _ => (0, 0, 0),
+        }
+    };
+    let compare_pins: Vec<(u32, u32, u32)> =
+        channel_names.iter().map(|ch| compare_pin(ch)).collect();
+
+    writeln!(mcu_def, "")?;
+    writeln!(mcu_def, "#define HAVE_AVR_TIMER{} 1", num)?;
+    writeln!(mcu_def, "template <> struct TimerDesc<{}> {{", num)?;
+    writeln!(mcu_def, "  static constexpr uint8_t kWidth = {};", width)?;
+    writeln!(mcu_def, "  static constexpr uint8_t kChannels = {};", channels)?;
+    writeln!(
+        mcu_def,
+        "  /// Clock divisor for each clock select value; 0 if not a divisor"
+    )?;
+    writeln!(
+        mcu_def,
+        "  static constexpr uint16_t kPrescalers[{}] = {{{}}};",
+        prescalers.len(),
+        prescalers
+            .iter()
+            .map(|p| p.to_string())
+            .collect::<Vec<_>>()
+            .join(", ")
+    )?;
+    if channels > 0 {
+        writeln!(
+            mcu_def,
+            "  /// The OCnx pin of each channel; DDR and PORT are 0 if unknown"
+        )?;
+        for &(label, idx) in [("kOcDdr", 0), ("kOcPort", 1), ("kOcBit", 2)].iter() {
+            writeln!(
+                mcu_def,
+                "  static constexpr uint{}_t {}[{}] = {{{}}};",
+                if idx == 2 { 8 } else { 16 },
+                label,
+                channels,
+                compare_pins
+                    .iter()
+                    .map(|pin| {
+                        match idx {
+                            0 => format!("{:#x}", pin.0),
+                            1 => format!("{:#x}", pin.1),
+                            _ => pin.2.to_string(),
+                        }
+                    })
+                    .collect::<Vec<_>>()
+                    .join(", ")
+            )?;
+        }
+    }
+    writeln!(mcu_def, "  /// Register addresses; 0 if not present")?;
+    for &(label, ref name) in [
+        ("kTccrA", format!("TCCR{}A", num)),
+        ("kTccrB", format!("TCCR{}B", num)),
+        ("kTcnt", format!("TCNT{}", num)),
+        ("kOcrA", format!("OCR{}A", num)),
+        ("kOcrB", format!("OCR{}B", num)),
+        ("kOcrC", format!("OCR{}C", num)),
+        ("kIcr", format!("ICR{}", num)),
+        ("kTimsk", format!("TIMSK{}", num)),
+        ("kTifr", format!("TIFR{}", num)),
+    ].iter()
+    {
+        writeln!(
+            mcu_def,
+            "  static constexpr uint16_t {} = {:#x};",
+            label,
+            addr(name.clone())
+        )?;
+    }
+    writeln!(mcu_def, "}};")?;
+    Ok(())
+}
+
+/// Collect the interrupt number of each port pin from the instance
+/// signals in the named group (PCINT or INT), keyed by port letter.
+/// Pads are named like PB1; pins without an interrupt are 0xff.
+fn interrupt_pins(instance: Option<&&avr_mcu::Instance>, group: &str) -> Vec<(char, [u8; 8])> {
+    let mut ports: Vec<(char, [u8; 8])> = Vec::new();
+    if let Some(inst) = instance {
+        for sig in inst.signals.iter() {
+            if sig.group.as_ref().map(|g| g != group).unwrap_or(true) {
+                continue;
+            }
+            let pad = sig.pad.as_bytes();
+            let index = match sig.index {
+                Some(index) => index,
+                None => continue,
+            };
+            if pad.len() != 3 || pad[0] != b'P' || !pad[2].is_ascii_digit() {
+                continue;
+            }
+            let port = pad[1] as char;
+            let pos = match ports.iter().position(|&(p, _)| p == port) {
+                Some(pos) => pos,
+                None => {
+                    ports.push((port, [0xff; 8]));
+                    ports.len() - 1
+                }
+            };
+            ports[pos].1[(pad[2] - b'0') as usize] = index;
+        }
+    }
+    ports.sort_by(|a, b| a.0.cmp(&b.0));
+    ports
+}
+
+/// Emit a `template <char Port> struct Name` that maps each pin of a
+/// port to its interrupt number
+fn gen_interrupt_pins(
+    mcu_def: &mut File,
+    name: &str,
+    field: &str,
+    ports: &Vec<(char, [u8; 8])>,
+) -> std::io::Result<()> {
+    writeln!(mcu_def, "template <char Port> struct {} {{", name)?;
+    writeln!(
+        mcu_def,
+        "  static constexpr uint8_t {}[8] = \
+         {{0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}};",
+        field
+    )?;
+    writeln!(mcu_def, "}};")?;
+    for &(port, ref pins) in ports.iter() {
+        writeln!(mcu_def, "template <> struct {}<'{}'> {{", name, port)?;
+        writeln!(
+            mcu_def,
+            "  static constexpr uint8_t {}[8] = {{{}}};",
+            field,
+            pins.iter()
+                .map(|&n| if n == 0xff { "0xff".to_owned() } else { n.to_string() })
+                .collect::<Vec<_>>()
+                .join(", ")
+        )?;
+        writeln!(mcu_def, "}};")?;
+    }
+    Ok(())
+}
+
+/// Emit the external and pin change interrupt registers and the INTn
+/// and PCINTn number of each port pin, so that flutterby/PinChange.h
+/// can arm the interrupts for a set of pins without per-device tables.
+fn gen_exint_desc(
+    mcu_def: &mut File,
+    group: &avr_mcu::RegisterGroup,
+    instance: Option<&&avr_mcu::Instance>,
+    port_reg_addr: &HashMap<String, u32>,
+) -> std::io::Result<()> {
+    let find = |name: &str| group.registers.iter().find(|r| r.name == name);
+    let addr = |name: &str| find(name).map(|r| r.offset).unwrap_or(0);
+
+    let int_ports = interrupt_pins(instance, "INT");
+    let num_ints = int_ports
+        .iter()
+        .flat_map(|&(_, ref pins)| pins.iter())
+        .filter(|&&n| n != 0xff)
+        .map(|&n| n + 1)
+        .max()
+        .unwrap_or(0);
+    if num_ints > 0 && find("EIMSK").is_some() {
+        writeln!(mcu_def, "")?;
+        writeln!(mcu_def, "#define HAVE_AVR_EXTINT 1")?;
+        writeln!(mcu_def, "/// External interrupt registers; see flutterby/PinChange.h")?;
+        writeln!(mcu_def, "struct ExtIntDesc {{")?;
+        writeln!(mcu_def, "  static constexpr uint8_t kCount = {};", num_ints)?;
+        writeln!(mcu_def, "  /// Sense control for INT0-3 and INT4-7; 0 if not present")?;
+        writeln!(mcu_def, "  static constexpr uint16_t kEicra = {:#x};", addr("EICRA"))?;
+        writeln!(mcu_def, "  static constexpr uint16_t kEicrb = {:#x};", addr("EICRB"))?;
+        writeln!(mcu_def, "  static constexpr uint16_t kEimsk = {:#x};", addr("EIMSK"))?;
+        writeln!(mcu_def, "  static constexpr uint16_t kEifr = {:#x};", addr("EIFR"))?;
+        writeln!(mcu_def, "}};")?;
+        writeln!(
+            mcu_def,
+            "/// The INTn number of each pin of a port; 0xff if the pin has none"
+        )?;
+        gen_interrupt_pins(mcu_def, "ExtIntPins", "kInt", &int_ports)?;
+    }
+
+    let (pcicr, pcifr) = match (find("PCICR"), find("PCIFR")) {
+        (Some(pcicr), Some(pcifr)) => (pcicr.offset, pcifr.offset),
+        _ => return Ok(()),
+    };
+    let mut pcmsk = Vec::new();
+    while let Some(reg) = find(&format!("PCMSK{}", pcmsk.len())) {
+        pcmsk.push(reg.offset);
+    }
+    if pcmsk.is_empty() {
+        return Ok(());
+    }
+
+    let pcint_ports = interrupt_pins(instance, "PCINT");
+
+    // The PINx register that holds each group, when all of the pins
+    // of the group belong to the same port
+    let group_pin: Vec<u32> = (0..pcmsk.len())
+        .map(|g| {
+            let mut port = None;
+            for &(p, ref pins) in pcint_ports.iter() {
+                if pins.iter().any(|&n| n != 0xff && n as usize / 8 == g) {
+                    if port.is_some() {
+                        return 0;
+                    }
+                    port = Some(p);
+                }
+            }
+            port.and_then(|p| port_reg_addr.get(&format!("PIN{}", p)))
+                .cloned()
+                .unwrap_or(0)
+        })
+        .collect();
+
+    let join = |v: &Vec<u32>| {
+        v.iter()
+            .map(|a| format!("{:#x}", a))
+            .collect::<Vec<_>>()
+            .join(", ")
+    };
+
+    writeln!(mcu_def, "")?;
+    writeln!(mcu_def, "#define HAVE_AVR_PCINT 1")?;
+    writeln!(mcu_def, "/// Pin change interrupt registers; see flutterby/PinChange.h")?;
+    writeln!(mcu_def, "struct PcintDesc {{")?;
+    writeln!(mcu_def, "  static constexpr uint8_t kGroups = {};", pcmsk.len())?;
+    writeln!(mcu_def, "  static constexpr uint16_t kPcicr = {:#x};", pcicr)?;
+    writeln!(mcu_def, "  static constexpr uint16_t kPcifr = {:#x};", pcifr)?;
+    writeln!(
+        mcu_def,
+        "  static constexpr uint16_t kPcmsk[{}] = {{{}}};",
+        pcmsk.len(),
+        join(&pcmsk)
+    )?;
+    writeln!(
+        mcu_def,
+        "  /// The PINx register of each group; 0 if the group spans ports"
+    )?;
+    writeln!(
+        mcu_def,
+        "  static constexpr uint16_t kPin[{}] = {{{}}};",
+        group_pin.len(),
+        join(&group_pin)
+    )?;
+    writeln!(mcu_def, "}};")?;
+    writeln!(
+        mcu_def,
+        "/// The PCINT number of each pin of a port; 0xff if the pin has none"
+    )?;
+    gen_interrupt_pins(mcu_def, "PcintPins", "kPcint", &pcint_ports)?;
+    Ok(())
+}
+
+/// Emit a description of each bit of the power reduction registers
+/// (PRR, or PRR0 and PRR1 on the larger parts) so that flutterby/Power.h
+/// can gate peripheral clocks without per-device tables.
+fn gen_power_gates(mcu_def: &mut File, mcu: &avr_mcu::Mcu) -> std::io::Result<()> {
+    writeln!(mcu_def, "")?;
+    writeln!(mcu_def, "/// Power reduction bits; see flutterby/Power.h")?;
+    writeln!(mcu_def, "namespace power_gate {{")?;
+    for module in mcu.modules.iter() {
+        for group in module.register_groups.iter() {
+            for reg in group.registers.iter() {
+                if reg.name != "PRR" && reg.name != "PRR0" && reg.name != "PRR1" {
+                    continue;
+                }
+                for field in reg.bitfields.iter() {
+                    writeln!(mcu_def, "#define HAVE_AVR_POWER_{} 1", field.name)?;
+                    writeln!(mcu_def, "struct {} {{", field.name)?;
+                    writeln!(
+                        mcu_def,
+                        "  static constexpr uint16_t kReg = {:#x};",
+                        reg.offset
+                    )?;
+                    writeln!(
+                        mcu_def,
+                        "  static constexpr uint8_t kMask = {:#x};",
+                        field.mask
+                    )?;
+                    writeln!(mcu_def, "}};")?;
+                }
+            }
+        }
+    }
+    writeln!(mcu_def, "}}")?;
+    Ok(())
+}
+
+/// Emit the addresses of the USB device controller registers so that
+/// lib/usb.cpp can drive the endpoints by number.  The bit layout is
+/// the same on every part that has this controller.
+fn gen_usb_desc(mcu_def: &mut File, mcu: &avr_mcu::Mcu) -> std::io::Result<()> {
+    let mut regs = HashMap::new();
+    for module in mcu.modules.iter() {
+        for group in module.register_groups.iter() {
+            for reg in group.registers.iter() {
+                regs.insert(reg.name.clone(), reg);
+            }
+        }
+    }
+
+    let names = [
+        ("kUhwcon", "UHWCON"),
+        ("kUsbcon", "USBCON"),
+        ("kUsbsta", "USBSTA"),
+        ("kUsbint", "USBINT"),
+        ("kUdcon", "UDCON"),
+        ("kUdint", "UDINT"),
+        ("kUdien", "UDIEN"),
+        ("kUdaddr", "UDADDR"),
+        ("kUenum", "UENUM"),
+        ("kUerst", "UERST"),
+        ("kUeconx", "UECONX"),
+        ("kUecfg0x", "UECFG0X"),
+        ("kUecfg1x", "UECFG1X"),
+        ("kUesta0x", "UESTA0X"),
+        ("kUeintx", "UEINTX"),
+        ("kUeienx", "UEIENX"),
+        ("kUedatx", "UEDATX"),
+        ("kUebclx", "UEBCLX"),
+        ("kUeint", "UEINT"),
+        ("kPllcsr", "PLLCSR"),
+    ];
+    if names.iter().any(|&(_, name)| !regs.contains_key(name)) {
+        return Ok(());
+    }
+
+    // One UERST bit per endpoint
+    let endpoints = regs["UERST"]
+        .bitfields
+        .iter()
+        .map(|f| f.mask.count_ones())
+        .sum::<u32>();
+
+    writeln!(mcu_def, "")?;
+    writeln!(mcu_def, "#define HAVE_AVR_USB 1")?;
+    writeln!(mcu_def, "/// USB device controller registers; see flutterby/Usb.h")?;
+    writeln!(mcu_def, "struct UsbDesc {{")?;
+    writeln!(mcu_def, "  static constexpr uint8_t kEndpoints = {};", endpoints)?;
+    for &(field, name) in names.iter() {
+        writeln!(
+            mcu_def,
+            "  static constexpr uint16_t {} = {:#x};",
+            field,
+            regs[name].offset
+        )?;
+    }
+    writeln!(mcu_def, "}};")?;
+    Ok(())
+}
+
 fn genmcu(mcu: &avr_mcu::Mcu, _name: &str, output_file_name: &str) -> std::io::Result<()> {
     let mut mcu_def = File::create(output_file_name)?;
 
@@ -76,6 +537,11 @@ fn genmcu(mcu: &avr_mcu::Mcu, _name: &str, output_file_name: &str) -> std::io::R
     writeln!(mcu_def, "#include <flutterby/Bitflags.h>")?;
     writeln!(mcu_def, "namespace flutterby {{")?;
     writeln!(mcu_def, "// MCU defs for {}", mcu.device.name)?;
+    writeln!(
+        mcu_def,
+        "/// Describes Timer/Counter N; see flutterby/HwTimer.h"
+    )?;
+    writeln!(mcu_def, "template <uint8_t N> struct TimerDesc;")?;
 
     // Interrupt handler definitions.  These assume that we're linking
     // with the avr libc startup and that it will take care of putting
@@ -108,6 +574,22 @@ fn genmcu(mcu: &avr_mcu::Mcu, _name: &str, output_file_name: &str) -> std::io::R
         }
     }
 
+    // The DDRx, PORTx and PINx addresses, used to describe the pins
+    // that belong to the timer compare outputs and interrupt groups
+    let mut port_reg_addr = HashMap::new();
+    for module in mcu.modules.iter() {
+        for group in module.register_groups.iter() {
+            for reg in group.registers.iter() {
+                if reg.name.starts_with("DDR")
+                    || reg.name.starts_with("PORT")
+                    || reg.name.starts_with("PIN")
+                {
+                    port_reg_addr.insert(reg.name.clone(), reg.offset);
+                }
+            }
+        }
+    }
+
     // Candidate locations for simavr registers
     let mut simavr_console_reg = None;
     let mut simavr_command_reg = None;
@@ -298,9 +780,29 @@ fn genmcu(mcu: &avr_mcu::Mcu, _name: &str, output_file_name: &str) -> std::io::R
             }
 
             writeln!(mcu_def, "}}")?;
+
+            gen_timer_desc(
+                &mut mcu_def,
+                group,
+                &value_group_by_name,
+                instance_by_name.get(&group.name),
+                &port_reg_addr,
+            )?;
+
+            if group.name == "EXINT" {
+                gen_exint_desc(
+                    &mut mcu_def,
+                    group,
+                    instance_by_name.get(&group.name),
+                    &port_reg_addr,
+                )?;
+            }
         }
     }
 
+    gen_power_gates(&mut mcu_def, mcu)?;
+    gen_usb_desc(&mut mcu_def, mcu)?;
+
     writeln!(mcu_def, "\n\n")?;
 
     writeln!(mcu_def, "#ifdef HAVE_SIMAVR")?;
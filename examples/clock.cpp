@@ -3,9 +3,14 @@
 #include "flutterby/Debug.h"
 #include "flutterby/Serial0.h"
 #include "flutterby/I2c.h"
+#include "flutterby/Rtc.h"
 #include "flutterby/Gpio.h"
-#include "flutterby/Timer0.h"
+#include "flutterby/PinChange.h"
+#include "flutterby/HwTimer.h"
+#include "flutterby/Timebase.h"
+#include "flutterby/Profile.h"
 #include "flutterby/BusyWait.h"
+#include "flutterby/CompressedProgmem.h"
 
 #include "gfxfont.h"
 #include "TomThumb.h"
@@ -17,50 +22,10 @@
 
 using namespace flutterby;
 
-enum Ds1337Consts {
-  TWI_ADDR = 0x68,
-  SECONDS = 0x00,
-  MINUTES = 0x01,
-  HOURS = 0x02,
-  DAY = 0x03,
-  DATE = 0x04,
-  MONTH = 0x05,
-  YEAR = 0x06,
-};
-
-struct bcd_time {
-  u8 seconds;
-  u8 minutes;
-  u8 hours;
-  u8 day; // day of the week. 0 == Sunday
-  u8 date;
-  u8 month;
-  u8 year;
-};
-
-static bcd_time last_read_time;
-
-static inline u8 decode_bcd(u8 x) {
-  return ((x >> 4) * 10 + (x & 0x0F));
-}
-
-Result<bcd_time, I2cMaster::Error> read_time() {
-  bcd_time time;
-  auto res = I2cMaster::read(TWI_ADDR, 100, SECONDS, time);
-  if (res.is_err()) {
-    return Error<bcd_time>(move(res.error()));
-  }
-
-  time.seconds = decode_bcd(time.seconds);
-  time.minutes = decode_bcd(time.minutes);
-  time.hours = decode_bcd(time.hours);
-  time.day = decode_bcd(time.day);
-  time.date = decode_bcd(time.date);
-  time.month = decode_bcd(time.month);
-  time.year = decode_bcd(time.year);
-
-  return Ok<bcd_time, I2cMaster::Error>(move(time));
-}
+// The buttons occupy INT0 and INT1 on this board, so rather than using
+// the square wave output of the DS1337 we tick the software clock from
+// an event loop timer and resync with the chip every 10 minutes.
+using Clock = Rtc<rtc::Ds1337>;
 
 // Portb is attached to the 7 LED display rows.
 // Set them to output mode.
@@ -135,22 +100,28 @@ static void next_screen() {
   active_matrix = (active_matrix + 1) & 1;
 }
 
+// The glyph bitmaps are stored compressed; the font header is only
+// consulted at compile time, so the uncompressed bitmaps aren't emitted
+CompressedProgMem(TomThumbPacked, TomThumbBitmaps);
+static_assert(
+    sizeof(TomThumbPacked) < sizeof(TomThumbBitmaps),
+    "compression should save flash");
+static constexpr auto kFirstChar = TomThumb.first;
+static constexpr auto kGlyphs = TomThumb.glyph;
+
 u8 render_char_at(u8 screen, u8 x, u8 y, u8 c) {
-  c -= progmem_deref(&TomThumb.first);
-  auto glyph = &(progmem_deref(&TomThumb.glyph)[c]);
-  auto bitmap = progmem_deref(&TomThumb.bitmap);
-
-  auto bo = progmem_deref(&glyph->bitmapOffset);
-  auto w = progmem_deref(&glyph->width);
-  auto h = progmem_deref(&glyph->height);
-  int8_t xo = progmem_deref(&glyph->xOffset),
-         yo = progmem_deref(&glyph->yOffset);
+  PROFILE_SCOPE("render_char_at"_P);
+  auto glyph = ProgMemReader(&kGlyphs[c - kFirstChar]).read<GFXglyph>();
+  auto bitmap = TomThumbPacked.at(glyph.bitmapOffset);
+
+  int8_t xo = glyph.xOffset, yo = glyph.yOffset;
   uint8_t xx, yy, bits = 0, bit = 0;
 
-  for (yy = 0; yy < h; yy++) {
-    for (xx = 0; xx < w; xx++) {
+  for (yy = 0; yy < glyph.height; yy++) {
+    for (xx = 0; xx < glyph.width; xx++) {
       if (!(bit++ & 7)) {
-        bits = progmem_deref(&bitmap[bo++]);
+        bits = *bitmap;
+        ++bitmap;
       }
       auto target_x =  x + xo + xx;
       auto target_y = y + yo + yy;
@@ -162,7 +133,7 @@ u8 render_char_at(u8 screen, u8 x, u8 y, u8 c) {
   }
 
   // Return the visible width of the character
-  return progmem_deref(&glyph->xAdvance);
+  return glyph.xAdvance;
 }
 
 // Render to the not-currently-displayed screen buffer
@@ -186,6 +157,12 @@ static u8 long_message_len = 26;
 static u8 long_message_pos = 0;
 static bool scrolling = false;
 
+// The button contacts bounce on release as well as on press, so a
+// falling edge only counts as a press once the pin has been quiet for
+// this long
+static constexpr u32 kButtonSettle = timebase::us_to_ticks(20000);
+static u32 button_edge_at = 0;
+
 // Drives the state machine for the LEDs.
 // Each time we are called we tick through these steps:
 // 1. if "on", turn on the column and set state to "off"
@@ -194,6 +171,7 @@ static bool scrolling = false;
 // The explicit "off" state prevents ghosting/bleeding of the
 // on "pixels" in the subsequent column.
 static void led_tick() {
+  PROFILE_SCOPE("led_tick"_P);
   static volatile int col_num = 0;
   static bool on = true;
 
@@ -219,19 +197,6 @@ IRQ_TIMER0_COMPA {
   led_tick();
 }
 
-void read_clock() {
-  auto res = read_time();
-  if (res.is_ok()) {
-    last_read_time = move(res.value());
-#if 0
-                   TXSER() << time.hours << ":"_P << time.minutes << ":"_P
-                           << time.seconds << " day:"_P << time.day
-                           << " date:"_P << time.date << " month:"_P
-                           << time.month << " year:"_P << time.year;
-#endif
-  }
-}
-
 int main() {
   __builtin_avr_cli();
   __builtin_avr_wdr();
@@ -250,38 +215,55 @@ int main() {
 
   // Timer0 drives the LED display updates; every 200us we tick
   // and drive the state machine.
-  Timer0::configure(
-      Timer0::WaveformGenerationMode::ClearOnTimerMatchOutputCompare,
-      200);
+  HwTimer<0>::configure_period<200>();
+
+  // Everything we need has been set up (the event loop starts Timer1
+  // for itself), so stop clocking the rest
+  power::gate_unused();
 
   clear_screen();
   MATRIX() << "w00t!!!"_P;
   next_screen();
-  read_clock();
 
   // Show the w00t splash screen for 2 seconds, then turn on
   // the clock display.
   __builtin_avr_sei();
   busy_wait_ms(2000);
 
-  // This periodic task is responsible for re-reading from the RTC.
-  // We do this approximately every second and store the value in
-  // the global last_read_time variable.
-  eventloop::enable_timer(make_timer(1_s, true, read_clock).value());
+  if (Clock::begin(600).is_err()) {
+    DBG() << "failed to read the RTC"_P;
+  }
+
+  // This periodic task advances the software clock every second.
+  // It only talks to the RTC when a resync is due.
+  eventloop::enable_timer(make_timer(1_s, true, [] {
+                            Clock::on_edge();
+                            if (Clock::poll().is_err()) {
+                              DBG() << "failed to resync the RTC"_P;
+                            }
+                          }).value());
+
+  // Pressing Button1 pulls INT1 low, which starts or stops the scrolling
+  // message as soon as it happens
+  spawn(Button1::edges(gpio::Edge::Both).for_each([](gpio::Edge edge) {
+    auto now = timebase::now();
+    bool settled = now - button_edge_at >= kButtonSettle;
+    button_edge_at = now;
+    if (edge != gpio::Edge::Falling || !settled) {
+      return;
+    }
+    if (!scrolling) {
+      scrolling = true;
+    } else if (long_message_pos > 3) {
+      // Allow stopping the scroll, but only once it has got going
+      scrolling = false;
+    }
+  }));
 
   eventloop::enable_timer(
       make_timer(300_ms, true, [] {
         clear_screen();
 
-        if (!scrolling && !Button1::read()) {
-          scrolling = true;
-        } else if (scrolling && long_message_pos > 3 && !Button1::read()) {
-          // Allow stopping the scroll, but effectively de-bounce
-          // by deferring looking at the button until we've scrolled
-          // a bit
-          scrolling = false;
-        }
-
         if (scrolling) {
           u8 x = 0;
           u8 i = long_message_pos;
@@ -297,16 +279,17 @@ int main() {
             scrolling = false;
           }
         } else {
+          auto now = Clock::now();
           auto out = MATRIX();
-          if (last_read_time.hours < 10) {
+          if (now.hours < 10) {
             out << "0"_P;
           }
-          out << last_read_time.hours;
+          out << now.hours;
           out << ":"_P;
-          if (last_read_time.minutes < 10) {
+          if (now.minutes < 10) {
             out << "0"_P;
           }
-          out << last_read_time.minutes;
+          out << now.minutes;
         }
 
         next_screen();
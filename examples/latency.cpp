@@ -0,0 +1,68 @@
+#include "avr_autogen.h"
+#include "flutterby/KeyMatrix.h"
+#include "flutterby/Timebase.h"
+#ifdef HAVE_AVR_USART0
+#include "flutterby/Serial0.h"
+#endif
+#ifdef HAVE_AVR_USB
+#include "flutterby/Usb.h"
+#endif
+
+using namespace flutterby;
+using namespace flutterby::gpio;
+
+// The firmware for `make bench`: scans the 4x6 virtual matrix that
+// simrunner wires up, and reports each key event as quickly as it can
+// on every output that the part has.  simrunner --bench presses keys
+// and measures how long each output takes to respond.
+
+using Rows = OutputPins<
+    OutputPin<PortC, 0>,
+    OutputPin<PortC, 1>,
+    OutputPin<PortC, 2>,
+    OutputPin<PortC, 3>>;
+using Cols = InputPins<
+    InputPin<PortD, 4, kEnablePullUp>,
+    InputPin<PortD, 5, kEnablePullUp>,
+    InputPin<PortD, 6, kEnablePullUp>,
+    InputPin<PortD, 7, kEnablePullUp>,
+    InputPin<PortB, 4, kEnablePullUp>,
+    InputPin<PortB, 5, kEnablePullUp>>;
+using Matrix = KeyMatrix<Rows, Cols, debounce::Eager<5>>;
+
+// Toggled for each event; the quickest output, so it shows the cost
+// of the scan and debounce alone
+using Marker = OutputPin<PortB, 1>;
+
+static constexpr u32 kScanInterval = timebase::us_to_ticks(1000);
+
+int main() {
+  timebase::start();
+  __builtin_avr_sei();
+
+  Marker::setup();
+  Matrix matrix;
+  matrix.setup();
+#ifdef HAVE_AVR_USART0
+  Serial0::configure(57600);
+#endif
+#ifdef HAVE_AVR_USB
+  usb::attach();
+#endif
+
+  for (;;) {
+    auto start = timebase::now();
+    matrix.scan([](KeyEvent e) {
+      Marker::toggle();
+#ifdef HAVE_AVR_USART0
+      Serial0::write_byte((e.pressed ? 0x80 : 0) | (e.row << 4) | e.col);
+#endif
+#ifdef HAVE_AVR_USB
+      // Usages from 0x04 (a) onwards
+      usb::key(0x04 + e.row * Matrix::kCols + e.col, e.pressed);
+#endif
+    });
+    while (timebase::now() - start < kScanInterval) {
+    }
+  }
+}
@@ -48,7 +48,7 @@
 
 #define TOMTHUMB_USE_EXTENDED 0
 
-const uint8_t TomThumbBitmaps[] __attribute__((progmem)) = {
+constexpr uint8_t TomThumbBitmaps[] __attribute__((progmem)) = {
    0x00,                                /* 0x20 space */
    0x80, 0x80, 0x80, 0x00, 0x80,        /* 0x21 exclam */
    0xA0, 0xA0,                          /* 0x22 quotedbl */
@@ -468,7 +468,7 @@ const GFXglyph TomThumbGlyphs[] __attribute__((progmem)) = {
 #endif /* (TOMTHUMB_USE_EXTENDED) */
 };
 
-const GFXfont TomThumb __attribute__((progmem)) = {
+constexpr GFXfont TomThumb __attribute__((progmem)) = {
   (uint8_t  *)TomThumbBitmaps,
   (GFXglyph *)TomThumbGlyphs,
   0x20, 0x7E, 6 };
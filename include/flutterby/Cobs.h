@@ -0,0 +1,123 @@
+#pragma once
+#include "flutterby/Types.h"
+
+/** Consistent Overhead Byte Stuffing.
+ * COBS removes all zero bytes from a packet at the cost of at most one
+ * extra byte per 254, which leaves zero free to delimit packets on a
+ * byte stream such as a USART.  A receiver that joins the stream part
+ * way through (or that sees a corrupted packet) resynchronizes at the
+ * next zero.
+ */
+
+namespace flutterby {
+namespace cobs {
+
+/** Encode len bytes of data, passing each encoded byte to sink.
+ * The trailing zero delimiter is not included. */
+template <typename Sink>
+void encode(const u8* data, u8 len, Sink&& sink) {
+  u8 pos = 0;
+  while (true) {
+    u8 run = 0;
+    while (pos + run < len && data[pos + run] != 0 && run < 254) {
+      ++run;
+    }
+    sink(u8(run + 1));
+    for (u8 i = 0; i < run; ++i) {
+      sink(data[pos + i]);
+    }
+    pos += run;
+    if (pos == len) {
+      return;
+    }
+    if (run < 254) {
+      // skip the zero that terminated this run
+      ++pos;
+    }
+  }
+}
+
+/** Decoder incrementally decodes a packet into a caller supplied
+ * buffer, one encoded byte at a time.  This avoids buffering the
+ * encoded form of the packet as well as the decoded form. */
+class Decoder {
+  u8* buf_;
+  u8 capacity_;
+  u8 len_{0};
+  // Encoded bytes left in the current block; 0 means the next
+  // byte is a block code
+  u8 remaining_{0};
+  // True if the current block ends with an implicit zero
+  bool pending_zero_{false};
+  // True if the packet overflowed buf_ or was malformed
+  bool error_{false};
+  u8 last_len_{0};
+
+  void append(u8 b) {
+    if (len_ == capacity_) {
+      error_ = true;
+      return;
+    }
+    buf_[len_++] = b;
+  }
+
+ public:
+  enum class Status : u8 {
+    // The packet is incomplete
+    Pending,
+    // A packet of length() bytes is available in the buffer
+    Complete,
+    // The packet was malformed or too long and has been discarded
+    Invalid,
+  };
+
+  Decoder(u8* buf, u8 capacity) : buf_(buf), capacity_(capacity) {}
+
+  /** Feed an encoded byte; zero marks the end of a packet.
+   * After Complete or Invalid the decoder is ready for the next packet,
+   * but the buffer content remains valid until the next call. */
+  Status feed(u8 b) {
+    if (b == 0) {
+      Status status;
+      if (len_ == 0 && remaining_ == 0 && !pending_zero_ && !error_) {
+        // Back to back delimiters are used to flush the line;
+        // quietly ignore the empty packet
+        status = Status::Pending;
+      } else if (remaining_ == 0 && !error_) {
+        // The final implicit zero is not part of the packet
+        status = Status::Complete;
+      } else {
+        status = Status::Invalid;
+      }
+      last_len_ = len_;
+      reset();
+      return status;
+    }
+    if (remaining_ == 0) {
+      if (pending_zero_) {
+        append(0);
+      }
+      remaining_ = b - 1;
+      pending_zero_ = b != 0xff;
+    } else {
+      append(b);
+      --remaining_;
+    }
+    return Status::Pending;
+  }
+
+  /** Discard any partially decoded packet */
+  void reset() {
+    len_ = 0;
+    remaining_ = 0;
+    pending_zero_ = false;
+    error_ = false;
+  }
+
+  /** The length of the most recently completed packet */
+  u8 length() const {
+    return last_len_;
+  }
+};
+}
+}
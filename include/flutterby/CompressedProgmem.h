@@ -0,0 +1,255 @@
+#pragma once
+#include "flutterby/Progmem.h"
+
+namespace flutterby {
+namespace compress {
+
+/* A byte oriented LZ77 codec for constant tables such as fonts, cheap
+ * enough to decode a byte at a time while streaming out of flash.
+ * The compressed stream is a sequence of tokens:
+ *
+ *   0lllllll      l+1 literal bytes follow
+ *   1llddddd      copy l+2 bytes from d+1 bytes back
+ *
+ * A copy may overlap the bytes it produces, so a run of a repeated
+ * byte is a chain of copies from 1 byte back.  Copies are short and
+ * reach at most kWindow bytes back; font bitmaps are full of short
+ * repeats of a few distinct bytes, and the decoder needs only that
+ * much history.
+ *
+ * The data is encoded in independent blocks of kBlock bytes: no token
+ * spans a block boundary and no copy reaches into an earlier block.
+ * The offset of each block is kept alongside the data, so a reader can
+ * seek to any position by decoding at most kBlock - 1 bytes. */
+
+static constexpr uint8_t kBlock = 128;
+static constexpr uint8_t kWindow = 32;
+static constexpr uint8_t kMinCopy = 2;
+static constexpr uint8_t kMaxCopy = 3 + kMinCopy;
+static constexpr uint8_t kMaxLiterals = 0x80;
+
+static_assert((kWindow & (kWindow - 1)) == 0, "kWindow must be 2^n");
+
+/** Returns byte i of a table of bytes */
+template <size_t N>
+constexpr uint8_t byte_at(const uint8_t (&table)[N], size_t i) {
+  return table[i];
+}
+
+/** Returns byte i of a table of fixed size rows, such as a font with
+ * one row per character */
+template <size_t N, size_t M>
+constexpr uint8_t byte_at(const uint8_t (&table)[N][M], size_t i) {
+  return table[i / M][i % M];
+}
+
+/** Encodes the first len bytes of table and returns the size of the
+ * compressed stream.  If out is not null the stream is stored there,
+ * and if index is not null the offset of each block is stored there.
+ * This is meant to be run by the compiler; see CompressedProgMem(). */
+template <typename Table>
+constexpr size_t
+encode(const Table& table, size_t len, uint8_t* out, uint16_t* index) {
+  size_t n = 0;
+  auto emit = [&](uint8_t b) {
+    if (out) {
+      out[n] = b;
+    }
+    ++n;
+  };
+  auto emit_literals = [&](size_t from, size_t to) {
+    while (from < to) {
+      size_t count = to - from > kMaxLiterals ? kMaxLiterals : to - from;
+      emit(uint8_t(count - 1));
+      for (size_t i = 0; i < count; ++i) {
+        emit(byte_at(table, from + i));
+      }
+      from += count;
+    }
+  };
+
+  for (size_t start = 0; start < len; start += kBlock) {
+    if (index) {
+      index[start / kBlock] = uint16_t(n);
+    }
+    size_t end = len - start > kBlock ? start + kBlock : len;
+    size_t i = start;
+    size_t literals = start;
+
+    while (i < end) {
+      size_t best_len = 0;
+      size_t best_dist = 0;
+      for (size_t dist = 1; dist <= kWindow && dist <= i - start; ++dist) {
+        size_t l = 0;
+        while (i + l < end && l < kMaxCopy &&
+               byte_at(table, i + l) == byte_at(table, i + l - dist)) {
+          ++l;
+        }
+        if (l > best_len) {
+          best_len = l;
+          best_dist = dist;
+        }
+      }
+
+      if (best_len >= kMinCopy) {
+        emit_literals(literals, i);
+        emit(uint8_t(0x80 | ((best_len - kMinCopy) << 5) | (best_dist - 1)));
+        i += best_len;
+        literals = i;
+      } else {
+        ++i;
+      }
+    }
+    emit_literals(literals, end);
+  }
+  return n;
+}
+
+/** Returns the compressed size of a table */
+template <typename Table>
+constexpr size_t encoded_size(const Table& table) {
+  return encode(table, sizeof(table), nullptr, nullptr);
+}
+}
+
+/** Iterates the bytes of a CompressedProgMemInst, decoding them from
+ * flash one at a time.  It holds the last compress::kWindow bytes that
+ * it produced; the table itself is never copied to SRAM. */
+class CompressedProgMemPtr {
+  ProgMemReader src_;
+  uint16_t pos_;
+  uint16_t size_;
+  // Bytes remaining in the current token, and the distance back to
+  // copy them from; 0 for literals
+  uint8_t run_{0};
+  uint8_t dist_{0};
+  uint8_t cur_{0};
+  uint8_t window_[compress::kWindow];
+
+  void decode() {
+    if (run_ == 0) {
+      auto token = src_.next();
+      if (token & 0x80) {
+        run_ = ((token >> 5) & 3) + compress::kMinCopy;
+        dist_ = (token & 0x1f) + 1;
+      } else {
+        run_ = token + 1;
+        dist_ = 0;
+      }
+    }
+    --run_;
+    if (dist_) {
+      cur_ = window_[(pos_ - dist_) & (compress::kWindow - 1)];
+    } else {
+      cur_ = src_.next();
+    }
+    window_[pos_ & (compress::kWindow - 1)] = cur_;
+  }
+
+ public:
+  /** Positions the iterator at the start of the block that begins at
+   * raw offset pos and whose stream begins at src.  If pos is the size
+   * of the table this is the end iterator and nothing is decoded. */
+  CompressedProgMemPtr(const uint8_t* src, uint16_t pos, uint16_t size)
+      : src_(src), pos_(pos), size_(size) {
+    if (pos_ < size_) {
+      decode();
+    }
+  }
+
+  uint8_t operator*() const {
+    return cur_;
+  }
+
+  operator uint8_t() const {
+    return cur_;
+  }
+
+  bool operator!=(const CompressedProgMemPtr& other) const {
+    return pos_ != other.pos_;
+  }
+
+  /** Advances to the next byte.  The stream runs on into the next
+   * block, since blocks are only independent for the sake of at() */
+  CompressedProgMemPtr& operator++() {
+    if (++pos_ < size_) {
+      decode();
+    }
+    return *this;
+  }
+
+  /** Returns the offset of the current byte in the uncompressed table */
+  uint16_t position() const {
+    return pos_;
+  }
+};
+
+/** A table of bytes stored compressed in ProgMem; see compress::encode
+ * for the format.  The table is compressed by the compiler from a
+ * constexpr array, which then need not be emitted at all, and iterates
+ * as the original bytes:
+ *
+ * ```
+ * constexpr uint8_t kBitmaps[] = {...};
+ * CompressedProgMem(Bitmaps, kBitmaps);
+ * ...
+ *   for (auto b : Bitmaps) { ... }
+ *   auto it = Bitmaps.at(offset);
+ * ```
+ */
+template <size_t RawSize, size_t Size>
+class CompressedProgMemInst {
+  static_assert(RawSize < 0x10000, "tables are indexed by a u16");
+  static constexpr size_t kBlocks =
+      (RawSize + compress::kBlock - 1) / compress::kBlock;
+
+  uint16_t index_[kBlocks];
+  uint8_t data_[Size];
+
+ public:
+  template <typename Table>
+  constexpr CompressedProgMemInst(const Table& table) : index_{0}, data_{0} {
+    compress::encode(table, RawSize, data_, index_);
+  }
+
+  CompressedProgMemPtr begin() const {
+    return CompressedProgMemPtr(data_, 0, RawSize);
+  }
+
+  CompressedProgMemPtr end() const {
+    return CompressedProgMemPtr(data_, RawSize, RawSize);
+  }
+
+  /** Returns an iterator positioned at the specified offset in the
+   * uncompressed table.  Performs no bounds checks! */
+  CompressedProgMemPtr at(uint16_t offset) const {
+    auto block = offset / compress::kBlock;
+    CompressedProgMemPtr it(
+        data_ + progmem_deref(&index_[block]),
+        block * compress::kBlock,
+        RawSize);
+    for (auto skip = offset % compress::kBlock; skip > 0; --skip) {
+      ++it;
+    }
+    return it;
+  }
+
+  /** Returns the size of the uncompressed table */
+  constexpr typename smallest_integer_maximum<RawSize>::type size() const {
+    return RawSize;
+  }
+};
+
+/** A macro to compress a constexpr table of bytes, or of rows of bytes,
+ * into ProgMem.  The ident parameter is the identifier to be emitted in
+ * the current namespace.  It is declared constexpr so that a table too
+ * large for the compiler to encode is an error rather than a silent
+ * fallback to encoding it at startup. */
+#define CompressedProgMem(ident, content)                              \
+  constexpr CompressedProgMemInst<                                     \
+      sizeof(content),                                                 \
+      flutterby::compress::encoded_size(content)>                      \
+      ident __attribute__((progmem)) {                                 \
+    content                                                            \
+  }
+}
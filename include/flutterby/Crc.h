@@ -0,0 +1,26 @@
+#pragma once
+#include "flutterby/Types.h"
+
+namespace flutterby {
+
+/** CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xffff, no
+ * reflection and no final xor.  Computed a bit at a time; this is
+ * slower than a table but costs no flash for the table. */
+static inline u16 crc16_ccitt_update(u16 crc, u8 b) {
+  crc ^= u16(b) << 8;
+  for (u8 i = 0; i < 8; ++i) {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+static constexpr u16 kCrc16CcittInit = 0xffff;
+
+static inline u16 crc16_ccitt(const u8* data, u8 len) {
+  u16 crc = kCrc16CcittInit;
+  for (u8 i = 0; i < len; ++i) {
+    crc = crc16_ccitt_update(crc, data[i]);
+  }
+  return crc;
+}
+}
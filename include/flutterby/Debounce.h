@@ -0,0 +1,137 @@
+#pragma once
+#include "flutterby/Types.h"
+
+namespace flutterby {
+namespace debounce {
+
+enum class Mode : u8 {
+  // Report a change as soon as it is seen, then ignore the key until it
+  // has been stable for the debounce time.  Lowest latency, but a glitch
+  // on an idle key is reported as a press.
+  Eager,
+  // Report a change once the key has been in its new state for the whole
+  // debounce time.  Immune to glitches shorter than that.
+  Deferred,
+};
+
+// Returns the number of bits needed to count up to n
+constexpr u8 counter_bits(u8 n) {
+  return n < 2 ? 1 : 1 + counter_bits(n >> 1);
+}
+
+/** Debounces a matrix of switches using vertical counters.
+ *
+ * Rather than keeping a counter per key, bit n of each key's counter is
+ * stored in plane n, one Row bitmap per plane.  Updating the counters
+ * for all of the keys in a row then takes a few logic operations per
+ * plane, regardless of how many keys there are in the row.
+ *
+ * Periods is the debounce time, measured in scans.  Counters need
+ * counter_bits(Periods + 1) planes, so a 5 scan debounce on 16 columns
+ * costs 6 bytes per row.
+ */
+template <class Row, u8 Rows, u8 Periods, Mode DebounceMode>
+class VerticalDebouncer {
+  static_assert(Periods > 0, "the debounce time must be at least one scan");
+  static_assert(Periods < 255, "the debounce time is too long");
+
+  static constexpr u8 kBits = counter_bits(Periods + 1);
+  // The counter value at which a key becomes stable
+  static constexpr u8 kEnd = DebounceMode == Mode::Eager ? Periods + 1 : Periods;
+
+ public:
+  /** Feed in the raw state of row r and return its debounced state */
+  Row update(u8 r, Row raw) {
+    Row delta = raw ^ stable_[r];
+
+    if (DebounceMode == Mode::Deferred) {
+      // Count the scans that each key has differed from its stable
+      // state, starting over if it bounces back
+      increment(r, delta);
+      Row settled = at_end(r, delta);
+      clear(r, settled);
+      stable_[r] ^= settled;
+    } else {
+      // Keys with a non-zero counter are locked after a recent change
+      Row locked = nonzero(r);
+      increment(r, locked);
+      Row expired = at_end(r, locked);
+      clear(r, expired);
+      locked &= ~expired;
+
+      Row accepted = delta & ~locked;
+      stable_[r] ^= accepted;
+      counters_[0][r] |= accepted;
+    }
+
+    return stable_[r];
+  }
+
+  /** Returns the debounced state of row r as of the last update */
+  Row stable(u8 r) const {
+    return stable_[r];
+  }
+
+ private:
+  // Add one to the counters of the keys in mask, and reset
+  // the others to zero
+  void increment(u8 r, Row mask) {
+    Row carry = mask;
+    for (u8 i = 0; i < kBits; ++i) {
+      Row plane = counters_[i][r];
+      counters_[i][r] = (plane ^ carry) & mask;
+      carry &= plane;
+    }
+  }
+
+  // Returns the keys in mask whose counter equals kEnd
+  Row at_end(u8 r, Row mask) const {
+    for (u8 i = 0; i < kBits; ++i) {
+      mask &= (kEnd >> i) & 1 ? counters_[i][r] : Row(~counters_[i][r]);
+    }
+    return mask;
+  }
+
+  Row nonzero(u8 r) const {
+    Row any = 0;
+    for (u8 i = 0; i < kBits; ++i) {
+      any |= counters_[i][r];
+    }
+    return any;
+  }
+
+  void clear(u8 r, Row mask) {
+    for (u8 i = 0; i < kBits; ++i) {
+      counters_[i][r] &= ~mask;
+    }
+  }
+
+  Row stable_[Rows]{};
+  Row counters_[kBits][Rows]{};
+};
+
+/** Debounce policies for KeyMatrix */
+
+// Report the raw scan results
+struct None {
+  template <class Row, u8 Rows>
+  struct Engine {
+    Row update(u8, Row raw) {
+      return raw;
+    }
+  };
+};
+
+template <u8 Periods>
+struct Eager {
+  template <class Row, u8 Rows>
+  using Engine = VerticalDebouncer<Row, Rows, Periods, Mode::Eager>;
+};
+
+template <u8 Periods>
+struct Deferred {
+  template <class Row, u8 Rows>
+  using Engine = VerticalDebouncer<Row, Rows, Periods, Mode::Deferred>;
+};
+}
+}
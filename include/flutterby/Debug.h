@@ -1,6 +1,7 @@
 #pragma once
 #include "avr_autogen.h"
 #include "flutterby/Types.h"
+#include "flutterby/CompressedProgmem.h"
 #include "flutterby/Progmem.h"
 
 #ifdef HAVE_SIMAVR
@@ -51,6 +52,15 @@ class FormatStream {
     }
   }
 
+  // Stream the bytes between two ProgMem iterators
+  template <typename C>
+  void write(ProgMemPtr<C> a, ProgMemPtr<C> b) {
+    ProgMemReader reader(a);
+    while (reader.raw_ptr() != b.raw_ptr()) {
+      stream_(reader.read<C>());
+    }
+  }
+
   // Iterate the array and write out each byte
   template <typename C, size_t Size>
   void write(const ProgMemArrayInst<C, Size>& arr) {
@@ -63,6 +73,12 @@ class FormatStream {
     write(arr.begin(), arr.end());
   }
 
+  // Decompress the table and write out each byte
+  template <size_t RawSize, size_t Size>
+  void write(const CompressedProgMemInst<RawSize, Size>& table) {
+    write(table.begin(), table.end());
+  }
+
   // Format an unsigned integer with the specified base and write it out
   template <typename Int>
   typename enable_if<
@@ -149,6 +165,14 @@ FormatStream<T, NL>& operator<<(
   return stm;
 }
 
+template <typename T, u8 NL, size_t RawSize, size_t Size>
+FormatStream<T, NL>& operator<<(
+    FormatStream<T, NL>& stm,
+    const CompressedProgMemInst<RawSize, Size>& table) {
+  stm.write(table);
+  return stm;
+}
+
 /** Support streaming regular string literals but emit a deprecation
  * notice to remind folks to use the _P literal */
 template <typename T, u8 NL, typename A, size_t Size>
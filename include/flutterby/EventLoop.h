@@ -1,6 +1,7 @@
 #pragma once
 #include "flutterby/Types.h"
 #include "flutterby/Heap.h"
+#include "flutterby/Sleep.h"
 
 namespace flutterby {
 namespace eventloop {
@@ -68,6 +69,13 @@ inline void enable_timer(Shared<TimerBase> timer) {
  * a real firmware but we allow it to make testing a bit easier in the
  * simulator. */
 void run_forever();
+
+/** Sets the sleep mode that run_forever uses when it has nothing to
+ * do; the default is SleepMode::Idle.  The deeper modes stop Timer1,
+ * so scheduled timers don't advance until something else (such as a
+ * pin change interrupt) wakes the CPU. */
+void set_idle_sleep_mode(SleepMode mode);
+SleepMode idle_sleep_mode();
 }
 
 }
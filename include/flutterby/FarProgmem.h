@@ -0,0 +1,249 @@
+#pragma once
+#include "flutterby/Progmem.h"
+
+namespace flutterby {
+
+/* Flash beyond the first 64KB, as on the atmega1284 and atmega2560, is
+ * out of reach of lpm and the 16 bit pointers used by Progmem.h.  The
+ * types here carry a 24 bit flash address in a uint32_t and read with
+ * elpm, which takes the top byte of the address from RAMPZ.
+ *
+ * The compiler doesn't reserve RAMPZ for us, so every read sets it
+ * afresh.  Interrupt handlers that use RAMPZ save and restore it.
+ *
+ * On parts without elpm all of this falls back to plain lpm and the
+ * near address, so code written against these types builds for either.
+ */
+
+#ifdef __AVR_HAVE_ELPM__
+
+/** Placement attribute for data that may live anywhere in flash.
+ * The linker places .progmemx after the code, leaving low flash for
+ * the near ProgMem data.  Such data must only be read through the Far
+ * types below. */
+# define FAR_PROGMEM __attribute__((section(".progmemx.data")))
+
+/** Yields the 24 bit flash address of var as a uint32_t.
+ * A plain pointer is only 16 bits wide, so we have the assembler
+ * compute the full address for us */
+# define FAR_ADDRESS(var)                   \
+  ({                                        \
+    uint32_t far_addr_;                     \
+    __asm__("ldi %A0, lo8(%1)\n\t"          \
+            "ldi %B0, hi8(%1)\n\t"          \
+            "ldi %C0, hh8(%1)\n\t"          \
+            "clr %D0\n\t"                   \
+            : "=d"(far_addr_)               \
+            : "p"(&(var)));                 \
+    far_addr_;                              \
+  })
+
+extern "C" void memcpy_PF(void* dest, uint32_t src, size_t);
+
+/** Copies len bytes, 1-255 of them, starting at the far address addr.
+ * RAMPZ is loaded once and elpm post-increments across the whole
+ * RAMPZ:Z pair, so the copy may span a 64KB boundary. */
+inline void far_progmem_copy(void* dest, uint32_t addr, uint8_t len) {
+  __asm__ __volatile__(
+      "out __RAMPZ__, %C[addr]\n\t"
+      "movw r30, %A[addr]\n\t"
+      "1: elpm __tmp_reg__, Z+\n\t"
+      "st %a[dest]+, __tmp_reg__\n\t"
+      "dec %[len]\n\t"
+      "brne 1b\n\t"
+      : [dest] "+e"(dest), [len] "+r"(len)
+      : [addr] "r"(addr)
+      : "r30", "r31", "memory");
+}
+
+/** Copies len bytes of any length; avr-libc's memcpy_PF is the
+ * cheaper choice for long runs */
+inline void far_progmem_copy_long(void* dest, uint32_t addr, size_t len) {
+  memcpy_PF(dest, addr, len);
+}
+
+template <typename U>
+inline typename enable_if<sizeof(U) == 1, U>::type far_progmem_deref(
+    uint32_t addr) {
+  U result;
+  __asm__ __volatile__(
+      "out __RAMPZ__, %C[addr]\n\t"
+      "movw r30, %A[addr]\n\t"
+      "elpm %[retval], Z\n\t"
+      : [retval] "=r"(result)
+      : [addr] "r"(addr)
+      : "r30", "r31");
+  return result;
+}
+
+template <typename U>
+inline typename enable_if<sizeof(U) >= 2, U>::type far_progmem_deref(
+    uint32_t addr) {
+  U result;
+  far_progmem_copy(&result, addr, sizeof(U));
+  return result;
+}
+
+#else
+
+# define FAR_PROGMEM __attribute__((progmem))
+# define FAR_ADDRESS(var) uint32_t(uintptr_t(&(var)))
+
+inline void far_progmem_copy(void* dest, uint32_t addr, uint8_t len) {
+  memcpy_P(dest, reinterpret_cast<const void*>(uintptr_t(addr)), len);
+}
+
+inline void far_progmem_copy_long(void* dest, uint32_t addr, size_t len) {
+  memcpy_P(dest, reinterpret_cast<const void*>(uintptr_t(addr)), len);
+}
+
+template <typename U>
+inline U far_progmem_deref(uint32_t addr) {
+  return progmem_deref(reinterpret_cast<const U*>(uintptr_t(addr)));
+}
+
+#endif
+
+/** The far counterpart of ProgMemPtr; an iterator over data that may
+ * be anywhere in flash */
+template <typename T>
+class FarProgMemPtr {
+  uint32_t addr_;
+
+ public:
+  constexpr explicit FarProgMemPtr(uint32_t addr) : addr_(addr) {}
+
+  T operator*() const {
+    return far_progmem_deref<T>(addr_);
+  }
+
+  operator T() const {
+    return far_progmem_deref<T>(addr_);
+  }
+
+  constexpr bool operator!=(const FarProgMemPtr<T>& other) const {
+    return addr_ != other.addr_;
+  }
+
+  constexpr bool operator==(const FarProgMemPtr<T>& other) const {
+    return addr_ == other.addr_;
+  }
+
+  constexpr FarProgMemPtr<T>& operator++() {
+    addr_ += sizeof(T);
+    return *this;
+  }
+
+  constexpr FarProgMemPtr<T>& operator+=(size_t n) {
+    addr_ += n * sizeof(T);
+    return *this;
+  }
+
+  constexpr FarProgMemPtr<T> operator+(size_t n) const {
+    return FarProgMemPtr<T>(addr_ + n * sizeof(T));
+  }
+
+  /** Returns the 24 bit address in program space */
+  constexpr uint32_t raw_address() const {
+    return addr_;
+  }
+};
+
+/** The far counterpart of ProgMemReader; reads consecutive data
+ * anywhere in flash.  Each read sets up RAMPZ and Z once and then
+ * streams the bytes of the value with post-incrementing elpm. */
+class FarProgMemReader {
+  uint32_t addr_;
+
+ public:
+  constexpr explicit FarProgMemReader(uint32_t addr) : addr_(addr) {}
+
+  template <typename T>
+  constexpr FarProgMemReader(const FarProgMemPtr<T>& ptr)
+      : addr_(ptr.raw_address()) {}
+
+  /** Returns the next byte and advances past it */
+  uint8_t next() {
+    return far_progmem_deref<uint8_t>(addr_++);
+  }
+
+  /** Returns a copy of the next T and advances past it */
+  template <typename T>
+  T read() {
+    static_assert(sizeof(T) < 256, "use read_bytes() for large types");
+    T result;
+    far_progmem_copy(&result, addr_, sizeof(T));
+    addr_ += sizeof(T);
+    return result;
+  }
+
+  /** Copies the next len bytes into SRAM at dest */
+  void read_bytes(void* dest, size_t len) {
+    far_progmem_copy_long(dest, addr_, len);
+    addr_ += len;
+  }
+
+  /** Advances past len bytes without reading them */
+  void skip(size_t len) {
+    addr_ += len;
+  }
+
+  /** Returns the current 24 bit address in program space */
+  constexpr uint32_t raw_address() const {
+    return addr_;
+  }
+};
+
+/** A handle on a T[Size] that may be anywhere in flash.  It is
+ * obtained from an array declared with FarProgMemTable() by passing
+ * the identifier to FarArray():
+ *
+ * ```
+ * FarProgMemTable(Frames, {...});
+ * ...
+ *   for (auto frame : FarArray(Frames)) { ... }
+ * ```
+ */
+template <typename T, size_t Size>
+class FarProgMemArray {
+  uint32_t base_;
+
+ public:
+  constexpr explicit FarProgMemArray(uint32_t base) : base_(base) {}
+
+  constexpr FarProgMemPtr<T> begin() const {
+    return FarProgMemPtr<T>(base_);
+  }
+
+  constexpr FarProgMemPtr<T> end() const {
+    return FarProgMemPtr<T>(base_ + Size * sizeof(T));
+  }
+
+  constexpr typename smallest_integer_maximum<Size>::type size() const {
+    return Size;
+  }
+
+  /** Returns a pointer to the specified array index.
+   * Performs no bounds checks! */
+  constexpr FarProgMemPtr<T> operator[](size_t idx) const {
+    return FarProgMemPtr<T>(base_ + idx * sizeof(T));
+  }
+};
+
+/** A helper to deduce the element type and size for FarArray() */
+template <typename T, size_t Size>
+constexpr FarProgMemArray<T, Size> makeFarArray(
+    uint32_t base,
+    const ProgMemArrayInst<T, Size>&) {
+  return FarProgMemArray<T, Size>(base);
+}
+
+/** A macro to declare an array to be stored in far flash.
+ * The resulting identifier must only be used with FarArray() */
+#define FarProgMemTable(ident, content) \
+  const auto ident FAR_PROGMEM = makeProgArray(content)
+
+/** Returns the FarProgMemArray handle for an array declared with
+ * FarProgMemTable() */
+#define FarArray(ident) makeFarArray(FAR_ADDRESS(ident), ident)
+}
@@ -1,9 +1,17 @@
 #pragma once
+#include "flutterby/Types.h"
 namespace flutterby {
 namespace gpio {
 
 static constexpr bool kEnablePullUp = true;
 
+// The transitions reported by InputPin::wait_edge() and edges()
+enum class Edge : uint8_t {
+  Falling = 1,
+  Rising = 2,
+  Both = 3,
+};
+
 // Represents an 8-bit GPIO port
 template <class PortType>
 struct Port {
@@ -44,6 +52,18 @@ constexpr uint8_t shift(uint8_t x) {
   return shift_impl<N, (N < 0)>::shift(x);
 }
 
+// Evaluates to 1 for a real pin and 0 for the NoOutputPin and
+// NoInputPin placeholders
+template <class PIN, class PINPORT = typename PIN::port>
+struct pin_count {
+  static constexpr uint8_t value = 1;
+};
+
+template <class PIN>
+struct pin_count<PIN, NO_PORT> {
+  static constexpr uint8_t value = 0;
+};
+
 // Base case for bit mapping helper; returns 0.
 // This case is used when PortType != PINPORT and thus no bits
 // should be set.
@@ -102,6 +122,86 @@ struct map_bits_impl {
       map_bit_impl<PortType, typename T7::port, T7, 7>::mask;
 };
 
+// Base case for the inverse bit mapping helper; returns 0.
+// This case is used when PortType != PINPORT and thus the
+// port value doesn't contribute to BIT.
+template <class PortType, class PINPORT, class PIN, int BIT>
+struct unmap_bit_impl {
+  static constexpr uint8_t unmap_bit(uint8_t x) {
+    return 0;
+  }
+};
+
+// Inverse bit mapping helper; for a given PortType and PIN definition,
+// and a value x read from the PortType pin register, if the pin's bit is
+// set in x, return BIT set in the result.
+template <class PortType, class PIN, int BIT>
+struct unmap_bit_impl<PortType, PortType, PIN, BIT> {
+  static constexpr uint8_t unmap_bit(uint8_t x) {
+    return shift<BIT - PIN::bit>(static_cast<uint8_t>(x & PIN::mask));
+  }
+};
+
+// The inverse of map_bits_impl; given a PortType and a set of input pins,
+// and a value x read from PortType in a single read operation, compute
+// the bits of the aggregate value that are held by pins in PortType.
+template <
+    class PortType,
+    class T0,
+    class T1,
+    class T2,
+    class T3,
+    class T4,
+    class T5,
+    class T6,
+    class T7>
+struct unmap_bits_impl {
+  static constexpr uint8_t unmap_bits(uint8_t x) {
+    return unmap_bit_impl<PortType, typename T0::port, T0, 0>::unmap_bit(x) |
+        unmap_bit_impl<PortType, typename T1::port, T1, 1>::unmap_bit(x) |
+        unmap_bit_impl<PortType, typename T2::port, T2, 2>::unmap_bit(x) |
+        unmap_bit_impl<PortType, typename T3::port, T3, 3>::unmap_bit(x) |
+        unmap_bit_impl<PortType, typename T4::port, T4, 4>::unmap_bit(x) |
+        unmap_bit_impl<PortType, typename T5::port, T5, 5>::unmap_bit(x) |
+        unmap_bit_impl<PortType, typename T6::port, T6, 6>::unmap_bit(x) |
+        unmap_bit_impl<PortType, typename T7::port, T7, 7>::unmap_bit(x);
+  }
+};
+
+template <
+    class PortType,
+    class T0,
+    class T1,
+    class T2,
+    class T3,
+    class T4,
+    class T5,
+    class T6,
+    class T7,
+    int MASK>
+struct read_bits_impl {
+  static uint8_t read_bits(const volatile uint8_t& reg) {
+    return unmap_bits_impl<PortType, T0, T1, T2, T3, T4, T5, T6, T7>::
+        unmap_bits(reg);
+  }
+};
+
+template <
+    class PortType,
+    class T0,
+    class T1,
+    class T2,
+    class T3,
+    class T4,
+    class T5,
+    class T6,
+    class T7>
+struct read_bits_impl<PortType, T0, T1, T2, T3, T4, T5, T6, T7, 0> {
+  static uint8_t read_bits(const volatile uint8_t& reg) {
+    return 0;
+  }
+};
+
 template <
     class PortType,
     class T0,
@@ -157,6 +257,20 @@ struct InputPin : Port<PortType> {
   static u8 read() {
     return Port<PortType>::pin() & mask;
   }
+
+  // Edge notification; these are defined in flutterby/PinChange.h,
+  // which must be included in order to use them.
+
+  /** Returns a Future that resolves to the first matching Edge.
+   * This arms the interrupt for the pin; edges that happen between
+   * successive calls are remembered from then on. */
+  static auto wait_edge(Edge edge);
+
+  /** Returns a Stream that yields each matching Edge */
+  static auto edges(Edge edge);
+
+  /** Disarm the interrupt used by wait_edge() and edges() */
+  static void disable_edges();
 };
 
 // Represents a Pin in a port that is to be configured
@@ -185,8 +299,8 @@ struct OutputPin : Port<PortType> {
     //Port<PortType>::reg() ^= mask;
     // "Writing a logic one to PINxn toggles the value of PORTxn, independent on
     // the value of DDRxn".  The compiler is smart enough to translate this next
-    // line to an sbi instruction
-    Port<PortType>::pin() |= mask;
+    // line to an sbi instruction.  pin() is only const for the reads.
+    const_cast<volatile uint8_t&>(Port<PortType>::pin()) |= mask;
   }
   static inline bool read() {
     return (Port<PortType>::reg() & mask) == mask;
@@ -200,6 +314,7 @@ struct PortB;
 template <>
 struct Port<PortB> {
   using port = PortB;
+  static constexpr char name = 'B';
   static inline volatile uint8_t& ddr() {
     return Portb::ddrb.raw_bits();
   }
@@ -216,6 +331,7 @@ struct PortC;
 template <>
 struct Port<PortC> {
   using port = PortC;
+  static constexpr char name = 'C';
   static inline volatile uint8_t& ddr() {
     return Portc::ddrc.raw_bits();
   }
@@ -232,6 +348,7 @@ struct PortD;
 template <>
 struct Port<PortD> {
   using port = PortD;
+  static constexpr char name = 'D';
   static inline volatile uint8_t& ddr() {
     return Portd::ddrd.raw_bits();
   }
@@ -248,6 +365,7 @@ struct PortE;
 template <>
 struct Port<PortE> {
   using port = PortE;
+  static constexpr char name = 'E';
   static inline volatile uint8_t& ddr() {
     return Porte::ddre.raw_bits();
   }
@@ -264,6 +382,7 @@ struct PortF;
 template <>
 struct Port<PortF> {
   using port = PortF;
+  static constexpr char name = 'F';
   static inline volatile uint8_t& ddr() {
     return Portf::ddrf.raw_bits();
   }
@@ -328,6 +447,33 @@ void do_write_pins(uint8_t mask) {
       write_bits(Port<PortType>::reg(), mask);
 }
 
+// Reads the pin levels; the port is read only if it holds
+// at least one of the pins
+template <
+    class PortType,
+    class T0,
+    class T1,
+    class T2,
+    class T3,
+    class T4,
+    class T5,
+    class T6,
+    class T7>
+uint8_t do_read_pins() {
+  return read_bits_impl<
+      PortType,
+      T0,
+      T1,
+      T2,
+      T3,
+      T4,
+      T5,
+      T6,
+      T7,
+      map_bits_impl<PortType, T0, T1, T2, T3, T4, T5, T6, T7>::mask>::
+      read_bits(Port<PortType>::pin());
+}
+
 // OutputPins is used to combine a set of OutputPin types
 // into an aggregate type.  The template parameters consist
 // of up to 8 output pins.  Writing a byte to the aggregate
@@ -338,9 +484,6 @@ void do_write_pins(uint8_t mask) {
 // The first template parameter (T0) corresponds to the
 // least significant bit in the value being written, through
 // to T7 mapping to the most significant bit.
-// A similar technique could be used to create an InputPins
-// class; it would need a helper that does the inverse of
-// map_bits_impl.
 
 template <
     class T0,
@@ -352,6 +495,12 @@ template <
     class T6 = NoOutputPin,
     class T7 = NoOutputPin> // LSB to MSB order
 struct OutputPins {
+  // The number of pins in the set
+  static constexpr uint8_t count = pin_count<T0>::value +
+      pin_count<T1>::value + pin_count<T2>::value + pin_count<T3>::value +
+      pin_count<T4>::value + pin_count<T5>::value + pin_count<T6>::value +
+      pin_count<T7>::value;
+
   static void setup() {
 #ifdef HAVE_AVR_PORTB
     do_setup_pins<PortB, T0, T1, T2, T3, T4, T5, T6, T7>(0xff);
@@ -399,16 +548,12 @@ void setupPin() {
 template <>
 inline void setupPin<NoInputPin>() {}
 
-template <typename Pin>
-uint8_t readPin(uint8_t value) {
-  return Pin::read() ? value : 0;
-}
-
-template <>
-inline uint8_t readPin<NoInputPin>(uint8_t) {
-  return 0;
-}
-
+// InputPins is the input counterpart of OutputPins; reading
+// the aggregate returns a byte with T0 in the least significant bit
+// through to T7 in the most significant bit.  Each port that holds
+// any of the pins is read exactly once and the bits are moved into
+// place with constant shifts and masks, so pins that share a port are
+// sampled at the same instant.
 template <
     class T0,
     class T1 = NoInputPin,
@@ -419,6 +564,12 @@ template <
     class T6 = NoInputPin,
     class T7 = NoInputPin> // LSB to MSB order
 struct InputPins {
+  // The number of pins in the set
+  static constexpr uint8_t count = pin_count<T0>::value +
+      pin_count<T1>::value + pin_count<T2>::value + pin_count<T3>::value +
+      pin_count<T4>::value + pin_count<T5>::value + pin_count<T6>::value +
+      pin_count<T7>::value;
+
   static void setup() {
     setupPin<T0>();
     setupPin<T1>();
@@ -431,9 +582,44 @@ struct InputPins {
   }
 
   static uint8_t read() {
-    return readPin<T0>(1 << 0) | readPin<T1>(1 << 1) | readPin<T2>(1 << 2) |
-        readPin<T3>(1 << 3) | readPin<T4>(1 << 4) | readPin<T5>(1 << 5) |
-        readPin<T6>(1 << 6) | readPin<T7>(1 << 7);
+    uint8_t x = 0;
+#ifdef HAVE_AVR_PORTB
+    x |= do_read_pins<PortB, T0, T1, T2, T3, T4, T5, T6, T7>();
+#endif
+#ifdef HAVE_AVR_PORTC
+    x |= do_read_pins<PortC, T0, T1, T2, T3, T4, T5, T6, T7>();
+#endif
+#ifdef HAVE_AVR_PORTD
+    x |= do_read_pins<PortD, T0, T1, T2, T3, T4, T5, T6, T7>();
+#endif
+#ifdef HAVE_AVR_PORTE
+    x |= do_read_pins<PortE, T0, T1, T2, T3, T4, T5, T6, T7>();
+#endif
+#ifdef HAVE_AVR_PORTF
+    x |= do_read_pins<PortF, T0, T1, T2, T3, T4, T5, T6, T7>();
+#endif
+    return x;
+  }
+};
+
+// Combines two InputPins sets into a 16-bit wide set, for when there
+// are more than 8 inputs to read together.  Low provides the least
+// significant byte and must have all 8 pins.  Each set is read as
+// described above, so pins that share a port but are in different
+// sets are sampled separately.
+template <class Low, class High>
+struct InputPins16 {
+  static_assert(Low::count == 8, "Low must have 8 pins");
+
+  static constexpr uint8_t count = Low::count + High::count;
+
+  static void setup() {
+    Low::setup();
+    High::setup();
+  }
+
+  static uint16_t read() {
+    return Low::read() | (uint16_t(High::read()) << 8);
   }
 };
 }
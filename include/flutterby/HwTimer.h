@@ -0,0 +1,371 @@
+#pragma once
+#include "avr_autogen.h"
+#include "flutterby/CriticalSection.h"
+#include "flutterby/Power.h"
+#include "flutterby/Types.h"
+
+/** HwTimer<N> drives Timer/Counter N.
+ *
+ * Everything that differs between the timers (the counter width, the
+ * available clock prescalers and the register addresses) comes from
+ * the TimerDesc<N> that atdf2cpp generates from the device description,
+ * so the same code drives every 8 and 16-bit timer on the MCU.
+ *
+ * Periods are specified as template parameters; the prescaler and
+ * compare value are computed at compile time, and a period that can't
+ * be produced, or that can only be approximated with more than
+ * MaxErrorPpm of rounding error, fails to compile:
+ *
+ * ```
+ * // Fire IRQ_TIMER2_COMPA every 250us
+ * HwTimer<2>::configure_period<250>();
+ * ```
+ */
+
+namespace flutterby {
+namespace timer {
+
+enum class Waveform : u8 {
+  // Count up to the maximum and wrap around
+  Normal,
+  // Count up to compare A, then restart from zero (CTC)
+  ClearOnMatch,
+  // Fast PWM with an 8-bit TOP of 0xff
+  FastPwm,
+  // Fast PWM with TOP = compare A
+  FastPwmTopA,
+  // Phase correct PWM with an 8-bit TOP of 0xff
+  PhaseCorrectPwm,
+  // Phase correct PWM with TOP = compare A
+  PhaseCorrectPwmTopA,
+  // Fast PWM with TOP = the input capture register (16-bit only)
+  FastPwmTopIcr,
+  // Phase correct PWM with TOP = the input capture register (16-bit only)
+  PhaseCorrectPwmTopIcr,
+};
+
+/** The COMnx setting that controls how compare channel x drives
+ * its OCnx pin */
+enum class CompareOutput : u8 {
+  // Normal port operation; the pin is not driven by the timer
+  Disconnected = 0,
+  Toggle = 1,
+  // Non-inverting PWM
+  Clear = 2,
+  // Inverting PWM
+  Set = 3,
+};
+
+/** Returns true if the waveform counts up and then back down,
+ * taking two passes per period */
+constexpr bool is_dual_slope(Waveform w) {
+  return w == Waveform::PhaseCorrectPwm ||
+      w == Waveform::PhaseCorrectPwmTopA ||
+      w == Waveform::PhaseCorrectPwmTopIcr;
+}
+
+/** Returns true if the waveform only works on the 16-bit timers */
+constexpr bool needs_icr(Waveform w) {
+  return w == Waveform::FastPwmTopIcr || w == Waveform::PhaseCorrectPwmTopIcr;
+}
+
+/** Returns true if the waveform counts up to compare A rather than
+ * to a fixed TOP */
+constexpr bool is_top_a(Waveform w) {
+  return w == Waveform::ClearOnMatch || w == Waveform::FastPwmTopA ||
+      w == Waveform::PhaseCorrectPwmTopA;
+}
+
+/** Maps a Waveform to the WGM mode number.  The 8 and 16-bit timers
+ * number their modes differently. */
+constexpr u8 wgm_mode(u8 width, Waveform w) {
+  switch (w) {
+    case Waveform::Normal:
+      return 0;
+    case Waveform::ClearOnMatch:
+      return width == 8 ? 2 : 4;
+    case Waveform::FastPwm:
+      return width == 8 ? 3 : 5;
+    case Waveform::FastPwmTopA:
+      return width == 8 ? 7 : 15;
+    case Waveform::PhaseCorrectPwm:
+      return 1;
+    case Waveform::PhaseCorrectPwmTopA:
+      return width == 8 ? 5 : 11;
+    case Waveform::FastPwmTopIcr:
+      return 14;
+    case Waveform::PhaseCorrectPwmTopIcr:
+      return 10;
+  }
+  return 0;
+}
+
+/** The outcome of searching the prescaler table for a period */
+struct ClockSelection {
+  bool found;
+  // Value for the CSn bits
+  u8 clock_select;
+  u16 divisor;
+  // Value for the TOP register (compare A)
+  u16 top;
+  // Rounding error of the achieved period, in parts per million
+  u32 error_ppm;
+};
+
+/** Returns the length of a period in millionths of a CPU cycle;
+ * the clock selection works in these units to avoid rounding */
+constexpr uint64_t period_us_to_cycles(u32 cpu_hz, u32 period_us) {
+  return uint64_t(cpu_hz) * period_us;
+}
+
+constexpr uint64_t frequency_to_cycles(u32 cpu_hz, u32 hz) {
+  return uint64_t(cpu_hz) * 1000000 / hz;
+}
+
+/** Find the smallest divisor (and thus the finest resolution) that
+ * can produce a period of `wanted` millionths of a cycle.
+ * Single slope waveforms take TOP+1 ticks per period, dual slope
+ * waveforms count up and back down and take 2*TOP ticks.
+ * If fixed_top is true the counter always counts to max_top and only
+ * the divisor can be chosen, so the closest period is selected. */
+template <typename Desc>
+constexpr ClockSelection select_clock(
+    uint64_t wanted,
+    u32 max_top,
+    bool dual_slope,
+    bool fixed_top = false) {
+  ClockSelection best{false, 0, 0, 0, 0};
+  u8 passes = dual_slope ? 2 : 1;
+  for (u8 cs = 0; cs < sizeof(Desc::kPrescalers) / sizeof(u16); ++cs) {
+    u16 divisor = Desc::kPrescalers[cs];
+    if (divisor == 0 || (best.found && !fixed_top && divisor >= best.divisor)) {
+      continue;
+    }
+    uint64_t per_tick = uint64_t(divisor) * passes * 1000000;
+    uint64_t ticks = (wanted + per_tick / 2) / per_tick;
+    if (fixed_top) {
+      ticks = dual_slope ? max_top : uint64_t(max_top) + 1;
+    }
+    uint64_t top = dual_slope ? ticks : ticks - 1;
+    if (ticks == 0 || top == 0 || top > max_top) {
+      continue;
+    }
+    uint64_t achieved = ticks * per_tick;
+    uint64_t diff = achieved > wanted ? achieved - wanted : wanted - achieved;
+    u32 error_ppm = diff * 1000000 / wanted;
+    if (best.found && fixed_top && error_ppm >= best.error_ppm) {
+      continue;
+    }
+    best = ClockSelection{true, cs, divisor, u16(top), error_ppm};
+  }
+  return best;
+}
+
+static constexpr u32 kDefaultMaxErrorPpm = 1000;
+
+// Bits common to the TIMSKn and TIFRn registers of all timers
+static constexpr u8 kOverflowBit = 1 << 0;
+static constexpr u8 kCompareABit = 1 << 1;
+static constexpr u8 kCompareBBit = 1 << 2;
+static constexpr u8 kCompareCBit = 1 << 3;
+static constexpr u8 kInputCaptureBit = 1 << 5;
+
+// Input capture control bits in TCCRnB of the 16-bit timers
+static constexpr u8 kCaptureRisingEdgeBit = 1 << 6;
+static constexpr u8 kCaptureNoiseCancelerBit = 1 << 7;
+
+static inline volatile u8& reg8(u16 addr) {
+  return *reinterpret_cast<volatile u8*>(addr);
+}
+
+static inline volatile u16& reg16(u16 addr) {
+  return *reinterpret_cast<volatile u16*>(addr);
+}
+}
+
+template <u8 N>
+class HwTimer {
+  using Desc = TimerDesc<N>;
+  static_assert(
+      Desc::kWidth == 8 || Desc::kWidth == 16,
+      "HwTimer only supports the 8 and 16-bit timers");
+  static_assert(
+      Desc::kTccrA && Desc::kTccrB && Desc::kTcnt && Desc::kTimsk &&
+          Desc::kTifr,
+      "TimerDesc is missing registers");
+
+ public:
+  static constexpr u8 kNumber = N;
+  static constexpr u8 kWidth = Desc::kWidth;
+  static constexpr u8 kChannels = Desc::kChannels;
+  using Count = conditional_t<kWidth == 8, u8, u16>;
+  static constexpr u16 kMaxCount = kWidth == 8 ? 0xff : 0xffff;
+
+  /** The compile time clock selection for a period.
+   * Using this in a constant expression triggers the checks. */
+  template <
+      u32 PeriodUs,
+      timer::Waveform Wave = timer::Waveform::ClearOnMatch,
+      u32 MaxErrorPpm = timer::kDefaultMaxErrorPpm>
+  struct Period {
+    static_assert(
+        timer::is_top_a(Wave) || timer::needs_icr(Wave),
+        "FastPwm and PhaseCorrectPwm count to a fixed TOP, so their "
+        "period can't be chosen");
+    static constexpr auto kSelection = timer::select_clock<Desc>(
+        timer::period_us_to_cycles(F_CPU, PeriodUs),
+        kMaxCount,
+        timer::is_dual_slope(Wave));
+    static_assert(
+        kSelection.found,
+        "The period is too long or too short for this timer");
+    static_assert(
+        kSelection.error_ppm <= MaxErrorPpm,
+        "The period can't be produced accurately enough by this timer");
+
+    static constexpr u8 kClockSelect = kSelection.clock_select;
+    static constexpr Count kTop = kSelection.top;
+  };
+
+  /** Start the timer in CTC mode so that the compare A interrupt
+   * (IRQ_TIMERn_COMPA) fires every PeriodUs microseconds */
+  template <u32 PeriodUs, u32 MaxErrorPpm = timer::kDefaultMaxErrorPpm>
+  static inline void configure_period() {
+    using P = Period<PeriodUs, timer::Waveform::ClearOnMatch, MaxErrorPpm>;
+    configure(P::kClockSelect, timer::Waveform::ClearOnMatch, P::kTop);
+    enable_interrupts(timer::kCompareABit);
+  }
+
+  /** Reset and start the timer.  clock_select is the value for the
+   * CSn bits, top is used as TOP by the *TopA, *TopIcr and ClearOnMatch
+   * waveforms and left alone by the others.  The *TopIcr waveforms are
+   * only valid for the 16-bit timers.  Timer interrupts are disabled
+   * and the compare outputs are disconnected.
+   * The timer holds a reference on its power gate until stop(). */
+  static inline void
+  configure(u8 clock_select, timer::Waveform wave, Count top = 0) {
+    if (!powered_) {
+      powered_ = true;
+      power::acquire(power::timer(N));
+    }
+    u8 mode = timer::wgm_mode(kWidth, wave);
+    u8 a = mode & 0b11;
+    u8 b = ((mode >> 2) << 3) | clock_select;
+
+    interrupt_free([&]() {
+      timer::reg8(Desc::kTimsk) = 0;
+      timer::reg8(Desc::kTccrA) = 0;
+      timer::reg8(Desc::kTccrB) = 0;
+      set_count_unguarded(0);
+      // Clear any stale interrupt flags by writing ones to them
+      timer::reg8(Desc::kTifr) = 0xff;
+
+      if (kWidth == 16 && timer::needs_icr(wave)) {
+        timer::reg16(Desc::kIcr) = top;
+      } else if (timer::is_top_a(wave)) {
+        set_compare_unguarded<0>(top);
+      }
+      timer::reg8(Desc::kTccrA) = a;
+      timer::reg8(Desc::kTccrB) = b;
+    });
+  }
+
+  /** Stop the clock, disable the timer interrupts and release
+   * the power gate */
+  static inline void stop() {
+    interrupt_free([]() {
+      timer::reg8(Desc::kTimsk) = 0;
+      timer::reg8(Desc::kTccrB) = 0;
+    });
+    if (powered_) {
+      powered_ = false;
+      power::release(power::timer(N));
+    }
+  }
+
+  /** Returns true if the timer has been configured with a clock
+   * source and not stopped */
+  static inline bool running() {
+    return powered_ && (timer::reg8(Desc::kTccrB) & 0b111);
+  }
+
+  /** Enable the interrupts in mask (timer::kCompareABit etc.) */
+  static inline void enable_interrupts(u8 mask) {
+    interrupt_free([&]() { timer::reg8(Desc::kTimsk) |= mask; });
+  }
+
+  static inline void disable_interrupts(u8 mask) {
+    interrupt_free([&]() { timer::reg8(Desc::kTimsk) &= ~mask; });
+  }
+
+  /** Set the compare value of Channel (0 for A, 1 for B, 2 for C) */
+  template <u8 Channel>
+  static inline void set_compare(Count value) {
+    interrupt_free([&]() { set_compare_unguarded<Channel>(value); });
+  }
+
+  /** Connect or disconnect compare Channel from its OCnx pin.
+   * The pin must also be configured as an output. */
+  template <u8 Channel>
+  static inline void set_compare_output(timer::CompareOutput mode) {
+    static_assert(Channel < kChannels, "no such compare channel");
+    // COMnA is in bits 7:6, COMnB in 5:4 and COMnC in 3:2
+    constexpr u8 shift = 6 - 2 * Channel;
+    interrupt_free([&]() {
+      auto& tccra = timer::reg8(Desc::kTccrA);
+      tccra = (tccra & ~(0b11 << shift)) | (u8(mode) << shift);
+    });
+  }
+
+  template <u8 Channel>
+  static inline Count compare() {
+    static_assert(Channel < kChannels, "no such compare channel");
+    if constexpr (kWidth == 8) {
+      return timer::reg8(compare_register(Channel));
+    } else {
+      return interrupt_free(
+          []() { return timer::reg16(compare_register(Channel)); });
+    }
+  }
+
+  static inline void set_count(Count count) {
+    interrupt_free([&]() { set_count_unguarded(count); });
+  }
+
+  static inline Count count() {
+    if constexpr (kWidth == 8) {
+      return timer::reg8(Desc::kTcnt);
+    } else {
+      // The 16-bit registers share a temporary high byte register
+      // with the ISRs, so the read must not be interrupted
+      return interrupt_free([]() { return timer::reg16(Desc::kTcnt); });
+    }
+  }
+
+ private:
+  static constexpr u16 compare_register(u8 channel) {
+    return channel == 0 ? Desc::kOcrA
+                        : channel == 1 ? Desc::kOcrB : Desc::kOcrC;
+  }
+
+  template <u8 Channel>
+  static inline void set_compare_unguarded(Count value) {
+    static_assert(Channel < kChannels, "no such compare channel");
+    if constexpr (kWidth == 8) {
+      timer::reg8(compare_register(Channel)) = value;
+    } else {
+      timer::reg16(compare_register(Channel)) = value;
+    }
+  }
+
+  static inline bool powered_;
+
+  static inline void set_count_unguarded(Count count) {
+    if constexpr (kWidth == 8) {
+      timer::reg8(Desc::kTcnt) = count;
+    } else {
+      timer::reg16(Desc::kTcnt) = count;
+    }
+  }
+};
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include "flutterby/Types.h"
 #include "flutterby/Result.h"
+#include "flutterby/Option.h"
 
 namespace flutterby {
 
@@ -62,5 +63,37 @@ I2cResult write(
       reinterpret_cast<const uint8_t*>(&src),
       sizeof(T));
 }
+
+/** Returns the number of read_buffer() and write_buffer() calls made
+ * so far, each of which is one bus transaction.  The count wraps. */
+u16 transactions();
+
+/** One step of an asynchronous batch: write write_len bytes (typically
+ * a register number and some data) to the slave, then, if read_len is
+ * non-zero, issue a repeated start and read read_len bytes back.
+ * At least one of the lengths must be non-zero. */
+struct Transfer {
+  u8 slave_address;
+  u8 write_len;
+  u8 read_len;
+  const u8* write_buf;
+  u8* read_buf;
+};
+
+/** Start running a batch of transfers back to back from the TWI
+ * interrupt, separated by repeated starts, so that the main loop can get
+ * on with something else while the bus is busy.  The batch ends with a
+ * STOP after the last transfer, or at the first error.  The transfers
+ * and their buffers must remain valid until the batch is done.
+ * Returns false if a batch is already running.
+ *
+ * Call enable() first.  The batch uses the TWI interrupt, so it can't
+ * be combined with I2cSlave, and the synchronous functions above must
+ * not be used while a batch is running. */
+bool start_batch(const Transfer* transfers, u8 count);
+
+/** Returns None while a batch is running, otherwise the result of the
+ * most recent batch */
+Option<I2cResult> batch_result();
 }
 }
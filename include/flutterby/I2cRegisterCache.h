@@ -0,0 +1,188 @@
+#pragma once
+#include "flutterby/I2c.h"
+
+namespace flutterby {
+namespace I2cMaster {
+
+/** RegisterCache keeps a shadow copy of the registers of an I2C device.
+ * Configuration registers usually only change when we write to them,
+ * so re-reading them over the bus before modifying a bit or two is
+ * wasteful.  Registers that have been marked as cacheable are served
+ * from RAM once their value is known, turning a read-modify-write of
+ * a configuration register into a single bus write.
+ *
+ * Registers that are not cacheable (for example, a running clock)
+ * are always read from the device.
+ *
+ * Writes are normally written through to the device immediately.
+ * Alternatively, stage() records a new value for a cacheable register
+ * and marks it dirty; flush() then sends each run of contiguous dirty
+ * registers to the device in a single burst write.
+ *
+ * NumRegs is the number of registers, starting from register 0, that
+ * the cache tracks.
+ */
+template <u8 NumRegs>
+class RegisterCache {
+  static constexpr u8 kBitmapSize = (NumRegs + 7) / 8;
+
+  u8 slave_address_;
+  u16 timeout_ms_;
+  u8 regs_[NumRegs];
+  u8 cacheable_[kBitmapSize];
+  u8 valid_[kBitmapSize];
+  u8 dirty_[kBitmapSize];
+
+  static inline bool test(const u8* bitmap, u8 reg) {
+    return bitmap[reg >> 3] & (1 << (reg & 7));
+  }
+  static inline void set(u8* bitmap, u8 reg) {
+    bitmap[reg >> 3] |= 1 << (reg & 7);
+  }
+  static inline void clear(u8* bitmap, u8 reg) {
+    bitmap[reg >> 3] &= ~(1 << (reg & 7));
+  }
+
+  inline bool is_cached(u8 reg) const {
+    return test(cacheable_, reg) && test(valid_, reg);
+  }
+
+  // Record a value that matches the device for a cacheable register
+  inline void remember(u8 reg, u8 value) {
+    if (test(cacheable_, reg)) {
+      regs_[reg] = value;
+      set(valid_, reg);
+    }
+  }
+
+ public:
+  RegisterCache(u8 slave_address, u16 timeout_ms)
+      : slave_address_(slave_address),
+        timeout_ms_(timeout_ms),
+        regs_{0},
+        cacheable_{0},
+        valid_{0},
+        dirty_{0} {}
+
+  /** Mark the inclusive range of registers [first, last] as cacheable */
+  void mark_cacheable(u8 first, u8 last) {
+    for (u8 reg = first; reg <= last && reg < NumRegs; ++reg) {
+      set(cacheable_, reg);
+    }
+  }
+
+  /** Forget the cached values, forcing them to be read from the device.
+   * Any staged but unflushed values are discarded. */
+  void invalidate() {
+    for (u8 i = 0; i < kBitmapSize; ++i) {
+      valid_[i] = 0;
+      dirty_[i] = 0;
+    }
+  }
+
+  /** Returns true if there are staged values waiting for flush() */
+  bool is_dirty() const {
+    for (u8 i = 0; i < kBitmapSize; ++i) {
+      if (dirty_[i]) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /** Populate the cache for count registers starting at first with
+   * a single burst read.  Non-cacheable registers in the range are
+   * read but not retained.  Any staged values in the range are
+   * discarded in favor of the device values. */
+  I2cResult prime(u8 first, u8 count) {
+    if (first + count > NumRegs) {
+      panic("RegisterCache::prime out of range"_P);
+    }
+    Try(read_buffer(
+        slave_address_, timeout_ms_, first, &regs_[first], count));
+    for (u8 reg = first; reg < first + count; ++reg) {
+      clear(dirty_, reg);
+      if (test(cacheable_, reg)) {
+        set(valid_, reg);
+      }
+    }
+    return I2cResult::Ok();
+  }
+
+  /** Read a register, serving it from the cache where possible */
+  Result<u8, Error> read(u8 reg) {
+    if (reg < NumRegs && is_cached(reg)) {
+      return Result<u8, Error>::Ok(regs_[reg]);
+    }
+    u8 value;
+    auto res = I2cMaster::read(slave_address_, timeout_ms_, reg, value);
+    if (res.is_err()) {
+      return Result<u8, Error>::Error(res.error());
+    }
+    if (reg < NumRegs) {
+      remember(reg, value);
+    }
+    return Result<u8, Error>::Ok(value);
+  }
+
+  /** Write a register through to the device, updating the cache */
+  I2cResult write(u8 reg, u8 value) {
+    Try(I2cMaster::write(slave_address_, timeout_ms_, reg, value));
+    if (reg < NumRegs) {
+      remember(reg, value);
+      clear(dirty_, reg);
+    }
+    return I2cResult::Ok();
+  }
+
+  /** Clear the bits in clear_mask and then set the bits in set_mask.
+   * When the register is cached this costs a single bus write,
+   * and no bus traffic at all if the value is unchanged. */
+  I2cResult update(u8 reg, u8 clear_mask, u8 set_mask) {
+    bool cached = reg < NumRegs && is_cached(reg);
+    auto res = read(reg);
+    if (res.is_err()) {
+      return I2cResult::Error(res.error());
+    }
+    u8 value = (res.value() & ~clear_mask) | set_mask;
+    if (cached && value == res.value() && !test(dirty_, reg)) {
+      return I2cResult::Ok();
+    }
+    return write(reg, value);
+  }
+
+  /** Record a new value for a cacheable register without touching
+   * the bus.  The value is sent to the device by the next flush(). */
+  void stage(u8 reg, u8 value) {
+    if (reg >= NumRegs || !test(cacheable_, reg)) {
+      panic("RegisterCache::stage requires a cacheable register"_P);
+    }
+    regs_[reg] = value;
+    set(valid_, reg);
+    set(dirty_, reg);
+  }
+
+  /** Send the staged values to the device.  Each run of contiguous
+   * dirty registers is sent as a single burst write. */
+  I2cResult flush() {
+    u8 reg = 0;
+    while (reg < NumRegs) {
+      if (!test(dirty_, reg)) {
+        ++reg;
+        continue;
+      }
+      u8 first = reg;
+      while (reg < NumRegs && test(dirty_, reg)) {
+        ++reg;
+      }
+      Try(write_buffer(
+          slave_address_, timeout_ms_, first, &regs_[first], reg - first));
+      for (u8 i = first; i < reg; ++i) {
+        clear(dirty_, i);
+      }
+    }
+    return I2cResult::Ok();
+  }
+};
+}
+}
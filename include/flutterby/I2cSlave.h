@@ -0,0 +1,84 @@
+#pragma once
+#include "flutterby/Option.h"
+#include "flutterby/Types.h"
+
+/** I2cSlave implements the slave side of the TWI bus.
+ * It is intended for use in the secondary half of a split keyboard,
+ * where the primary half is the bus master and wants to fetch the
+ * matrix state of this half with as little latency as possible.
+ *
+ * All of the bus handling happens in the TWI ISR; the main loop
+ * never blocks on the bus.  The slave exposes a small register map:
+ *
+ * - Reads are served from a double buffered block of `tx` registers.
+ *   The master writes the starting register number and then performs
+ *   a burst read; the register pointer auto-increments and wraps.
+ *   The main loop prepares the next snapshot in the back buffer and
+ *   calls publish() to make it visible to the master atomically.
+ * - Writes from the master land in the `rx` mailbox, starting at the
+ *   register number that the master selected.  take_mailbox() reports
+ *   completed writes.  Until the mailbox is taken, further data bytes
+ *   from the master are NACKd.
+ *
+ * The slave and I2cMaster share the TWI hardware; a device is expected
+ * to operate in one role or the other.
+ */
+
+namespace flutterby {
+namespace I2cSlave {
+
+/** Storage for the register map.
+ * This typically lives in a static variable in the firmware. */
+template <u8 TxSize, u8 RxSize>
+struct RegisterMap {
+  static_assert(TxSize > 0, "must expose at least one register");
+  static_assert(RxSize > 0, "mailbox must hold at least one byte");
+
+  u8 tx[2][TxSize];
+  u8 rx[RxSize];
+};
+
+/** Describes a completed write from the master into the mailbox */
+struct MailboxWrite {
+  // The register number selected by the master
+  u8 reg;
+  // The number of bytes that were stored, starting at rx[reg]
+  u8 len;
+};
+
+// Implementation detail of enable(); use that instead.
+void enable_impl(
+    u8 slave_address,
+    u8* tx_buffers,
+    u8 tx_size,
+    u8* rx_buffer,
+    u8 rx_size);
+
+/** Start responding to the master on the specified 7-bit address.
+ * The register map must outlive the time that the slave is enabled. */
+template <u8 TxSize, u8 RxSize>
+void enable(u8 slave_address, RegisterMap<TxSize, RxSize>& map) {
+  enable_impl(slave_address, &map.tx[0][0], TxSize, map.rx, RxSize);
+}
+
+/** Stop responding to the master and release the TWI hardware */
+void disable();
+
+/** Returns the tx buffer that the main loop may fill with the next
+ * snapshot.  After a successful publish() it holds a copy of the
+ * snapshot that was just published, so partial updates are fine. */
+u8* back_buffer();
+
+/** Make the back buffer visible to the master.
+ * Returns false if the master is part way through a burst read;
+ * in that case the snapshot remains in the back buffer and publish()
+ * should be retried later.  The master always sees a coherent
+ * snapshot. */
+bool publish();
+
+/** If the master has written to the mailbox since the last call,
+ * returns the details of that write.  Taking the mailbox allows
+ * the master to write to it again. */
+Option<MailboxWrite> take_mailbox();
+}
+}
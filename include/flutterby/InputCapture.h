@@ -0,0 +1,149 @@
+#pragma once
+#include "avr_autogen.h"
+#include "flutterby/Stream.h"
+#include "flutterby/Timebase.h"
+#include "flutterby/Types.h"
+
+// The number of edges that can be queued by the capture interrupt
+// before they are consumed.  Must be a power of two no larger than 128.
+#ifndef INPUT_CAPTURE_BUFFER_SIZE
+#define INPUT_CAPTURE_BUFFER_SIZE 16
+#endif
+
+namespace flutterby {
+namespace capture {
+
+enum class Edge : u8 {
+  Rising,
+  Falling,
+  // Alternate between rising and falling edges
+  Both,
+};
+
+/** An edge seen on the ICP1 pin */
+struct Event {
+  // When the edge happened, on the same scale as timebase::now()
+  u32 timestamp;
+  bool rising;
+};
+
+/** One cycle of a pulse train, measured from rising edge to rising edge */
+struct Pulse {
+  // Length of the cycle, in timebase ticks
+  u32 period;
+  // How long the signal was high during the cycle
+  u32 high;
+
+  /** Returns the duty cycle in parts per thousand */
+  u16 duty_permille() const {
+    return period ? u16((uint64_t(high) * 1000) / period) : 0;
+  }
+
+  /** Returns the frequency in Hz */
+  u32 frequency() const {
+    return period ? timebase::kTicksPerSecond / period : 0;
+  }
+};
+}
+
+/** InputCapture timestamps edges on the ICP1 pin.
+ *
+ * The hardware latches the Timer1 count into ICR1 when the edge
+ * happens, so the timestamps are unaffected by interrupt latency.
+ * The capture ISR extends the 16-bit value to 32 bits using the
+ * timebase overflow count and queues it for the application.
+ *
+ * Timer1 is the shared system timebase (see flutterby/Timebase.h), so
+ * this can be used alongside the event loop.
+ *
+ * ```
+ * InputCapture::enable(capture::Edge::Both);
+ * spawn(InputCapture::pulses().for_each([](capture::Pulse p) {
+ *   DBG() << p.frequency() << "Hz "_P << p.duty_permille() << "/1000"_P;
+ * }));
+ * ```
+ *
+ * The ICP1 pin must be an input, which is its state after reset.
+ * With Edge::Both the ISR switches the edge after each capture, so
+ * pulses shorter than the interrupt latency can't be measured.
+ */
+class InputCapture {
+ public:
+  /** Start timestamping edges.  This starts the timebase if it is
+   * not already running.  Set noise_canceler to require the input
+   * to be stable for 4 clock cycles before an edge is accepted. */
+  static void enable(capture::Edge edge, bool noise_canceler = false);
+
+  /** Stop timestamping edges.  The timebase keeps running. */
+  static void disable();
+
+  /** Returns the next queued edge, if any, without blocking */
+  static Option<capture::Event> read_event();
+
+  /** Returns the number of edges that were dropped because the
+   * buffer was full, and resets the count */
+  static u8 take_overruns();
+
+  /** Returns a Stream that yields edges as they are captured */
+  static auto events() {
+    return Stream<capture::Event, Unit, ReadEvent>(ReadEvent{});
+  }
+
+  /** Returns a Stream that yields a Pulse for each complete cycle.
+   * Requires Edge::Both.  Cycles that are missing an edge, due to
+   * an overrun or a pulse that was too short, are skipped. */
+  static auto pulses() {
+    return Stream<capture::Pulse, Unit, ReadPulse>(ReadPulse{});
+  }
+
+ private:
+  using PollType = Option<Result<capture::Event, Unit>>;
+  using PulsePollType = Option<Result<capture::Pulse, Unit>>;
+
+  struct ReadEvent {
+    PollType operator()() {
+      auto ev = read_event();
+      if (ev.is_none()) {
+        return PollType::None();
+      }
+      return Some(Result<capture::Event, Unit>::Ok(ev.value()));
+    }
+  };
+
+  struct ReadPulse {
+    u32 rise{0};
+    u32 fall{0};
+    // Which edges of the current cycle have been seen
+    bool have_rise{false};
+    bool have_fall{false};
+
+    PulsePollType operator()() {
+      while (true) {
+        auto ev = read_event();
+        if (ev.is_none()) {
+          return PulsePollType::None();
+        }
+        auto& e = ev.value();
+        if (!e.rising) {
+          if (have_fall) {
+            // The rising edge between these two was lost
+            have_rise = false;
+          }
+          have_fall = have_rise;
+          fall = e.timestamp;
+          continue;
+        }
+
+        bool complete = have_rise && have_fall;
+        capture::Pulse pulse{e.timestamp - rise, fall - rise};
+        rise = e.timestamp;
+        have_rise = true;
+        have_fall = false;
+        if (complete) {
+          return Some(Result<capture::Pulse, Unit>::Ok(pulse));
+        }
+      }
+    }
+  };
+};
+}
@@ -0,0 +1,325 @@
+#pragma once
+#include "flutterby/Debounce.h"
+#include "flutterby/EventLoop.h"
+#include "flutterby/Future.h"
+#include "flutterby/Gpio.h"
+#include "flutterby/PinChange.h"
+#include "flutterby/Types.h"
+
+namespace flutterby {
+
+/** A change in the state of one switch in a KeyMatrix */
+struct KeyEvent {
+  u8 row;
+  u8 col;
+  bool pressed;
+};
+
+namespace keymatrix {
+// About 1us; long enough for the column lines to settle after a
+// row is selected on a typical hand wired board
+static constexpr u8 kDefaultSettleCycles = F_CPU / 1000000;
+
+/** The debounced state of a switch matrix, as one bitmap per row with
+ * bit n representing column n.  The raw samples of each row pass
+ * through the Debounce policy before they are compared with the
+ * previous state.  KeyMatrix keeps one of these for its local pins,
+ * and sources that sample rows some other way (such as an I/O
+ * expander) use it to share the same debounce and change reporting.
+ */
+template <class Row, u8 Rows, class Debounce>
+class State {
+ public:
+  /** Feed in the raw sample of row r, with a 1 bit for each pressed
+   * key, and call on_change(KeyEvent) for each key that changed in the
+   * debounced state.  Returns true if anything changed. */
+  template <typename Func>
+  bool update(u8 r, Row raw, Func&& on_change) {
+    Row now = debounce_.update(r, raw);
+    Row delta = now ^ state_[r];
+    if (delta == 0) {
+      return false;
+    }
+    state_[r] = now;
+    for (u8 c = 0; delta; ++c, delta >>= 1, now >>= 1) {
+      if (delta & 1) {
+        on_change(KeyEvent{r, c, bool(now & 1)});
+      }
+    }
+    return true;
+  }
+
+  Row row(u8 r) const {
+    return state_[r];
+  }
+
+  bool is_pressed(u8 r, u8 c) const {
+    return state_[r] & (Row(1) << c);
+  }
+
+  bool any_pressed() const {
+    for (auto row : state_) {
+      if (row) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /** Report every pressed key as released and forget it, as when the
+   * source of the samples goes away */
+  template <typename Func>
+  void release_all(Func&& on_change) {
+    for (u8 r = 0; r < Rows; ++r) {
+      Row now = state_[r];
+      state_[r] = 0;
+      for (u8 c = 0; now; ++c, now >>= 1) {
+        if (now & 1) {
+          on_change(KeyEvent{r, c, false});
+        }
+      }
+    }
+    debounce_ = typename Debounce::template Engine<Row, Rows>();
+  }
+
+ private:
+  Row state_[Rows]{};
+  typename Debounce::template Engine<Row, Rows> debounce_;
+};
+}
+
+/** KeyMatrix scans a switch matrix.
+ *
+ * RowPins is a gpio::OutputPins set; the rows are driven high and
+ * scanned by pulling one of them low at a time.  ColPins is a
+ * gpio::InputPins or gpio::InputPins16 set, with the pull-ups enabled
+ * in each InputPin.  A closed switch (with its diode pointing towards
+ * the row) pulls its column low while its row is selected.
+ *
+ * The pin sets read and write each port once, so the cost of a scan
+ * depends mostly on the number of rows rather than the number of
+ * columns.  The state is held as one bitmap per row, with bit n
+ * representing column n.
+ *
+ * Debounce is one of the policies from flutterby/Debounce.h; it filters
+ * each row bitmap before it is compared with the previous scan, so the
+ * debounce time is measured in scans.
+ *
+ * ```
+ * using Rows = gpio::OutputPins<
+ *     gpio::OutputPin<gpio::PortB, 0>, gpio::OutputPin<gpio::PortB, 1>>;
+ * using Cols = gpio::InputPins<
+ *     gpio::InputPin<gpio::PortD, 4, gpio::kEnablePullUp>,
+ *     gpio::InputPin<gpio::PortD, 5, gpio::kEnablePullUp>>;
+ * KeyMatrix<Rows, Cols, debounce::Deferred<5>> matrix;
+ *
+ * matrix.setup();
+ * matrix.scan([](KeyEvent e) {
+ *   DBG() << e.row << ","_P << e.col << (e.pressed ? " down"_P : " up"_P);
+ * });
+ * ```
+ */
+template <
+    class RowPins,
+    class ColPins,
+    class Debounce = debounce::None,
+    u8 SettleCycles = keymatrix::kDefaultSettleCycles>
+class KeyMatrix {
+ public:
+  // The bitmap type for a row
+  using Row = decltype(ColPins::read());
+
+  static constexpr u8 kRows = RowPins::count;
+  static constexpr u8 kCols = ColPins::count;
+  static_assert(kRows > 0 && kCols > 0, "the matrix has no keys");
+
+  /** Configure the pins and leave all rows deselected */
+  static void setup() {
+    RowPins::write(0xff);
+    RowPins::setup();
+    ColPins::setup();
+  }
+
+  /** Scan the matrix, calling on_change(KeyEvent) for each switch that
+   * changed state since the previous scan.  Events are reported in
+   * row order, then column order.  Returns true if anything changed. */
+  template <typename Func>
+  bool scan(Func&& on_change) {
+    bool changed = false;
+    for (u8 r = 0; r < kRows; ++r) {
+      if (state_.update(r, sample(r), on_change)) {
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  /** Scan the matrix, updating the state without reporting the
+   * individual changes.  Returns true if anything changed. */
+  bool scan() {
+    return scan([](KeyEvent) {});
+  }
+
+  /** Returns the bitmap of keys in the row that were pressed
+   * as of the last scan */
+  Row row(u8 r) const {
+    return state_.row(r);
+  }
+
+  bool is_pressed(u8 r, u8 c) const {
+    return state_.is_pressed(r, c);
+  }
+
+#ifdef HAVE_AVR_PCINT
+  /** Prepare to sleep until a key is pressed.  Every row is selected,
+   * so any key pulls its column low, and the pin change interrupt is
+   * armed on the columns.  Returns false, leaving the matrix as it
+   * was, if a key is already held and so there would be no edge to
+   * wake on. */
+  static bool arm_wake() {
+    RowPins::write(0);
+    __builtin_avr_delay_cycles(SettleCycles);
+    PinChange<ColPins>::enable();
+    if ((Row(~ColPins::read()) & kColMask) != 0) {
+      disarm_wake();
+      return false;
+    }
+    return true;
+  }
+
+  /** Undo arm_wake, ready to resume scanning */
+  static void disarm_wake() {
+    PinChange<ColPins>::disable();
+    RowPins::write(0xff);
+  }
+
+  /** Returns true if a key press has fired the interrupt armed by
+   * arm_wake since the last call */
+  static bool take_wake() {
+    return PinChange<ColPins>::take_fired();
+  }
+#endif
+
+  /** Returns true if any key was pressed as of the last scan */
+  bool any_pressed() const {
+    return state_.any_pressed();
+  }
+
+ private:
+  static constexpr Row kColMask =
+      Row(kCols == sizeof(Row) * 8 ? ~Row(0) : (Row(1) << kCols) - 1);
+
+  // Select row r, read the columns and deselect it again.
+  // A pressed key reads as 0, so invert the sample.
+  static Row sample(u8 r) {
+    RowPins::write(u8(~(1 << r)));
+    __builtin_avr_delay_cycles(SettleCycles);
+    Row cols = ColPins::read();
+    RowPins::write(0xff);
+    return Row(~cols) & kColMask;
+  }
+
+  keymatrix::State<Row, kRows, Debounce> state_;
+};
+
+#ifdef HAVE_AVR_PCINT
+/** Scans a KeyMatrix at full rate while it is in use, and lets the CPU
+ * power down while it is not.
+ *
+ * Once every key has been released for IdleScans consecutive scans,
+ * the matrix is armed to wake on a key press (see
+ * KeyMatrix::arm_wake) and run_forever is switched to
+ * SleepMode::PowerDown.  Timer1 stops in that mode, so the scan timer
+ * stops too.  Instead a Future is spawned that run_forever polls each
+ * time the CPU wakes; once the pin change interrupt from the first key
+ * press has fired, it scans with the on_change handler that put the
+ * matrix to sleep and then completes.  That scan switches run_forever
+ * back to SleepMode::Idle and reports the key that caused the wakeup
+ * without waiting for another scan period.  It never puts the matrix
+ * back to sleep itself; that is left to the next scan() from the
+ * timer, so nothing is spawned from inside a poll.
+ *
+ * The Future stays spawned until it sees the matrix awake, and a
+ * matrix that goes back to sleep before then reuses it, so there is
+ * at most one of them at a time.
+ *
+ * Call scan() on the regular scan interval, from an event loop timer.
+ * The handler is copied by the Future, so it must not capture
+ * anything that may be gone by the time a key is pressed.  Nothing
+ * else that needs Timer1 can run while the matrix is asleep.
+ */
+template <class Matrix, u16 IdleScans>
+class LowPowerScan {
+ public:
+  Matrix& matrix() {
+    return matrix_;
+  }
+
+  /** Returns true if the matrix is waiting for a key press */
+  bool asleep() const {
+    return asleep_;
+  }
+
+  template <typename Func>
+  bool scan(Func&& on_change) {
+    bool changed = scan_awake(on_change);
+    if (idle_scans_ >= IdleScans) {
+      idle_scans_ = 0;
+      if (Matrix::arm_wake()) {
+        asleep_ = true;
+        eventloop::set_idle_sleep_mode(SleepMode::PowerDown);
+        if (!waking_) {
+          waking_ = true;
+          spawn(Future<Unit, Unit, WakeScan<typename decay<Func>::type>>(
+              WakeScan<typename decay<Func>::type>{*this, on_change}));
+        }
+      }
+    }
+    return changed;
+  }
+
+ private:
+  // Wake up if need be and scan, without going back to sleep
+  template <typename Func>
+  bool scan_awake(Func& on_change) {
+    if (asleep_) {
+      Matrix::disarm_wake();
+      asleep_ = false;
+      eventloop::set_idle_sleep_mode(SleepMode::Idle);
+    }
+
+    bool changed = matrix_.scan(on_change);
+    if (changed || matrix_.any_pressed()) {
+      idle_scans_ = 0;
+    } else if (idle_scans_ < IdleScans) {
+      ++idle_scans_;
+    }
+    return changed;
+  }
+
+  // Scans as soon as the key press that ends a sleep has fired
+  template <typename Func>
+  struct WakeScan {
+    LowPowerScan& scanner;
+    Func on_change;
+
+    Option<Result<Unit, Unit>> operator()() {
+      if (scanner.asleep_ && Matrix::take_wake()) {
+        scanner.scan_awake(on_change);
+      }
+      if (scanner.asleep_) {
+        return Option<Result<Unit, Unit>>::None();
+      }
+      scanner.waking_ = false;
+      return Some(Result<Unit, Unit>::Ok());
+    }
+  };
+
+  Matrix matrix_;
+  u16 idle_scans_{0};
+  bool asleep_{false};
+  // True while a WakeScan is spawned
+  bool waking_{false};
+};
+#endif
+}
@@ -0,0 +1,306 @@
+#pragma once
+#include "flutterby/Progmem.h"
+#include "flutterby/SmallestInteger.h"
+#include "flutterby/Types.h"
+
+namespace flutterby {
+namespace keymap {
+
+/** The action bound to a key.
+ *
+ * The high byte is the kind of action and the low byte its argument.
+ * Kind 0 is a plain key whose argument is its HID keyboard usage
+ * (page 0x07), so the common case is the usage code itself.  Usage 1
+ * (ErrorRollOver) never appears in a keymap and is used to mark a
+ * transparent key instead.
+ */
+using Action = u16;
+
+static constexpr Action kNoAction = 0x0000;
+static constexpr Action kTransparent = 0x0001;
+
+enum class Kind : u8 {
+  // Send the HID usage in the argument
+  Key = 0x00,
+  // Activate the layer in the argument while the key is held
+  Momentary = 0x10,
+  // Toggle the layer in the argument when the key is pressed
+  Toggle = 0x11,
+  // Dual role keys send the usage in the argument when tapped.  The
+  // low bits of the kind say what the key does when held: ModTap holds
+  // the modifier 0xe0 + n for n in 0-7 and LayerTap activates layer n
+  // for n in 0-31.  See flutterby/TapHold.h.
+  ModTap = 0x20,
+  LayerTap = 0x40,
+};
+
+constexpr Action make_action(Kind kind, u8 arg) {
+  return Action(u16(kind) << 8 | arg);
+}
+
+constexpr Action key(u8 usage) {
+  return make_action(Kind::Key, usage);
+}
+
+constexpr Action momentary(u8 layer) {
+  return make_action(Kind::Momentary, layer);
+}
+
+constexpr Action toggle(u8 layer) {
+  return make_action(Kind::Toggle, layer);
+}
+
+constexpr Kind kind(Action action) {
+  return Kind(action >> 8);
+}
+
+constexpr u8 arg(Action action) {
+  return action & 0xff;
+}
+
+/** Tap for usage, hold for the modifier (0xe0 to 0xe7) */
+constexpr Action mod_tap(u8 modifier, u8 usage) {
+  return Action((u16(Kind::ModTap) | (modifier & 0x07)) << 8 | usage);
+}
+
+/** Tap for usage, hold for momentary access to layer */
+constexpr Action layer_tap(u8 layer, u8 usage) {
+  return Action((u16(Kind::LayerTap) | (layer & 0x1f)) << 8 | usage);
+}
+
+constexpr bool is_tap_hold(Action action) {
+  return ((action >> 8) & 0xf8) == u8(Kind::ModTap) ||
+      ((action >> 8) & 0xe0) == u8(Kind::LayerTap);
+}
+
+/** The action of a dual role key when it is tapped */
+constexpr Action tap_action(Action action) {
+  return key(arg(action));
+}
+
+/** The action of a dual role key when it is held */
+constexpr Action hold_action(Action action) {
+  return (action >> 8) < u8(Kind::LayerTap)
+      ? key(0xe0 + ((action >> 8) & 0x07))
+      : momentary((action >> 8) & 0x1f);
+}
+
+// Returned by Keymap::layer_for when a key is transparent in every
+// active layer
+static constexpr u8 kNoLayer = 0xff;
+
+static constexpr u8 kMaxComboKeys = 4;
+static constexpr u8 kNoKey = 0xff;
+
+/** Pressing all of the keys of a combo at about the same time sends its
+ * action instead of theirs.  Keys are numbered row * Cols + col, and
+ * combos of fewer than kMaxComboKeys keys are padded with kNoKey.
+ * Combo tables are stored in flash:
+ *
+ * ```
+ * const ProgMemArrayInst<Combo, 1> Combos __attribute__((progmem))({
+ *   // J and K together are Escape
+ *   {{7, 8, kNoKey, kNoKey}, key(0x29)},
+ * });
+ * ```
+ */
+struct Combo {
+  u8 keys[kMaxComboKeys];
+  Action action;
+};
+
+// The smallest type with a bit for each layer
+template <u8 Layers>
+using LayerMask = typename smallest_integer_bits<Layers - 1>::type;
+}
+
+/** A layered keymap, stored in flash.
+ *
+ * The table holds an Action for every (layer, row, col), packed layer by
+ * layer and then row by row, so any entry can be located with a multiply
+ * and add and read straight from flash.  Nothing is copied into SRAM.
+ *
+ * lookup() takes the set of active layers as a bitmask and searches them
+ * from the highest down, skipping keys that are kTransparent in a layer,
+ * so an overlay layer only needs to define the keys that it changes.
+ * Layer 0 is the base layer and is always searched last.
+ *
+ * The table is usually generated from a text description by the keymapc
+ * tool; the generated header declares it like this:
+ *
+ * ```
+ * const Keymap<2, 2, 3> MyKeymap __attribute__((progmem))({
+ *   // layer 0
+ *   0x0004, 0x0005, 0x1001,
+ *   0x0006, 0x0007, 0x0008,
+ *   // layer 1
+ *   0x001e, 0x0001, 0x0001,
+ *   0x0001, 0x0001, 0x0001,
+ * });
+ *
+ * auto action = MyKeymap.lookup(layers.active(), event.row, event.col);
+ * ```
+ */
+template <u8 Layers, u8 Rows, u8 Cols>
+class Keymap {
+ public:
+  static constexpr u16 kKeys = u16(Rows) * Cols;
+  static constexpr u16 kSize = kKeys * Layers;
+  using Mask = keymap::LayerMask<Layers>;
+
+  static_assert(Layers > 0 && Rows > 0 && Cols > 0, "the keymap is empty");
+  static_assert(Layers <= 32, "too many layers");
+
+  constexpr Keymap(const keymap::Action (&actions)[kSize]) : table_(actions) {}
+
+  /** Returns the action bound to the key in the given layer, which may
+   * be kTransparent */
+  keymap::Action action(u8 layer, u8 row, u8 col) const {
+    return table_[layer * kKeys + row * Cols + col];
+  }
+
+  /** Returns the action for the key given the bitmask of active layers.
+   * Returns kNoAction if the key is transparent in every active layer. */
+  keymap::Action lookup(Mask active, u8 row, u8 col) const {
+    u16 idx = row * Cols + col;
+    // Walk down from the highest layer; bit 0 is forced on so the base
+    // layer terminates the search
+    active |= 1;
+    u16 offset = (Layers - 1) * kKeys;
+    for (Mask bit = Mask(1) << (Layers - 1); bit; bit >>= 1, offset -= kKeys) {
+      if (!(active & bit)) {
+        continue;
+      }
+      keymap::Action action = table_[offset + idx];
+      if (action != keymap::kTransparent) {
+        return action;
+      }
+    }
+    return keymap::kNoAction;
+  }
+
+  /** Returns the layer that lookup() would take the action from, or
+   * kNoLayer if the key is transparent in every active layer */
+  u8 layer_for(Mask active, u8 row, u8 col) const {
+    u16 idx = row * Cols + col;
+    active |= 1;
+    for (u8 layer = Layers; layer-- > 0;) {
+      if ((active & (Mask(1) << layer)) &&
+          table_[layer * kKeys + idx] != keymap::kTransparent) {
+        return layer;
+      }
+    }
+    return keymap::kNoLayer;
+  }
+
+ private:
+  ProgMemArrayInst<keymap::Action, kSize> table_;
+};
+
+namespace keymap {
+
+/** Tracks the active layers of a Keymap and applies the layer
+ * actions to them.
+ *
+ * A momentary layer is active while its key is held, and a toggled layer
+ * stays active until it is toggled again.
+ *
+ * resolve() looks up key events and applies them.  It records the layer
+ * that each press was found in, one byte per key, and resolves the
+ * release from the same layer, so a key is always released as the
+ * action it was pressed as even if the layers have changed meanwhile.
+ * A release with no recorded press, such as a key that was held across
+ * clear() or since reset, resolves to kNoAction.
+ * Keys is the number of keys in the keymap.  TapHold does its own
+ * recording and passes its actions straight to apply(), so it can use
+ * the default of 0.
+ *
+ * ```
+ * // 2 layers of 6 keys
+ * keymap::LayerState<2, 6> layers;
+ * ...
+ *   auto action = layers.resolve(MyKeymap, event.row, event.col, event.pressed);
+ * ```
+ */
+template <u8 Layers, u16 Keys = 0>
+class LayerState {
+ public:
+  using Mask = LayerMask<Layers>;
+
+  LayerState() {
+    forget_presses();
+  }
+
+  /** Looks up the action for a key event and applies it if it is a
+   * layer action.  Returns the action, which is kNoAction if the key
+   * is transparent in every layer. */
+  template <u8 Rows, u8 Cols>
+  Action resolve(
+      const Keymap<Layers, Rows, Cols>& keymap,
+      u8 row,
+      u8 col,
+      bool pressed) {
+    static_assert(
+        Keys == u16(Rows) * Cols,
+        "resolve() needs LayerState<Layers, Rows * Cols>");
+    u16 idx = row * Cols + col;
+    u8 layer;
+    if (pressed) {
+      layer = keymap.layer_for(active(), row, col);
+      pressed_layer_[idx] = layer;
+    } else {
+      layer = pressed_layer_[idx];
+      pressed_layer_[idx] = kNoLayer;
+    }
+    Action action =
+        layer >= Layers ? kNoAction : keymap.action(layer, row, col);
+    apply(action, pressed);
+    return action;
+  }
+
+  Mask active() const {
+    return held_ | toggled_;
+  }
+
+  bool is_active(u8 layer) const {
+    return active() & (Mask(1) << layer);
+  }
+
+  /** Apply a key event whose action has been looked up.  Returns true if
+   * it was a layer action and has been consumed. */
+  bool apply(Action action, bool pressed) {
+    Mask bit = Mask(1) << (arg(action) % Layers);
+    switch (kind(action)) {
+      case Kind::Momentary:
+        held_ = pressed ? Mask(held_ | bit) : Mask(held_ & ~bit);
+        return true;
+      case Kind::Toggle:
+        if (pressed) {
+          toggled_ ^= bit;
+        }
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  void clear() {
+    held_ = 0;
+    toggled_ = 0;
+    forget_presses();
+  }
+
+ private:
+  void forget_presses() {
+    for (auto& layer : pressed_layer_) {
+      layer = kNoLayer;
+    }
+  }
+
+  Mask held_{0};
+  Mask toggled_{0};
+  // The layer that each key was pressed in
+  u8 pressed_layer_[Keys ? Keys : 1];
+};
+}
+}
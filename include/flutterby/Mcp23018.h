@@ -0,0 +1,205 @@
+#pragma once
+#include "flutterby/I2c.h"
+#include "flutterby/KeyMatrix.h"
+#include "flutterby/Types.h"
+
+namespace flutterby {
+namespace mcp23018 {
+// The address with the ADDR pin tied to ground
+static constexpr u8 kDefaultAddress = 0x20;
+
+// Registers, in the default IOCON.BANK=0 layout where the A and B
+// registers of each pair are adjacent and the address pointer
+// increments after each byte
+static constexpr u8 kIodirA = 0x00;
+static constexpr u8 kGppuA = 0x0c;
+static constexpr u8 kGpioA = 0x12;
+static constexpr u8 kGpioB = 0x13;
+
+// Give up on a synchronous transfer after this long
+static constexpr u16 kTimeoutMs = 10;
+// How many scans to wait before trying to set up a missing expander
+static constexpr u8 kRetryScans = 250;
+}
+
+/** Scans the half of a split keyboard that hangs off an MCP23018 I/O
+ * expander, as on the ErgoDox.
+ *
+ * The rows are on GPA0-GPA(Rows-1) and are selected by driving them
+ * low; the open drain outputs float the others.  The columns are on
+ * GPB0-GPB(Cols-1), with the expander's pull-ups enabled.  The samples
+ * go through the same keymatrix::State and Debounce policy as a local
+ * KeyMatrix, and events are reported in the expander's own rows and
+ * columns.
+ *
+ * Each row is a single bus transaction: write the row select to GPIOA,
+ * which leaves the address pointer at GPIOB, then repeated start and
+ * read the columns.  scan() never waits for the bus.  It takes the
+ * results of the batch of transactions that was started by the previous
+ * call, if it has completed, and starts the next batch from the TWI
+ * interrupt (see I2cMaster::start_batch).  Calling it just before
+ * scanning the local half lets the two overlap:
+ *
+ * ```
+ * I2cMaster::enable(400000);
+ * remote.setup();
+ * for (;;) {
+ *   remote.scan([](KeyEvent e) { e.col += kLocalCols; handle(e); });
+ *   local.scan(handle);
+ *   ...
+ * }
+ * ```
+ *
+ * If the expander stops responding, its pressed keys are reported as
+ * released and scan() sets it up again every mcp23018::kRetryScans
+ * calls, so the halves can be reconnected while running.  The set up
+ * writes are issued as a batch too, so a missing half never stalls the
+ * scan of the local one.
+ */
+template <
+    u8 Rows,
+    u8 Cols,
+    class Debounce = debounce::None,
+    u8 Address = mcp23018::kDefaultAddress>
+class Mcp23018Matrix {
+  static_assert(Rows > 0 && Rows <= 8, "the rows are on port A");
+  static_assert(Cols > 0 && Cols <= 8, "the columns are on port B");
+
+ public:
+  using Row = u8;
+  static constexpr u8 kRows = Rows;
+  static constexpr u8 kCols = Cols;
+
+  Mcp23018Matrix() {
+    for (u8 r = 0; r < Rows; ++r) {
+      select_[r][0] = mcp23018::kGpioA;
+      select_[r][1] = u8(~(1 << r));
+      transfers_[r] = I2cMaster::Transfer{
+          Address, 2, 1, select_[r], &samples_[r]};
+    }
+    // Leave every row deselected at the end of the batch
+    transfers_[Rows] =
+        I2cMaster::Transfer{Address, 2, 0, kDeselect, nullptr};
+    configure_[0] = I2cMaster::Transfer{Address, 3, 0, kDirections, nullptr};
+    configure_[1] = I2cMaster::Transfer{Address, 3, 0, kPullUps, nullptr};
+    configure_[2] = I2cMaster::Transfer{Address, 2, 0, kDeselect, nullptr};
+  }
+
+  /** Configure the expander's ports synchronously.  I2cMaster must
+   * have been enabled first. */
+  I2cMaster::I2cResult setup() {
+    connected_ = false;
+    Try(I2cMaster::write_buffer(
+        Address, mcp23018::kTimeoutMs, kDirections[0], kDirections + 1, 2));
+    Try(I2cMaster::write_buffer(
+        Address, mcp23018::kTimeoutMs, kPullUps[0], kPullUps + 1, 2));
+    Try(I2cMaster::write_buffer(
+        Address,
+        mcp23018::kTimeoutMs,
+        kDeselect[0],
+        kDeselect + 1,
+        1));
+    connected_ = true;
+    started_ = false;
+    return I2cMaster::I2cResult::Ok();
+  }
+
+  /** Report the changes seen by the last completed batch of samples and
+   * start the next one.  Returns true if anything changed. */
+  template <typename Func>
+  bool scan(Func&& on_change) {
+    if (!connected_) {
+      if (configuring_) {
+        auto result = I2cMaster::batch_result();
+        if (result.is_none()) {
+          return false;
+        }
+        configuring_ = false;
+        if (result.value().is_err()) {
+          return false;
+        }
+        connected_ = true;
+        started_ = false;
+      } else {
+        if (retry_ < mcp23018::kRetryScans) {
+          ++retry_;
+        }
+        // If the bus is busy, try again on the next call
+        if (retry_ >= mcp23018::kRetryScans &&
+            I2cMaster::start_batch(configure_, 3)) {
+          retry_ = 0;
+          configuring_ = true;
+        }
+        return false;
+      }
+    }
+
+    bool changed = false;
+    if (started_) {
+      auto result = I2cMaster::batch_result();
+      if (result.is_none()) {
+        // Still busy with the previous batch
+        return false;
+      }
+      started_ = false;
+      if (result.value().is_err()) {
+        connected_ = false;
+        changed = state_.any_pressed();
+        state_.release_all(on_change);
+        return changed;
+      }
+      for (u8 r = 0; r < Rows; ++r) {
+        // A pressed key reads as 0
+        if (state_.update(r, Row(~samples_[r]) & kColMask, on_change)) {
+          changed = true;
+        }
+      }
+    }
+
+    started_ = I2cMaster::start_batch(transfers_, Rows + 1);
+    return changed;
+  }
+
+  /** Returns true if the expander responded to the last batch */
+  bool connected() const {
+    return connected_;
+  }
+
+  Row row(u8 r) const {
+    return state_.row(r);
+  }
+
+  bool is_pressed(u8 r, u8 c) const {
+    return state_.is_pressed(r, c);
+  }
+
+  bool any_pressed() const {
+    return state_.any_pressed();
+  }
+
+ private:
+  static constexpr Row kColMask = Row(Cols == 8 ? 0xff : (1 << Cols) - 1);
+  static constexpr u8 kDeselect[2] = {mcp23018::kGpioA, 0xff};
+  // IODIRA and IODIRB: rows are outputs, columns inputs
+  static constexpr u8 kDirections[3] = {mcp23018::kIodirA, 0x00, 0xff};
+  // GPPUA and GPPUB: pull the columns up
+  static constexpr u8 kPullUps[3] = {mcp23018::kGppuA, 0x00, 0xff};
+
+  u8 select_[Rows][2];
+  u8 samples_[Rows];
+  I2cMaster::Transfer transfers_[Rows + 1];
+  I2cMaster::Transfer configure_[3];
+  bool connected_{false};
+  bool started_{false};
+  bool configuring_{false};
+  u8 retry_{0};
+  keymatrix::State<Row, Rows, Debounce> state_;
+};
+
+template <u8 Rows, u8 Cols, class Debounce, u8 Address>
+constexpr u8 Mcp23018Matrix<Rows, Cols, Debounce, Address>::kDeselect[2];
+template <u8 Rows, u8 Cols, class Debounce, u8 Address>
+constexpr u8 Mcp23018Matrix<Rows, Cols, Debounce, Address>::kDirections[3];
+template <u8 Rows, u8 Cols, class Debounce, u8 Address>
+constexpr u8 Mcp23018Matrix<Rows, Cols, Debounce, Address>::kPullUps[3];
+}
@@ -0,0 +1,342 @@
+#pragma once
+#include "avr_autogen.h"
+#include "flutterby/Future.h"
+#include "flutterby/Gpio.h"
+#include "flutterby/Stream.h"
+#include "flutterby/Types.h"
+
+/** Pin change (PCINTn) and external (INTn) interrupts.
+ *
+ * PinChange<Pins> arms the pin change interrupt for a set of pins,
+ * which is enough to wake the CPU from any sleep mode.
+ *
+ * gpio::InputPin::wait_edge() and edges() report the edges on a single
+ * pin.  A pin with a dedicated INTn line uses it; other pins use their
+ * pin change interrupt.  The pin change vectors are shared by up to 8
+ * pins each; their ISRs record the rising and falling edges for every
+ * armed pin in the group and each pin's Future or Stream checks its own
+ * bit, with the group and bit resolved at compile time.
+ *
+ * ```
+ * using Button = gpio::InputPin<gpio::PortD, 3, gpio::kEnablePullUp>;
+ * Button::setup();
+ * spawn(Button::edges(gpio::Edge::Falling).for_each([](gpio::Edge) {
+ *   DBG() << "pressed"_P;
+ * }));
+ * ```
+ *
+ * The edges are sampled by the ISR, so a pulse that is shorter than
+ * the interrupt latency may be missed.  The INTn lines only detect
+ * edges while the I/O clock is running, so only pin change interrupts
+ * can wake the CPU from SleepMode::PowerDown.
+ */
+
+#ifdef HAVE_AVR_EXTINT
+namespace flutterby {
+namespace extint {
+
+/** Arm INTn to report the given edges of the pin with the
+ * given PINx register and mask */
+void enable(u8 n, gpio::Edge edge, const volatile u8* pin, u8 mask);
+void disable(u8 n);
+
+/** Returns the edges seen on INTn since the last call, as a mask of
+ * gpio::Edge bits, and forgets them */
+u8 take_edges(u8 n);
+
+/** Records an edge on INTn; called from the IRQ_INTn handlers */
+void edge(u8 n);
+
+/** The IRQ_INTn handler lives in lib/extintN.cpp along with
+ * link_vector<n>(), which Source::enable() calls so that only the
+ * handlers for the lines that are in use get linked.  Firmware may
+ * define its own handler for any other INTn. */
+template <u8 N>
+void link_vector();
+#ifdef IRQ_INT0
+template <>
+void link_vector<0>();
+#endif
+#ifdef IRQ_INT1
+template <>
+void link_vector<1>();
+#endif
+#ifdef IRQ_INT2
+template <>
+void link_vector<2>();
+#endif
+#ifdef IRQ_INT3
+template <>
+void link_vector<3>();
+#endif
+#ifdef IRQ_INT6
+template <>
+void link_vector<6>();
+#endif
+}
+}
+#endif
+
+#ifdef HAVE_AVR_PCINT
+namespace flutterby {
+namespace pcint {
+
+/** The PCMSK bits for a set of pins, one byte per interrupt group */
+struct Masks {
+  u8 group[PcintDesc::kGroups];
+};
+
+// Returns the PCINT number of a pin, or 0xff if it has none
+template <class Pin>
+constexpr u8 number() {
+  return PcintPins<gpio::Port<typename Pin::port>::name>::kPcint[Pin::bit];
+}
+
+template <class Pin>
+constexpr void add_pin(Masks& masks) {
+  if constexpr (gpio::pin_count<Pin>::value != 0) {
+    static_assert(
+        number<Pin>() != 0xff, "this pin has no pin change interrupt");
+    masks.group[number<Pin>() / 8] |= 1 << (number<Pin>() % 8);
+  }
+}
+
+// Computes the Masks for a gpio::InputPins or gpio::InputPins16 set
+template <class Pins>
+struct masks_of;
+
+template <
+    class T0,
+    class T1,
+    class T2,
+    class T3,
+    class T4,
+    class T5,
+    class T6,
+    class T7>
+struct masks_of<gpio::InputPins<T0, T1, T2, T3, T4, T5, T6, T7>> {
+  static constexpr Masks compute() {
+    Masks masks{};
+    add_pin<T0>(masks);
+    add_pin<T1>(masks);
+    add_pin<T2>(masks);
+    add_pin<T3>(masks);
+    add_pin<T4>(masks);
+    add_pin<T5>(masks);
+    add_pin<T6>(masks);
+    add_pin<T7>(masks);
+    return masks;
+  }
+  static constexpr Masks value = compute();
+};
+
+template <class Low, class High>
+struct masks_of<gpio::InputPins16<Low, High>> {
+  static constexpr Masks compute() {
+    Masks masks{};
+    for (u8 g = 0; g < PcintDesc::kGroups; ++g) {
+      masks.group[g] =
+          masks_of<Low>::value.group[g] | masks_of<High>::value.group[g];
+    }
+    return masks;
+  }
+  static constexpr Masks value = compute();
+};
+
+/** Enable the pin change interrupt for the pins in masks.  Edges that
+ * happened before this call are discarded, except for pins that were
+ * already enabled. */
+void enable(const Masks& masks);
+
+/** Disable the pin change interrupt for the pins in masks */
+void disable(const Masks& masks);
+
+/** Returns the set of groups, as a bitmask, whose interrupt has fired
+ * since the last call, limited to the groups in which_groups, and
+ * forgets them */
+u8 take_fired(u8 which_groups);
+
+/** Returns the edges seen on the pins in mask of a group since the
+ * last call, as a mask of gpio::Edge bits, and forgets them.
+ * Only groups whose pins are all on one port record edges. */
+u8 take_edges(u8 group, u8 mask);
+}
+
+/** Arms the pin change interrupts for a gpio::InputPins set.
+ * The pins are grouped into the PCMSK registers at compile time.
+ * Each edge on one of the pins wakes the CPU from any sleep mode and
+ * sets the event pending flag.
+ *
+ * ```
+ * using Buttons = gpio::InputPins<...>;
+ * PinChange<Buttons>::enable();
+ * wait_for_event(SleepMode::PowerDown);
+ * if (PinChange<Buttons>::take_fired()) {
+ *   ...
+ * }
+ * ```
+ */
+template <class Pins>
+struct PinChange {
+  static constexpr pcint::Masks kMasks = pcint::masks_of<Pins>::value;
+
+  static constexpr u8 groups() {
+    u8 groups = 0;
+    for (u8 g = 0; g < PcintDesc::kGroups; ++g) {
+      if (kMasks.group[g]) {
+        groups |= 1 << g;
+      }
+    }
+    return groups;
+  }
+
+  static void enable() {
+    pcint::enable(kMasks);
+  }
+
+  static void disable() {
+    pcint::disable(kMasks);
+  }
+
+  /** Returns true if a pin change interrupt that covers these pins
+   * has fired since the last call.  The interrupts fire for any pin in
+   * a group, so this may also be due to another pin in the same
+   * group. */
+  static bool take_fired() {
+    return pcint::take_fired(groups()) != 0;
+  }
+};
+}
+#endif
+
+namespace flutterby {
+namespace pin_events {
+
+template <class Pin>
+constexpr u8 int_number() {
+#ifdef HAVE_AVR_EXTINT
+  return ExtIntPins<gpio::Port<typename Pin::port>::name>::kInt[Pin::bit];
+#else
+  return 0xff;
+#endif
+}
+
+// The interrupt that reports edges for Pin; its dedicated INTn
+// line if it has one, otherwise its pin change interrupt
+template <class Pin, bool UseInt = int_number<Pin>() != 0xff>
+struct Source;
+
+#ifdef HAVE_AVR_EXTINT
+template <class Pin>
+struct Source<Pin, true> {
+  static constexpr u8 kInt = int_number<Pin>();
+
+  static void enable(gpio::Edge edge) {
+    extint::link_vector<kInt>();
+    extint::enable(kInt, edge, &gpio::Port<typename Pin::port>::pin(), Pin::mask);
+  }
+  static void disable() {
+    extint::disable(kInt);
+  }
+  static u8 take() {
+    return extint::take_edges(kInt);
+  }
+};
+#endif
+
+#ifdef HAVE_AVR_PCINT
+template <class Pin>
+struct Source<Pin, false> {
+  static constexpr u8 kPcint = pcint::number<Pin>();
+  static_assert(kPcint != 0xff, "this pin has no pin change interrupt");
+  static constexpr u8 kGroup = kPcint / 8;
+  static constexpr u8 kMask = 1 << (kPcint % 8);
+  static_assert(
+      PcintDesc::kPin[kGroup] != 0,
+      "edges can't be tracked for a pin change group that spans ports");
+
+  static constexpr pcint::Masks masks() {
+    pcint::Masks masks{};
+    masks.group[kGroup] = kMask;
+    return masks;
+  }
+
+  // The pin change interrupt reports both edges; filtering
+  // happens when they are taken
+  static void enable(gpio::Edge) {
+    pcint::enable(masks());
+  }
+  static void disable() {
+    pcint::disable(masks());
+  }
+  static u8 take() {
+    return pcint::take_edges(kGroup, kMask);
+  }
+};
+#endif
+
+// Of the edges in seen, which happened first.  If both have happened
+// the current level tells us which was last.
+template <class Pin>
+gpio::Edge first_edge(u8 seen) {
+  if (seen == u8(gpio::Edge::Both)) {
+    return Pin::read() ? gpio::Edge::Falling : gpio::Edge::Rising;
+  }
+  return gpio::Edge(seen);
+}
+
+template <class Pin>
+struct WaitEdge {
+  gpio::Edge edge;
+
+  Option<Result<gpio::Edge, Unit>> operator()() {
+    u8 seen = Source<Pin>::take() & u8(edge);
+    if (!seen) {
+      return Option<Result<gpio::Edge, Unit>>::None();
+    }
+    return Some(Result<gpio::Edge, Unit>::Ok(first_edge<Pin>(seen)));
+  }
+};
+
+template <class Pin>
+struct Edges {
+  gpio::Edge edge;
+  // The second of two edges that were taken together
+  u8 pending{0};
+
+  Option<Result<gpio::Edge, Unit>> operator()() {
+    if (pending) {
+      auto next = gpio::Edge(pending);
+      pending = 0;
+      return Some(Result<gpio::Edge, Unit>::Ok(next));
+    }
+    u8 seen = Source<Pin>::take() & u8(edge);
+    if (!seen) {
+      return Option<Result<gpio::Edge, Unit>>::None();
+    }
+    auto first = first_edge<Pin>(seen);
+    pending = seen & ~u8(first);
+    return Some(Result<gpio::Edge, Unit>::Ok(first));
+  }
+};
+}
+
+template <class PortType, unsigned BIT, bool PULLUP>
+auto gpio::InputPin<PortType, BIT, PULLUP>::wait_edge(Edge edge) {
+  pin_events::Source<InputPin>::enable(edge);
+  return Future<Edge, Unit, pin_events::WaitEdge<InputPin>>(
+      pin_events::WaitEdge<InputPin>{edge});
+}
+
+template <class PortType, unsigned BIT, bool PULLUP>
+auto gpio::InputPin<PortType, BIT, PULLUP>::edges(Edge edge) {
+  pin_events::Source<InputPin>::enable(edge);
+  return Stream<Edge, Unit, pin_events::Edges<InputPin>>(
+      pin_events::Edges<InputPin>{edge});
+}
+
+template <class PortType, unsigned BIT, bool PULLUP>
+void gpio::InputPin<PortType, BIT, PULLUP>::disable_edges() {
+  pin_events::Source<InputPin>::disable();
+}
+}
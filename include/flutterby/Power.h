@@ -0,0 +1,119 @@
+#pragma once
+#include "avr_autogen.h"
+#include "flutterby/Types.h"
+
+/** Peripheral power management.
+ *
+ * Each peripheral that can be switched off through the Power Reduction
+ * Register(s) has a reference count.  Drivers acquire their peripheral
+ * before touching its registers and release it when they are done; the
+ * clock to the peripheral is gated whenever the count is zero.
+ *
+ * The peripherals are all clocked after reset.  Call gate_unused() once
+ * the drivers have been set up to switch off everything that nothing
+ * has acquired:
+ *
+ * ```
+ * I2cMaster::enable(400000);
+ * Serial0::configure(57600);
+ * power::gate_unused();
+ * DBG() << "live peripherals: "_P << power::live();
+ * ```
+ *
+ * A gated peripheral ignores writes to its registers, so code that
+ * pokes at registers directly must acquire() the peripheral first.
+ */
+
+namespace flutterby {
+namespace power {
+
+enum class Peripheral : u8 {
+  Adc,
+  Spi,
+  Twi,
+  Usart0,
+  Usart1,
+  Timer0,
+  Timer1,
+  Timer2,
+  Timer3,
+  Timer4,
+  Usb,
+  Count,
+};
+
+/** The PRR register and bit for a peripheral; kReg is 0 if this
+ * device can't gate it */
+template <Peripheral P>
+struct Gate {
+  static constexpr u16 kReg = 0;
+  static constexpr u8 kMask = 0;
+};
+
+#define FLUTTERBY_POWER_GATE(peripheral, bit)       \
+  template <>                                       \
+  struct Gate<Peripheral::peripheral> {             \
+    static constexpr u16 kReg = power_gate::bit::kReg; \
+    static constexpr u8 kMask = power_gate::bit::kMask; \
+  };
+
+#ifdef HAVE_AVR_POWER_PRADC
+FLUTTERBY_POWER_GATE(Adc, PRADC)
+#endif
+#ifdef HAVE_AVR_POWER_PRSPI
+FLUTTERBY_POWER_GATE(Spi, PRSPI)
+#endif
+#ifdef HAVE_AVR_POWER_PRTWI
+FLUTTERBY_POWER_GATE(Twi, PRTWI)
+#endif
+#ifdef HAVE_AVR_POWER_PRUSART0
+FLUTTERBY_POWER_GATE(Usart0, PRUSART0)
+#endif
+#ifdef HAVE_AVR_POWER_PRUSART1
+FLUTTERBY_POWER_GATE(Usart1, PRUSART1)
+#endif
+#ifdef HAVE_AVR_POWER_PRTIM0
+FLUTTERBY_POWER_GATE(Timer0, PRTIM0)
+#endif
+#ifdef HAVE_AVR_POWER_PRTIM1
+FLUTTERBY_POWER_GATE(Timer1, PRTIM1)
+#endif
+#ifdef HAVE_AVR_POWER_PRTIM2
+FLUTTERBY_POWER_GATE(Timer2, PRTIM2)
+#endif
+#ifdef HAVE_AVR_POWER_PRTIM3
+FLUTTERBY_POWER_GATE(Timer3, PRTIM3)
+#endif
+#ifdef HAVE_AVR_POWER_PRTIM4
+FLUTTERBY_POWER_GATE(Timer4, PRTIM4)
+#endif
+#ifdef HAVE_AVR_POWER_PRUSB
+FLUTTERBY_POWER_GATE(Usb, PRUSB)
+#endif
+
+#undef FLUTTERBY_POWER_GATE
+
+/** Returns the Peripheral for timer N */
+constexpr Peripheral timer(u8 n) {
+  return Peripheral(u8(Peripheral::Timer0) + n);
+}
+
+/** Take a reference to the peripheral, ungating its clock if it
+ * was gated */
+void acquire(Peripheral p);
+
+/** Drop a reference to the peripheral, gating its clock when
+ * nothing else is using it */
+void release(Peripheral p);
+
+/** Gate the clock of every peripheral that has not been acquired */
+void gate_unused();
+
+/** Returns the number of references held on the peripheral */
+u8 refs(Peripheral p);
+
+/** Returns a bitmask of the acquired peripherals, with bit n set
+ * for Peripheral(n) */
+u16 live();
+}
+}
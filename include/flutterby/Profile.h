@@ -0,0 +1,148 @@
+#pragma once
+#include "avr_autogen.h"
+#include "flutterby/Debug.h"
+#include "flutterby/Timebase.h"
+#include "flutterby/Types.h"
+
+/** PROFILE_SCOPE("name"_P) measures how long the rest of the
+ * enclosing scope takes to run:
+ *
+ * ```
+ * static void led_tick() {
+ *   PROFILE_SCOPE("led_tick"_P);
+ *   ...
+ * }
+ * ```
+ *
+ * Each PROFILE_SCOPE has a statically allocated profile::Entry that
+ * accumulates the number of calls and the min, max and total time
+ * spent in the scope.  Entries join the table the first time they
+ * run; profile::dump() prints it:
+ *
+ * ```
+ * profile::dump();  // via DBG()
+ * profile::dump<Serial0TxStream, kFormatStreamCRLF>();
+ * ```
+ *
+ * This is not a cycle counter.  Times are read with timebase::now()
+ * from the Timer1 timebase (flutterby/Timebase.h), which must be
+ * running: run_forever() starts it, or call timebase::start().  Their
+ * resolution is kCyclesPerTick, the timebase prescaler: 8 cycles with
+ * an 8MHz clock.  Timer1 is shared, so it can't be run at F_CPU/1 just
+ * for profiling.
+ *
+ * Each probe costs an interrupt_free read of TCNT1 plus the overflow
+ * fix-up in timebase::extend, a few dozen cycles; the count is read
+ * part way through, so a scope records the tail of its entry probe and
+ * the head of its exit probe.  That cost is measured once, as the
+ * least of several back to back pairs of reads, when the first scope
+ * runs, and cycles() subtracts it from the times that dump() reports.
+ * It isn't entirely fixed: an overflow that is still pending takes
+ * the longer path, and any interrupt that runs during a scope is
+ * counted too.  The first run of a scope also adds its entry to the
+ * table, before its entry probe reads the time.
+ *
+ * Profiling is off unless FLUTTERBY_PROFILE=1 is defined.  While it is
+ * off PROFILE_SCOPE compiles to nothing and its name is never placed
+ * in flash.
+ */
+
+#ifndef FLUTTERBY_PROFILE
+#define FLUTTERBY_PROFILE 0
+#endif
+
+namespace flutterby {
+namespace profile {
+
+static constexpr u32 kCyclesPerTick = timebase::TickPeriod::kSelection.divisor;
+
+struct Entry {
+  FlashString name{nullptr, nullptr};
+  Entry* next{nullptr};
+  u16 calls{0};
+  // In timebase ticks
+  u32 min{0xffffffff};
+  u32 max{0};
+  u32 total{0};
+};
+
+/** Adds entry to the table.  Called the first time that a scope runs. */
+void add_entry(Entry& entry, FlashString name);
+
+/** Returns the first entry in the table; follow Entry::next for the rest */
+Entry* first_entry();
+
+/** Clears the counts of every entry in the table */
+void reset();
+
+/** Returns the ticks that an empty scope records: the cost of the
+ * probes themselves.  Measured when the first scope runs. */
+u32 overhead();
+
+/** Converts a time recorded by a scope to CPU cycles, less the cost of
+ * the probes */
+inline u32 cycles(u32 ticks) {
+  u32 cost = overhead();
+  return ticks > cost ? (ticks - cost) * kCyclesPerTick : 0;
+}
+
+class Scope {
+  Entry& entry_;
+  u32 start_;
+
+ public:
+  Scope(Entry& entry, FlashString name) : entry_(entry) {
+    if (!entry_.name.begin().raw_ptr()) {
+      add_entry(entry_, name);
+    }
+    start_ = timebase::now();
+  }
+
+  ~Scope() {
+    u32 elapsed = timebase::now() - start_;
+    ++entry_.calls;
+    entry_.total += elapsed;
+    if (elapsed < entry_.min) {
+      entry_.min = elapsed;
+    }
+    if (elapsed > entry_.max) {
+      entry_.max = elapsed;
+    }
+  }
+};
+
+/** Writes a line per entry to Sink: name, calls, min, max and mean
+ * cycles, less the probe overhead.  Defaults to the simavr console,
+ * like DBG(). */
+template <typename Sink = SimavrConsoleStream, u8 NewLine = kFormatStreamCR>
+void dump() {
+  for (auto entry = first_entry(); entry; entry = entry->next) {
+    FormatStream<Sink, NewLine> out;
+    out.write(entry->name);
+    out << " calls="_P << entry->calls;
+    if (entry->calls == 0) {
+      continue;
+    }
+    out << " min="_P << cycles(entry->min) << " max="_P
+        << cycles(entry->max) << " mean="_P
+        << cycles(entry->total / entry->calls);
+  }
+}
+}
+}
+
+#define FLUTTERBY_PROFILE_CONCAT2(a, b) a##b
+#define FLUTTERBY_PROFILE_CONCAT(a, b) FLUTTERBY_PROFILE_CONCAT2(a, b)
+
+#if FLUTTERBY_PROFILE
+#define PROFILE_SCOPE(name)                                            \
+  static ::flutterby::profile::Entry FLUTTERBY_PROFILE_CONCAT(         \
+      flutterby_profile_entry_, __LINE__);                             \
+  ::flutterby::profile::Scope FLUTTERBY_PROFILE_CONCAT(                \
+      flutterby_profile_scope_, __LINE__)(                             \
+      FLUTTERBY_PROFILE_CONCAT(flutterby_profile_entry_, __LINE__), name)
+#else
+#define PROFILE_SCOPE(name) \
+  do {                      \
+  } while (0)
+#endif
@@ -118,6 +118,92 @@ class ProgMemPtr {
   }
 };
 
+/** A cursor that reads consecutive data from ProgMem.
+ * progmem_deref() and ProgMemPtr load Z afresh for every access; the
+ * reader keeps its position in Z and uses the post-incrementing form of
+ * lpm, so walking a run of bytes costs little more than the loads
+ * themselves.  This is the preferred way to stream strings, bitmaps and
+ * tables out of flash:
+ *
+ * ```
+ * ProgMemReader reader(Font.raw_ptr());
+ * auto glyph = reader.read<Glyph>();
+ * ```
+ */
+class ProgMemReader {
+  const uint8_t* ptr_;
+
+ public:
+  constexpr ProgMemReader(const void* ptr)
+      : ptr_(static_cast<const uint8_t*>(ptr)) {}
+
+  template <typename T>
+  constexpr ProgMemReader(const ProgMemPtr<T>& ptr)
+      : ProgMemReader(ptr.raw_ptr()) {}
+
+  /** Returns the next byte and advances past it */
+  uint8_t next() {
+    uint8_t result;
+    __asm__ __volatile__("lpm %[retval], Z+;\n\t"
+                         : [retval] "=r"(result), "+z"(ptr_));
+    return result;
+  }
+
+  /** Returns a copy of the next T and advances past it.
+   * The bytes are loaded one after the other by next(); the
+   * compiler unrolls this for the small types. */
+  template <typename T>
+  T read() {
+    T result;
+    auto dest = reinterpret_cast<uint8_t*>(&result);
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      dest[i] = next();
+    }
+    return result;
+  }
+
+  /** Copies the next len bytes into SRAM at dest.
+   * This is a memcpy_P and is the better choice for long runs. */
+  void read_bytes(void* dest, size_t len) {
+    memcpy_P(dest, ptr_, len);
+    ptr_ += len;
+  }
+
+  /** Advances past len bytes without reading them */
+  void skip(size_t len) {
+    ptr_ += len;
+  }
+
+  /** Returns a T with just the listed fields loaded from the struct at
+   * the cursor, and advances past the whole struct.  The other fields
+   * are value initialized.  The fields must be listed in the order that
+   * they appear in T: the cursor only moves forward, skipping the gaps
+   * between them and loading each field with lpm Z+ as read() does, so
+   * Z is set up once for the whole struct rather than once per field:
+   *
+   * ```
+   * auto font = ProgMemReader(&TomThumb)
+   *     .read_struct<GFXfont>(&GFXfont::bitmap, &GFXfont::first);
+   * ```
+   */
+  template <typename T, typename... U>
+  T read_struct(U T::*... fields) {
+    T result{};
+    auto src = reinterpret_cast<const T*>(ptr_);
+    auto end = ptr_ + sizeof(T);
+    ((skip(reinterpret_cast<const uint8_t*>(&(src->*fields)) - ptr_),
+      result.*fields = read<U>()),
+     ...);
+    ptr_ = end;
+    return result;
+  }
+
+  /** Returns the current position in program space */
+  constexpr const void* raw_ptr() const {
+    return ptr_;
+  }
+};
+
 /** An instance of a non-array type stored in ProgMem */
 template <typename T>
 class ProgMemInst {
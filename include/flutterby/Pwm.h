@@ -0,0 +1,188 @@
+#pragma once
+#include "flutterby/HwTimer.h"
+
+/** Hardware PWM on the output compare pins (OCnA, OCnB, ...) of
+ * the timers.  Once configured, the waveform is produced entirely
+ * by the timer with no interrupt load.
+ *
+ * PwmTimer configures the frequency for a timer, which is shared by
+ * all of its channels.  The frequency is checked at compile time:
+ *
+ * ```
+ * // 31.25kHz fast PWM on Timer2, driving OC2B
+ * using Backlight = PwmTimer<2, 31250>::Channel<1>;
+ * PwmTimer<2, 31250>::configure();
+ * Backlight::enable();
+ * Backlight::set_duty(Backlight::kTop / 2);
+ * ```
+ *
+ * Timer1 is the event loop timebase (see Timebase.h), which
+ * InputCapture and PROFILE_SCOPE rely on too.  Configuring it for PWM
+ * takes it over, so only use PwmTimer<1> in firmware that uses none
+ * of those.
+ *
+ * The 16-bit timers use ICRn as TOP, so the frequency can be set
+ * finely and every channel is available for output.  The 8-bit
+ * timers always count to 0xff and only the prescaler can be chosen,
+ * so relatively few frequencies are possible; MaxErrorPpm sets how
+ * close the frequency has to be.
+ */
+
+namespace flutterby {
+namespace pwm {
+
+enum class Mode : u8 {
+  // Single slope; twice the frequency of PhaseCorrect for a given TOP
+  Fast,
+  // Dual slope; the pulses stay centered as the duty changes
+  PhaseCorrect,
+};
+
+// 5%, as the 8-bit timers have so few frequencies to choose from
+static constexpr u32 kDefaultMaxErrorPpm = 50000;
+}
+
+template <typename Timer, u8 Channel>
+class PwmChannel;
+
+template <
+    u8 N,
+    u32 FrequencyHz,
+    pwm::Mode Mode = pwm::Mode::Fast,
+    u32 MaxErrorPpm = pwm::kDefaultMaxErrorPpm>
+class PwmTimer {
+  using Desc = TimerDesc<N>;
+  static constexpr bool kUseIcr = HwTimer<N>::kWidth == 16 && Desc::kIcr != 0;
+
+ public:
+  using Timer = HwTimer<N>;
+  using Count = typename Timer::Count;
+
+  static constexpr timer::Waveform kWaveform = Mode == pwm::Mode::Fast
+      ? (kUseIcr ? timer::Waveform::FastPwmTopIcr : timer::Waveform::FastPwm)
+      : (kUseIcr ? timer::Waveform::PhaseCorrectPwmTopIcr
+                 : timer::Waveform::PhaseCorrectPwm);
+  static constexpr bool kFast = Mode == pwm::Mode::Fast;
+
+  static constexpr auto kSelection = timer::select_clock<Desc>(
+      timer::frequency_to_cycles(F_CPU, FrequencyHz),
+      kUseIcr ? Timer::kMaxCount : 0xff,
+      Mode == pwm::Mode::PhaseCorrect,
+      !kUseIcr);
+  static_assert(
+      kSelection.found,
+      "The PWM frequency is too high or too low for this timer");
+  static_assert(
+      kSelection.error_ppm <= MaxErrorPpm,
+      "The PWM frequency can't be produced accurately enough by this timer");
+
+  // The largest duty value; a duty of kTop holds the output high
+  static constexpr Count kTop = kSelection.top;
+
+  template <u8 Ch>
+  using Channel = PwmChannel<PwmTimer, Ch>;
+
+  /** Start the timer with all channels disconnected from their pins */
+  static inline void configure() {
+    Timer::configure(kSelection.clock_select, kWaveform, kTop);
+  }
+
+  /** Stop the timer.  Channels that are still enabled hold
+   * whatever level their pin had when the timer stopped. */
+  static inline void stop() {
+    Timer::stop();
+  }
+};
+
+/** One output compare channel of a PwmTimer; Channel 0 is OCnA,
+ * 1 is OCnB and 2 is OCnC */
+template <typename PwmTimerType, u8 Channel>
+class PwmChannel {
+  using Timer = typename PwmTimerType::Timer;
+  using Desc = TimerDesc<Timer::kNumber>;
+  static_assert(Channel < Timer::kChannels, "no such compare channel");
+  static_assert(
+      Desc::kOcDdr[Channel] != 0,
+      "the pin for this channel is unknown for this device");
+  static_assert(
+      PwmTimerType::kWaveform != timer::Waveform::FastPwmTopA &&
+          PwmTimerType::kWaveform != timer::Waveform::PhaseCorrectPwmTopA,
+      "compare A is used as TOP by this timer");
+
+  static constexpr u8 kMask = 1 << Desc::kOcBit[Channel];
+  // COMnA is in bits 7:6, COMnB in 5:4 and COMnC in 3:2
+  static constexpr u8 kComShift = 6 - 2 * Channel;
+
+  static inline bool connected() {
+    return timer::reg8(Desc::kTccrA) & (0b11 << kComShift);
+  }
+
+  // Connect the channel just after the counter wraps to BOTTOM, where
+  // a fast PWM period begins, so that the first pulse is a whole one.
+  // This spins for up to a period.
+  static inline void connect_at_bottom() {
+    auto last = Timer::count();
+    while (true) {
+      auto now = Timer::count();
+      if (now < last) {
+        break;
+      }
+      last = now;
+    }
+    Timer::template set_compare_output<Channel>(timer::CompareOutput::Clear);
+  }
+
+ public:
+  using Count = typename PwmTimerType::Count;
+  static constexpr Count kTop = PwmTimerType::kTop;
+
+  /** Make the pin an output, initially low (a duty of 0) */
+  static inline void enable() {
+    set_duty(0);
+    interrupt_free([]() { timer::reg8(Desc::kOcDdr[Channel]) |= kMask; });
+  }
+
+  /** Disconnect the channel and return the pin to being an input */
+  static inline void disable() {
+    Timer::template set_compare_output<Channel>(
+        timer::CompareOutput::Disconnected);
+    interrupt_free([]() {
+      timer::reg8(Desc::kOcDdr[Channel]) &= ~kMask;
+      timer::reg8(Desc::kOcPort[Channel]) &= ~kMask;
+    });
+  }
+
+  /** Set the duty cycle to duty/kTop.
+   *
+   * The compare registers are double buffered in the PWM modes, so a
+   * new duty takes effect at the start of the next period and never
+   * produces a truncated or doubled pulse.
+   * In fast PWM mode a compare value of 0 still produces a one tick
+   * pulse each period, so a duty of 0 disconnects the channel from
+   * the pin and holds it low instead.  Going from 0 to a non-zero duty
+   * then waits for the next period to start before reconnecting, which
+   * takes up to one period.  Phase correct mode holds the pin low with
+   * a compare value of 0 and never needs to wait. */
+  static inline void set_duty(Count duty) {
+    if (PwmTimerType::kFast && duty == 0) {
+      Timer::template set_compare_output<Channel>(
+          timer::CompareOutput::Disconnected);
+      interrupt_free(
+          []() { timer::reg8(Desc::kOcPort[Channel]) &= ~kMask; });
+      return;
+    }
+    Timer::template set_compare<Channel>(duty > kTop ? kTop : duty);
+    if (PwmTimerType::kFast && !connected()) {
+      connect_at_bottom();
+    } else {
+      Timer::template set_compare_output<Channel>(
+          timer::CompareOutput::Clear);
+    }
+  }
+
+  /** Set the duty cycle to duty/255, scaled to the timer resolution */
+  static inline void set_duty_scaled(u8 duty) {
+    set_duty(Count((u32(duty) * kTop + 127) / 255));
+  }
+};
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "flutterby/Option.h"
+#include "flutterby/Types.h"
+
+namespace flutterby {
+
+/** RingBuffer is a fixed size single-producer, single-consumer queue.
+ * It is intended for passing data between an ISR and the main loop
+ * without having to disable interrupts: the producer only ever writes
+ * head_ and the consumer only ever writes tail_.
+ *
+ * The indices are free running 8-bit counters that are masked when
+ * accessing the storage, which is why Size must be a power of two
+ * no larger than 128.  All Size slots are usable.
+ */
+template <typename T, u8 Size>
+class RingBuffer {
+  static_assert(
+      Size > 0 && Size <= 128 && (Size & (Size - 1)) == 0,
+      "RingBuffer Size must be a power of two <= 128");
+  static constexpr u8 kMask = Size - 1;
+
+  T buf_[Size];
+  volatile u8 head_{0}; // next slot to write
+  volatile u8 tail_{0}; // next slot to read
+
+  static inline void barrier() {
+    __asm__ __volatile__("" ::: "memory");
+  }
+
+ public:
+  static constexpr u8 capacity() {
+    return Size;
+  }
+
+  /** Returns the number of queued items */
+  u8 size() const {
+    return u8(head_ - tail_);
+  }
+
+  bool empty() const {
+    return head_ == tail_;
+  }
+
+  bool full() const {
+    return size() == Size;
+  }
+
+  /** Producer: append an item.  Returns false if the buffer is full */
+  bool push(const T& value) {
+    u8 head = head_;
+    if (u8(head - tail_) == Size) {
+      return false;
+    }
+    buf_[head & kMask] = value;
+    // Make sure the data is stored before it is published to the consumer
+    barrier();
+    head_ = head + 1;
+    return true;
+  }
+
+  /** Consumer: remove and return the oldest item, if any */
+  Option<T> pop() {
+    u8 tail = tail_;
+    if (tail == head_) {
+      return Option<T>::None();
+    }
+    barrier();
+    T value = buf_[tail & kMask];
+    barrier();
+    tail_ = tail + 1;
+    return Some(move(value));
+  }
+
+  /** Consumer: returns a pointer to the oldest item without removing
+   * it, or nullptr if the buffer is empty.  The item remains valid
+   * until the next call to pop() or skip(). */
+  const T* peek() const {
+    u8 tail = tail_;
+    if (tail == head_) {
+      return nullptr;
+    }
+    barrier();
+    return &buf_[tail & kMask];
+  }
+
+  /** Consumer: discard up to n of the oldest items */
+  void skip(u8 n) {
+    u8 avail = size();
+    tail_ = tail_ + (n < avail ? n : avail);
+  }
+
+  /** Consumer: discard everything that is queued */
+  void clear() {
+    tail_ = head_;
+  }
+};
+}
@@ -0,0 +1,273 @@
+#pragma once
+#include "flutterby/Cobs.h"
+#include "flutterby/Crc.h"
+#include "flutterby/Future.h"
+#include "flutterby/Option.h"
+#include "flutterby/Types.h"
+
+/** A request/response protocol for talking to a host over a USART.
+ *
+ * Each message is a COBS encoded packet terminated by a zero byte.
+ * The decoded packets are laid out as:
+ *
+ *   request:  command, seq, payload..., crc16 (little endian)
+ *   response: command | 0x80, seq, status, payload..., crc16
+ *
+ * seq is chosen by the host and echoed in the response, so the host
+ * can pipeline several requests without waiting for each response.
+ * The CRC is CRC-16/CCITT-FALSE over everything that precedes it.
+ * Requests with a bad CRC are dropped without a response; the host
+ * is expected to time out and retry.
+ *
+ * Handlers are bound at compile time.  Each handler is a type with
+ * a kCommand constant and a static handle() function:
+ *
+ * ```
+ * struct GetTicks {
+ *   static constexpr u8 kCommand = 1;
+ *   static rpc::Status handle(const rpc::Request& req, rpc::Response& resp) {
+ *     resp.put(timebase::now());
+ *     return rpc::Status::Ok;
+ *   }
+ * };
+ *
+ * using Server = RpcServer<Serial0, 32, rpc::Echo<0>, GetTicks>;
+ * ...
+ *   spawn(Server::serve());
+ * ```
+ *
+ * Packets are decoded directly out of the port's receive buffer into
+ * the request buffer and handlers see the payload in place; responses
+ * are built in place and encoded directly into the transmit buffer.
+ * simrunner/rpc_client.h is the host side of the protocol, and
+ * simrunner/rpc_client_test.cpp checks it against Cobs.h and Crc.h.
+ */
+
+namespace flutterby {
+namespace rpc {
+
+enum class Status : u8 {
+  Ok = 0,
+  UnknownCommand = 1,
+  BadRequest = 2,
+  ResponseTooLarge = 3,
+};
+
+static constexpr u8 kResponseFlag = 0x80;
+// command + seq + crc16
+static constexpr u8 kRequestOverhead = 4;
+// command + seq + status + crc16
+static constexpr u8 kResponseOverhead = 5;
+
+/** A read-only view of the payload of a request */
+class Request {
+  const u8* data_;
+  u8 len_;
+
+ public:
+  Request(const u8* data, u8 len) : data_(data), len_(len) {}
+
+  const u8* data() const {
+    return data_;
+  }
+
+  u8 size() const {
+    return len_;
+  }
+
+  /** Decode a little endian integer at offset */
+  template <typename T>
+  Option<T> get(u8 offset) const {
+    if (offset + sizeof(T) > len_) {
+      return Option<T>::None();
+    }
+    T value = 0;
+    for (u8 i = 0; i < sizeof(T); ++i) {
+      value |= T(data_[offset + i]) << (8 * i);
+    }
+    return Some(move(value));
+  }
+};
+
+/** Accumulates the payload of a response */
+class Response {
+  u8* data_;
+  u8 capacity_;
+  u8 len_{0};
+  bool overflow_{false};
+
+ public:
+  Response(u8* data, u8 capacity) : data_(data), capacity_(capacity) {}
+
+  /** Append a little endian integer.
+   * Returns false (and marks the response as overflowed) if it
+   * doesn't fit */
+  template <typename T>
+  bool put(T value) {
+    if (len_ + sizeof(T) > capacity_) {
+      overflow_ = true;
+      return false;
+    }
+    for (u8 i = 0; i < sizeof(T); ++i) {
+      data_[len_++] = u8(value);
+      value >>= 8;
+    }
+    return true;
+  }
+
+  bool append(const u8* data, u8 len) {
+    if (len_ + len > capacity_) {
+      overflow_ = true;
+      return false;
+    }
+    for (u8 i = 0; i < len; ++i) {
+      data_[len_++] = data[i];
+    }
+    return true;
+  }
+
+  u8 size() const {
+    return len_;
+  }
+
+  bool overflowed() const {
+    return overflow_;
+  }
+};
+
+/** Replies with a copy of the request payload; handy for checking
+ * that the link works and for measuring round trip time */
+template <u8 Command>
+struct Echo {
+  static constexpr u8 kCommand = Command;
+  static Status handle(const Request& req, Response& resp) {
+    resp.append(req.data(), req.size());
+    return Status::Ok;
+  }
+};
+
+template <typename... Handlers>
+constexpr bool commands_are_valid() {
+  const u8 commands[] = {0, Handlers::kCommand...};
+  for (u8 i = 1; i < sizeof(commands); ++i) {
+    if (commands[i] & kResponseFlag) {
+      return false;
+    }
+    for (u8 j = i + 1; j < sizeof(commands); ++j) {
+      if (commands[i] == commands[j]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+}
+
+/** Serves requests that arrive via Port.
+ * Port must provide static Option<u8> read_byte() and
+ * static void write_byte_blocking(u8), as Serial0 does.
+ * MaxPayload bounds the payload of both requests and responses. */
+template <typename Port, u8 MaxPayload, typename... Handlers>
+class RpcServer {
+  static_assert(
+      MaxPayload <= 255 - rpc::kResponseOverhead,
+      "MaxPayload is too large");
+  static_assert(
+      rpc::commands_are_valid<Handlers...>(),
+      "RPC commands must be unique and less than 0x80");
+
+  static constexpr u8 kRequestSize = MaxPayload + rpc::kRequestOverhead;
+  static constexpr u8 kResponseSize = MaxPayload + rpc::kResponseOverhead;
+
+  static inline u8 request_[kRequestSize];
+  static inline u8 response_[kResponseSize];
+  static inline cobs::Decoder decoder_{request_, kRequestSize};
+  static inline u16 bad_packets_;
+
+  static void dispatch(u8 len) {
+    if (len < rpc::kRequestOverhead) {
+      ++bad_packets_;
+      return;
+    }
+    u8 body_len = len - 2;
+    u16 crc = request_[body_len] | (u16(request_[body_len + 1]) << 8);
+    if (crc != crc16_ccitt(request_, body_len)) {
+      ++bad_packets_;
+      return;
+    }
+    u8 command = request_[0];
+    if (command & rpc::kResponseFlag) {
+      // Not for us; most likely our own output echoed back
+      return;
+    }
+
+    rpc::Request req(request_ + 2, body_len - 2);
+    rpc::Response resp(response_ + 3, MaxPayload);
+    auto status = rpc::Status::UnknownCommand;
+    ((command == Handlers::kCommand &&
+      (status = Handlers::handle(req, resp), true)) ||
+     ...);
+
+    u8 resp_len = resp.size();
+    if (resp.overflowed()) {
+      status = rpc::Status::ResponseTooLarge;
+      resp_len = 0;
+    } else if (status != rpc::Status::Ok) {
+      resp_len = 0;
+    }
+
+    response_[0] = command | rpc::kResponseFlag;
+    response_[1] = request_[1];
+    response_[2] = u8(status);
+    resp_len += 3;
+    crc = crc16_ccitt(response_, resp_len);
+    response_[resp_len++] = u8(crc);
+    response_[resp_len++] = u8(crc >> 8);
+
+    cobs::encode(
+        response_, resp_len, [](u8 b) { Port::write_byte_blocking(b); });
+    Port::write_byte_blocking(0);
+  }
+
+ public:
+  /** Process received bytes.  Returns true after processing a
+   * complete packet, or false once there is no more input */
+  static bool poll() {
+    while (true) {
+      auto b = Port::read_byte();
+      if (b.is_none()) {
+        return false;
+      }
+      switch (decoder_.feed(b.value())) {
+        case cobs::Decoder::Status::Pending:
+          break;
+        case cobs::Decoder::Status::Invalid:
+          ++bad_packets_;
+          break;
+        case cobs::Decoder::Status::Complete:
+          dispatch(decoder_.length());
+          return true;
+      }
+    }
+  }
+
+  /** Returns a Future that serves requests forever; spawn() it */
+  static auto serve() {
+    struct Serve {
+      Option<Result<Unit, Unit>> operator()() {
+        while (poll()) {
+          ;
+        }
+        return Option<Result<Unit, Unit>>::None();
+      }
+    };
+    return Future<Unit, Unit, Serve>(Serve{});
+  }
+
+  /** Returns the number of packets that were dropped because they
+   * were malformed, too long or failed the CRC check */
+  static u16 bad_packets() {
+    return bad_packets_;
+  }
+};
+}
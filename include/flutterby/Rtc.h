@@ -0,0 +1,242 @@
+#pragma once
+#include "avr_autogen.h"
+#include "flutterby/CriticalSection.h"
+#include "flutterby/I2c.h"
+#include "flutterby/Sleep.h"
+
+/** A driver for the DS1337 and DS1338 family of real time clocks.
+ *
+ * Rather than re-reading the time over I2C whenever it is needed,
+ * the driver reads the full time once and then keeps a copy in RAM
+ * that is advanced once per second.  The chip is periodically re-read
+ * to correct for any drift, and also whenever the date rolls over
+ * so that we don't need to know about calendars.
+ *
+ * The preferred source of the once-per-second tick is the 1Hz square
+ * wave output of the chip, wired to an external interrupt pin.  Both
+ * chips update their seconds register on the falling edge of that
+ * output, so the RAM copy stays in lock step with the chip:
+ *
+ * ```
+ * using Clock = Rtc<rtc::Ds1338>;
+ * IRQ_INT0 {
+ *   Clock::on_edge();
+ * }
+ * ...
+ *   Try(Clock::begin());
+ *   Try(Clock::enable_square_wave_interrupt<0>());
+ * ```
+ *
+ * If the square wave output isn't wired to the MCU, on_edge() may be
+ * called from a 1_s event loop timer instead; the MCU clock is then
+ * used to interpolate between resyncs.
+ *
+ * The I2C reads happen in poll(), which should be called from the
+ * main loop (for example from an event loop timer) so that the bus
+ * is never touched from interrupt context.
+ */
+
+namespace flutterby {
+namespace rtc {
+
+// The time registers, decoded from BCD
+struct Time {
+  u8 seconds;
+  u8 minutes;
+  u8 hours; // 24 hour clock
+  u8 day; // day of the week, 1-7
+  u8 date;
+  u8 month;
+  u8 year;
+};
+
+enum TimeRegisters {
+  SECONDS = 0x00,
+  MINUTES = 0x01,
+  HOURS = 0x02,
+  DAY = 0x03,
+  DATE = 0x04,
+  MONTH = 0x05,
+  YEAR = 0x06,
+};
+
+struct Ds1337 {
+  static constexpr u8 kAddress = 0x68;
+  static constexpr u8 kControl = 0x0e;
+  // INTCN=0 routes the square wave to SQW/INTB and RS2=RS1=0 selects 1Hz
+  static constexpr u8 kSquareWaveClear = (1 << 4) | (1 << 3) | (1 << 2);
+  static constexpr u8 kSquareWaveSet = 0;
+};
+
+struct Ds1338 {
+  static constexpr u8 kAddress = 0x68;
+  static constexpr u8 kControl = 0x07;
+  // RS1=RS0=0 selects 1Hz and SQWE enables the output
+  static constexpr u8 kSquareWaveClear = (1 << 1) | (1 << 0);
+  static constexpr u8 kSquareWaveSet = 1 << 4;
+};
+
+static inline u8 decode_bcd(u8 x) {
+  return ((x >> 4) * 10 + (x & 0x0F));
+}
+
+/** Decodes the hours register to a 24 hour clock.  Bit 6 selects
+ * the 12 hour mode, in which bit 5 is set for PM and the hour
+ * counts 12, 1, 2 ... 11. */
+static inline u8 decode_hours(u8 x) {
+  if (!(x & (1 << 6))) {
+    return decode_bcd(x & 0x3f);
+  }
+  u8 hours = decode_bcd(x & 0x1f) % 12;
+  return (x & (1 << 5)) ? hours + 12 : hours;
+}
+
+/** Why a resync failed */
+enum class SyncError {
+  Bus, // An I2C transfer failed
+  Unsettled, // A tick arrived during every attempt to read the time
+};
+using SyncResult = Result<Unit, SyncError>;
+
+/** Reads and decodes the time registers in a single burst read */
+template <typename Chip>
+Result<Time, I2cMaster::Error> read_time(u16 timeout_ms) {
+  Time time;
+  auto res = I2cMaster::read(Chip::kAddress, timeout_ms, SECONDS, time);
+  if (res.is_err()) {
+    return Result<Time, I2cMaster::Error>::Error(res.error());
+  }
+
+  // Mask off the clock halt bit
+  time.seconds = decode_bcd(time.seconds & 0x7f);
+  time.minutes = decode_bcd(time.minutes & 0x7f);
+  time.hours = decode_hours(time.hours);
+  time.day = decode_bcd(time.day & 0x07);
+  time.date = decode_bcd(time.date & 0x3f);
+  time.month = decode_bcd(time.month & 0x1f);
+  time.year = decode_bcd(time.year);
+
+  return Result<Time, I2cMaster::Error>::Ok(time);
+}
+}
+
+template <typename Chip>
+class Rtc {
+  static constexpr u16 kTimeoutMs = 100;
+  // The chip updates its time registers just before the tick that
+  // tells us about it, so a read that raced with one tick will
+  // succeed on the next attempt.  Only a stream of spurious ticks
+  // defeats this many.
+  static constexpr u8 kSyncAttempts = 4;
+
+  static inline rtc::Time time_;
+  // Seconds elapsed since the last resync
+  static inline volatile u16 since_sync_;
+  static inline volatile bool sync_wanted_;
+  // Bumped on every tick so that a resync can tell that it raced
+  static inline volatile u8 generation_;
+  static inline u16 resync_interval_;
+
+ public:
+  /** Read the time from the chip and start tracking it in RAM.
+   * The chip is re-read every resync_interval seconds. */
+  static rtc::SyncResult begin(u16 resync_interval = 3600) {
+    resync_interval_ = resync_interval;
+    return sync();
+  }
+
+  /** Configure the chip to emit its 1Hz square wave and enable
+   * the falling edge interrupt on INTn.  You must define the
+   * corresponding IRQ_INTn handler and have it call on_edge(). */
+  template <u8 IntNum>
+  static I2cMaster::I2cResult enable_square_wave_interrupt() {
+    static_assert(IntNum < 4, "only INT0-INT3 are supported");
+    u8 control;
+    Try(I2cMaster::read(Chip::kAddress, kTimeoutMs, Chip::kControl, control));
+    control = (control & ~Chip::kSquareWaveClear) | Chip::kSquareWaveSet;
+    Try(I2cMaster::write(Chip::kAddress, kTimeoutMs, Chip::kControl, control));
+
+    interrupt_free([]() {
+      // ISCn1:ISCn0 = 0b10 selects the falling edge.  The EXINT flag
+      // names vary between parts, so we poke the raw bits here.
+      auto& eicra = Exint::eicra.raw_bits();
+      eicra = (eicra & ~(0b11 << (IntNum * 2))) | (0b10 << (IntNum * 2));
+      // Clear any stale flag before unmasking
+      Exint::eifr.raw_bits() = 1 << IntNum;
+      Exint::eimsk.raw_bits() |= 1 << IntNum;
+    });
+    return I2cMaster::I2cResult::Ok();
+  }
+
+  /** Advance the RAM copy of the time by one second.
+   * Intended to be called from the square wave ISR. */
+  static void on_edge() {
+    ++generation_;
+    auto& t = time_;
+    if (++t.seconds >= 60) {
+      t.seconds = 0;
+      if (++t.minutes >= 60) {
+        t.minutes = 0;
+        if (++t.hours >= 24) {
+          // Let the chip figure out the calendar
+          t.hours = 0;
+          sync_wanted_ = true;
+        }
+      }
+    }
+    if (++since_sync_ >= resync_interval_) {
+      sync_wanted_ = true;
+    }
+    set_event_pending();
+  }
+
+  /** Returns a coherent copy of the current time */
+  static rtc::Time now() {
+    return interrupt_free([]() { return time_; });
+  }
+
+  /** Returns the number of ticks seen; handy for noticing that
+   * the time has changed without copying it */
+  static u8 generation() {
+    return generation_;
+  }
+
+  /** Resync with the chip if one is due; otherwise does nothing.
+   * Call this from the main loop. */
+  static rtc::SyncResult poll() {
+    if (!sync_wanted_) {
+      return rtc::SyncResult::Ok();
+    }
+    return sync();
+  }
+
+  /** Unconditionally re-read the time from the chip.  If a tick
+   * arrives during each of several attempts the RAM copy is left
+   * alone, a resync stays due, and Unsettled is returned. */
+  static rtc::SyncResult sync() {
+    for (u8 attempt = 0; attempt < kSyncAttempts; ++attempt) {
+      u8 generation = generation_;
+      auto res = rtc::read_time<Chip>(kTimeoutMs);
+      if (res.is_err()) {
+        return rtc::SyncResult::Error(rtc::SyncError::Bus);
+      }
+      bool stored = interrupt_free([&]() {
+        if (generation != generation_) {
+          // A tick arrived while we were reading; the chip may have
+          // advanced after we read it, so try again
+          return false;
+        }
+        time_ = res.value();
+        since_sync_ = 0;
+        sync_wanted_ = false;
+        return true;
+      });
+      if (stored) {
+        return rtc::SyncResult::Ok();
+      }
+    }
+    sync_wanted_ = true;
+    return rtc::SyncResult::Error(rtc::SyncError::Unsettled);
+  }
+};
+}
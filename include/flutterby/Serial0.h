@@ -1,13 +1,39 @@
 #pragma once
 #include "avr_autogen.h"
 #include "flutterby/Debug.h"
+#include "flutterby/Future.h"
+#include "flutterby/Stream.h"
 #include "flutterby/Types.h"
 
+// The sizes of the transmit and receive ring buffers.  These can be
+// overridden by adding -D flags to AVR_CXXFLAGS; they must be powers
+// of two no larger than 128.
+#ifndef SERIAL0_TX_BUFFER_SIZE
+#define SERIAL0_TX_BUFFER_SIZE 64
+#endif
+#ifndef SERIAL0_RX_BUFFER_SIZE
+#define SERIAL0_RX_BUFFER_SIZE 32
+#endif
+
 namespace flutterby {
 
+/** Serial0 drives USART0.
+ * Transmit and receive are interrupt driven and buffered:
+ * write_byte() queues a byte and returns immediately, and the UDRE
+ * interrupt feeds the queue to the hardware.  Received bytes are
+ * queued by the RXC interrupt and can be consumed via read_byte(),
+ * the read() Future or the bytes() Stream.
+ */
 class Serial0 {
+  // Starts the interrupt driven transmit and receive; called by configure()
+  static void enable_interrupts();
+  // Acquires the USART0 power gate; called by configure()
+  static void power_up();
+
  public:
   static void configure(u32 baud) {
+    power_up();
+
     // Use 2x speed mode
     Usart0::ucsr0a |= Usart0Ucsr0aFlags::U2X0;
     u16 setting = (F_CPU / 4 / baud - 1) / 2;
@@ -27,24 +53,75 @@ class Serial0 {
         Usart0Ucsr0cFlags::UPM0_DISABLED /* no parity */ |
         Usart0Ucsr0cFlags::USBS0_1BIT /* 1 stop bit */ |
         Usart0Ucsr0cFlags::UCSZ0 /* 8bit (really a mask)*/;
+
+    enable_interrupts();
   }
 
-  static inline void write_byte_immediate(u8 b) {
-    // Wait for empty transmit buffer
-    while ((Usart0::ucsr0a & Usart0Ucsr0aFlags::UDRE0) !=
-           Usart0Ucsr0aFlags::UDRE0) {
-      ;
-    }
-    Usart0::udr0 = b;
-    Usart0::ucsr0a |=
-        Usart0Ucsr0aFlags::TXC0; // clear this bit by writing a 1 to it
+  /** Wait for pending output to be sent, then turn off the USART
+   * and gate its clock */
+  static void disable();
+
+  /** Bypass the transmit buffer and block until the byte has been
+   * handed to the hardware.  Interrupts are masked while it waits for
+   * the data register, which takes at most one character time, so the
+   * UDRE interrupt can't load a queued byte in between; bytes queued by
+   * write_byte() that have not yet been sent go out after this one. */
+  static void write_byte_immediate(u8 b);
+
+  /** Queue a byte for transmission without blocking.
+   * Returns false if the transmit buffer is full. */
+  static bool write_byte(u8 b);
+
+  /** Queue as much of buf as will fit in the transmit buffer.
+   * Returns the number of bytes that were queued. */
+  static u8 write(const u8* buf, u8 len);
+
+  /** Queue a byte, waiting for space in the transmit buffer if
+   * necessary.  This is safe to call with interrupts disabled;
+   * the buffer is drained by polling in that case. */
+  static void write_byte_blocking(u8 b);
+
+  /** Returns the amount of free space in the transmit buffer */
+  static u8 tx_space();
+
+  /** Block until everything in the transmit buffer has been sent */
+  static void flush();
+
+  /** Returns the next received byte, if any, without blocking */
+  static Option<u8> read_byte();
+
+  /** Returns the number of bytes that were dropped because the
+   * receive buffer was full, and resets the count */
+  static u8 take_overruns();
+
+  /** Returns a Future that resolves to the next received byte */
+  static auto read() {
+    return Future<u8, Unit, ReadByte>(ReadByte{});
   }
+
+  /** Returns a Stream that yields bytes as they are received */
+  static auto bytes() {
+    return Stream<u8, Unit, ReadByte>(ReadByte{});
+  }
+
+ private:
+  struct ReadByte {
+    Option<Result<u8, Unit>> operator()() {
+      auto b = read_byte();
+      if (b.is_none()) {
+        return Option<Result<u8, Unit>>::None();
+      }
+      return Some(Result<u8, Unit>::Ok(b.value()));
+    }
+  };
 };
 
+/** Queues bytes into the Serial0 transmit buffer.
+ * Waits for space if the buffer fills up, so nothing is lost */
 class Serial0TxStream {
   public:
     void operator()(u8 b) {
-      Serial0::write_byte_immediate(b);
+      Serial0::write_byte_blocking(b);
     }
 };
 
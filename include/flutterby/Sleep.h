@@ -1,6 +1,15 @@
 #pragma once
 #include "flutterby/Types.h"
 
+// wait_for_event() gathers SleepStats if the library is built with
+// this defined to 1.  It costs two reads of the timebase per sleep,
+// and links in the timebase and its Timer1 interrupt handlers even
+// for firmware that has no other use for them.  The simulator builds
+// turn it on so that the tests can look at the stats.
+#ifndef FLUTTERBY_SLEEP_STATS
+#define FLUTTERBY_SLEEP_STATS 0
+#endif
+
 namespace flutterby {
 
 // http://microchipdeveloper.com/8avr:avrsleep
@@ -14,6 +23,8 @@ enum class SleepMode {
   ExtendedStandBy,
 };
 
+static constexpr u8 kSleepModeCount = 6;
+
 /** Configures the sleep mode, but doesn't sleep the CPU */
 void set_sleep_mode(SleepMode mode);
 
@@ -32,4 +43,45 @@ static inline void set_event_pending() {
  */
 void wait_for_event(SleepMode mode);
 
+/** Statistics about the time spent in wait_for_event().
+ * Times are in timebase ticks (flutterby/Timebase.h) and are only
+ * measured while the timebase is running.  Timer1 stops in the
+ * power down, power save and standby modes, so sleeps in those modes
+ * are counted but their duration isn't measured. */
+struct SleepStats {
+  static constexpr u8 kBurstBuckets = 16;
+
+  // Time asleep, indexed by SleepMode
+  u32 asleep[kSleepModeCount];
+  // Time awake between sleeps
+  u32 awake;
+  // Number of times that the CPU slept and was woken
+  u16 wakeups;
+  // Histogram of the time spent awake between two sleeps.  Bucket n
+  // counts bursts of 2^n to 2^(n+1)-1 ticks; bucket 0 includes bursts
+  // of 0 ticks and the last bucket includes everything longer.
+  u16 bursts[kBurstBuckets];
+
+  u32 total_asleep() const {
+    u32 total = 0;
+    for (auto t : asleep) {
+      total += t;
+    }
+    return total;
+  }
+
+  /** Returns the fraction of the measured time spent awake,
+   * in parts per thousand */
+  u16 duty_permille() const {
+    u32 total = awake + total_asleep();
+    return total ? u16((uint64_t(awake) * 1000) / total) : 0;
+  }
+};
+
+/** Returns the statistics gathered since startup or the last reset.
+ * All zero if FLUTTERBY_SLEEP_STATS is 0. */
+SleepStats sleep_stats();
+
+void reset_sleep_stats();
+
 }
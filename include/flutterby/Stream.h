@@ -0,0 +1,147 @@
+#pragma once
+#include "flutterby/Future.h"
+
+/** Streams
+ * A Stream<> is the multi-valued counterpart of a Future<>; rather than
+ * resolving to a single Result it yields a sequence of them over time.
+ * This is a natural fit for hardware that produces data as it arrives,
+ * such as bytes received by a USART or edges seen on a pin.
+ *
+ * Like Future<>, the Impl is a functor that is polled; it returns None
+ * when no value is ready yet, or Some(Result) when one is.  The streams
+ * in this library represent hardware and never end.
+ *
+ * The usual way to consume a Stream is to turn it into a Future via
+ * for_each() and spawn() it:
+ *
+ * ```
+ *    spawn(Serial0::bytes().for_each([](u8 b) {
+ *      DBG() << "got "_P << b;
+ *    }));
+ * ```
+ */
+
+namespace flutterby {
+
+// A detail namespace for stream related things
+namespace stream {
+
+// Constructs Ok and Error results.  This smooths over the
+// Result<Unit, Unit> specialization, which has no storage.
+template <typename R>
+struct Make {
+  template <typename V>
+  static R ok(V&& value) {
+    return R::Ok(move(value));
+  }
+  template <typename E>
+  static R error(E&& error) {
+    return R::Error(move(error));
+  }
+};
+
+template <>
+struct Make<Result<Unit, Unit>> {
+  static Result<Unit, Unit> ok(Unit) {
+    return Result<Unit, Unit>::Ok();
+  }
+  static Result<Unit, Unit> error(Unit) {
+    return Result<Unit, Unit>::Error();
+  }
+};
+}
+
+template <typename ValueType, typename ErrorType, typename Impl>
+class[[nodiscard]] Stream {
+  Impl impl_;
+
+ public:
+  using value_type = ValueType;
+  using error_type = ErrorType;
+  using result_type = Result<ValueType, ErrorType>;
+  using poll_type = Option<result_type>;
+
+  explicit Stream(Impl && impl) : impl_(move(impl)) {}
+
+  /** Returns the next value if one is ready */
+  poll_type poll_next() {
+    return impl_();
+  }
+
+  /** Consumes the stream, returning a Future that resolves to
+   * its next value */
+  auto next()&& {
+    struct Next {
+      Stream inner;
+
+      poll_type operator()() {
+        return inner.poll_next();
+      }
+    };
+    return Future<ValueType, ErrorType, Next>(Next{move(*this)});
+  }
+
+  /** Stream.map([](ValueType) -> NextValue) */
+  template <typename Func>
+  auto map(Func && func)&& {
+    using NextValue = typename future::resultOf<Func, ValueType&&>;
+    using NextResult = Result<NextValue, ErrorType>;
+    struct Map {
+      Stream inner;
+      Func func;
+
+      Option<NextResult> operator()() {
+        auto status = inner.poll_next();
+        if (status.is_none()) {
+          return Option<NextResult>::None();
+        }
+        auto& result = status.value();
+        if (result.is_err()) {
+          return Some(
+              stream::Make<NextResult>::error(move(result.error())));
+        }
+        return Some(
+            stream::Make<NextResult>::ok(func(move(result.value()))));
+      }
+    };
+    return Stream<NextValue, ErrorType, Map>(Map{move(*this), move(func)});
+  }
+
+  /** Consumes the stream, returning a Future that invokes func for
+   * each value as it becomes available.  Every value that is ready
+   * is processed each time the Future is polled.  The Future only
+   * completes if the stream yields an error.  If ErrorType is Unit
+   * then the Future can be passed directly to spawn(). */
+  template <typename Func>
+  auto for_each(Func && func)&& {
+    using NextResult = Result<Unit, ErrorType>;
+    struct ForEach {
+      Stream inner;
+      Func func;
+
+      Option<NextResult> operator()() {
+        while (true) {
+          auto status = inner.poll_next();
+          if (status.is_none()) {
+            return Option<NextResult>::None();
+          }
+          auto& result = status.value();
+          if (result.is_err()) {
+            return Some(
+                stream::Make<NextResult>::error(move(result.error())));
+          }
+          func(move(result.value()));
+        }
+      }
+    };
+    return Future<Unit, ErrorType, ForEach>(
+        ForEach{move(*this), move(func)});
+  }
+};
+
+/** Construct a Stream<> from a functor that polls for the next value */
+template <typename ValueType, typename ErrorType = Unit, typename Impl>
+auto make_stream(Impl impl) {
+  return Stream<ValueType, ErrorType, Impl>(move(impl));
+}
+}
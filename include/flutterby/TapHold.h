@@ -0,0 +1,371 @@
+#pragma once
+#include "flutterby/KeyMatrix.h"
+#include "flutterby/Keymap.h"
+#include "flutterby/Option.h"
+#include "flutterby/Progmem.h"
+#include "flutterby/Timebase.h"
+#include "flutterby/Types.h"
+
+namespace flutterby {
+namespace taphold {
+// How long a dual role key has to be held before it acts as held
+static constexpr u32 kDefaultHoldUs = 200000;
+// How close together the keys of a combo have to be pressed
+static constexpr u32 kDefaultComboUs = 50000;
+}
+
+/** TapHold resolves dual role keys and combos into plain actions.
+ *
+ * Neither can be decided when the key is pressed: a dual role key (see
+ * keymap::mod_tap and keymap::layer_tap) is a tap if it is released
+ * before HoldUs has passed, and a combo needs all of its keys to have
+ * been pressed within ComboUs.  Key events are queued while a decision
+ * is outstanding and are then resolved strictly in order, so a key
+ * pressed after a dual role key sees the modifier or layer when it is
+ * held.  A dual role key is also held if another key is both pressed
+ * and released while it is down, which lets it be used at full typing
+ * speed without waiting for the hold time.
+ *
+ * The queue is a fixed array of Pending events and the keys that are
+ * down are tracked in a fixed array of Held entries, so nothing is
+ * allocated per key press.  Each event costs O(Pending) to resolve, plus
+ * a pass over the combo table for keys that belong to a combo.  If the
+ * queue fills up, the oldest key is decided as if its time had run out.
+ * A press that finds no room in the Held array is ignored along with
+ * its release.
+ *
+ * There is a single deadline for the earliest outstanding decision.
+ * poll() does nothing until it is reached, so it is cheap to call on
+ * every scan, and deadline() tells a low power scan loop how long it may
+ * sleep for.  Times are timebase::now() ticks; HoldUs and ComboUs are
+ * given in microseconds and converted to ticks at compile time.
+ *
+ * Actions are looked up as each key reaches the head of the queue, with
+ * lookup(row, col), and passed to emit(action, pressed).  A release
+ * always emits the action that was emitted for the press, even if the
+ * layers have changed since.
+ *
+ * ```
+ * TapHold<Matrix::kCols> taphold(Combos);
+ * keymap::LayerState<2> layers;
+ * auto lookup = [&](u8 row, u8 col) {
+ *   return MyKeymap.lookup(layers.active(), row, col);
+ * };
+ * auto emit = [&](keymap::Action action, bool pressed) {
+ *   if (!layers.apply(action, pressed)) {
+ *     usb::key(keymap::arg(action), pressed);
+ *   }
+ * };
+ * for (;;) {
+ *   auto now = timebase::now();
+ *   matrix.scan([&](KeyEvent e) { taphold.process(e, now, lookup, emit); });
+ *   taphold.poll(now, lookup, emit);
+ * }
+ * ```
+ */
+template <
+    u8 Cols,
+    u8 Pending = 8,
+    u8 Held = 10,
+    u32 HoldUs = taphold::kDefaultHoldUs,
+    u32 ComboUs = taphold::kDefaultComboUs>
+class TapHold {
+  static_assert(Pending > 0 && Pending < 128, "invalid queue size");
+  static_assert(Held > 0, "invalid held key count");
+  static constexpr u32 kHoldTicks = timebase::us_to_ticks(HoldUs);
+  static constexpr u32 kComboTicks = timebase::us_to_ticks(ComboUs);
+
+ public:
+  using Combos = ProgMemRange<keymap::Combo>;
+
+  TapHold() : combos_(nullptr, nullptr) {}
+
+  template <size_t Size>
+  explicit TapHold(const ProgMemArrayInst<keymap::Combo, Size>& combos)
+      : combos_(combos.begin(), combos.end()) {}
+
+  /** Queue a key event from the matrix and resolve whatever can now
+   * be decided */
+  template <typename Lookup, typename Emit>
+  void process(KeyEvent e, u32 now, Lookup&& lookup, Emit&& emit) {
+    if (count_ == Pending) {
+      step(now, true, lookup, emit);
+    }
+    auto& event = queue_[count_++];
+    event.key = e.row * Cols + e.col;
+    event.pressed = e.pressed;
+    event.at = now;
+    event.seq = seq_++;
+    event.press_seq = event.seq;
+    if (!e.pressed) {
+      // Remember the press that this release ends, if it is queued
+      for (u8 i = 0; i + 1 < count_; ++i) {
+        if (queue_[i].key == event.key && queue_[i].pressed) {
+          event.press_seq = queue_[i].seq;
+        }
+      }
+    }
+    resolve(now, lookup, emit);
+  }
+
+  /** Resolve the outstanding decision if its deadline has passed */
+  template <typename Lookup, typename Emit>
+  void poll(u32 now, Lookup&& lookup, Emit&& emit) {
+    if (waiting_ && i32(now - deadline_) >= 0) {
+      resolve(now, lookup, emit);
+    }
+  }
+
+  /** Returns the time at which poll() next has work to do */
+  Option<u32> deadline() const {
+    return waiting_ ? Some(deadline_) : Option<u32>::None();
+  }
+
+  /** Returns true if no events are queued */
+  bool idle() const {
+    return count_ == 0;
+  }
+
+ private:
+  struct Event {
+    u8 key;
+    bool pressed;
+    u8 seq;
+    // For a release, the seq of its press if that was still queued
+    // when the release arrived; otherwise the same as seq
+    u8 press_seq;
+    u32 at;
+  };
+
+  struct Down {
+    u8 key;
+    // Non-zero for the keys of a combo; one more than its index
+    u8 combo;
+    keymap::Action action;
+  };
+
+  enum class Match : u8 { None, Wait, Fired };
+  enum class Role : u8 { Tap, Hold, Undecided };
+
+  template <typename Lookup, typename Emit>
+  void resolve(u32 now, Lookup& lookup, Emit& emit) {
+    waiting_ = false;
+    while (count_ > 0 && step(now, false, lookup, emit)) {
+    }
+  }
+
+  // Resolve the event at the head of the queue.  Returns false and sets
+  // the deadline if it can't be decided yet.  Always makes progress
+  // when force is true.
+  template <typename Lookup, typename Emit>
+  bool step(u32 now, bool force, Lookup& lookup, Emit& emit) {
+    auto head = queue_[0];
+    if (!head.pressed) {
+      release(head.key, emit);
+      remove(0);
+      return true;
+    }
+
+    switch (match_combo(now, force, emit)) {
+      case Match::Fired:
+        return true;
+      case Match::Wait:
+        return false;
+      case Match::None:
+        break;
+    }
+
+    auto action = lookup(u8(head.key / Cols), u8(head.key % Cols));
+    if (keymap::is_tap_hold(action)) {
+      switch (role(head)) {
+        case Role::Hold:
+          action = keymap::hold_action(action);
+          break;
+        case Role::Tap:
+          action = keymap::tap_action(action);
+          break;
+        case Role::Undecided:
+          if (force || now - head.at >= kHoldTicks) {
+            action = keymap::hold_action(action);
+            break;
+          }
+          wait(head.at + kHoldTicks);
+          return false;
+      }
+    }
+    press(head.key, 0, action, emit);
+    remove(0);
+    return true;
+  }
+
+  // Decides the role of the dual role key at the head of the queue from
+  // the events that follow it: a tap if it was released first, a hold
+  // if a later key was pressed and released first
+  Role role(const Event& head) const {
+    for (u8 i = 1; i < count_; ++i) {
+      auto& event = queue_[i];
+      if (event.pressed) {
+        continue;
+      }
+      if (event.key == head.key) {
+        return Role::Tap;
+      }
+      if (event.press_seq != event.seq && i8(event.press_seq - head.seq) > 0) {
+        return Role::Hold;
+      }
+    }
+    return Role::Undecided;
+  }
+
+  // Returns the bit for key in the combo's key mask, or 0 if it is
+  // not one of its keys
+  static u8 combo_bit(const keymap::Combo& combo, u8 key) {
+    for (u8 k = 0; k < keymap::kMaxComboKeys; ++k) {
+      if (combo.keys[k] == key) {
+        return 1 << k;
+      }
+    }
+    return 0;
+  }
+
+  // Looks for a combo formed by the press at the head of the queue and
+  // the presses that follow it.  A longer combo is preferred, and is
+  // waited for while it might still be completed.
+  template <typename Emit>
+  Match match_combo(u32 now, bool force, Emit& emit) {
+    auto head = queue_[0];
+    keymap::Combo best{};
+    u8 best_index = 0;
+    u8 best_keys = 0;
+    u8 wait_keys = 0;
+    u8 index = 0;
+
+    for (keymap::Combo combo : combos_) {
+      ++index;
+      u8 want = 0;
+      u8 keys = 0;
+      for (u8 k = 0; k < keymap::kMaxComboKeys; ++k) {
+        if (combo.keys[k] != keymap::kNoKey) {
+          want |= 1 << k;
+          ++keys;
+        }
+      }
+      if (keys < 2 || !combo_bit(combo, head.key)) {
+        continue;
+      }
+
+      // Collect the keys that were pressed in time, stopping at a key
+      // that isn't part of the combo or at the release of one that is
+      u8 have = 0;
+      bool open = true;
+      for (u8 i = 0; i < count_ && have != want; ++i) {
+        auto& event = queue_[i];
+        u8 bit = combo_bit(combo, event.key);
+        if (!event.pressed && !bit) {
+          continue;
+        }
+        if (!event.pressed || !bit || event.at - head.at > kComboTicks) {
+          open = false;
+          break;
+        }
+        have |= bit;
+      }
+
+      if (have == want) {
+        if (keys > best_keys) {
+          best = combo;
+          best_index = index;
+          best_keys = keys;
+        }
+      } else if (open && !force && now - head.at < kComboTicks && keys > wait_keys) {
+        wait_keys = keys;
+      }
+    }
+
+    if (wait_keys > best_keys) {
+      wait(head.at + kComboTicks);
+      return Match::Wait;
+    }
+    if (best_keys == 0) {
+      return Match::None;
+    }
+
+    // Like a single key, a combo that finds no room for its keys in the
+    // Held array is ignored along with its release
+    bool room = held_count_ + best_keys <= Held;
+    if (room && best.action != keymap::kNoAction) {
+      emit(best.action, true);
+    }
+    for (u8 k = 0; k < keymap::kMaxComboKeys; ++k) {
+      u8 key = best.keys[k];
+      if (key == keymap::kNoKey) {
+        continue;
+      }
+      if (room) {
+        held_[held_count_++] = Down{key, best_index, best.action};
+      }
+      for (u8 i = 0; i < count_; ++i) {
+        if (queue_[i].key == key && queue_[i].pressed) {
+          remove(i);
+          break;
+        }
+      }
+    }
+    return Match::Fired;
+  }
+
+  template <typename Emit>
+  void press(u8 key, u8 combo, keymap::Action action, Emit& emit) {
+    if (action == keymap::kNoAction || held_count_ == Held) {
+      return;
+    }
+    held_[held_count_++] = Down{key, combo, action};
+    emit(action, true);
+  }
+
+  template <typename Emit>
+  void release(u8 key, Emit& emit) {
+    for (u8 i = 0; i < held_count_; ++i) {
+      if (held_[i].key != key) {
+        continue;
+      }
+      auto down = held_[i];
+      held_[i] = held_[--held_count_];
+      if (down.action == keymap::kNoAction) {
+        return;
+      }
+      emit(down.action, false);
+      if (down.combo) {
+        // The first key of a combo to be released ends it
+        for (u8 j = 0; j < held_count_; ++j) {
+          if (held_[j].combo == down.combo) {
+            held_[j].action = keymap::kNoAction;
+          }
+        }
+      }
+      return;
+    }
+  }
+
+  void remove(u8 idx) {
+    --count_;
+    for (u8 i = idx; i < count_; ++i) {
+      queue_[i] = queue_[i + 1];
+    }
+  }
+
+  void wait(u32 deadline) {
+    waiting_ = true;
+    deadline_ = deadline;
+  }
+
+  Combos combos_;
+  Event queue_[Pending];
+  u8 count_{0};
+  u8 seq_{0};
+  Down held_[Held];
+  u8 held_count_{0};
+  bool waiting_{false};
+  u32 deadline_{0};
+};
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "flutterby/EventLoop.h"
+#include "flutterby/HwTimer.h"
+
+/** Timer1 is the system timebase.
+ *
+ * It counts freely from 0 to 0xffff at kTicksPerSecond, so that
+ * several users can share it:
+ *
+ * - The event loop schedules its ticks with compare A, advancing
+ *   the compare value by kTickInterval each time.
+ * - The overflow interrupt counts wraps so that now() can extend the
+ *   count to 32 bits; InputCapture and PROFILE_SCOPE use that.
+ * - InputCapture timestamps edges on the ICP1 pin.
+ *
+ * The prescaler is the finest one that lets kTickInterval fit in
+ * 16 bits: F_CPU/8 for an 8MHz clock, giving 1us ticks.
+ */
+
+namespace flutterby {
+namespace timebase {
+
+using Timer = HwTimer<1>;
+using TickPeriod = Timer::Period<1000000 / eventloop::kTimerHz>;
+
+static constexpr u32 kTicksPerSecond =
+    F_CPU / TickPeriod::kSelection.divisor;
+
+// Number of timer ticks between event loop ticks
+static constexpr u16 kTickInterval = TickPeriod::kTop + 1;
+
+/** Converts a duration in microseconds to ticks, for comparing
+ * with differences of now() */
+constexpr u32 us_to_ticks(u32 us) {
+  return u32(uint64_t(us) * kTicksPerSecond / 1000000);
+}
+
+/** Start Timer1, unless it is already running, and enable the
+ * event loop tick and overflow interrupts */
+void start();
+
+/** Returns the time since the timebase started, in ticks.
+ * This wraps around every 2^32 ticks; compute differences with
+ * unsigned arithmetic and they remain correct across the wrap. */
+u32 now();
+
+/** Extends a 16-bit count that was read from Timer1 to 32 bits.
+ * Must be called with interrupts disabled, promptly after reading
+ * the count.  Intended for use in the Timer1 ISRs. */
+u32 extend(u16 count);
+}
+}
@@ -0,0 +1,169 @@
+#pragma once
+#include "flutterby/CriticalSection.h"
+#include "flutterby/Serial0.h"
+#include "flutterby/SmallestInteger.h"
+#include "flutterby/Types.h"
+
+/** Deferred binary trace logging.
+ *
+ * TRACE() is an alternative to DBG()/TXSER() for hot paths.  Rather
+ * than formatting text on the target, each call site sends a 16-bit
+ * ID followed by the raw little endian bytes of its arguments:
+ *
+ * ```
+ * TRACE("key {} went down after {} ticks", key, ticks);
+ * ```
+ *
+ * emits 2 + sizeof(key) + sizeof(ticks) bytes.  The format string
+ * never reaches flash or the wire; it is recorded along with the ID,
+ * the argument types and the source location in the non-loaded
+ * .flutterby_trace ELF section.  target/tracedump (and simrunner,
+ * which decodes USART0 output on the fly) read that table back out
+ * of the ELF to reconstruct the messages.
+ *
+ * Each {} in the format is replaced by the next argument in decimal;
+ * use {:x} for hex.  Arguments must be integers (cast enums and
+ * pointers) and there may be at most 8 of them.  The format must be
+ * a plain string literal without quotes, backslashes or % signs,
+ * because it is pasted into an assembler directive.
+ *
+ * Output goes to FLUTTERBY_TRACE_SINK, which defaults to the Serial0
+ * transmit buffer.  A sink provides a static space() that returns the
+ * number of bytes it can queue, and an operator() that queues a byte
+ * without waiting.  A record that doesn't fit in the sink is dropped
+ * whole and counted by trace::take_overruns(), so TRACE() never waits
+ * for the wire.  Define FLUTTERBY_TRACE=0 to compile all TRACE() calls
+ * out; their arguments are then not evaluated.
+ */
+
+#ifndef FLUTTERBY_TRACE
+#define FLUTTERBY_TRACE 1
+#endif
+
+#ifndef FLUTTERBY_TRACE_SINK
+#define FLUTTERBY_TRACE_SINK ::flutterby::trace::Serial0Sink
+#endif
+
+namespace flutterby {
+namespace trace {
+
+/** The default sink: queues into the Serial0 transmit buffer */
+struct Serial0Sink {
+  static u8 space() {
+    return Serial0::tx_space();
+  }
+
+  void operator()(u8 b) {
+    Serial0::write_byte(b);
+  }
+};
+
+/** Counts a record that was dropped because the sink was full */
+void overrun();
+
+/** Returns the number of records that were dropped because the sink
+ * was full, and resets the count */
+u8 take_overruns();
+
+/** Computes the ID of a call site by hashing its location.
+ * The hash is 32-bit FNV-1a folded down to 16 bits.  Collisions are
+ * possible (though unlikely); tracedump reports any that it finds. */
+constexpr u16 make_id(const char* file, u16 line) {
+  u32 hash = 2166136261UL;
+  while (*file) {
+    hash = (hash ^ u8(*file++)) * 16777619UL;
+  }
+  hash = (hash ^ u8(line)) * 16777619UL;
+  hash = (hash ^ u8(line >> 8)) * 16777619UL;
+  return u16(hash ^ (hash >> 16));
+}
+
+/** The type code for a single argument: the low 3 bits hold its
+ * size in bytes and bit 3 is set if it is signed */
+template <typename T>
+constexpr u8 type_code() {
+  static_assert(
+      numeric_traits<T>::is_integral,
+      "TRACE arguments must be integers; cast enums and pointers");
+  static_assert(sizeof(T) <= 4, "TRACE arguments must fit in 32 bits");
+  return u8(sizeof(T)) | (numeric_traits<T>::is_signed ? 0x8 : 0);
+}
+
+/** The signature of a call site packs one type code per nibble, with
+ * the first argument in the least significant nibble.  A zero nibble
+ * terminates the list. */
+template <typename... Args>
+struct Signature {
+  static_assert(sizeof...(Args) <= 8, "TRACE supports at most 8 arguments");
+
+  static constexpr u32 value() {
+    u32 sig = 0;
+    u8 shift = 0;
+    ((sig |= u32(type_code<Args>()) << shift, shift += 4), ...);
+    return sig;
+  }
+};
+
+/** Only used in unevaluated context to deduce the signature */
+template <typename... Args>
+Signature<typename remove_cv<typename remove_reference<Args>::type>::type...>
+signature_of(Args&&...);
+
+template <typename Sink, typename T>
+inline void put(Sink& sink, T value) {
+  auto bits = typename numeric_traits<T>::unsigned_type(value);
+  for (u8 i = 0; i < sizeof(T); ++i) {
+    sink(u8(bits));
+    bits >>= 8;
+  }
+}
+
+/** Send a trace record, or drop it if the sink can't take all of it.
+ * Interrupts are masked while the record is queued so that a trace
+ * from an ISR can't split it; queueing never waits, so that is brief. */
+template <typename... Args>
+void emit(u16 id, Args... args) {
+  static constexpr u8 kSize = sizeof(id) + (0 + ... + sizeof(Args));
+  FLUTTERBY_TRACE_SINK sink;
+  CriticalSection cs;
+  if (sink.space() < kSize) {
+    overrun();
+    return;
+  }
+  put(sink, id);
+  (put(sink, args), ...);
+}
+}
+}
+
+#if FLUTTERBY_TRACE
+// Record the call site in the table and emit the record.  The
+// .flutterby_trace section has no flags, so it is kept in the ELF
+// but not loaded into flash.  Each entry is laid out as:
+//   u16 id, u32 signature, u16 line, file (NUL terminated),
+//   format (NUL terminated)
+// The entry is repeated if the call site is inlined; tracedump
+// ignores the duplicates.
+#define TRACE(fmt, ...)                                                   \
+  do {                                                                    \
+    constexpr ::flutterby::u16 _trace_id =                                \
+        ::flutterby::trace::make_id(__FILE__, __LINE__);                  \
+    using _trace_sig = decltype(                                          \
+        ::flutterby::trace::signature_of(__VA_ARGS__));                   \
+    __asm__ __volatile__(                                                 \
+        ".pushsection .flutterby_trace,\"\",@progbits\n\t"                \
+        ".short %0\n\t"                                                   \
+        ".long %1\n\t"                                                    \
+        ".short %2\n\t"                                                   \
+        ".asciz \"" __FILE__ "\"\n\t"                                     \
+        ".asciz \"" fmt "\"\n\t"                                          \
+        ".popsection" ::"i"(_trace_id),                                   \
+        "i"(_trace_sig::value()),                                         \
+        "i"(__LINE__));                                                   \
+    ::flutterby::trace::emit(_trace_id, ##__VA_ARGS__);                   \
+  } while (0)
+#else
+#define TRACE(fmt, ...) \
+  do {                  \
+  } while (0)
+#endif
@@ -0,0 +1,108 @@
+#pragma once
+#include "avr_autogen.h"
+#include "flutterby/Types.h"
+
+/** USB device stack for parts with the USB device controller found in
+ * the atmega32u4 family, presenting a HID keyboard.
+ *
+ * The device has two keyboard interfaces:
+ *
+ * - interface 0 is a boot protocol keyboard with the usual 8 byte report
+ *   (modifiers, reserved, 6 key codes) on endpoint 1.  BIOSes and boot
+ *   loaders only talk to this interface.
+ * - interface 1 reports every key as one bit of a bitmap (NKRO) on
+ *   endpoint 2, so any number of keys can be held at once.
+ *
+ * Both endpoints are polled by the host every 1ms.  Keys are reported
+ * through the NKRO interface unless it has been disabled with
+ * set_nkro(false) or the host has selected the boot protocol; the other
+ * interface reports no keys.
+ *
+ * The reports are kept up to date incrementally by key() and a report is
+ * queued for the host only when it has changed.  The endpoint has a
+ * single bank: the report loaded into it is sent at the next poll, and
+ * any changes made while it is waiting are sent together in the poll
+ * after that.  A key that is pressed and released within that time
+ * would never be seen by the host, so its release is held back until
+ * the press has been loaded into a report.
+ *
+ * Everything is driven from the USB interrupts, so the firmware only
+ * needs to call attach() and then key() as keys change:
+ *
+ * ```
+ * usb::attach();
+ * matrix.scan([](KeyEvent e) {
+ *   auto action = layers.resolve(MyKeymap, e.row, e.col, e.pressed);
+ *   if (keymap::kind(action) == keymap::Kind::Key) {
+ *     usb::key(keymap::arg(action), e.pressed);
+ *   }
+ * });
+ * ```
+ *
+ * The vendor and product ids default to the V-USB shared ids for
+ * keyboards; define FLUTTERBY_USB_VID and FLUTTERBY_USB_PID when building
+ * the library to change them.
+ */
+
+#ifdef HAVE_AVR_USB
+namespace flutterby {
+namespace usb {
+
+static constexpr u8 kControlSize = 32;
+static constexpr u8 kBootEndpoint = 1;
+static constexpr u8 kNkroEndpoint = 2;
+static constexpr u8 kBootReportSize = 8;
+// One bit for each usage from 0x00 to 0xdf, after the modifiers byte
+static constexpr u8 kNkroBitmapSize = 0xe0 / 8;
+static constexpr u8 kNkroReportSize = 1 + kNkroBitmapSize;
+// Usages 0-3 are reserved for "no event" and the error codes
+static constexpr u8 kFirstKey = 0x04;
+
+/** Power up the USB controller and attach to the bus.  Enumeration
+ * happens in the background; configured() reports when it is done. */
+void attach();
+
+/** Detach from the bus and power the USB controller down */
+void detach();
+
+/** Returns true once the host has configured the device */
+bool configured();
+
+/** Returns true if the host has selected the boot protocol */
+bool boot_protocol();
+
+/** Returns the keyboard LEDs as last set by the host; bit 0 is num
+ * lock, bit 1 caps lock, bit 2 scroll lock */
+u8 leds();
+
+/** Choose whether keys are reported through the NKRO interface, when
+ * the host allows it.  Defaults to true. */
+void set_nkro(bool enable);
+
+/** Press or release the key with the given HID keyboard usage.
+ * 0xe0-0xe7 are the modifiers.  A report is queued if this changes the
+ * state of the key.  Usages below kFirstKey or above 0xe7 aren't keys
+ * and are ignored.
+ *
+ * A release that arrives before the press has been loaded into a report
+ * is held back until it has, so that a press and release made within
+ * one poll interval are reported as two reports.  Pressing the key again
+ * before then cancels that release, so a double tap that fast is
+ * reported as a single press. */
+void key(u8 usage, bool pressed);
+
+/** Release every key */
+void release_all();
+
+/** Returns the number of keyboard reports loaded for the host since
+ * attach() */
+u16 reports_sent();
+
+/** Copies the report that the endpoint would send if it were loaded
+ * now into dest, which must have room for kBootReportSize or
+ * kNkroReportSize bytes.  The endpoint that isn't in use reports that
+ * nothing is pressed. */
+void copy_report(u8 endpoint, u8* dest);
+}
+}
+#endif
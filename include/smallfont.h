@@ -136,7 +136,7 @@
 #define _XXXXX_X 0x7d // 125
 #define _XXXXXX_ 0x7e // 126
 #define _XXXXXXX 0x7f // 127
-const uint8_t LETTERS[][5] __attribute__((progmem)) = {
+constexpr uint8_t LETTERS[][5] __attribute__((progmem)) = {
     // Space
     {
         ________,
@@ -995,7 +995,7 @@ const uint8_t LETTERS[][5] __attribute__((progmem)) = {
     },
 };
 
-const uint8_t GRAPHIC[][5] __attribute__((progmem)) = {
+constexpr uint8_t GRAPHIC[][5] __attribute__((progmem)) = {
     // Blank?
     {
         ________,
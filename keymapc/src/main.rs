@@ -0,0 +1,498 @@
+//! Compiles a textual keymap into the packed flash table used by
+//! flutterby/Keymap.h.
+//!
+//! ```text
+//! # A 2x3 board
+//! name MyKeymap
+//! rows 2
+//! cols 3
+//!
+//! layer base
+//!   A     B     MO(fn)
+//!   C     D     E
+//!
+//! layer fn
+//!   1     ____  ____
+//!   ____  NO    TG(nav)
+//!
+//! layer nav
+//!   F1    ____  ____
+//!   ____  ____  ____
+//! ```
+//!
+//! Each layer lists one line per row and one key per column.  Keys are
+//! HID keyboard usage names (`A`, `ENTER`, `LSFT`, `F1`, ...), `____` or
+//! `TRNS` for a transparent key, `NO` or `XXXX` for a key that does
+//! nothing, `MO(layer)` and `TG(layer)` for the layer actions (by layer
+//! name or number), `MT(mod,key)` and `LT(layer,key)` for dual role keys
+//! that send key when tapped and hold a modifier or layer, or a raw
+//! action code such as `0x1001`.
+
+use std::env;
+use std::fs::File;
+use std::io::{Read, Write};
+use std::process;
+
+const TRANSPARENT: u16 = 0x0001;
+const KIND_MOMENTARY: u16 = 0x10;
+const KIND_TOGGLE: u16 = 0x11;
+const KIND_MOD_TAP: u16 = 0x20;
+const KIND_LAYER_TAP: u16 = 0x40;
+
+struct Layer {
+    name: String,
+    // The source line number and keys of each row
+    keys: Vec<(usize, Vec<String>)>,
+    line: usize,
+}
+
+struct KeymapSource {
+    name: String,
+    rows: usize,
+    cols: usize,
+    layers: Vec<Layer>,
+}
+
+/// Returns the HID keyboard usage (page 0x07) for a key name
+fn usage(name: &str) -> Option<u8> {
+    let bytes = name.as_bytes();
+    if bytes.len() == 1 {
+        let c = bytes[0];
+        if c >= b'A' && c <= b'Z' {
+            return Some(0x04 + (c - b'A'));
+        }
+        if c == b'0' {
+            return Some(0x27);
+        }
+        if c >= b'1' && c <= b'9' {
+            return Some(0x1e + (c - b'1'));
+        }
+    }
+    if name.starts_with('F') {
+        if let Ok(n) = name[1..].parse::<u8>() {
+            match n {
+                1..=12 => return Some(0x3a + n - 1),
+                13..=24 => return Some(0x68 + n - 13),
+                _ => {}
+            }
+        }
+    }
+    let code = match name {
+        "ENTER" | "ENT" => 0x28,
+        "ESC" => 0x29,
+        "BSPC" => 0x2a,
+        "TAB" => 0x2b,
+        "SPACE" | "SPC" => 0x2c,
+        "MINUS" => 0x2d,
+        "EQUAL" => 0x2e,
+        "LBRC" => 0x2f,
+        "RBRC" => 0x30,
+        "BSLS" => 0x31,
+        "NUHS" => 0x32,
+        "SCLN" => 0x33,
+        "QUOT" => 0x34,
+        "GRV" => 0x35,
+        "COMM" => 0x36,
+        "DOT" => 0x37,
+        "SLSH" => 0x38,
+        "CAPS" => 0x39,
+        "PSCR" => 0x46,
+        "SLCK" => 0x47,
+        "PAUS" => 0x48,
+        "INS" => 0x49,
+        "HOME" => 0x4a,
+        "PGUP" => 0x4b,
+        "DEL" => 0x4c,
+        "END" => 0x4d,
+        "PGDN" => 0x4e,
+        "RGHT" => 0x4f,
+        "LEFT" => 0x50,
+        "DOWN" => 0x51,
+        "UP" => 0x52,
+        "NLCK" => 0x53,
+        "NUBS" => 0x64,
+        "APP" => 0x65,
+        "LCTL" => 0xe0,
+        "LSFT" => 0xe1,
+        "LALT" => 0xe2,
+        "LGUI" => 0xe3,
+        "RCTL" => 0xe4,
+        "RSFT" => 0xe5,
+        "RALT" => 0xe6,
+        "RGUI" => 0xe7,
+        _ => return None,
+    };
+    Some(code)
+}
+
+fn parse_number(text: &str) -> Option<u32> {
+    if text.starts_with("0x") {
+        u32::from_str_radix(&text[2..], 16).ok()
+    } else {
+        text.parse::<u32>().ok()
+    }
+}
+
+/// Resolves a layer reference, either its name or its number
+fn layer_index(keymap: &KeymapSource, name: &str) -> Result<u16, String> {
+    if let Some(idx) = keymap.layers.iter().position(|l| l.name == name) {
+        return Ok(idx as u16);
+    }
+    match parse_number(name) {
+        Some(idx) if (idx as usize) < keymap.layers.len() => Ok(idx as u16),
+        _ => Err(format!("unknown layer {}", name)),
+    }
+}
+
+/// Compiles `MT(mod,key)` or `LT(layer,key)`; the modifier or layer is
+/// packed into the low bits of the kind
+fn dual_role(keymap: &KeymapSource, kind: &str, args: &str) -> Result<u16, String> {
+    let mut parts = args.splitn(2, ',');
+    let (hold, tap) = match (parts.next(), parts.next()) {
+        (Some(hold), Some(tap)) => (hold, tap),
+        _ => return Err(format!("{} needs two arguments", kind)),
+    };
+    let tap = usage(tap).ok_or_else(|| format!("unknown key {}", tap))? as u16;
+    if kind == "MT" {
+        match usage(hold) {
+            Some(code) if code >= 0xe0 => {
+                Ok((KIND_MOD_TAP | (code as u16 - 0xe0)) << 8 | tap)
+            }
+            _ => Err(format!("{} is not a modifier", hold)),
+        }
+    } else {
+        let layer = layer_index(keymap, hold)?;
+        if layer > 0x1f {
+            return Err(format!("layer {} is too high for LT", hold));
+        }
+        Ok((KIND_LAYER_TAP | layer) << 8 | tap)
+    }
+}
+
+/// Compiles one key of the keymap to its action code
+fn action(keymap: &KeymapSource, key: &str) -> Result<u16, String> {
+    match key {
+        "____" | "TRNS" => return Ok(TRANSPARENT),
+        "NO" | "XXXX" => return Ok(0),
+        _ => {}
+    }
+    if key.ends_with(')') {
+        if let Some(open) = key.find('(') {
+            let args = &key[open + 1..key.len() - 1];
+            let kind = match &key[..open] {
+                "MO" => KIND_MOMENTARY,
+                "TG" => KIND_TOGGLE,
+                "MT" | "LT" => return dual_role(keymap, &key[..open], args),
+                other => return Err(format!("unknown layer action {}", other)),
+            };
+            let layer = layer_index(keymap, args)?;
+            return Ok(kind << 8 | layer);
+        }
+    }
+    if key.starts_with("0x") {
+        return match parse_number(key) {
+            Some(code) if code <= 0xffff => Ok(code as u16),
+            _ => Err(format!("invalid action code {}", key)),
+        };
+    }
+    usage(key)
+        .map(|code| code as u16)
+        .ok_or_else(|| format!("unknown key {}", key))
+}
+
+fn parse_dimension(value: Option<&str>, line: usize) -> Result<usize, String> {
+    match value.and_then(parse_number) {
+        Some(n) if n > 0 && n <= 255 => Ok(n as usize),
+        _ => Err(format!("line {}: expected a size between 1 and 255", line)),
+    }
+}
+
+fn parse(text: &str) -> Result<KeymapSource, String> {
+    let mut keymap = KeymapSource {
+        name: "Keymap".to_owned(),
+        rows: 0,
+        cols: 0,
+        layers: Vec::new(),
+    };
+
+    for (idx, line) in text.lines().enumerate() {
+        let line_no = idx + 1;
+        let line = match line.find('#') {
+            Some(pos) => &line[..pos],
+            None => line,
+        };
+        let mut words = line.split_whitespace();
+        let first = match words.next() {
+            Some(word) => word,
+            None => continue,
+        };
+        match first {
+            "name" => {
+                keymap.name = words
+                    .next()
+                    .ok_or_else(|| format!("line {}: expected a name", line_no))?
+                    .to_owned();
+            }
+            "rows" => keymap.rows = parse_dimension(words.next(), line_no)?,
+            "cols" => keymap.cols = parse_dimension(words.next(), line_no)?,
+            "layer" => {
+                let name = words
+                    .next()
+                    .ok_or_else(|| format!("line {}: expected a layer name", line_no))?;
+                if keymap.layers.iter().any(|l| l.name == name) {
+                    return Err(format!("line {}: duplicate layer {}", line_no, name));
+                }
+                keymap.layers.push(Layer {
+                    name: name.to_owned(),
+                    keys: Vec::new(),
+                    line: line_no,
+                });
+            }
+            _ => {
+                let cols = keymap.cols;
+                let layer = keymap
+                    .layers
+                    .last_mut()
+                    .ok_or_else(|| format!("line {}: keys outside of a layer", line_no))?;
+                let row: Vec<String> = line.split_whitespace().map(|s| s.to_owned()).collect();
+                if row.len() != cols {
+                    return Err(format!(
+                        "line {}: expected {} keys but found {}",
+                        line_no,
+                        cols,
+                        row.len()
+                    ));
+                }
+                layer.keys.push((line_no, row));
+            }
+        }
+    }
+
+    if keymap.rows == 0 || keymap.cols == 0 {
+        return Err("rows and cols must be set before the first layer".to_owned());
+    }
+    if keymap.layers.is_empty() {
+        return Err("no layers were defined".to_owned());
+    }
+    if keymap.layers.len() > 32 {
+        return Err("at most 32 layers are supported".to_owned());
+    }
+    for layer in &keymap.layers {
+        if layer.keys.len() != keymap.rows {
+            return Err(format!(
+                "line {}: layer {} has {} rows but expected {}",
+                layer.line,
+                layer.name,
+                layer.keys.len(),
+                keymap.rows
+            ));
+        }
+    }
+    Ok(keymap)
+}
+
+fn generate(keymap: &KeymapSource, source_name: &str) -> Result<String, String> {
+    let mut out = String::new();
+    out.push_str(&format!(
+        "// Generated by keymapc from {}; do not edit\n#pragma once\n#include \"flutterby/Keymap.h\"\n\n",
+        source_name
+    ));
+
+    out.push_str(&format!("namespace {}Layer {{\n", keymap.name));
+    for (idx, layer) in keymap.layers.iter().enumerate() {
+        out.push_str(&format!(
+            "static constexpr uint8_t {} = {};\n",
+            layer.name, idx
+        ));
+    }
+    out.push_str("}\n\n");
+
+    out.push_str(&format!(
+        "const flutterby::Keymap<{}, {}, {}> {} __attribute__((progmem))({{\n",
+        keymap.layers.len(),
+        keymap.rows,
+        keymap.cols,
+        keymap.name
+    ));
+    for (idx, layer) in keymap.layers.iter().enumerate() {
+        out.push_str(&format!("    // layer {}: {}\n", idx, layer.name));
+        for &(line_no, ref row) in &layer.keys {
+            out.push_str("   ");
+            for key in row {
+                let code = action(keymap, key)
+                    .map_err(|err| format!("line {}: {}", line_no, err))?;
+                out.push_str(&format!(" {:#06x},", code));
+            }
+            out.push('\n');
+        }
+    }
+    out.push_str("});\n");
+    Ok(out)
+}
+
+fn run(input_file_name: &str, output_file_name: &str) -> Result<(), String> {
+    let mut text = String::new();
+    File::open(input_file_name)
+        .and_then(|mut f| f.read_to_string(&mut text))
+        .map_err(|err| format!("{}: {}", input_file_name, err))?;
+
+    let keymap = parse(&text).map_err(|err| format!("{}: {}", input_file_name, err))?;
+    let header = generate(&keymap, input_file_name)
+        .map_err(|err| format!("{}: {}", input_file_name, err))?;
+
+    File::create(output_file_name)
+        .and_then(|mut f| f.write_all(header.as_bytes()))
+        .map_err(|err| format!("{}: {}", output_file_name, err))
+}
+
+fn main() {
+    let input_file_name = env::args()
+        .nth(1)
+        .expect("name of keymap file as first argument");
+    let output_file_name = env::args()
+        .nth(2)
+        .expect("name of dest file as second argument");
+    if let Err(err) = run(&input_file_name, &output_file_name) {
+        eprintln!("{}", err);
+        process::exit(1);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const EXAMPLE: &str = "
+# A 2x3 board
+name MyKeymap
+rows 2
+cols 3
+
+layer base
+  A     B     MO(fn)
+  C     D     E
+
+layer fn
+  1     ____  ____
+  ____  NO    TG(nav)
+
+layer nav
+  F1    ____  ____
+  ____  ____  ____
+";
+
+    fn action_of(key: &str) -> Result<u16, String> {
+        action(&parse(EXAMPLE).unwrap(), key)
+    }
+
+    fn parse_err(text: &str) -> String {
+        match parse(text) {
+            Ok(_) => panic!("expected an error"),
+            Err(err) => err,
+        }
+    }
+
+    #[test]
+    fn usages() {
+        assert_eq!(usage("A"), Some(0x04));
+        assert_eq!(usage("Z"), Some(0x1d));
+        assert_eq!(usage("1"), Some(0x1e));
+        assert_eq!(usage("0"), Some(0x27));
+        assert_eq!(usage("F1"), Some(0x3a));
+        assert_eq!(usage("F12"), Some(0x45));
+        assert_eq!(usage("F13"), Some(0x68));
+        assert_eq!(usage("SPC"), Some(0x2c));
+        assert_eq!(usage("RGUI"), Some(0xe7));
+        assert_eq!(usage("F25"), None);
+        assert_eq!(usage("a"), None);
+    }
+
+    #[test]
+    fn actions() {
+        assert_eq!(action_of("____"), Ok(TRANSPARENT));
+        assert_eq!(action_of("TRNS"), Ok(TRANSPARENT));
+        assert_eq!(action_of("NO"), Ok(0));
+        assert_eq!(action_of("ENTER"), Ok(0x28));
+        assert_eq!(action_of("MO(fn)"), Ok(0x1001));
+        assert_eq!(action_of("TG(2)"), Ok(0x1102));
+        assert_eq!(action_of("MT(LSFT,A)"), Ok(0x2104));
+        assert_eq!(action_of("LT(nav,SPC)"), Ok(0x422c));
+        assert_eq!(action_of("0x1234"), Ok(0x1234));
+    }
+
+    #[test]
+    fn action_errors() {
+        assert_eq!(action_of("FOO"), Err("unknown key FOO".to_owned()));
+        assert_eq!(action_of("TG(3)"), Err("unknown layer 3".to_owned()));
+        assert_eq!(action_of("MO(gaming)"), Err("unknown layer gaming".to_owned()));
+        assert_eq!(action_of("XX(fn)"), Err("unknown layer action XX".to_owned()));
+        assert_eq!(action_of("MT(A,B)"), Err("A is not a modifier".to_owned()));
+        assert_eq!(action_of("MT(LSFT)"), Err("MT needs two arguments".to_owned()));
+        assert_eq!(action_of("LT(fn,FOO)"), Err("unknown key FOO".to_owned()));
+        assert_eq!(action_of("0x10000"), Err("invalid action code 0x10000".to_owned()));
+    }
+
+    #[test]
+    fn parses_layers() {
+        let keymap = parse(EXAMPLE).unwrap();
+        assert_eq!(keymap.name, "MyKeymap");
+        assert_eq!(keymap.rows, 2);
+        assert_eq!(keymap.cols, 3);
+        let names: Vec<&str> = keymap.layers.iter().map(|l| l.name.as_str()).collect();
+        assert_eq!(names, vec!["base", "fn", "nav"]);
+        assert_eq!(keymap.layers[1].line, 11);
+        let (line, ref keys) = keymap.layers[1].keys[1];
+        assert_eq!(line, 13);
+        assert_eq!(keys, &["____", "NO", "TG(nav)"]);
+    }
+
+    #[test]
+    fn parse_errors() {
+        assert_eq!(
+            parse_err("rows 1\ncols 2\nlayer a\n  A\n"),
+            "line 4: expected 2 keys but found 1"
+        );
+        assert_eq!(
+            parse_err("rows 2\ncols 1\nlayer a\n  A\n"),
+            "line 3: layer a has 1 rows but expected 2"
+        );
+        assert_eq!(
+            parse_err("rows 1\ncols 1\nlayer a\n  A\nlayer a\n  B\n"),
+            "line 5: duplicate layer a"
+        );
+        assert_eq!(parse_err("rows 1\ncols 1\n  A\n"), "line 3: keys outside of a layer");
+        assert_eq!(
+            parse_err("rows 0\n"),
+            "line 1: expected a size between 1 and 255"
+        );
+        assert_eq!(
+            parse_err("cols 1\nlayer a\n  A\n"),
+            "rows and cols must be set before the first layer"
+        );
+        assert_eq!(parse_err("rows 1\ncols 1\n"), "no layers were defined");
+        assert_eq!(parse_err("name\n"), "line 1: expected a name");
+    }
+
+    #[test]
+    fn generates_table() {
+        let header = generate(&parse(EXAMPLE).unwrap(), "my.keymap").unwrap();
+        assert!(header.starts_with("// Generated by keymapc from my.keymap; do not edit\n"));
+        assert!(header.contains("static constexpr uint8_t nav = 2;\n"));
+        assert!(header.contains(
+            "const flutterby::Keymap<3, 2, 3> MyKeymap __attribute__((progmem))({\n\
+             \x20   // layer 0: base\n\
+             \x20   0x0004, 0x0005, 0x1001,\n\
+             \x20   0x0006, 0x0007, 0x0008,\n\
+             \x20   // layer 1: fn\n\
+             \x20   0x001e, 0x0001, 0x0001,\n\
+             \x20   0x0001, 0x0000, 0x1102,\n"
+        ));
+    }
+
+    #[test]
+    fn generate_reports_the_line() {
+        let keymap = parse("rows 1\ncols 1\nlayer a\n  FOO\n").unwrap();
+        let err = generate(&keymap, "x").unwrap_err();
+        assert_eq!(err, "line 4: unknown key FOO");
+    }
+}
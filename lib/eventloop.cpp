@@ -2,13 +2,14 @@
 #include "flutterby/EventLoop.h"
 #include "flutterby/Future.h"
 #include "flutterby/Sleep.h"
-#include "flutterby/Timer1.h"
+#include "flutterby/Timebase.h"
 
 namespace flutterby {
 
 namespace eventloop {
 TimerBase* TIMERS = nullptr;
 volatile u16 TICKS = 0;
+static SleepMode IDLE_SLEEP_MODE = SleepMode::Idle;
 }
 
 TimerBase::~TimerBase() {}
@@ -61,19 +62,28 @@ namespace eventloop {
 
 IRQ_TIMER1_COMPA {
 //  DBG() << "COMPA:"_P << TICKS;
+  // The timer runs freely; schedule the next tick
+  timebase::Timer::set_compare<0>(
+      timebase::Timer::compare<0>() + timebase::kTickInterval);
   ++TICKS;
   set_event_pending();
 }
 
 static void setup_timer() {
-  Timer1::configure(
-      Timer1::WaveformGenerationMode::ClearOnTimerMatchOutputCompare,
-      1000000 / kTimerHz);
+  timebase::start();
   // Some bootloaders let us get this far without interrupts enabled;
   // ensure that they are turned on for the remainder of operation
   __builtin_avr_sei();
 }
 
+void set_idle_sleep_mode(SleepMode mode) {
+  IDLE_SLEEP_MODE = mode;
+}
+
+SleepMode idle_sleep_mode() {
+  return IDLE_SLEEP_MODE;
+}
+
 void run_forever() {
   setup_timer();
 
@@ -96,7 +106,7 @@ void run_forever() {
       continue;
     }
 
-    wait_for_event(SleepMode::Idle);
+    wait_for_event(IDLE_SLEEP_MODE);
   }
 
 #ifdef HAVE_SIMAVR
@@ -104,9 +114,45 @@ void run_forever() {
   // the test harness to loop.  If we do somehow get here in a real device then
   // we want to allow the interrupt to reset the device so let's only do this
   // when building for the simulator
-  Timer1::configure(
-      Timer1::ClockSource::None, Timer1::WaveformGenerationMode::Normal);
+  timebase::Timer::stop();
 #endif
 }
 }
+
+namespace timebase {
+
+// The upper 16 bits of now()
+static volatile u16 OVERFLOWS = 0;
+
+IRQ_TIMER1_OVF {
+  OVERFLOWS = OVERFLOWS + 1;
+}
+
+void start() {
+  if (!Timer::running()) {
+    OVERFLOWS = 0;
+    // Normal mode leaves OCR1A alone, so set the compare value
+    // ourselves: the first tick is due when the count reaches kTop
+    Timer::configure(TickPeriod::kClockSelect, timer::Waveform::Normal);
+    Timer::set_compare<0>(TickPeriod::kTop);
+  }
+  Timer::enable_interrupts(timer::kCompareABit | timer::kOverflowBit);
+}
+
+u32 extend(u16 count) {
+  u16 overflows = OVERFLOWS;
+  // If the timer has wrapped but the overflow ISR hasn't run yet then
+  // the overflow flag is still set; a small count means that it was
+  // read after the wrap and must include that overflow.
+  if ((timer::reg8(TimerDesc<1>::kTifr) & timer::kOverflowBit) &&
+      count < 0x8000) {
+    ++overflows;
+  }
+  return (u32(overflows) << 16) | count;
+}
+
+u32 now() {
+  return interrupt_free([]() { return extend(Timer::count()); });
+}
+}
 }
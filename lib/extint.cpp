@@ -0,0 +1,88 @@
+#include "flutterby/PinChange.h"
+#include "flutterby/CriticalSection.h"
+#include "flutterby/Sleep.h"
+
+#ifdef HAVE_AVR_EXTINT
+namespace flutterby {
+namespace extint {
+
+// The edges seen on each INTn since they were last taken
+static volatile u8 RISEN = 0;
+static volatile u8 FELL = 0;
+// The INTn lines that report both edges; the ISR reads the pin to
+// find out which one it was
+static u8 BOTH = 0;
+static u8 RISING_ONLY = 0;
+static const volatile u8* PIN[ExtIntDesc::kCount];
+static u8 MASK[ExtIntDesc::kCount];
+
+static inline volatile u8& reg8(u16 addr) {
+  return *reinterpret_cast<volatile u8*>(addr);
+}
+
+// Each IRQ_INTn handler is in its own extintN.cpp; see link_vector()
+void edge(u8 n) {
+  u8 bit = 1 << n;
+  bool rising = (BOTH & bit) ? (*PIN[n] & MASK[n]) != 0 : (RISING_ONLY & bit);
+  if (rising) {
+    RISEN = RISEN | bit;
+  } else {
+    FELL = FELL | bit;
+  }
+  set_event_pending();
+}
+
+void enable(u8 n, gpio::Edge edge, const volatile u8* pin, u8 mask) {
+  // ISCn1:ISCn0 selects the sense; 01 is any change, 10 the falling
+  // edge and 11 the rising edge
+  u8 sense = edge == gpio::Edge::Both ? 0b01
+                                      : edge == gpio::Edge::Falling ? 0b10 : 0b11;
+  u16 eicr = n < 4 ? ExtIntDesc::kEicra : ExtIntDesc::kEicrb;
+  u8 shift = (n % 4) * 2;
+  u8 bit = 1 << n;
+
+  interrupt_free([&]() {
+    PIN[n] = pin;
+    MASK[n] = mask;
+    BOTH = edge == gpio::Edge::Both ? BOTH | bit : BOTH & ~bit;
+    RISING_ONLY =
+        edge == gpio::Edge::Rising ? RISING_ONLY | bit : RISING_ONLY & ~bit;
+
+    auto& reg = reg8(eicr);
+    u8 old_sense = (reg >> shift) & 0b11;
+    bool armed = reg8(ExtIntDesc::kEimsk) & bit;
+    if (armed && old_sense == sense) {
+      // Keep the edges that have been recorded already
+      return;
+    }
+    reg = (reg & ~(0b11 << shift)) | (sense << shift);
+    // Changing the sense can raise the flag; clear it before unmasking
+    reg8(ExtIntDesc::kEifr) = bit;
+    RISEN = RISEN & ~bit;
+    FELL = FELL & ~bit;
+    reg8(ExtIntDesc::kEimsk) |= bit;
+  });
+}
+
+void disable(u8 n) {
+  interrupt_free([n]() { reg8(ExtIntDesc::kEimsk) &= ~(1 << n); });
+}
+
+u8 take_edges(u8 n) {
+  return interrupt_free([n]() {
+    u8 bit = 1 << n;
+    u8 edges = 0;
+    if (FELL & bit) {
+      edges |= u8(gpio::Edge::Falling);
+    }
+    if (RISEN & bit) {
+      edges |= u8(gpio::Edge::Rising);
+    }
+    FELL = FELL & ~bit;
+    RISEN = RISEN & ~bit;
+    return edges;
+  });
+}
+}
+}
+#endif
@@ -0,0 +1,15 @@
+#include "flutterby/PinChange.h"
+
+#if defined(HAVE_AVR_EXTINT) && defined(IRQ_INT0)
+namespace flutterby {
+namespace extint {
+
+IRQ_INT0 {
+  edge(0);
+}
+
+template <>
+void link_vector<0>() {}
+}
+}
+#endif
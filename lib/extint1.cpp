@@ -0,0 +1,15 @@
+#include "flutterby/PinChange.h"
+
+#if defined(HAVE_AVR_EXTINT) && defined(IRQ_INT1)
+namespace flutterby {
+namespace extint {
+
+IRQ_INT1 {
+  edge(1);
+}
+
+template <>
+void link_vector<1>() {}
+}
+}
+#endif
@@ -0,0 +1,15 @@
+#include "flutterby/PinChange.h"
+
+#if defined(HAVE_AVR_EXTINT) && defined(IRQ_INT2)
+namespace flutterby {
+namespace extint {
+
+IRQ_INT2 {
+  edge(2);
+}
+
+template <>
+void link_vector<2>() {}
+}
+}
+#endif
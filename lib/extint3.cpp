@@ -0,0 +1,15 @@
+#include "flutterby/PinChange.h"
+
+#if defined(HAVE_AVR_EXTINT) && defined(IRQ_INT3)
+namespace flutterby {
+namespace extint {
+
+IRQ_INT3 {
+  edge(3);
+}
+
+template <>
+void link_vector<3>() {}
+}
+}
+#endif
@@ -0,0 +1,15 @@
+#include "flutterby/PinChange.h"
+
+#if defined(HAVE_AVR_EXTINT) && defined(IRQ_INT6)
+namespace flutterby {
+namespace extint {
+
+IRQ_INT6 {
+  edge(6);
+}
+
+template <>
+void link_vector<6>() {}
+}
+}
+#endif
@@ -1,5 +1,6 @@
 #include "flutterby/I2c.h"
 #include "flutterby/BusyWait.h"
+#include "flutterby/Power.h"
 #include "avr_autogen.h"
 
 static constexpr uint8_t TWI_ADDRESS_READ = 0x01;
@@ -29,7 +30,16 @@ static inline TwiStatus get_status() {
   return TwiStatus(Twi::twsr.raw_bits() & 0b11111000);
 }
 
+// True while we hold a reference on the TWI power gate
+static bool POWERED = false;
+static u16 TRANSACTIONS = 0;
+
 void enable(uint32_t bus_frequency) {
+  if (!POWERED) {
+    POWERED = true;
+    power::acquire(power::Peripheral::Twi);
+  }
+
   // Set to input and internal pull-ups on SDA, SCL
   Portd::ddrd &= ~(PortdSignalFlags::PD0 | PortdSignalFlags::PD1);
   Portd::portd |= PortdSignalFlags::PD0 | PortdSignalFlags::PD1;
@@ -40,6 +50,10 @@ void enable(uint32_t bus_frequency) {
 
 void disable() {
   Twi::twcr &= ~TwiTwcrFlags::TWEN;
+  if (POWERED) {
+    POWERED = false;
+    power::release(power::Peripheral::Twi);
+  }
 }
 
 inline void set_twcr(bitflags<TwiTwcrFlags::TwiTwcrFlags, u8> value) {
@@ -189,12 +203,17 @@ class TwiXmit {
   }
 };
 
+u16 transactions() {
+  return TRANSACTIONS;
+}
+
 I2cResult read_buffer(
     uint8_t slave_address,
     uint16_t timeout_ms,
     uint8_t read_address,
     uint8_t* destBuf,
     uint16_t destLen) {
+  ++TRANSACTIONS;
   slave_address <<= 1;
   TwiXmit xmit;
   Try(xmit.start(
@@ -220,6 +239,7 @@ Result<Unit, Error> write_buffer(
     uint8_t write_address,
     const uint8_t* src_buf,
     uint16_t srcLen) {
+  ++TRANSACTIONS;
   slave_address <<= 1;
   TwiXmit xmit;
 
@@ -0,0 +1,181 @@
+#include "flutterby/CriticalSection.h"
+#include "flutterby/I2c.h"
+#include "flutterby/Sleep.h"
+#include "avr_autogen.h"
+
+static constexpr uint8_t TWI_ADDRESS_READ = 0x01;
+static constexpr uint8_t TWI_ADDRESS_WRITE = 0x00;
+
+namespace flutterby {
+namespace I2cMaster {
+
+enum TwiMasterStatus {
+  BusError = 0x00,
+  Start = 0x08,
+  RepeatStart = 0x10,
+  XmitAckSLA = 0x18,
+  XmitNackSLA = 0x20,
+  XmitAckData = 0x28,
+  XmitNackData = 0x30,
+  ArbitrationLost = 0x38,
+  RxAckSLA = 0x40,
+  RxNackSLA = 0x48,
+  RxAckData = 0x50,
+  RxNackData = 0x58,
+};
+
+static inline TwiMasterStatus get_status() {
+  return TwiMasterStatus(Twi::twsr.raw_bits() & 0b11111000);
+}
+
+static const Transfer* TRANSFERS = nullptr;
+static volatile u8 COUNT = 0;
+// The transfer in progress and how far through it we are
+static volatile u8 CURRENT = 0;
+static volatile u8 POS = 0;
+// True once the write phase of the current transfer is done
+static volatile bool READING = false;
+static volatile bool RUNNING = false;
+// The outcome of the last batch; valid while !RUNNING
+static volatile bool FAILED = false;
+static volatile Error FAILURE = Error::BusFault;
+
+static inline void go(bool ack = false) {
+  auto flags = TwiTwcrFlags::TWINT | TwiTwcrFlags::TWEN | TwiTwcrFlags::TWIE;
+  if (ack) {
+    flags |= TwiTwcrFlags::TWEA;
+  }
+  Twi::twcr = flags;
+}
+
+static inline void start() {
+  Twi::twcr = TwiTwcrFlags::TWINT | TwiTwcrFlags::TWSTA | TwiTwcrFlags::TWEN |
+      TwiTwcrFlags::TWIE;
+}
+
+// Send a STOP and report the outcome of the batch
+static void finish(bool failed, Error error = Error::BusFault) {
+  Twi::twcr = TwiTwcrFlags::TWINT | TwiTwcrFlags::TWSTO | TwiTwcrFlags::TWEN;
+  FAILED = failed;
+  FAILURE = error;
+  RUNNING = false;
+  set_event_pending();
+}
+
+// Move on to the next transfer, or end the batch
+static void next_transfer() {
+  CURRENT = CURRENT + 1;
+  POS = 0;
+  READING = false;
+  if (CURRENT < COUNT) {
+    start();
+  } else {
+    finish(false);
+  }
+}
+
+// Read the next byte, ACKing it unless it is the last one wanted
+static inline void receive_next(const Transfer& t) {
+  go(POS + 1 < t.read_len);
+}
+
+IRQ_TWI {
+  const Transfer& t = TRANSFERS[CURRENT];
+  switch (get_status()) {
+    case Start:
+    case RepeatStart: {
+      u8 address = t.slave_address << 1;
+      if (t.write_len == 0 && !READING) {
+        READING = true;
+      }
+      Twi::twdr = address | (READING ? TWI_ADDRESS_READ : TWI_ADDRESS_WRITE);
+      go();
+      return;
+    }
+
+    case XmitAckSLA:
+    case XmitAckData:
+      if (POS < t.write_len) {
+        Twi::twdr = t.write_buf[POS];
+        POS = POS + 1;
+        go();
+      } else if (t.read_len) {
+        POS = 0;
+        READING = true;
+        start();
+      } else {
+        next_transfer();
+      }
+      return;
+
+    case RxAckSLA:
+      receive_next(t);
+      return;
+
+    case RxAckData:
+    case RxNackData:
+      t.read_buf[POS] = Twi::twdr;
+      POS = POS + 1;
+      if (POS < t.read_len) {
+        receive_next(t);
+      } else {
+        next_transfer();
+      }
+      return;
+
+    case XmitNackSLA:
+    case RxNackSLA:
+      finish(true, Error::SlaveNotReady);
+      return;
+
+    case XmitNackData:
+      finish(true, Error::SlaveNack);
+      return;
+
+    case ArbitrationLost:
+      // Another master won; try the same transfer again once the bus
+      // is free
+      POS = 0;
+      READING = false;
+      start();
+      return;
+
+    default:
+      finish(true, Error::BusFault);
+      return;
+  }
+}
+
+bool start_batch(const Transfer* transfers, u8 count) {
+  return interrupt_free([&]() {
+    if (RUNNING) {
+      return false;
+    }
+    if (count == 0) {
+      FAILED = false;
+      return true;
+    }
+    TRANSFERS = transfers;
+    COUNT = count;
+    CURRENT = 0;
+    POS = 0;
+    READING = false;
+    RUNNING = true;
+    start();
+    return true;
+  });
+}
+
+Option<I2cResult> batch_result() {
+  return interrupt_free([]() {
+    if (RUNNING) {
+      return Option<I2cResult>::None();
+    }
+    if (FAILED) {
+      return Some(I2cResult::Error(Error(FAILURE)));
+    }
+    return Some(I2cResult::Ok());
+  });
+}
+}
+}
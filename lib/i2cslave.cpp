@@ -0,0 +1,222 @@
+#include "flutterby/I2cSlave.h"
+#include "flutterby/Copy.h"
+#include "flutterby/CriticalSection.h"
+#include "flutterby/Power.h"
+#include "flutterby/Sleep.h"
+#include "avr_autogen.h"
+
+namespace flutterby {
+namespace I2cSlave {
+
+enum TwiSlaveStatus {
+  BusError = 0x00,
+  RxAckSLA = 0x60,
+  RxArbitrationLostAckSLA = 0x68,
+  RxAckGeneralCall = 0x70,
+  RxArbitrationLostAckGeneralCall = 0x78,
+  RxAckData = 0x80,
+  RxNackData = 0x88,
+  RxGeneralCallAckData = 0x90,
+  RxGeneralCallNackData = 0x98,
+  RxStopOrRepeatStart = 0xa0,
+  TxAckSLA = 0xa8,
+  TxArbitrationLostAckSLA = 0xb0,
+  TxAckData = 0xb8,
+  TxNackData = 0xc0,
+  TxLastAckData = 0xc8,
+};
+
+static inline TwiSlaveStatus get_status() {
+  return TwiSlaveStatus(Twi::twsr.raw_bits() & 0b11111000);
+}
+
+static u8* TX_BUFFERS = nullptr;
+static u8 TX_SIZE = 0;
+static u8* RX_BUFFER = nullptr;
+static u8 RX_SIZE = 0;
+
+// The tx buffer that will be served to the next burst read
+static volatile u8 FRONT = 0;
+// The tx buffer being served to the burst read that is in progress
+static volatile u8 SERVING = 0;
+// True while the master is part way through a burst read
+static volatile bool IN_READ = false;
+
+// The register pointer; selected by the first byte of a master write
+static volatile u8 REG = 0;
+// True if the next received byte selects the register pointer
+static volatile bool EXPECT_REG = false;
+
+// Tracks the mailbox write that is in progress
+static volatile u8 RX_REG = 0;
+static volatile u8 RX_LEN = 0;
+// True if the mailbox holds a write that has not yet been taken
+static volatile bool MAILBOX_FULL = false;
+// The completed write that is waiting to be taken
+static volatile u8 MAILBOX_REG = 0;
+static volatile u8 MAILBOX_LEN = 0;
+
+static inline void reply(bool ack) {
+  auto flags = TwiTwcrFlags::TWINT | TwiTwcrFlags::TWEN | TwiTwcrFlags::TWIE;
+  if (ack) {
+    flags |= TwiTwcrFlags::TWEA;
+  }
+  Twi::twcr = flags;
+}
+
+// Returns true if we can accept another mailbox byte
+static inline bool can_receive() {
+  return !MAILBOX_FULL && REG < RX_SIZE;
+}
+
+IRQ_TWI {
+  switch (get_status()) {
+    case RxAckSLA:
+    case RxArbitrationLostAckSLA:
+      // The first byte of a write always selects the register
+      EXPECT_REG = true;
+      RX_LEN = 0;
+      reply(true);
+      return;
+
+    case RxAckData:
+    case RxNackData: {
+      u8 data = Twi::twdr;
+      if (EXPECT_REG) {
+        EXPECT_REG = false;
+        REG = data;
+        RX_REG = data;
+      } else if (can_receive()) {
+        RX_BUFFER[REG++] = data;
+        ++RX_LEN;
+      }
+      reply(can_receive());
+      return;
+    }
+
+    case RxStopOrRepeatStart:
+      if (RX_LEN) {
+        MAILBOX_REG = RX_REG;
+        MAILBOX_LEN = RX_LEN;
+        MAILBOX_FULL = true;
+        RX_LEN = 0;
+        set_event_pending();
+      }
+      IN_READ = false;
+      reply(true);
+      return;
+
+    case TxAckSLA:
+    case TxArbitrationLostAckSLA:
+      // Latch the front buffer for the duration of the burst so
+      // that the master sees a coherent snapshot
+      SERVING = FRONT;
+      IN_READ = true;
+    // fall through
+    case TxAckData: {
+      u8 reg = REG;
+      if (reg >= TX_SIZE) {
+        reg = 0;
+      }
+      Twi::twdr = TX_BUFFERS[(SERVING ? TX_SIZE : 0) + reg];
+      REG = reg + 1;
+      reply(true);
+      return;
+    }
+
+    case TxNackData:
+    case TxLastAckData:
+      // The master has all that it wants; we're no longer addressed
+      IN_READ = false;
+      reply(true);
+      return;
+
+    case BusError:
+      // Release the bus and resume listening for our address
+      IN_READ = false;
+      Twi::twcr = TwiTwcrFlags::TWINT | TwiTwcrFlags::TWSTO |
+          TwiTwcrFlags::TWEN | TwiTwcrFlags::TWIE | TwiTwcrFlags::TWEA;
+      return;
+
+    default:
+      // General calls are not supported; NACK their data
+      reply(false);
+      return;
+  }
+}
+
+// True while we hold a reference on the TWI power gate
+static bool POWERED = false;
+
+void enable_impl(
+    u8 slave_address,
+    u8* tx_buffers,
+    u8 tx_size,
+    u8* rx_buffer,
+    u8 rx_size) {
+  if (!POWERED) {
+    POWERED = true;
+    power::acquire(power::Peripheral::Twi);
+  }
+  interrupt_free([&]() {
+    TX_BUFFERS = tx_buffers;
+    TX_SIZE = tx_size;
+    RX_BUFFER = rx_buffer;
+    RX_SIZE = rx_size;
+    FRONT = 0;
+    IN_READ = false;
+    REG = 0;
+    EXPECT_REG = false;
+    RX_LEN = 0;
+    MAILBOX_FULL = false;
+
+    // Don't respond to general calls; only our own address
+    Twi::twar.set_raw_bits(slave_address << 1);
+    Twi::twcr =
+        TwiTwcrFlags::TWEN | TwiTwcrFlags::TWIE | TwiTwcrFlags::TWEA;
+  });
+}
+
+void disable() {
+  Twi::twcr &= ~(TwiTwcrFlags::TWEN | TwiTwcrFlags::TWIE |
+                 TwiTwcrFlags::TWEA);
+  if (POWERED) {
+    POWERED = false;
+    power::release(power::Peripheral::Twi);
+  }
+}
+
+u8* back_buffer() {
+  return TX_BUFFERS + (FRONT ? 0 : TX_SIZE);
+}
+
+bool publish() {
+  bool swapped = interrupt_free([]() {
+    if (IN_READ) {
+      return false;
+    }
+    FRONT = FRONT ^ 1;
+    return true;
+  });
+
+  if (swapped) {
+    // The ISR only ever reads from the front buffer, so we can
+    // refresh the back buffer with interrupts enabled
+    auto front = TX_BUFFERS + (FRONT ? TX_SIZE : 0);
+    copy_n(front, TX_SIZE, back_buffer());
+  }
+  return swapped;
+}
+
+Option<MailboxWrite> take_mailbox() {
+  return interrupt_free([]() {
+    if (!MAILBOX_FULL) {
+      return Option<MailboxWrite>::None();
+    }
+    MailboxWrite write{MAILBOX_REG, MAILBOX_LEN};
+    MAILBOX_FULL = false;
+    return Some(move(write));
+  });
+}
+}
+}
@@ -0,0 +1,73 @@
+#include "flutterby/InputCapture.h"
+#include "flutterby/CriticalSection.h"
+#include "flutterby/RingBuffer.h"
+#include "flutterby/Sleep.h"
+#include "avr_autogen.h"
+
+namespace flutterby {
+
+using Desc = TimerDesc<1>;
+
+static RingBuffer<capture::Event, INPUT_CAPTURE_BUFFER_SIZE> EVENTS;
+// Count of edges dropped because EVENTS was full
+static volatile u8 OVERRUNS = 0;
+static volatile bool BOTH_EDGES = false;
+
+IRQ_TIMER1_CAPT {
+  u16 icr = timer::reg16(Desc::kIcr);
+  u8 tccrb = timer::reg8(Desc::kTccrB);
+
+  capture::Event event{timebase::extend(icr),
+                       (tccrb & timer::kCaptureRisingEdgeBit) != 0};
+  if (!EVENTS.push(event)) {
+    if (OVERRUNS != 0xff) {
+      OVERRUNS = OVERRUNS + 1;
+    }
+  }
+
+  if (BOTH_EDGES) {
+    timer::reg8(Desc::kTccrB) = tccrb ^ timer::kCaptureRisingEdgeBit;
+    // Changing the edge can set the capture flag; clear it by
+    // writing a 1 to it
+    timer::reg8(Desc::kTifr) = timer::kInputCaptureBit;
+  }
+  set_event_pending();
+}
+
+void InputCapture::enable(capture::Edge edge, bool noise_canceler) {
+  timebase::start();
+  interrupt_free([&]() {
+    EVENTS.clear();
+    OVERRUNS = 0;
+    BOTH_EDGES = edge == capture::Edge::Both;
+
+    u8 tccrb = timer::reg8(Desc::kTccrB) &
+        ~(timer::kCaptureRisingEdgeBit | timer::kCaptureNoiseCancelerBit);
+    if (edge != capture::Edge::Falling) {
+      tccrb |= timer::kCaptureRisingEdgeBit;
+    }
+    if (noise_canceler) {
+      tccrb |= timer::kCaptureNoiseCancelerBit;
+    }
+    timer::reg8(Desc::kTccrB) = tccrb;
+    timer::reg8(Desc::kTifr) = timer::kInputCaptureBit;
+  });
+  timebase::Timer::enable_interrupts(timer::kInputCaptureBit);
+}
+
+void InputCapture::disable() {
+  timebase::Timer::disable_interrupts(timer::kInputCaptureBit);
+}
+
+Option<capture::Event> InputCapture::read_event() {
+  return EVENTS.pop();
+}
+
+u8 InputCapture::take_overruns() {
+  return interrupt_free([]() {
+    u8 overruns = OVERRUNS;
+    OVERRUNS = 0;
+    return overruns;
+  });
+}
+}
@@ -0,0 +1,124 @@
+#include "flutterby/PinChange.h"
+#include "flutterby/CriticalSection.h"
+#include "flutterby/Sleep.h"
+
+#ifdef HAVE_AVR_PCINT
+namespace flutterby {
+namespace pcint {
+
+// The groups whose interrupt has fired
+static volatile u8 FIRED = 0;
+// The pin levels as of the last interrupt, and the edges seen since
+// they were last taken, for groups that have a PINx register
+static u8 LEVELS[PcintDesc::kGroups];
+static volatile u8 RISEN[PcintDesc::kGroups];
+static volatile u8 FELL[PcintDesc::kGroups];
+
+static inline volatile u8& reg8(u16 addr) {
+  return *reinterpret_cast<volatile u8*>(addr);
+}
+
+static inline void fired(u8 group) {
+  if (PcintDesc::kPin[group]) {
+    u8 now = reg8(PcintDesc::kPin[group]);
+    u8 changed = (now ^ LEVELS[group]) & reg8(PcintDesc::kPcmsk[group]);
+    RISEN[group] = RISEN[group] | (changed & now);
+    FELL[group] = FELL[group] | (changed & ~now);
+    LEVELS[group] = now;
+  }
+  FIRED = FIRED | (1 << group);
+  set_event_pending();
+}
+
+#ifdef IRQ_PCINT0
+IRQ_PCINT0 {
+  fired(0);
+}
+#endif
+#ifdef IRQ_PCINT1
+IRQ_PCINT1 {
+  fired(1);
+}
+#endif
+#ifdef IRQ_PCINT2
+IRQ_PCINT2 {
+  fired(2);
+}
+#endif
+#ifdef IRQ_PCINT3
+IRQ_PCINT3 {
+  fired(3);
+}
+#endif
+
+void enable(const Masks& masks) {
+  interrupt_free([&]() {
+    for (u8 g = 0; g < PcintDesc::kGroups; ++g) {
+      // Pins that are already armed keep their recorded edges
+      u8 armed = reg8(PcintDesc::kPcmsk[g]);
+      u8 added = masks.group[g] & ~armed;
+      if (!added) {
+        continue;
+      }
+      bool pending = reg8(PcintDesc::kPcifr) & (1 << g);
+      if (PcintDesc::kPin[g]) {
+        LEVELS[g] =
+            (LEVELS[g] & ~added) | (reg8(PcintDesc::kPin[g]) & added);
+        RISEN[g] = RISEN[g] & ~added;
+        FELL[g] = FELL[g] & ~added;
+      }
+      reg8(PcintDesc::kPcmsk[g]) |= added;
+      // Writing a one clears the flag
+      reg8(PcintDesc::kPcifr) = 1 << g;
+      if (armed && pending) {
+        // The flag was for the pins that were already armed; do what
+        // the ISR would have done with it
+        fired(g);
+      } else if (!armed) {
+        FIRED = FIRED & ~(1 << g);
+      }
+      reg8(PcintDesc::kPcicr) |= 1 << g;
+    }
+  });
+}
+
+void disable(const Masks& masks) {
+  interrupt_free([&]() {
+    for (u8 g = 0; g < PcintDesc::kGroups; ++g) {
+      if (!masks.group[g]) {
+        continue;
+      }
+      auto remain = reg8(PcintDesc::kPcmsk[g]) & ~masks.group[g];
+      reg8(PcintDesc::kPcmsk[g]) = remain;
+      if (!remain) {
+        reg8(PcintDesc::kPcicr) &= ~(1 << g);
+      }
+    }
+  });
+}
+
+u8 take_edges(u8 group, u8 mask) {
+  return interrupt_free([group, mask]() {
+    u8 edges = 0;
+    if (FELL[group] & mask) {
+      edges |= u8(gpio::Edge::Falling);
+    }
+    if (RISEN[group] & mask) {
+      edges |= u8(gpio::Edge::Rising);
+    }
+    FELL[group] = FELL[group] & ~mask;
+    RISEN[group] = RISEN[group] & ~mask;
+    return edges;
+  });
+}
+
+u8 take_fired(u8 which_groups) {
+  return interrupt_free([which_groups]() {
+    u8 fired = FIRED & which_groups;
+    FIRED = FIRED & ~fired;
+    return fired;
+  });
+}
+}
+}
+#endif
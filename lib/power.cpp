@@ -0,0 +1,109 @@
+#include "flutterby/Power.h"
+#include "flutterby/CriticalSection.h"
+
+namespace flutterby {
+namespace power {
+
+static u8 REFS[u8(Peripheral::Count)];
+
+struct GateInfo {
+  u16 reg;
+  u8 mask;
+};
+
+template <Peripheral P>
+static constexpr GateInfo gate_info() {
+  return GateInfo{Gate<P>::kReg, Gate<P>::kMask};
+}
+
+static GateInfo gate(Peripheral p) {
+  switch (p) {
+    case Peripheral::Adc:
+      return gate_info<Peripheral::Adc>();
+    case Peripheral::Spi:
+      return gate_info<Peripheral::Spi>();
+    case Peripheral::Twi:
+      return gate_info<Peripheral::Twi>();
+    case Peripheral::Usart0:
+      return gate_info<Peripheral::Usart0>();
+    case Peripheral::Usart1:
+      return gate_info<Peripheral::Usart1>();
+    case Peripheral::Timer0:
+      return gate_info<Peripheral::Timer0>();
+    case Peripheral::Timer1:
+      return gate_info<Peripheral::Timer1>();
+    case Peripheral::Timer2:
+      return gate_info<Peripheral::Timer2>();
+    case Peripheral::Timer3:
+      return gate_info<Peripheral::Timer3>();
+    case Peripheral::Timer4:
+      return gate_info<Peripheral::Timer4>();
+    case Peripheral::Usb:
+      return gate_info<Peripheral::Usb>();
+    default:
+      return GateInfo{0, 0};
+  }
+}
+
+static inline volatile u8& reg8(u16 addr) {
+  return *reinterpret_cast<volatile u8*>(addr);
+}
+
+static void set_gated(Peripheral p, bool gated) {
+  auto info = gate(p);
+  if (!info.reg) {
+    return;
+  }
+  if (gated) {
+    reg8(info.reg) |= info.mask;
+  } else {
+    reg8(info.reg) &= ~info.mask;
+  }
+}
+
+void acquire(Peripheral p) {
+  interrupt_free([&]() {
+    auto& refs = REFS[u8(p)];
+    if (refs++ == 0) {
+      set_gated(p, false);
+    }
+  });
+}
+
+void release(Peripheral p) {
+  interrupt_free([&]() {
+    auto& refs = REFS[u8(p)];
+    if (refs == 0) {
+      return;
+    }
+    if (--refs == 0) {
+      set_gated(p, true);
+    }
+  });
+}
+
+void gate_unused() {
+  interrupt_free([]() {
+    for (u8 i = 0; i < u8(Peripheral::Count); ++i) {
+      if (REFS[i] == 0) {
+        set_gated(Peripheral(i), true);
+      }
+    }
+  });
+}
+
+u8 refs(Peripheral p) {
+  return REFS[u8(p)];
+}
+
+u16 live() {
+  u16 mask = 0;
+  for (u8 i = 0; i < u8(Peripheral::Count); ++i) {
+    if (REFS[i]) {
+      mask |= 1 << i;
+    }
+  }
+  return mask;
+}
+}
+}
@@ -0,0 +1,62 @@
+#include "flutterby/Profile.h"
+#include "flutterby/CriticalSection.h"
+
+namespace flutterby {
+namespace profile {
+
+static Entry* ENTRIES = nullptr;
+// The ticks recorded by an empty scope; see calibrate()
+static u32 OVERHEAD = 0;
+static bool CALIBRATED = false;
+
+// Times back to back reads of the timebase, as a scope's entry and exit
+// probes are, and keeps the least; the others were caught by an
+// interrupt or a pending overflow
+static void calibrate() {
+  u32 least = 0xffffffff;
+  for (u8 i = 0; i < 8; ++i) {
+    u32 start = timebase::now();
+    u32 elapsed = timebase::now() - start;
+    if (elapsed < least) {
+      least = elapsed;
+    }
+  }
+  OVERHEAD = least;
+  CALIBRATED = true;
+}
+
+void add_entry(Entry& entry, FlashString name) {
+  if (!CALIBRATED) {
+    calibrate();
+  }
+  // A scope inside an ISR may race with one in the main program
+  interrupt_free([&]() {
+    if (entry.name.begin().raw_ptr()) {
+      return;
+    }
+    entry.name = name;
+    entry.next = ENTRIES;
+    ENTRIES = &entry;
+  });
+}
+
+u32 overhead() {
+  return OVERHEAD;
+}
+
+Entry* first_entry() {
+  return ENTRIES;
+}
+
+void reset() {
+  interrupt_free([]() {
+    for (auto entry = ENTRIES; entry; entry = entry->next) {
+      entry->calls = 0;
+      entry->min = 0xffffffff;
+      entry->max = 0;
+      entry->total = 0;
+    }
+  });
+}
+}
+}
@@ -0,0 +1,168 @@
+#include "flutterby/Serial0.h"
+#include "flutterby/CriticalSection.h"
+#include "flutterby/Power.h"
+#include "flutterby/RingBuffer.h"
+#include "flutterby/Sleep.h"
+#include "avr_autogen.h"
+
+namespace flutterby {
+
+static RingBuffer<u8, SERIAL0_TX_BUFFER_SIZE> TX_BUFFER;
+static RingBuffer<u8, SERIAL0_RX_BUFFER_SIZE> RX_BUFFER;
+// Count of received bytes dropped because RX_BUFFER was full
+static volatile u8 RX_OVERRUNS = 0;
+// True while we hold a reference on the USART0 power gate
+static bool POWERED = false;
+// True if a byte has been loaded into the data register since the
+// last flush(); TXC0 only becomes meaningful after that
+static volatile bool TX_STARTED = false;
+
+static inline void enable_udre_interrupt() {
+  Usart0::ucsr0b |= Usart0Ucsr0bFlags::UDRIE0;
+}
+
+// Moves the next queued byte into the data register.
+// Disables the UDRE interrupt once there is nothing left to send.
+static inline void send_next() {
+  auto b = TX_BUFFER.pop();
+  if (b.is_none()) {
+    Usart0::ucsr0b &= ~Usart0Ucsr0bFlags::UDRIE0;
+    return;
+  }
+  Usart0::udr0 = b.value();
+  Usart0::ucsr0a |=
+      Usart0Ucsr0aFlags::TXC0; // clear this bit by writing a 1 to it
+  TX_STARTED = true;
+}
+
+IRQ_USART_UDRE {
+  send_next();
+}
+
+IRQ_USART_RX {
+  // Reading UDR0 clears the interrupt, so always read it
+  u8 b = Usart0::udr0;
+  if (!RX_BUFFER.push(b)) {
+    if (RX_OVERRUNS != 0xff) {
+      RX_OVERRUNS = RX_OVERRUNS + 1;
+    }
+  }
+  set_event_pending();
+}
+
+void Serial0::enable_interrupts() {
+  interrupt_free([]() {
+    TX_BUFFER.clear();
+    RX_BUFFER.clear();
+    RX_OVERRUNS = 0;
+    TX_STARTED = false;
+    Usart0::ucsr0b |= Usart0Ucsr0bFlags::RXCIE0;
+  });
+}
+
+void Serial0::power_up() {
+  if (!POWERED) {
+    POWERED = true;
+    power::acquire(power::Peripheral::Usart0);
+  }
+}
+
+void Serial0::disable() {
+  if (!POWERED) {
+    return;
+  }
+  flush();
+  Usart0::ucsr0b &=
+      ~(Usart0Ucsr0bFlags::RXEN0 | Usart0Ucsr0bFlags::TXEN0 |
+        Usart0Ucsr0bFlags::RXCIE0 | Usart0Ucsr0bFlags::UDRIE0);
+  POWERED = false;
+  power::release(power::Peripheral::Usart0);
+}
+
+bool Serial0::write_byte(u8 b) {
+  if (!TX_BUFFER.push(b)) {
+    return false;
+  }
+  // The ISR may have disabled itself after draining the buffer
+  // just before our push, so always (re)enable it here
+  enable_udre_interrupt();
+  return true;
+}
+
+u8 Serial0::write(const u8* buf, u8 len) {
+  u8 queued = 0;
+  while (queued < len && TX_BUFFER.push(buf[queued])) {
+    ++queued;
+  }
+  if (queued) {
+    enable_udre_interrupt();
+  }
+  return queued;
+}
+
+// Returns true if global interrupts are enabled
+static inline bool interrupts_enabled() {
+  return (Cpu::sreg & CpuSregFlags::I) == CpuSregFlags::I;
+}
+
+// If interrupts are disabled then the UDRE ISR can't run, so we
+// need to feed the data register ourselves to make progress
+static inline void service_tx_if_masked() {
+  if (!interrupts_enabled() &&
+      (Usart0::ucsr0a & Usart0Ucsr0aFlags::UDRE0) ==
+          Usart0Ucsr0aFlags::UDRE0) {
+    send_next();
+  }
+}
+
+void Serial0::write_byte_immediate(u8 b) {
+  interrupt_free([b]() {
+    while ((Usart0::ucsr0a & Usart0Ucsr0aFlags::UDRE0) !=
+           Usart0Ucsr0aFlags::UDRE0) {
+      ;
+    }
+    Usart0::udr0 = b;
+    Usart0::ucsr0a |=
+        Usart0Ucsr0aFlags::TXC0; // clear this bit by writing a 1 to it
+    TX_STARTED = true;
+  });
+}
+
+void Serial0::write_byte_blocking(u8 b) {
+  while (!write_byte(b)) {
+    service_tx_if_masked();
+  }
+}
+
+u8 Serial0::tx_space() {
+  return TX_BUFFER.capacity() - TX_BUFFER.size();
+}
+
+void Serial0::flush() {
+  while (!TX_BUFFER.empty()) {
+    service_tx_if_masked();
+  }
+  // Wait for the final byte to leave the shift register.  TXC0 is
+  // cleared each time we load the data register and set by the
+  // hardware when the transmission completes.
+  if (TX_STARTED) {
+    while ((Usart0::ucsr0a & Usart0Ucsr0aFlags::TXC0) !=
+           Usart0Ucsr0aFlags::TXC0) {
+      ;
+    }
+    TX_STARTED = false;
+  }
+}
+
+Option<u8> Serial0::read_byte() {
+  return RX_BUFFER.pop();
+}
+
+u8 Serial0::take_overruns() {
+  return interrupt_free([]() {
+    u8 overruns = RX_OVERRUNS;
+    RX_OVERRUNS = 0;
+    return overruns;
+  });
+}
+}
@@ -1,5 +1,8 @@
 #include "flutterby/Sleep.h"
 #include "avr_autogen.h"
+#if FLUTTERBY_SLEEP_STATS
+#include "flutterby/Timebase.h"
+#endif
 
 namespace flutterby {
 
@@ -14,12 +17,16 @@ void set_sleep_mode(SleepMode mode) {
       break;
     case SleepMode::PowerDown:
       flags = CpuSmcrFlags::SM_POWER_DOWN;
+      break;
     case SleepMode::PowerSave:
       flags = CpuSmcrFlags::SM_POWER_SAVE;
+      break;
     case SleepMode::StandyBy:
       flags = CpuSmcrFlags::SM_STANDBY;
+      break;
     case SleepMode::ExtendedStandBy:
       flags = CpuSmcrFlags::SM_EXTENDED_STANDBY;
+      break;
     default:
       return;
   }
@@ -38,17 +45,66 @@ inline void sleep_disable() {
   Cpu::smcr &= ~CpuSmcrFlags::SE;
 }
 
+#if FLUTTERBY_SLEEP_STATS
+static SleepStats STATS;
+// When we last woke up, if we have slept before
+static u32 LAST_WAKE;
+static bool HAVE_WOKEN = false;
+
+static u8 burst_bucket(u32 ticks) {
+  u8 bucket = 0;
+  while (ticks > 1 && bucket < SleepStats::kBurstBuckets - 1) {
+    ticks >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+#endif
+
 void wait_for_event(SleepMode mode) {
   set_sleep_mode(mode);
   __builtin_avr_cli();
   if (!PENDING) {
+#if FLUTTERBY_SLEEP_STATS
+    auto start = timebase::now();
+    if (HAVE_WOKEN) {
+      auto burst = start - LAST_WAKE;
+      STATS.awake += burst;
+      auto& count = STATS.bursts[burst_bucket(burst)];
+      if (count != 0xffff) {
+        ++count;
+      }
+    }
+#endif
     sleep_enable();
     __builtin_avr_sei();
     __builtin_avr_sleep();
     sleep_disable();
+#if FLUTTERBY_SLEEP_STATS
+    // The ISR that woke us has run by the time we get here
+    LAST_WAKE = timebase::now();
+    HAVE_WOKEN = true;
+    STATS.asleep[u8(mode)] += LAST_WAKE - start;
+    ++STATS.wakeups;
+#endif
   }
   PENDING = 0;
   __builtin_avr_sei();
 }
 
+SleepStats sleep_stats() {
+#if FLUTTERBY_SLEEP_STATS
+  return STATS;
+#else
+  return SleepStats{};
+#endif
+}
+
+void reset_sleep_stats() {
+#if FLUTTERBY_SLEEP_STATS
+  STATS = SleepStats{};
+  HAVE_WOKEN = false;
+#endif
+}
+
 }
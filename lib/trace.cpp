@@ -0,0 +1,23 @@
+#include "flutterby/Trace.h"
+
+namespace flutterby {
+namespace trace {
+
+// Count of records dropped because the sink was full
+static volatile u8 OVERRUNS = 0;
+
+void overrun() {
+  if (OVERRUNS != 0xff) {
+    OVERRUNS = OVERRUNS + 1;
+  }
+}
+
+u8 take_overruns() {
+  return interrupt_free([]() {
+    u8 overruns = OVERRUNS;
+    OVERRUNS = 0;
+    return overruns;
+  });
+}
+}
+}
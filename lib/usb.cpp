@@ -0,0 +1,747 @@
+#include "flutterby/Usb.h"
+#include "flutterby/CriticalSection.h"
+#include "flutterby/Power.h"
+#include "flutterby/Progmem.h"
+#include "flutterby/Sleep.h"
+
+#ifdef HAVE_AVR_USB
+#ifndef FLUTTERBY_USB_VID
+#define FLUTTERBY_USB_VID 0x16c0
+#endif
+#ifndef FLUTTERBY_USB_PID
+#define FLUTTERBY_USB_PID 0x27db
+#endif
+
+namespace flutterby {
+namespace usb {
+
+static inline volatile u8& reg8(u16 addr) {
+  return *reinterpret_cast<volatile u8*>(addr);
+}
+
+// Register bits; the layout is the same on every part with this
+// controller
+static constexpr u8 kUvrege = 1 << 0; // UHWCON
+static constexpr u8 kUsbe = 1 << 7; // USBCON
+static constexpr u8 kFrzclk = 1 << 5;
+static constexpr u8 kOtgpade = 1 << 4;
+static constexpr u8 kPindiv = 1 << 4; // PLLCSR
+static constexpr u8 kPlle = 1 << 1;
+static constexpr u8 kPlock = 1 << 0;
+static constexpr u8 kDetach = 1 << 0; // UDCON
+static constexpr u8 kEorst = 1 << 3; // UDINT, UDIEN
+static constexpr u8 kAdden = 1 << 7; // UDADDR
+static constexpr u8 kEpen = 1 << 0; // UECONX
+static constexpr u8 kStallrq = 1 << 5;
+static constexpr u8 kControl = 0x00; // UECFG0X
+static constexpr u8 kInterruptIn = 0xc1;
+static constexpr u8 kSize8 = 0x00; // UECFG1X
+static constexpr u8 kSize32 = 0x20;
+static constexpr u8 kAlloc = 1 << 1;
+static constexpr u8 kTxini = 1 << 0; // UEINTX
+static constexpr u8 kRxouti = 1 << 2;
+static constexpr u8 kRxstpi = 1 << 3;
+static constexpr u8 kFifocon = 1 << 7;
+static constexpr u8 kTxine = 1 << 0; // UEIENX
+static constexpr u8 kRxstpe = 1 << 3;
+
+// Standard and HID requests
+static constexpr u8 kGetStatus = 0x00;
+static constexpr u8 kSetAddress = 0x05;
+static constexpr u8 kGetDescriptor = 0x06;
+static constexpr u8 kGetConfiguration = 0x08;
+static constexpr u8 kSetConfiguration = 0x09;
+static constexpr u8 kGetReport = 0x01;
+static constexpr u8 kGetIdle = 0x02;
+static constexpr u8 kGetProtocol = 0x03;
+static constexpr u8 kSetReport = 0x09;
+static constexpr u8 kSetIdle = 0x0a;
+static constexpr u8 kSetProtocol = 0x0b;
+
+static const u8 DEVICE_DESCRIPTOR[] __attribute__((progmem)) = {
+    18, 1, // bLength, DEVICE
+    0x00, 0x02, // USB 2.0
+    0, 0, 0, // class is defined by the interfaces
+    kControlSize,
+    FLUTTERBY_USB_VID & 0xff, FLUTTERBY_USB_VID >> 8,
+    FLUTTERBY_USB_PID & 0xff, FLUTTERBY_USB_PID >> 8,
+    0x00, 0x01, // bcdDevice
+    1, 2, 0, // manufacturer, product, no serial number
+    1, // bNumConfigurations
+};
+
+static const u8 BOOT_REPORT_DESCRIPTOR[] __attribute__((progmem)) = {
+    0x05, 0x01, // Usage Page (Generic Desktop)
+    0x09, 0x06, // Usage (Keyboard)
+    0xa1, 0x01, // Collection (Application)
+    0x05, 0x07, //   Usage Page (Key Codes)
+    0x19, 0xe0, //   Usage Minimum (224)
+    0x29, 0xe7, //   Usage Maximum (231)
+    0x15, 0x00, //   Logical Minimum (0)
+    0x25, 0x01, //   Logical Maximum (1)
+    0x75, 0x01, //   Report Size (1)
+    0x95, 0x08, //   Report Count (8)
+    0x81, 0x02, //   Input (Data, Variable, Absolute); modifiers
+    0x95, 0x01, //   Report Count (1)
+    0x75, 0x08, //   Report Size (8)
+    0x81, 0x03, //   Input (Constant); reserved byte
+    0x95, 0x05, //   Report Count (5)
+    0x75, 0x01, //   Report Size (1)
+    0x05, 0x08, //   Usage Page (LEDs)
+    0x19, 0x01, //   Usage Minimum (1)
+    0x29, 0x05, //   Usage Maximum (5)
+    0x91, 0x02, //   Output (Data, Variable, Absolute); LEDs
+    0x95, 0x01, //   Report Count (1)
+    0x75, 0x03, //   Report Size (3)
+    0x91, 0x03, //   Output (Constant); padding
+    0x95, 0x06, //   Report Count (6)
+    0x75, 0x08, //   Report Size (8)
+    0x15, 0x00, //   Logical Minimum (0)
+    0x26, 0xff, 0x00, // Logical Maximum (255)
+    0x05, 0x07, //   Usage Page (Key Codes)
+    0x19, 0x00, //   Usage Minimum (0)
+    0x2a, 0xff, 0x00, // Usage Maximum (255)
+    0x81, 0x00, //   Input (Data, Array); key codes
+    0xc0, // End Collection
+};
+
+static const u8 NKRO_REPORT_DESCRIPTOR[] __attribute__((progmem)) = {
+    0x05, 0x01, // Usage Page (Generic Desktop)
+    0x09, 0x06, // Usage (Keyboard)
+    0xa1, 0x01, // Collection (Application)
+    0x05, 0x07, //   Usage Page (Key Codes)
+    0x19, 0xe0, //   Usage Minimum (224)
+    0x29, 0xe7, //   Usage Maximum (231)
+    0x15, 0x00, //   Logical Minimum (0)
+    0x25, 0x01, //   Logical Maximum (1)
+    0x75, 0x01, //   Report Size (1)
+    0x95, 0x08, //   Report Count (8)
+    0x81, 0x02, //   Input (Data, Variable, Absolute); modifiers
+    0x19, 0x00, //   Usage Minimum (0)
+    0x29, 0xdf, //   Usage Maximum (223)
+    0x95, 0xe0, //   Report Count (224)
+    0x81, 0x02, //   Input (Data, Variable, Absolute); key bitmap
+    0xc0, // End Collection
+};
+
+// Offsets of the HID descriptors within CONFIG_DESCRIPTOR
+static constexpr u8 kBootHidOffset = 9 + 9;
+static constexpr u8 kNkroHidOffset = 9 + 9 + 9 + 7 + 9;
+static constexpr u8 kConfigSize = kNkroHidOffset + 9 + 7;
+
+static const u8 CONFIG_DESCRIPTOR[] __attribute__((progmem)) = {
+    9, 2, // bLength, CONFIGURATION
+    kConfigSize, 0,
+    2, // bNumInterfaces
+    1, // bConfigurationValue
+    0, // iConfiguration
+    0x80, // bus powered
+    50, // 100mA
+
+    // Boot keyboard
+    9, 4, // bLength, INTERFACE
+    0, 0, // bInterfaceNumber, bAlternateSetting
+    1, // bNumEndpoints
+    0x03, 0x01, 0x01, // HID, boot subclass, keyboard
+    0, // iInterface
+    9, 0x21, // bLength, HID
+    0x11, 0x01, // HID 1.11
+    0, 1, // no country code, one report descriptor
+    0x22, sizeof(BOOT_REPORT_DESCRIPTOR), 0,
+    7, 5, // bLength, ENDPOINT
+    0x80 | kBootEndpoint,
+    0x03, // interrupt
+    kBootReportSize, 0,
+    1, // bInterval, 1ms
+
+    // NKRO keyboard
+    9, 4, // bLength, INTERFACE
+    1, 0, // bInterfaceNumber, bAlternateSetting
+    1, // bNumEndpoints
+    0x03, 0x00, 0x00, // HID, no subclass or protocol
+    0, // iInterface
+    9, 0x21, // bLength, HID
+    0x11, 0x01, // HID 1.11
+    0, 1, // no country code, one report descriptor
+    0x22, sizeof(NKRO_REPORT_DESCRIPTOR), 0,
+    7, 5, // bLength, ENDPOINT
+    0x80 | kNkroEndpoint,
+    0x03, // interrupt
+    32, 0,
+    1, // bInterval, 1ms
+};
+static_assert(sizeof(CONFIG_DESCRIPTOR) == kConfigSize, "");
+
+// String descriptors are stored as ASCII and widened as they are sent
+static const char MANUFACTURER[] __attribute__((progmem)) = "flutterby";
+static const char PRODUCT[] __attribute__((progmem)) = "flutterby keyboard";
+
+// Device state
+static volatile u8 CONFIGURATION = 0;
+static volatile u8 PROTOCOL = 1; // report protocol
+static volatile u8 IDLE = 0;
+static volatile u8 LEDS = 0;
+static volatile bool NKRO = true;
+static volatile u16 REPORTS = 0;
+
+// Keyboard state.  The bitmap holds every key; the boot report holds
+// the first six in the order that they were pressed and OVERFLOW counts
+// the pressed keys that didn't fit.
+static u8 MODS = 0;
+static u8 BITMAP[kNkroBitmapSize];
+static u8 BOOT_KEYS[6];
+static u8 BOOT_COUNT = 0;
+static u8 OVERFLOW = 0;
+// The endpoints, as a bitmask, with a report waiting to be loaded
+static volatile u8 DIRTY = 0;
+// Keys whose press hasn't been loaded into a report yet, and those of
+// them that have been released since.  Indexed like BITMAP, where
+// usages 0xe0-0xe7 fall into the extra last byte.
+static u8 UNSENT[kNkroBitmapSize + 1];
+static u8 DEFERRED[kNkroBitmapSize + 1];
+
+static inline bool is_set(u8 usage) {
+  return BITMAP[usage >> 3] & (1 << (usage & 7));
+}
+
+static inline bool test(const u8* set, u8 usage) {
+  return set[usage >> 3] & (1 << (usage & 7));
+}
+
+static inline void assign(u8* set, u8 usage, bool value) {
+  u8 bit = 1 << (usage & 7);
+  set[usage >> 3] = value ? set[usage >> 3] | bit : set[usage >> 3] & ~bit;
+}
+
+static u8 active_endpoint() {
+  return (PROTOCOL == 0 || !NKRO) ? kBootEndpoint : kNkroEndpoint;
+}
+
+// Returns byte i of the report for an endpoint.  The endpoint that is
+// not in use reports that nothing is pressed.
+static u8 report_byte(u8 ep, u8 i) {
+  if (ep != active_endpoint()) {
+    return 0;
+  }
+  if (i == 0) {
+    return MODS;
+  }
+  if (ep == kNkroEndpoint) {
+    return BITMAP[i - 1];
+  }
+  if (i == 1) {
+    return 0;
+  }
+  if (OVERFLOW) {
+    return 0x01; // ErrorRollOver
+  }
+  return i - 2 < BOOT_COUNT ? BOOT_KEYS[i - 2] : 0;
+}
+
+static inline u8 report_size(u8 ep) {
+  return ep == kBootEndpoint ? kBootReportSize : kNkroReportSize;
+}
+
+// Mark the reports on the endpoints in mask as changed, and have the
+// endpoint interrupt load them as soon as their bank is free
+static void queue_reports(u8 mask) {
+  DIRTY = DIRTY | mask;
+  if (!CONFIGURATION) {
+    return;
+  }
+  // This may be called part way through a control request
+  u8 selected = reg8(UsbDesc::kUenum);
+  for (u8 ep = kBootEndpoint; ep <= kNkroEndpoint; ++ep) {
+    if (mask & (1 << ep)) {
+      reg8(UsbDesc::kUenum) = ep;
+      reg8(UsbDesc::kUeienx) = kTxine;
+    }
+  }
+  reg8(UsbDesc::kUenum) = selected;
+}
+
+static void boot_add(u8 usage) {
+  if (BOOT_COUNT < sizeof(BOOT_KEYS)) {
+    BOOT_KEYS[BOOT_COUNT++] = usage;
+  } else {
+    ++OVERFLOW;
+  }
+}
+
+static void boot_remove(u8 usage) {
+  for (u8 i = 0; i < BOOT_COUNT; ++i) {
+    if (BOOT_KEYS[i] != usage) {
+      continue;
+    }
+    --BOOT_COUNT;
+    for (; i < BOOT_COUNT; ++i) {
+      BOOT_KEYS[i] = BOOT_KEYS[i + 1];
+    }
+    if (!OVERFLOW) {
+      return;
+    }
+    // Promote one of the keys that didn't fit.  This is the only
+    // place that has to search the bitmap.
+    --OVERFLOW;
+    for (u8 u = 0; u < 0xe0; ++u) {
+      if (!is_set(u)) {
+        continue;
+      }
+      bool present = false;
+      for (u8 k = 0; k < BOOT_COUNT; ++k) {
+        present |= BOOT_KEYS[k] == u;
+      }
+      if (!present) {
+        BOOT_KEYS[BOOT_COUNT++] = u;
+        return;
+      }
+    }
+    return;
+  }
+  // The key was one of those that didn't fit
+  if (OVERFLOW) {
+    --OVERFLOW;
+  }
+}
+
+// Updates the state of a key; returns false if it was already in
+// that state
+static bool change(u8 usage, bool pressed) {
+  if (usage >= 0xe0) {
+    u8 bit = 1 << (usage - 0xe0);
+    if (bool(MODS & bit) == pressed) {
+      return false;
+    }
+    MODS ^= bit;
+  } else {
+    if (is_set(usage) == pressed) {
+      return false;
+    }
+    BITMAP[usage >> 3] ^= 1 << (usage & 7);
+    if (pressed) {
+      boot_add(usage);
+    } else {
+      boot_remove(usage);
+    }
+  }
+  return true;
+}
+
+// Called once the current state has been loaded into a report: every
+// press has now gone out, so the releases that were held back can be
+// applied.  Returns true if there were any.
+static bool release_deferred() {
+  bool any = false;
+  for (u8 i = 0; i < sizeof(UNSENT); ++i) {
+    UNSENT[i] = 0;
+    u8 bits = DEFERRED[i];
+    if (!bits) {
+      continue;
+    }
+    DEFERRED[i] = 0;
+    for (u8 b = 0; b < 8; ++b) {
+      if (bits & (1 << b)) {
+        change((i << 3) | b, false);
+      }
+    }
+    any = true;
+  }
+  return any;
+}
+
+void key(u8 usage, bool pressed) {
+  if (usage < kFirstKey || usage > 0xe7) {
+    return;
+  }
+  interrupt_free([usage, pressed]() {
+    if (test(UNSENT, usage)) {
+      // The host hasn't seen the press yet.  Releasing now would
+      // lose it, so hold the release back until it has been loaded
+      // into a report; pressing again just cancels that release.
+      assign(DEFERRED, usage, !pressed);
+      return;
+    }
+    if (!change(usage, pressed)) {
+      return;
+    }
+    assign(UNSENT, usage, pressed);
+    queue_reports(1 << active_endpoint());
+  });
+}
+
+void release_all() {
+  interrupt_free([]() {
+    MODS = 0;
+    for (auto& b : BITMAP) {
+      b = 0;
+    }
+    BOOT_COUNT = 0;
+    OVERFLOW = 0;
+    for (u8 i = 0; i < sizeof(UNSENT); ++i) {
+      UNSENT[i] = 0;
+      DEFERRED[i] = 0;
+    }
+    queue_reports(1 << active_endpoint());
+  });
+}
+
+void set_nkro(bool enable) {
+  interrupt_free([enable]() {
+    if (NKRO != enable) {
+      NKRO = enable;
+      // Release everything on the endpoint that we are leaving
+      queue_reports((1 << kBootEndpoint) | (1 << kNkroEndpoint));
+    }
+  });
+}
+
+bool configured() {
+  return CONFIGURATION != 0;
+}
+
+bool boot_protocol() {
+  return PROTOCOL == 0;
+}
+
+u8 leds() {
+  return LEDS;
+}
+
+u16 reports_sent() {
+  return interrupt_free([]() { return REPORTS; });
+}
+
+void copy_report(u8 endpoint, u8* dest) {
+  interrupt_free([endpoint, dest]() {
+    for (u8 i = 0; i < report_size(endpoint); ++i) {
+      dest[i] = report_byte(endpoint, i);
+    }
+  });
+}
+
+void attach() {
+  power::acquire(power::Peripheral::Usb);
+  reg8(UsbDesc::kUhwcon) = kUvrege;
+  reg8(UsbDesc::kUsbcon) = kUsbe | kFrzclk;
+  // The PLL needs an 8MHz input
+  reg8(UsbDesc::kPllcsr) = (F_CPU == 16000000 ? kPindiv : 0) | kPlle;
+  while (!(reg8(UsbDesc::kPllcsr) & kPlock)) {
+  }
+  reg8(UsbDesc::kUsbcon) = kUsbe | kOtgpade;
+  interrupt_free([]() {
+    CONFIGURATION = 0;
+    PROTOCOL = 1;
+    REPORTS = 0;
+    reg8(UsbDesc::kUdien) = kEorst;
+    // Full speed, and attach
+    reg8(UsbDesc::kUdcon) = 0;
+  });
+}
+
+void detach() {
+  interrupt_free([]() {
+    reg8(UsbDesc::kUdcon) = kDetach;
+    reg8(UsbDesc::kUdien) = 0;
+    CONFIGURATION = 0;
+  });
+  reg8(UsbDesc::kUsbcon) = kFrzclk;
+  reg8(UsbDesc::kPllcsr) = 0;
+  reg8(UsbDesc::kUhwcon) = 0;
+  power::release(power::Peripheral::Usb);
+}
+
+IRQ_USB_GEN {
+  u8 pending = reg8(UsbDesc::kUdint);
+  reg8(UsbDesc::kUdint) = 0;
+  if (pending & kEorst) {
+    // The bus was reset; set up the control endpoint and
+    // wait to be enumerated again
+    reg8(UsbDesc::kUenum) = 0;
+    reg8(UsbDesc::kUeconx) = kEpen;
+    reg8(UsbDesc::kUecfg0x) = kControl;
+    reg8(UsbDesc::kUecfg1x) = kSize32 | kAlloc;
+    reg8(UsbDesc::kUeienx) = kRxstpe;
+    CONFIGURATION = 0;
+    PROTOCOL = 1;
+  }
+}
+
+// Control transfer helpers.  These operate on endpoint 0 and busy wait
+// for the host; each stage of a transfer is quick compared with the
+// 1ms frame.
+static inline u8 wait_in_or_out() {
+  u8 bits;
+  do {
+    bits = reg8(UsbDesc::kUeintx);
+  } while (!(bits & (kTxini | kRxouti)));
+  return bits;
+}
+
+static inline void wait_in() {
+  while (!(reg8(UsbDesc::kUeintx) & kTxini)) {
+  }
+}
+
+static inline void send_in() {
+  reg8(UsbDesc::kUeintx) = u8(~kTxini);
+}
+
+static inline void wait_out() {
+  while (!(reg8(UsbDesc::kUeintx) & kRxouti)) {
+  }
+}
+
+static inline void ack_out() {
+  reg8(UsbDesc::kUeintx) = u8(~kRxouti);
+}
+
+static inline void stall() {
+  reg8(UsbDesc::kUeconx) = kStallrq | kEpen;
+}
+
+// Send the data stage of a control read, len bytes produced by
+// byte(i), in kControlSize packets.  Stops early if the host moves on
+// to the status stage.
+template <typename Func>
+static void send_control(u16 len, u16 requested, Func&& byte) {
+  if (len > requested) {
+    len = requested;
+  }
+  u16 pos = 0;
+  u8 n;
+  do {
+    if (wait_in_or_out() & kRxouti) {
+      return;
+    }
+    n = len - pos < kControlSize ? len - pos : kControlSize;
+    for (u8 i = 0; i < n; ++i) {
+      reg8(UsbDesc::kUedatx) = byte(pos++);
+    }
+    send_in();
+    // A full packet at the end of a short transfer is followed by a
+    // zero length packet
+  } while (pos < len || (n == kControlSize && len < requested));
+}
+
+static void send_progmem(const u8* data, u16 len, u16 requested) {
+  send_control(len, requested, [data](u16 i) {
+    return progmem_deref(&data[i]);
+  });
+}
+
+static void send_string(const char* str, u16 requested) {
+  u8 chars = 0;
+  while (progmem_deref(&str[chars])) {
+    ++chars;
+  }
+  u8 len = 2 + 2 * chars;
+  send_control(len, requested, [str, len](u16 i) -> u8 {
+    if (i == 0) {
+      return len;
+    }
+    if (i == 1) {
+      return 3; // STRING
+    }
+    return (i & 1) ? 0 : progmem_deref(&str[(i - 2) / 2]);
+  });
+}
+
+static void get_descriptor(u16 value, u16 index, u16 requested) {
+  u8 type = value >> 8;
+  u8 idx = value & 0xff;
+  switch (type) {
+    case 1:
+      send_progmem(DEVICE_DESCRIPTOR, sizeof(DEVICE_DESCRIPTOR), requested);
+      return;
+    case 2:
+      send_progmem(CONFIG_DESCRIPTOR, sizeof(CONFIG_DESCRIPTOR), requested);
+      return;
+    case 3:
+      if (idx == 0) {
+        static const u8 LANGUAGES[] __attribute__((progmem)) = {
+            4, 3, 0x09, 0x04}; // US English
+        send_progmem(LANGUAGES, sizeof(LANGUAGES), requested);
+      } else if (idx == 1) {
+        send_string(MANUFACTURER, requested);
+      } else if (idx == 2) {
+        send_string(PRODUCT, requested);
+      } else {
+        break;
+      }
+      return;
+    case 0x21: // HID
+      send_progmem(
+          CONFIG_DESCRIPTOR + (index == 0 ? kBootHidOffset : kNkroHidOffset),
+          9,
+          requested);
+      return;
+    case 0x22: // HID report
+      if (index == 0) {
+        send_progmem(
+            BOOT_REPORT_DESCRIPTOR, sizeof(BOOT_REPORT_DESCRIPTOR), requested);
+      } else {
+        send_progmem(
+            NKRO_REPORT_DESCRIPTOR, sizeof(NKRO_REPORT_DESCRIPTOR), requested);
+      }
+      return;
+  }
+  stall();
+}
+
+static void configure_endpoints() {
+  for (u8 ep = kBootEndpoint; ep <= kNkroEndpoint; ++ep) {
+    reg8(UsbDesc::kUenum) = ep;
+    reg8(UsbDesc::kUeconx) = kEpen;
+    reg8(UsbDesc::kUecfg0x) = kInterruptIn;
+    reg8(UsbDesc::kUecfg1x) =
+        (ep == kBootEndpoint ? kSize8 : kSize32) | kAlloc;
+  }
+  reg8(UsbDesc::kUerst) = (1 << kBootEndpoint) | (1 << kNkroEndpoint);
+  reg8(UsbDesc::kUerst) = 0;
+  // Let the host know the current state
+  queue_reports((1 << kBootEndpoint) | (1 << kNkroEndpoint));
+}
+
+static void control_request() {
+  u8 request_type = reg8(UsbDesc::kUedatx);
+  u8 request = reg8(UsbDesc::kUedatx);
+  u16 value = reg8(UsbDesc::kUedatx);
+  value |= reg8(UsbDesc::kUedatx) << 8;
+  u16 index = reg8(UsbDesc::kUedatx);
+  index |= reg8(UsbDesc::kUedatx) << 8;
+  u16 length = reg8(UsbDesc::kUedatx);
+  length |= reg8(UsbDesc::kUedatx) << 8;
+  reg8(UsbDesc::kUeintx) = u8(~(kRxstpi | kRxouti | kTxini));
+
+  switch (request_type) {
+    case 0x80: // standard, device to host
+      if (request == kGetDescriptor) {
+        get_descriptor(value, index, length);
+        return;
+      }
+      if (request == kGetConfiguration) {
+        u8 config = CONFIGURATION;
+        send_control(1, length, [config](u16) { return config; });
+        return;
+      }
+      if (request == kGetStatus) {
+        send_control(2, length, [](u16) { return u8(0); });
+        return;
+      }
+      break;
+    case 0x81: // standard, interface to host
+      if (request == kGetDescriptor) {
+        get_descriptor(value, index, length);
+        return;
+      }
+      break;
+    case 0x00: // standard, host to device
+      if (request == kSetAddress) {
+        // The address takes effect after the status stage
+        send_in();
+        wait_in();
+        reg8(UsbDesc::kUdaddr) = (value & 0x7f) | kAdden;
+        return;
+      }
+      if (request == kSetConfiguration) {
+        CONFIGURATION = value;
+        send_in();
+        if (CONFIGURATION) {
+          configure_endpoints();
+        }
+        set_event_pending();
+        return;
+      }
+      break;
+    case 0xa1: // class, interface to host
+      if (request == kGetReport) {
+        u8 ep = index == 0 ? kBootEndpoint : kNkroEndpoint;
+        send_control(report_size(ep), length, [ep](u16 i) {
+          return report_byte(ep, i);
+        });
+        return;
+      }
+      if (request == kGetIdle) {
+        u8 idle = IDLE;
+        send_control(1, length, [idle](u16) { return idle; });
+        return;
+      }
+      if (request == kGetProtocol) {
+        u8 protocol = PROTOCOL;
+        send_control(1, length, [protocol](u16) { return protocol; });
+        return;
+      }
+      break;
+    case 0x21: // class, host to interface
+      if (request == kSetReport) {
+        // The LED output report of the boot keyboard
+        wait_out();
+        LEDS = reg8(UsbDesc::kUedatx);
+        ack_out();
+        send_in();
+        set_event_pending();
+        return;
+      }
+      if (request == kSetIdle) {
+        // Reports are only sent on change, so the idle rate is
+        // recorded but otherwise ignored
+        IDLE = value >> 8;
+        send_in();
+        return;
+      }
+      if (request == kSetProtocol) {
+        if (index == 0 && PROTOCOL != (value & 0xff)) {
+          PROTOCOL = value & 0xff;
+          queue_reports((1 << kBootEndpoint) | (1 << kNkroEndpoint));
+        }
+        send_in();
+        return;
+      }
+      break;
+  }
+  stall();
+}
+
+// Load the latest report for an endpoint into its bank
+static void load_report(u8 ep) {
+  for (u8 i = 0; i < report_size(ep); ++i) {
+    reg8(UsbDesc::kUedatx) = report_byte(ep, i);
+  }
+  // Clearing FIFOCON hands the bank to the controller
+  reg8(UsbDesc::kUeintx) = u8(~(kFifocon | kTxini));
+  REPORTS = REPORTS + 1;
+  if (ep == active_endpoint() && release_deferred()) {
+    // The releases go out in the next report
+    DIRTY = DIRTY | (1 << ep);
+  }
+}
+
+IRQ_USB_COM {
+  u8 pending = reg8(UsbDesc::kUeint);
+  if (pending & 1) {
+    reg8(UsbDesc::kUenum) = 0;
+    if (reg8(UsbDesc::kUeintx) & kRxstpi) {
+      control_request();
+    }
+  }
+  for (u8 ep = kBootEndpoint; ep <= kNkroEndpoint; ++ep) {
+    u8 mask = 1 << ep;
+    if (!(pending & mask)) {
+      continue;
+    }
+    reg8(UsbDesc::kUenum) = ep;
+    if (!(reg8(UsbDesc::kUeintx) & kTxini)) {
+      continue;
+    }
+    if (DIRTY & mask) {
+      DIRTY = DIRTY & ~mask;
+      load_report(ep);
+    } else {
+      // Nothing more to send until the next change
+      reg8(UsbDesc::kUeienx) = 0;
+    }
+  }
+}
+}
+}
+#endif
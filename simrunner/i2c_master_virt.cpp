@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "i2c_master_virt.h"
+#include "simavr/avr_twi.h"
+#include "simavr/sim_time.h"
+
+enum {
+  I2C_MASTER_IRQ_OUTPUT = 0, // from the AVR to us
+  I2C_MASTER_IRQ_INPUT, // from us to the AVR
+  I2C_MASTER_IRQ_COUNT
+};
+
+static const char* _i2c_master_irq_names[I2C_MASTER_IRQ_COUNT] = {
+    [I2C_MASTER_IRQ_OUTPUT] = "32<i2c_master.in",
+    [I2C_MASTER_IRQ_INPUT] = "8>i2c_master.out",
+};
+
+// The steps of the read/write-back cycle.  Each step is waiting
+// for the AVR to respond to the message that we sent when we
+// entered that state.
+enum {
+  STATE_IDLE,
+  STATE_READ_ADDR_W, // sent START + SLA+W for the register select
+  STATE_READ_REG, // sent the register number
+  STATE_READ_ADDR_R, // sent repeated START + SLA+R
+  STATE_READ_DATA, // requested a data byte
+  STATE_WRITE_ADDR_W, // sent START + SLA+W for the write-back
+  STATE_WRITE_REG, // sent the register number
+  STATE_WRITE_DATA, // sent a data byte
+};
+
+static void
+send(i2c_master_virt_t* p, uint8_t msg, uint8_t addr, uint8_t data) {
+  avr_raise_irq(
+      p->irq + I2C_MASTER_IRQ_INPUT, avr_twi_irq_msg(msg, addr, data));
+}
+
+static void finish(i2c_master_virt_t* p, const char* why) {
+  if (p->state != STATE_IDLE) {
+    send(p, TWI_COND_STOP, p->slave_address << 1, 0);
+  }
+  if (p->verbose && why) {
+    printf("i2c_master: %s\n", why);
+  }
+  p->state = STATE_IDLE;
+}
+
+static void request_byte(i2c_master_virt_t* p) {
+  // ACK signals that we want more data after this byte
+  uint8_t more = p->pos + 1 < p->len ? TWI_COND_ACK : 0;
+  send(p, TWI_COND_READ | more, (p->slave_address << 1) | 1, 0);
+}
+
+static void
+i2c_master_virt_out_hook(struct avr_irq_t* irq, uint32_t value, void* param) {
+  auto p = (i2c_master_virt_t*)param;
+  avr_twi_msg_irq_t v;
+  v.u.v = value;
+
+  if ((v.u.twi.addr >> 1) != p->slave_address) {
+    // Not a response from our slave
+    return;
+  }
+
+  switch (p->state) {
+    case STATE_IDLE:
+      return;
+
+    case STATE_READ_ADDR_W:
+      if (!(v.u.twi.msg & TWI_COND_ACK)) {
+        return finish(p, "slave did not ack SLA+W");
+      }
+      p->state = STATE_READ_REG;
+      send(p, TWI_COND_WRITE, p->slave_address << 1, 0);
+      return;
+
+    case STATE_READ_REG:
+      if (!(v.u.twi.msg & TWI_COND_ACK)) {
+        return finish(p, "slave did not ack the register number");
+      }
+      p->state = STATE_READ_ADDR_R;
+      send(p, TWI_COND_START, (p->slave_address << 1) | 1, 0);
+      return;
+
+    case STATE_READ_ADDR_R:
+      if (!(v.u.twi.msg & TWI_COND_ACK)) {
+        return finish(p, "slave did not ack SLA+R");
+      }
+      p->state = STATE_READ_DATA;
+      p->pos = 0;
+      request_byte(p);
+      return;
+
+    case STATE_READ_DATA:
+      if (!(v.u.twi.msg & TWI_COND_READ)) {
+        return;
+      }
+      p->data[p->pos++] = v.u.twi.data;
+      if (p->pos < p->len) {
+        request_byte(p);
+        return;
+      }
+      // Now write it all back into the mailbox
+      send(p, TWI_COND_STOP, p->slave_address << 1, 0);
+      p->state = STATE_WRITE_ADDR_W;
+      send(p, TWI_COND_START, p->slave_address << 1, 0);
+      return;
+
+    case STATE_WRITE_ADDR_W:
+      if (!(v.u.twi.msg & TWI_COND_ACK)) {
+        return finish(p, "slave did not ack write-back SLA+W");
+      }
+      p->state = STATE_WRITE_REG;
+      send(p, TWI_COND_WRITE, p->slave_address << 1, 0);
+      return;
+
+    case STATE_WRITE_REG:
+      if (!(v.u.twi.msg & TWI_COND_ACK)) {
+        return finish(p, "slave did not ack the register number");
+      }
+      p->state = STATE_WRITE_DATA;
+      p->pos = 0;
+      send(p, TWI_COND_WRITE, p->slave_address << 1, p->data[p->pos]);
+      return;
+
+    case STATE_WRITE_DATA:
+      if (!(v.u.twi.msg & TWI_COND_ACK)) {
+        return finish(p, "slave NACKd the mailbox write");
+      }
+      if (++p->pos < p->len) {
+        send(p, TWI_COND_WRITE, p->slave_address << 1, p->data[p->pos]);
+        return;
+      }
+      p->transactions++;
+      return finish(p, "write-back complete");
+  }
+}
+
+static avr_cycle_count_t
+i2c_master_virt_tick(struct avr_t* avr, avr_cycle_count_t when, void* param) {
+  auto p = (i2c_master_virt_t*)param;
+  avr_cycle_count_t next = when + avr_usec_to_cycles(avr, p->period_us);
+
+  if ((avr->data[I2C_MASTER_VIRT_TWAR] >> 1) != p->slave_address) {
+    // The firmware hasn't enabled slave mode (yet)
+    return next;
+  }
+
+  if (p->state != STATE_IDLE) {
+    // The previous cycle stalled; abandon it
+    finish(p, "timed out waiting for the slave");
+  }
+
+  p->state = STATE_READ_ADDR_W;
+  send(p, TWI_COND_START, p->slave_address << 1, 0);
+  return next;
+}
+
+void i2c_master_virt_init(
+    struct avr_t* avr,
+    i2c_master_virt_t* p,
+    uint8_t slave_address,
+    uint8_t len) {
+  memset(p, 0, sizeof(*p));
+  p->avr = avr;
+  p->slave_address = slave_address;
+  p->len = len > I2C_MASTER_VIRT_MAX_LEN ? I2C_MASTER_VIRT_MAX_LEN : len;
+  p->period_us = 10000;
+  p->state = STATE_IDLE;
+
+  p->irq = avr_alloc_irq(
+      &avr->irq_pool, 0, I2C_MASTER_IRQ_COUNT, _i2c_master_irq_names);
+  avr_irq_register_notify(
+      p->irq + I2C_MASTER_IRQ_OUTPUT, i2c_master_virt_out_hook, p);
+
+  avr_cycle_timer_register_usec(avr, p->period_us, i2c_master_virt_tick, p);
+}
+
+void i2c_master_virt_attach_twi(i2c_master_virt_t* p, uint32_t i2c_irq_base) {
+  avr_connect_irq(
+      p->irq + I2C_MASTER_IRQ_INPUT,
+      avr_io_getirq(p->avr, i2c_irq_base, TWI_IRQ_INPUT));
+  avr_connect_irq(
+      avr_io_getirq(p->avr, i2c_irq_base, TWI_IRQ_OUTPUT),
+      p->irq + I2C_MASTER_IRQ_OUTPUT);
+}
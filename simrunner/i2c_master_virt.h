@@ -0,0 +1,50 @@
+#pragma once
+#include "simavr/sim_avr.h"
+#include "simavr/sim_irq.h"
+
+/*
+ * A virtual TWI bus master used to exercise the I2cSlave driver.
+ *
+ * It stays idle until the firmware enables slave mode on the expected
+ * address (by watching TWAR).  From then on, every period_us it:
+ *
+ *  1. selects register 0 and performs a burst read of len bytes
+ *  2. writes those same bytes back into the slave mailbox, starting
+ *     at register 0
+ *
+ * The firmware under test can then compare its mailbox with the
+ * snapshot that it published to verify the round trip.
+ *
+ * This relies on the slave mode support in simavr's TWI implementation.
+ */
+
+#define I2C_MASTER_VIRT_MAX_LEN 32
+
+/* TWAR lives at the same address on the atmega328p and atmega32u4 */
+#define I2C_MASTER_VIRT_TWAR 0xba
+
+typedef struct i2c_master_virt_t {
+  struct avr_t* avr;
+  avr_irq_t* irq;
+  uint8_t verbose;
+
+  uint8_t slave_address; // 7-bit address of the slave to talk to
+  uint8_t len; // number of bytes to burst read
+  uint32_t period_us; // how often to run the read/write-back cycle
+
+  int state;
+  uint8_t pos;
+  uint8_t data[I2C_MASTER_VIRT_MAX_LEN];
+  uint32_t transactions; // number of completed read/write-back cycles
+} i2c_master_virt_t;
+
+void i2c_master_virt_init(
+    struct avr_t* avr,
+    i2c_master_virt_t* p,
+    uint8_t slave_address,
+    uint8_t len);
+
+/*
+ * Connect the virtual master to the AVR TWI; pass AVR_IOCTL_TWI_GETIRQ(0)
+ */
+void i2c_master_virt_attach_twi(i2c_master_virt_t* p, uint32_t i2c_irq_base);
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "keymatrix_virt.h"
+#include "simavr/avr_ioport.h"
+#include "simavr/sim_time.h"
+
+static keymatrix_virt_port_t* find_port(keymatrix_virt_t* p, char name) {
+  for (uint8_t i = 0; i < p->num_ports; ++i) {
+    if (p->ports[i].name == name) {
+      return &p->ports[i];
+    }
+  }
+  return nullptr;
+}
+
+// Recompute the level of each column from the switches and the rows
+// that the AVR is currently driving low
+static void update_columns(keymatrix_virt_t* p) {
+  uint16_t active_rows = 0;
+  for (uint8_t r = 0; r < p->rows; ++r) {
+    auto port = find_port(p, p->row_pins[r].port);
+    uint8_t mask = 1 << p->row_pins[r].pin;
+    if ((port->ddr & mask) && !(port->port & mask)) {
+      active_rows |= 1 << r;
+    }
+  }
+
+  for (uint8_t c = 0; c < p->cols; ++c) {
+    auto port = find_port(p, p->col_pins[c].port);
+    uint8_t mask = 1 << p->col_pins[c].pin;
+    if ((port->ddr & mask) || !(port->port & mask)) {
+      // Not an input with a pull-up; leave it alone
+      continue;
+    }
+
+    uint32_t level = 1;
+    for (uint8_t r = 0; r < p->rows; ++r) {
+      if ((active_rows & (1 << r)) && (p->closed[r] & (1 << c))) {
+        level = 0;
+        break;
+      }
+    }
+    avr_raise_irq(
+        avr_io_getirq(
+            p->avr, AVR_IOCTL_IOPORT_GETIRQ(port->name), p->col_pins[c].pin),
+        level);
+  }
+}
+
+static void
+keymatrix_virt_ddr_hook(struct avr_irq_t* irq, uint32_t value, void* param) {
+  auto port = (keymatrix_virt_port_t*)param;
+  port->ddr = value;
+  update_columns(port->matrix);
+}
+
+static void
+keymatrix_virt_port_hook(struct avr_irq_t* irq, uint32_t value, void* param) {
+  auto port = (keymatrix_virt_port_t*)param;
+  port->port = value;
+  update_columns(port->matrix);
+}
+
+static void add_port(keymatrix_virt_t* p, char name) {
+  if (find_port(p, name) || p->num_ports >= KEYMATRIX_VIRT_MAX_PORTS) {
+    return;
+  }
+  auto port = &p->ports[p->num_ports++];
+  port->matrix = p;
+  port->name = name;
+
+  avr_irq_register_notify(
+      avr_io_getirq(
+          p->avr, AVR_IOCTL_IOPORT_GETIRQ(name), IOPORT_IRQ_DIRECTION_ALL),
+      keymatrix_virt_ddr_hook,
+      port);
+  avr_irq_register_notify(
+      avr_io_getirq(p->avr, AVR_IOCTL_IOPORT_GETIRQ(name), IOPORT_IRQ_REG_PORT),
+      keymatrix_virt_port_hook,
+      port);
+}
+
+void keymatrix_virt_init(
+    struct avr_t* avr,
+    keymatrix_virt_t* p,
+    const keymatrix_virt_pin_t* row_pins,
+    uint8_t rows,
+    const keymatrix_virt_pin_t* col_pins,
+    uint8_t cols) {
+  memset(p, 0, sizeof(*p));
+  p->avr = avr;
+  p->rows = rows > KEYMATRIX_VIRT_MAX_ROWS ? KEYMATRIX_VIRT_MAX_ROWS : rows;
+  p->cols = cols > KEYMATRIX_VIRT_MAX_COLS ? KEYMATRIX_VIRT_MAX_COLS : cols;
+  memcpy(p->row_pins, row_pins, p->rows * sizeof(*row_pins));
+  memcpy(p->col_pins, col_pins, p->cols * sizeof(*col_pins));
+
+  for (uint8_t r = 0; r < p->rows; ++r) {
+    add_port(p, p->row_pins[r].port);
+  }
+  for (uint8_t c = 0; c < p->cols; ++c) {
+    add_port(p, p->col_pins[c].port);
+  }
+}
+
+void keymatrix_virt_set_key(
+    keymatrix_virt_t* p,
+    uint8_t row,
+    uint8_t col,
+    uint8_t pressed) {
+  if (row >= p->rows || col >= p->cols) {
+    return;
+  }
+  if (p->verbose) {
+    printf(
+        "keymatrix: %u,%u %s\n", row, col, pressed ? "pressed" : "released");
+  }
+  if (pressed) {
+    p->closed[row] |= 1 << col;
+  } else {
+    p->closed[row] &= ~(1 << col);
+  }
+  update_columns(p);
+}
+
+static avr_cycle_count_t
+keymatrix_virt_tick(struct avr_t* avr, avr_cycle_count_t when, void* param) {
+  auto p = (keymatrix_virt_t*)param;
+
+  // Apply everything that is due, then sleep until the next event
+  while (p->script_pos < p->script_len) {
+    auto& ev = p->script[p->script_pos];
+    auto due = avr_usec_to_cycles(avr, ev.at_us);
+    if (due > when) {
+      return due;
+    }
+    keymatrix_virt_set_key(p, ev.row, ev.col, ev.pressed);
+    p->script_pos++;
+  }
+  return 0;
+}
+
+void keymatrix_virt_play(
+    keymatrix_virt_t* p,
+    const keymatrix_virt_event_t* script,
+    size_t len) {
+  p->script = script;
+  p->script_len = len;
+  p->script_pos = 0;
+  if (len > 0) {
+    avr_cycle_timer_register(
+        p->avr,
+        avr_usec_to_cycles(p->avr, script[0].at_us),
+        keymatrix_virt_tick,
+        p);
+  }
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <stddef.h>
+#include "simavr/sim_avr.h"
+#include "simavr/sim_irq.h"
+
+/*
+ * A virtual switch matrix with a diode per switch, as used by
+ * flutterby::KeyMatrix.
+ *
+ * The row pins are outputs from the AVR and the column pins are inputs
+ * with pull-ups.  A closed switch pulls its column low whenever its row
+ * is driven low.  The matrix only drives a column while the firmware has
+ * configured that pin as an input with its pull-up enabled, so other
+ * firmware that uses the same pins for something else is unaffected.
+ *
+ * The switches are operated by a script of timed events so that tests
+ * can check what the firmware reports and when.
+ */
+
+#define KEYMATRIX_VIRT_MAX_ROWS 8
+#define KEYMATRIX_VIRT_MAX_COLS 16
+#define KEYMATRIX_VIRT_MAX_PORTS 4
+
+typedef struct keymatrix_virt_pin_t {
+  char port;
+  uint8_t pin;
+} keymatrix_virt_pin_t;
+
+typedef struct keymatrix_virt_event_t {
+  uint32_t at_us; // simulated time since reset
+  uint8_t row;
+  uint8_t col;
+  uint8_t pressed;
+} keymatrix_virt_event_t;
+
+struct keymatrix_virt_t;
+
+// Our view of the DDR and PORT registers of one of the AVR ports
+typedef struct keymatrix_virt_port_t {
+  struct keymatrix_virt_t* matrix;
+  char name;
+  uint8_t ddr;
+  uint8_t port;
+} keymatrix_virt_port_t;
+
+typedef struct keymatrix_virt_t {
+  struct avr_t* avr;
+  uint8_t verbose;
+
+  uint8_t rows;
+  uint8_t cols;
+  keymatrix_virt_pin_t row_pins[KEYMATRIX_VIRT_MAX_ROWS];
+  keymatrix_virt_pin_t col_pins[KEYMATRIX_VIRT_MAX_COLS];
+  uint16_t closed[KEYMATRIX_VIRT_MAX_ROWS]; // bitmap of closed switches
+
+  uint8_t num_ports;
+  keymatrix_virt_port_t ports[KEYMATRIX_VIRT_MAX_PORTS];
+
+  const keymatrix_virt_event_t* script;
+  size_t script_len;
+  size_t script_pos;
+} keymatrix_virt_t;
+
+void keymatrix_virt_init(
+    struct avr_t* avr,
+    keymatrix_virt_t* p,
+    const keymatrix_virt_pin_t* row_pins,
+    uint8_t rows,
+    const keymatrix_virt_pin_t* col_pins,
+    uint8_t cols);
+
+/*
+ * Open or close a switch immediately
+ */
+void keymatrix_virt_set_key(
+    keymatrix_virt_t* p,
+    uint8_t row,
+    uint8_t col,
+    uint8_t pressed);
+
+/*
+ * Play the events in order at their scheduled times.  The events must
+ * be sorted by time and must outlive the simulation.
+ */
+void keymatrix_virt_play(
+    keymatrix_virt_t* p,
+    const keymatrix_virt_event_t* script,
+    size_t len);
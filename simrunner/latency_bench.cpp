@@ -0,0 +1,166 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "latency_bench.h"
+#include "simavr/avr_ioport.h"
+#include "simavr/avr_uart.h"
+#include "simavr/sim_time.h"
+
+static uint64_t now_us(latency_bench_t* p) {
+  return avr_cycles_to_usec(p->avr, p->avr->cycle);
+}
+
+// A small LCG; the sequence only needs to be repeatable
+static uint32_t next_random(latency_bench_t* p) {
+  p->seed = p->seed * 1103515245 + 12345;
+  return p->seed >> 8;
+}
+
+static void observe(latency_bench_t* p, uint8_t which) {
+  auto& src = p->sources[which];
+  if (!src.waiting) {
+    return;
+  }
+  src.waiting = 0;
+  auto latency = now_us(p) - p->changed_at_us;
+  if (src.count < LATENCY_BENCH_MAX_SAMPLES) {
+    src.samples[src.count++] = latency;
+  }
+  if (p->verbose) {
+    printf("latency: %s %" PRIu64 "us\n", src.name, latency);
+  }
+}
+
+static void uart_hook(struct avr_irq_t* irq, uint32_t value, void* param) {
+  observe((latency_bench_t*)param, LATENCY_BENCH_UART);
+}
+
+static void marker_hook(struct avr_irq_t* irq, uint32_t value, void* param) {
+  observe((latency_bench_t*)param, LATENCY_BENCH_GPIO);
+}
+
+void latency_bench_usb_report(
+    void* param,
+    uint8_t ep,
+    const uint8_t* report,
+    uint32_t len,
+    uint64_t at_us) {
+  observe((latency_bench_t*)param, LATENCY_BENCH_USB);
+}
+
+static avr_cycle_count_t
+latency_bench_tick(struct avr_t* avr, avr_cycle_count_t when, void* param) {
+  auto p = (latency_bench_t*)param;
+
+  // Anything that hasn't responded to the previous change missed it
+  for (auto& src : p->sources) {
+    if (src.waiting) {
+      src.waiting = 0;
+      src.misses++;
+    }
+  }
+
+  if (p->made >= p->changes) {
+    // Leave the last key released
+    p->done = 1;
+    return 0;
+  }
+
+  // Press then release each key in turn
+  auto key = p->made / 2;
+  uint8_t row = (key / p->matrix->cols) % p->matrix->rows;
+  uint8_t col = key % p->matrix->cols;
+  bool pressed = (p->made & 1) == 0;
+  p->made++;
+
+  for (auto& src : p->sources) {
+    src.waiting = 1;
+  }
+  p->changed_at_us = now_us(p);
+  keymatrix_virt_set_key(p->matrix, row, col, pressed);
+
+  uint32_t delay = p->interval_us;
+  if (p->jitter_us) {
+    delay += next_random(p) % p->jitter_us;
+  }
+  return when + avr_usec_to_cycles(avr, delay);
+}
+
+void latency_bench_init(
+    struct avr_t* avr,
+    latency_bench_t* p,
+    keymatrix_virt_t* matrix) {
+  memset(p, 0, sizeof(*p));
+  p->avr = avr;
+  p->matrix = matrix;
+  // Leave time for USB enumeration before the first change
+  p->start_us = 300000;
+  p->interval_us = 20000;
+  p->jitter_us = 5000;
+  p->changes = 200;
+  p->seed = 1;
+  p->sources[LATENCY_BENCH_USB].name = "usb";
+  p->sources[LATENCY_BENCH_UART].name = "uart";
+  p->sources[LATENCY_BENCH_GPIO].name = "gpio";
+}
+
+void latency_bench_start(
+    latency_bench_t* p,
+    char marker_port,
+    uint8_t marker_pin) {
+  auto uart = avr_io_getirq(p->avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT);
+  if (uart) {
+    avr_irq_register_notify(uart, uart_hook, p);
+  }
+  auto marker =
+      avr_io_getirq(p->avr, AVR_IOCTL_IOPORT_GETIRQ(marker_port), marker_pin);
+  if (marker) {
+    avr_irq_register_notify(marker, marker_hook, p);
+  }
+  if (p->changes > LATENCY_BENCH_MAX_SAMPLES) {
+    p->changes = LATENCY_BENCH_MAX_SAMPLES;
+  }
+  avr_cycle_timer_register(
+      p->avr,
+      avr_usec_to_cycles(p->avr, p->start_us),
+      latency_bench_tick,
+      p);
+}
+
+static int compare_u32(const void* a, const void* b) {
+  auto x = *(const uint32_t*)a;
+  auto y = *(const uint32_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+int latency_bench_report(latency_bench_t* p) {
+  int responded = 0;
+  for (auto& src : p->sources) {
+    if (src.count == 0) {
+      continue;
+    }
+    responded++;
+    qsort(src.samples, src.count, sizeof(src.samples[0]), compare_u32);
+    // Nearest rank percentiles
+    auto rank = [&](uint32_t percent) {
+      uint32_t r = (src.count * percent + 99) / 100;
+      return src.samples[r ? r - 1 : 0];
+    };
+    printf(
+        "latency: %s: %u samples, %u missed, min %uus, median %uus, "
+        "p99 %uus, max %uus\n",
+        src.name,
+        src.count,
+        src.misses,
+        src.samples[0],
+        rank(50),
+        rank(99),
+        src.samples[src.count - 1]);
+  }
+  if (!responded) {
+    fprintf(stderr, "latency: the firmware didn't respond to any key\n");
+  }
+  return responded;
+}
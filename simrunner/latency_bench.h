@@ -0,0 +1,89 @@
+#pragma once
+#include <stdint.h>
+#include "keymatrix_virt.h"
+#include "simavr/sim_avr.h"
+
+/*
+ * Measures the end to end latency of the firmware: the time from a
+ * switch in a virtual key matrix changing state to the firmware's
+ * response appearing on one of its outputs.
+ *
+ * The bench presses and releases each key of the matrix in turn.  The
+ * time between changes has a pseudo random jitter so that the changes
+ * land at every phase of the firmware's scan loop.  For each change it
+ * records the delay until the first event on each output:
+ *
+ * - a USB report read by the virtual USB host
+ * - a byte transmitted by USART0
+ * - a level change on the marker pin
+ *
+ * An output that doesn't respond before the next change counts as a
+ * miss for that change.  Once every change has been made the bench
+ * is done and latency_bench_report() prints the min, median, p99 and
+ * max latency of each output that responded, in microseconds.
+ */
+
+#define LATENCY_BENCH_MAX_SAMPLES 1024
+
+enum {
+  LATENCY_BENCH_USB,
+  LATENCY_BENCH_UART,
+  LATENCY_BENCH_GPIO,
+  LATENCY_BENCH_SOURCES
+};
+
+typedef struct latency_bench_source_t {
+  const char* name;
+  uint8_t waiting; // no response to the last change yet
+  uint32_t misses;
+  uint32_t count;
+  uint32_t samples[LATENCY_BENCH_MAX_SAMPLES];
+} latency_bench_source_t;
+
+typedef struct latency_bench_t {
+  struct avr_t* avr;
+  keymatrix_virt_t* matrix;
+  uint8_t verbose;
+
+  uint32_t start_us; // time of the first change
+  uint32_t interval_us; // minimum time between changes
+  uint32_t jitter_us; // random extra time between changes
+  uint32_t changes; // the number of changes to make
+
+  uint32_t made;
+  uint64_t changed_at_us;
+  uint32_t seed;
+  uint8_t done;
+
+  latency_bench_source_t sources[LATENCY_BENCH_SOURCES];
+} latency_bench_t;
+
+/*
+ * Prepare the bench with default timing.  The timing fields may be
+ * changed before calling latency_bench_start.
+ */
+void latency_bench_init(
+    struct avr_t* avr,
+    latency_bench_t* p,
+    keymatrix_virt_t* matrix);
+
+/*
+ * Watch USART0 and the given marker pin for responses and schedule the
+ * first change
+ */
+void latency_bench_start(latency_bench_t* p, char marker_port, uint8_t marker_pin);
+
+/*
+ * Record a USB report; pass this to usb_host_virt_on_report
+ */
+void latency_bench_usb_report(
+    void* param,
+    uint8_t ep,
+    const uint8_t* report,
+    uint32_t len,
+    uint64_t at_us);
+
+/*
+ * Print the results.  Returns the number of outputs that responded.
+ */
+int latency_bench_report(latency_bench_t* p);
@@ -2,10 +2,19 @@
 #include <simavr/sim_elf.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <simavr/avr_twi.h>
+#include <simavr/avr_uart.h>
 
 #include "ds1338_virt.h"
+#include "i2c_master_virt.h"
+#include "keymatrix_virt.h"
+#include "latency_bench.h"
+#include "mcp23018_virt.h"
+#include "trace_decode.h"
+#include "uart_pty.h"
+#include "usb_host_virt.h"
 
 const char *firmware_filename = nullptr;
 
@@ -46,11 +55,73 @@ console_write(struct avr_t* avr, avr_io_addr_t addr, uint8_t v, void* param) {
   }
 }
 
+static void trace_emit(
+    void* param,
+    const trace_site_t& site,
+    const std::string& message) {
+  auto avr = (avr_t*)param;
+  AVR_LOG(
+      avr,
+      LOG_OUTPUT,
+      "%ld: %s: %s:%d: %s\n",
+      time(nullptr),
+      firmware_filename,
+      site.file.c_str(),
+      site.line,
+      message.c_str());
+}
+
+// A 4x6 switch matrix for tests/keymatrix.cpp.  The rows are PC0-PC3
+// and the columns span two ports to exercise the port grouping.
+static const keymatrix_virt_pin_t matrix_rows[] = {
+    {'C', 0}, {'C', 1}, {'C', 2}, {'C', 3}};
+static const keymatrix_virt_pin_t matrix_cols[] = {
+    {'D', 4}, {'D', 5}, {'D', 6}, {'D', 7}, {'B', 4}, {'B', 5}};
+
+static const keymatrix_virt_event_t matrix_script[] = {
+    {2000, 1, 2, 1},
+    {4000, 3, 0, 1},
+    {4000, 3, 5, 1},
+    {6000, 1, 2, 0},
+    {8000, 3, 0, 0},
+    {8000, 3, 5, 0},
+};
+
+// The other half of a split keyboard, behind an MCP23018 on the TWI
+// bus, for tests/expander.cpp
+static const keymatrix_virt_event_t expander_script[] = {
+    {20500, 1, 2, 1},
+    {22500, 3, 5, 1},
+    {25500, 1, 2, 0},
+    {26500, 3, 5, 0},
+};
+
+static void trace_uart_out(struct avr_irq_t* irq, uint32_t value, void* param) {
+  trace_decoder_feed((trace_decoder_t*)param, value & 0xff);
+}
+
 int main(int argc, char** argv) {
+  if (argc < 2 ||
+      (argc == 3 && strcmp(argv[2], "--pty") && strcmp(argv[2], "--bench")) ||
+      argc > 3) {
+    fprintf(stderr, "usage: %s FIRMWARE.elf [--pty|--bench]\n", argv[0]);
+    return 1;
+  }
   firmware_filename = argv[1];
+  bool use_pty = argc == 3 && !strcmp(argv[2], "--pty");
+  // Measure the key latency of examples/latency.cpp rather than
+  // playing the test script
+  bool use_bench = argc == 3 && !strcmp(argv[2], "--bench");
 
   elf_firmware_t f = {{0}};
   ds1338_virt_t rtc;
+  i2c_master_virt_t i2c_master;
+  keymatrix_virt_t matrix;
+  mcp23018_virt_t expander;
+  trace_decoder_t trace_decoder;
+  uart_pty_t pty;
+  usb_host_virt_t usb_host;
+  latency_bench_t bench;
 
   // Suppress firmware loading messages on the assumption that it will succeed
   avr_global_logger_set(logger);
@@ -69,6 +140,76 @@ int main(int argc, char** argv) {
   ds1338_virt_attach_twi(&rtc, AVR_IOCTL_TWI_GETIRQ(0));
   rtc.verbose = false;
 
+  // The square wave output drives INT0 on the atmega328p (tests/rtc.cpp)
+  ds1338_pin_t sqw_wiring = {'D', 2};
+  ds1338_virt_attach_square_wave_output(&rtc, &sqw_wiring);
+  // and ICP1 (tests/inputcapture.cpp)
+  ds1338_pin_t icp_wiring = {'B', 0};
+  ds1338_virt_attach_square_wave_output(&rtc, &icp_wiring);
+
+  // Drives tests/i2cslave.cpp; idle unless the firmware enables
+  // slave mode on address 0x10
+  i2c_master_virt_init(avr, &i2c_master, 0x10, 8);
+  i2c_master_virt_attach_twi(&i2c_master, AVR_IOCTL_TWI_GETIRQ(0));
+
+  mcp23018_virt_init(avr, &expander, 0x20, 4, 6);
+  mcp23018_virt_attach_twi(&expander, AVR_IOCTL_TWI_GETIRQ(0));
+  mcp23018_virt_play(
+      &expander,
+      expander_script,
+      sizeof(expander_script) / sizeof(expander_script[0]));
+
+  keymatrix_virt_init(avr, &matrix, matrix_rows, 4, matrix_cols, 6);
+  if (!use_bench) {
+    keymatrix_virt_play(
+        &matrix,
+        matrix_script,
+        sizeof(matrix_script) / sizeof(matrix_script[0]));
+  }
+
+  // Enumerates tests/usb.cpp on parts with a USB controller and
+  // logs the reports that it receives.  The LEDs turn caps lock on.
+  if (usb_host_virt_init(avr, &usb_host) == 0) {
+    usb_host.verbose = !use_bench;
+    usb_host.leds = 0x02;
+  }
+
+  if (use_bench) {
+    // The marker pin is PB1
+    latency_bench_init(avr, &bench, &matrix);
+    latency_bench_start(&bench, 'B', 1);
+    usb_host_virt_on_report(&usb_host, latency_bench_usb_report, &bench);
+  }
+
+  if (use_pty) {
+    // Let host tools such as target/rpcclient talk to USART0
+    if (uart_pty_init(avr, &pty)) {
+      return 1;
+    }
+    uart_pty_connect(&pty, '0');
+    fprintf(stderr, "USART0 is connected to %s\n", pty.slave_name);
+  } else {
+    // Loop the USART0 transmit line back to its receive line so that
+    // tests/serial.cpp can read back what it sends.  We also turn off
+    // the stdio echo; the firmware has the simavr console for output.
+    uint32_t uart_flags = 0;
+    avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &uart_flags);
+    uart_flags &= ~AVR_UART_FLAG_STDIO;
+    avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &uart_flags);
+    avr_connect_irq(
+        avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+        avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT));
+  }
+
+  // If the firmware uses TRACE() then decode its USART0 output
+  trace_decoder_init(&trace_decoder, trace_emit, avr);
+  if (trace_decoder_load(&trace_decoder, firmware_filename) > 0) {
+    avr_irq_register_notify(
+        avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+        trace_uart_out,
+        &trace_decoder);
+  }
+
   // Gnarly poking here replaces the default _avr_io_console_write
   // callback for the simavr console with our implementation that
   // allows escape sequences to be printed
@@ -79,8 +220,13 @@ int main(int argc, char** argv) {
     state = avr_run(avr);
     if (state == cpu_Done || state == cpu_Crashed)
       break;
+    if (use_bench && bench.done)
+      break;
   }
 
   avr_terminate(avr);
+  if (use_bench && state != cpu_Crashed) {
+    return latency_bench_report(&bench) == 0;
+  }
   return state == cpu_Crashed;
 }
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "mcp23018_virt.h"
+#include "simavr/avr_twi.h"
+#include "simavr/sim_time.h"
+
+// The level of the port A pins; outputs read as their latch and the
+// row inputs float high
+static uint8_t read_port_a(mcp23018_virt_t* p) {
+  auto outputs = uint8_t(~p->regs[MCP23018_VIRT_REG_IODIRA]);
+  return (p->regs[MCP23018_VIRT_REG_OLATA] & outputs) | uint8_t(~outputs);
+}
+
+// The level of the port B pins.  A column reads low if a closed switch
+// connects it to a row that is driven low.
+static uint8_t read_port_b(mcp23018_virt_t* p) {
+  auto outputs = uint8_t(~p->regs[MCP23018_VIRT_REG_IODIRB]);
+  uint8_t active_rows = ~read_port_a(p);
+  uint8_t level = 0xff;
+  for (uint8_t r = 0; r < p->rows; ++r) {
+    if (active_rows & (1 << r)) {
+      level &= ~p->closed[r];
+    }
+  }
+  return (p->regs[MCP23018_VIRT_REG_OLATB] & outputs) | (level & ~outputs);
+}
+
+static uint8_t read_reg(mcp23018_virt_t* p, uint8_t reg) {
+  switch (reg) {
+    case MCP23018_VIRT_REG_GPIOA:
+      return read_port_a(p);
+    case MCP23018_VIRT_REG_GPIOB:
+      return read_port_b(p);
+    default:
+      return p->regs[reg];
+  }
+}
+
+static void write_reg(mcp23018_virt_t* p, uint8_t reg, uint8_t value) {
+  switch (reg) {
+    case MCP23018_VIRT_REG_GPIOA:
+      reg = MCP23018_VIRT_REG_OLATA;
+      break;
+    case MCP23018_VIRT_REG_GPIOB:
+      reg = MCP23018_VIRT_REG_OLATB;
+      break;
+  }
+  if (p->verbose) {
+    printf("mcp23018: set register 0x%02x to 0x%02x\n", reg, value);
+  }
+  p->regs[reg] = value;
+}
+
+static void next_reg(mcp23018_virt_t* p) {
+  p->reg_addr = (p->reg_addr + 1) % MCP23018_VIRT_NUM_REGS;
+}
+
+static void
+mcp23018_virt_in_hook(struct avr_irq_t* irq, uint32_t value, void* param) {
+  auto p = (mcp23018_virt_t*)param;
+  avr_twi_msg_irq_t v;
+  v.u.v = value;
+
+  if (v.u.twi.msg & TWI_COND_STOP) {
+    p->selected = 0;
+    p->reg_selected = 0;
+  }
+
+  if (v.u.twi.msg & TWI_COND_START) {
+    // A repeated start keeps the register pointer, so a read can follow
+    // the write that selected the register
+    p->selected = 0;
+    p->reg_selected = 0;
+    if ((v.u.twi.addr >> 1) == p->address) {
+      p->selected = v.u.twi.addr;
+      avr_raise_irq(
+          p->irq + TWI_IRQ_INPUT,
+          avr_twi_irq_msg(TWI_COND_ACK, p->selected, 1));
+    }
+  }
+
+  if (!p->selected) {
+    return;
+  }
+
+  if (v.u.twi.msg & TWI_COND_WRITE) {
+    avr_raise_irq(
+        p->irq + TWI_IRQ_INPUT,
+        avr_twi_irq_msg(TWI_COND_ACK, p->selected, 1));
+    if (!p->reg_selected) {
+      p->reg_selected = 1;
+      p->reg_addr = v.u.twi.data % MCP23018_VIRT_NUM_REGS;
+    } else {
+      write_reg(p, p->reg_addr, v.u.twi.data);
+      next_reg(p);
+    }
+  }
+
+  if (v.u.twi.msg & TWI_COND_READ) {
+    uint8_t data = read_reg(p, p->reg_addr);
+    next_reg(p);
+    avr_raise_irq(
+        p->irq + TWI_IRQ_INPUT,
+        avr_twi_irq_msg(TWI_COND_READ, p->selected, data));
+  }
+}
+
+static const char* _mcp23018_irq_names[MCP23018_IRQ_COUNT] = {
+        [MCP23018_TWI_IRQ_OUTPUT] = "32<mcp23018.in",
+        [MCP23018_TWI_IRQ_INPUT] = "8>mcp23018.out",
+};
+
+void mcp23018_virt_init(
+    struct avr_t* avr,
+    mcp23018_virt_t* p,
+    uint8_t address,
+    uint8_t rows,
+    uint8_t cols) {
+  memset(p, 0, sizeof(*p));
+  p->avr = avr;
+  p->address = address;
+  p->rows = rows > 8 ? 8 : rows;
+  p->cols = cols > 8 ? 8 : cols;
+  // Every pin is an input at power on
+  p->regs[MCP23018_VIRT_REG_IODIRA] = 0xff;
+  p->regs[MCP23018_VIRT_REG_IODIRB] = 0xff;
+
+  p->irq =
+      avr_alloc_irq(&avr->irq_pool, 0, MCP23018_IRQ_COUNT, _mcp23018_irq_names);
+  avr_irq_register_notify(p->irq + TWI_IRQ_OUTPUT, mcp23018_virt_in_hook, p);
+}
+
+void mcp23018_virt_attach_twi(mcp23018_virt_t* p, uint32_t i2c_irq_base) {
+  avr_connect_irq(
+      p->irq + TWI_IRQ_INPUT,
+      avr_io_getirq(p->avr, i2c_irq_base, TWI_IRQ_INPUT));
+  avr_connect_irq(
+      avr_io_getirq(p->avr, i2c_irq_base, TWI_IRQ_OUTPUT),
+      p->irq + TWI_IRQ_OUTPUT);
+}
+
+void mcp23018_virt_set_key(
+    mcp23018_virt_t* p,
+    uint8_t row,
+    uint8_t col,
+    uint8_t pressed) {
+  if (row >= p->rows || col >= p->cols) {
+    return;
+  }
+  if (p->verbose) {
+    printf(
+        "mcp23018: %u,%u %s\n", row, col, pressed ? "pressed" : "released");
+  }
+  if (pressed) {
+    p->closed[row] |= 1 << col;
+  } else {
+    p->closed[row] &= ~(1 << col);
+  }
+}
+
+static avr_cycle_count_t
+mcp23018_virt_tick(struct avr_t* avr, avr_cycle_count_t when, void* param) {
+  auto p = (mcp23018_virt_t*)param;
+
+  while (p->script_pos < p->script_len) {
+    auto& ev = p->script[p->script_pos];
+    auto due = avr_usec_to_cycles(avr, ev.at_us);
+    if (due > when) {
+      return due;
+    }
+    mcp23018_virt_set_key(p, ev.row, ev.col, ev.pressed);
+    p->script_pos++;
+  }
+  return 0;
+}
+
+void mcp23018_virt_play(
+    mcp23018_virt_t* p,
+    const keymatrix_virt_event_t* script,
+    size_t len) {
+  p->script = script;
+  p->script_len = len;
+  p->script_pos = 0;
+  if (len > 0) {
+    avr_cycle_timer_register(
+        p->avr,
+        avr_usec_to_cycles(p->avr, script[0].at_us),
+        mcp23018_virt_tick,
+        p);
+  }
+}
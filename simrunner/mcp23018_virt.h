@@ -0,0 +1,84 @@
+#pragma once
+#include <stddef.h>
+#include "keymatrix_virt.h"
+#include "simavr/sim_avr.h"
+#include "simavr/sim_irq.h"
+
+/*
+ * A virtual MCP23018 16 bit I/O expander on the TWI bus, with a switch
+ * matrix wired to its ports as on the ErgoDox and as expected by
+ * flutterby::Mcp23018Matrix.
+ *
+ * The rows are on port A and the columns on port B.  A closed switch
+ * pulls its column low while its row is an output driven low.  The
+ * registers use the power on IOCON.BANK=0 layout, and the address
+ * pointer increments after each byte and wraps at the end of the
+ * register map.  Writes to GPIOx land in OLATx.  Bits that are neither
+ * pulled low nor driven read as 1, as if pulled up.
+ *
+ * The switches are operated by a script of timed events, as for
+ * keymatrix_virt.
+ */
+
+#define MCP23018_VIRT_NUM_REGS 0x16
+#define MCP23018_VIRT_REG_IODIRA 0x00
+#define MCP23018_VIRT_REG_IODIRB 0x01
+#define MCP23018_VIRT_REG_GPIOA 0x12
+#define MCP23018_VIRT_REG_GPIOB 0x13
+#define MCP23018_VIRT_REG_OLATA 0x14
+#define MCP23018_VIRT_REG_OLATB 0x15
+
+enum {
+  MCP23018_TWI_IRQ_OUTPUT = 0,
+  MCP23018_TWI_IRQ_INPUT,
+  MCP23018_IRQ_COUNT
+};
+
+typedef struct mcp23018_virt_t {
+  struct avr_t* avr;
+  avr_irq_t* irq;
+  uint8_t verbose;
+  uint8_t address; // 7 bit
+  uint8_t selected; // the address byte that selected us, or 0
+  uint8_t reg_selected; // true once the register pointer was written
+  uint8_t reg_addr;
+  uint8_t regs[MCP23018_VIRT_NUM_REGS];
+
+  uint8_t rows;
+  uint8_t cols;
+  uint8_t closed[8]; // bitmap of closed switches per row
+
+  const keymatrix_virt_event_t* script;
+  size_t script_len;
+  size_t script_pos;
+} mcp23018_virt_t;
+
+void mcp23018_virt_init(
+    struct avr_t* avr,
+    mcp23018_virt_t* p,
+    uint8_t address,
+    uint8_t rows,
+    uint8_t cols);
+
+/*
+ * Attach to the AVR's TWI; pass AVR_IOCTL_TWI_GETIRQ(0) for example
+ */
+void mcp23018_virt_attach_twi(mcp23018_virt_t* p, uint32_t i2c_irq_base);
+
+/*
+ * Open or close a switch immediately
+ */
+void mcp23018_virt_set_key(
+    mcp23018_virt_t* p,
+    uint8_t row,
+    uint8_t col,
+    uint8_t pressed);
+
+/*
+ * Play the events in order at their scheduled times.  The events must
+ * be sorted by time and must outlive the simulation.
+ */
+void mcp23018_virt_play(
+    mcp23018_virt_t* p,
+    const keymatrix_virt_event_t* script,
+    size_t len);
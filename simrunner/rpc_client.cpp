@@ -0,0 +1,203 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rpc_client.h"
+
+static const uint8_t kResponseFlag = 0x80;
+// command + seq + status + crc16
+static const size_t kResponseOverhead = 5;
+
+uint16_t rpc_crc16(const uint8_t* data, size_t len) {
+  uint16_t crc = 0xffff;
+  for (size_t i = 0; i < len; ++i) {
+    crc ^= uint16_t(data[i]) << 8;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static speed_t baud_to_speed(int baud) {
+  switch (baud) {
+    case 9600:
+      return B9600;
+    case 19200:
+      return B19200;
+    case 38400:
+      return B38400;
+    case 57600:
+      return B57600;
+    default:
+      return B115200;
+  }
+}
+
+int rpc_open_serial(const char* path, int baud) {
+  int fd = open(path, O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, baud_to_speed(baud));
+    cfsetospeed(&tio, baud_to_speed(baud));
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+void rpc_client_init(rpc_client_t* c, int fd) {
+  c->fd = fd;
+  c->next_seq = 0;
+  c->rx.clear();
+  c->remaining = 0;
+  c->pending_zero = false;
+  c->bad_packets = 0;
+}
+
+static void write_all(int fd, const std::vector<uint8_t>& buf) {
+  size_t done = 0;
+  while (done < buf.size()) {
+    auto n = write(fd, buf.data() + done, buf.size() - done);
+    if (n <= 0) {
+      return;
+    }
+    done += n;
+  }
+}
+
+uint8_t rpc_client_send(
+    rpc_client_t* c,
+    uint8_t command,
+    const uint8_t* payload,
+    size_t len) {
+  uint8_t seq = c->next_seq++;
+
+  std::vector<uint8_t> packet;
+  packet.push_back(command);
+  packet.push_back(seq);
+  packet.insert(packet.end(), payload, payload + len);
+  uint16_t crc = rpc_crc16(packet.data(), packet.size());
+  packet.push_back(crc & 0xff);
+  packet.push_back(crc >> 8);
+
+  // COBS encode, then delimit
+  std::vector<uint8_t> encoded;
+  size_t pos = 0;
+  while (true) {
+    size_t run = 0;
+    while (pos + run < packet.size() && packet[pos + run] != 0 && run < 254) {
+      ++run;
+    }
+    encoded.push_back(run + 1);
+    encoded.insert(
+        encoded.end(), packet.begin() + pos, packet.begin() + pos + run);
+    pos += run;
+    if (pos == packet.size()) {
+      break;
+    }
+    if (run < 254) {
+      ++pos;
+    }
+  }
+  encoded.push_back(0);
+
+  write_all(c->fd, encoded);
+  return seq;
+}
+
+// Returns true if b completed a valid response
+static bool feed(rpc_client_t* c, uint8_t b, rpc_response_t* resp) {
+  if (b == 0) {
+    auto& rx = c->rx;
+    bool valid = c->remaining == 0 && rx.size() >= kResponseOverhead;
+    if (valid) {
+      uint16_t crc = rx[rx.size() - 2] | (uint16_t(rx[rx.size() - 1]) << 8);
+      valid = crc == rpc_crc16(rx.data(), rx.size() - 2) &&
+          (rx[0] & kResponseFlag);
+    }
+    if (valid) {
+      resp->command = rx[0] & ~kResponseFlag;
+      resp->seq = rx[1];
+      resp->status = rx[2];
+      resp->payload.assign(rx.begin() + 3, rx.end() - 2);
+    } else if (!rx.empty() || c->pending_zero) {
+      ++c->bad_packets;
+    }
+    rx.clear();
+    c->remaining = 0;
+    c->pending_zero = false;
+    return valid;
+  }
+  if (c->remaining == 0) {
+    if (c->pending_zero) {
+      c->rx.push_back(0);
+    }
+    c->remaining = b - 1;
+    c->pending_zero = b != 0xff;
+  } else {
+    c->rx.push_back(b);
+    --c->remaining;
+  }
+  return false;
+}
+
+static int64_t now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool rpc_client_receive(rpc_client_t* c, rpc_response_t* resp, int timeout_ms) {
+  auto deadline = now_ms() + timeout_ms;
+  uint8_t buf[64];
+  while (true) {
+    int remaining = deadline - now_ms();
+    if (remaining < 0) {
+      return false;
+    }
+    struct pollfd pfd = {c->fd, POLLIN, 0};
+    if (poll(&pfd, 1, remaining) <= 0) {
+      return false;
+    }
+    // Read a byte at a time so that we don't consume input that
+    // belongs to the next response
+    auto n = read(c->fd, buf, 1);
+    if (n <= 0) {
+      return false;
+    }
+    if (feed(c, buf[0], resp)) {
+      return true;
+    }
+  }
+}
+
+int rpc_client_call(
+    rpc_client_t* c,
+    uint8_t command,
+    const uint8_t* payload,
+    size_t len,
+    std::vector<uint8_t>* response_payload,
+    int timeout_ms,
+    int retries) {
+  for (int attempt = 0; attempt <= retries; ++attempt) {
+    auto seq = rpc_client_send(c, command, payload, len);
+    rpc_response_t resp;
+    while (rpc_client_receive(c, &resp, timeout_ms)) {
+      if (resp.seq != seq || resp.command != command) {
+        // A late response to an earlier attempt
+        continue;
+      }
+      if (response_payload) {
+        *response_payload = resp.payload;
+      }
+      return resp.status;
+    }
+  }
+  return RPC_STATUS_TIMEOUT;
+}
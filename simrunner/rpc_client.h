@@ -0,0 +1,79 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * The host side of the RPC protocol implemented by RpcServer
+ * (include/flutterby/Rpc.h).  The client works with any file
+ * descriptor; use rpc_open_serial() for a USB serial adapter or
+ * for the pty that `simrunner FIRMWARE.elf --pty` creates.
+ *
+ * Requests may be pipelined: call rpc_client_send() several times
+ * and then collect the responses with rpc_client_receive(), matching
+ * them up by their seq numbers.
+ */
+
+enum {
+  RPC_STATUS_OK = 0,
+  RPC_STATUS_UNKNOWN_COMMAND = 1,
+  RPC_STATUS_BAD_REQUEST = 2,
+  RPC_STATUS_RESPONSE_TOO_LARGE = 3,
+  // Not sent by the firmware; reported by rpc_client_call()
+  RPC_STATUS_TIMEOUT = -1,
+};
+
+typedef struct rpc_response_t {
+  uint8_t command;
+  uint8_t seq;
+  uint8_t status;
+  std::vector<uint8_t> payload;
+} rpc_response_t;
+
+typedef struct rpc_client_t {
+  int fd;
+  uint8_t next_seq;
+  std::vector<uint8_t> rx; // decoded bytes of the packet in progress
+  uint8_t remaining; // COBS state; see flutterby/Cobs.h
+  bool pending_zero;
+  uint32_t bad_packets;
+} rpc_client_t;
+
+/*
+ * Open a serial device (or pty) in raw mode at the given baud rate.
+ * Returns the fd, or -1 on failure.
+ */
+int rpc_open_serial(const char* path, int baud);
+
+void rpc_client_init(rpc_client_t* c, int fd);
+
+/*
+ * Send a request and return its seq number
+ */
+uint8_t rpc_client_send(
+    rpc_client_t* c,
+    uint8_t command,
+    const uint8_t* payload,
+    size_t len);
+
+/*
+ * Wait up to timeout_ms for the next valid response.
+ * Returns true if one was received.
+ */
+bool rpc_client_receive(rpc_client_t* c, rpc_response_t* resp, int timeout_ms);
+
+/*
+ * Send a request and wait for its response, retrying on timeout.
+ * Returns the status from the firmware or RPC_STATUS_TIMEOUT.
+ */
+int rpc_client_call(
+    rpc_client_t* c,
+    uint8_t command,
+    const uint8_t* payload,
+    size_t len,
+    std::vector<uint8_t>* response_payload,
+    int timeout_ms,
+    int retries);
+
+/* CRC-16/CCITT-FALSE, matching flutterby/Crc.h */
+uint16_t rpc_crc16(const uint8_t* data, size_t len);
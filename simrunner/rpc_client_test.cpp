@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "flutterby/Cobs.h"
+#include "flutterby/Crc.h"
+#include "rpc_client.h"
+
+// Round trips packets between the host client and the firmware's own
+// COBS and CRC code, without a simulator: the test plays the part of
+// RpcServer on the other end of a socketpair.
+
+using namespace flutterby;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+      exit(1);                                                          \
+    }                                                                   \
+  } while (0)
+
+static const uint8_t kResponseFlag = 0x80;
+
+// Reads the next request from fd and decodes it with cobs::Decoder
+static std::vector<uint8_t> read_request(int fd) {
+  uint8_t buf[255];
+  cobs::Decoder decoder(buf, sizeof(buf));
+  while (true) {
+    uint8_t b;
+    CHECK(read(fd, &b, 1) == 1);
+    auto status = decoder.feed(b);
+    CHECK(status != cobs::Decoder::Status::Invalid);
+    if (status == cobs::Decoder::Status::Complete) {
+      return std::vector<uint8_t>(buf, buf + decoder.length());
+    }
+  }
+}
+
+// Checks and strips the CRC of a decoded request
+static void check_crc(std::vector<uint8_t>* packet) {
+  CHECK(packet->size() >= 4);
+  auto len = packet->size() - 2;
+  uint16_t crc = (*packet)[len] | (uint16_t((*packet)[len + 1]) << 8);
+  CHECK(crc == crc16_ccitt(packet->data(), len));
+  packet->resize(len);
+}
+
+// Encodes a response the way RpcServer does and writes it to fd.
+// If corrupt is set the CRC is wrong.
+static void write_response(
+    int fd,
+    uint8_t command,
+    uint8_t seq,
+    uint8_t status,
+    const std::vector<uint8_t>& payload,
+    bool corrupt = false) {
+  std::vector<uint8_t> packet = {uint8_t(command | kResponseFlag), seq, status};
+  packet.insert(packet.end(), payload.begin(), payload.end());
+  uint16_t crc = crc16_ccitt(packet.data(), packet.size());
+  if (corrupt) {
+    crc ^= 1;
+  }
+  packet.push_back(crc & 0xff);
+  packet.push_back(crc >> 8);
+
+  std::vector<uint8_t> encoded;
+  cobs::encode(packet.data(), packet.size(), [&](uint8_t b) {
+    encoded.push_back(b);
+  });
+  encoded.push_back(0);
+  CHECK(write(fd, encoded.data(), encoded.size()) == ssize_t(encoded.size()));
+}
+
+int main() {
+  // The check value for CRC-16/CCITT-FALSE
+  const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+  CHECK(rpc_crc16(check, sizeof(check)) == 0x29b1);
+  CHECK(crc16_ccitt(check, sizeof(check)) == 0x29b1);
+
+  int fds[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  int device = fds[1];
+  rpc_client_t client;
+  rpc_client_init(&client, fds[0]);
+
+  // Zeros in the payload survive the encoding
+  const uint8_t zeros[] = {0x00, 0x11, 0x00, 0x00, 0x22, 0x00};
+  auto seq = rpc_client_send(&client, 5, zeros, sizeof(zeros));
+  auto request = read_request(device);
+  check_crc(&request);
+  CHECK(request.size() == 2 + sizeof(zeros));
+  CHECK(request[0] == 5);
+  CHECK(request[1] == seq);
+  for (size_t i = 0; i < sizeof(zeros); ++i) {
+    CHECK(request[2 + i] == zeros[i]);
+  }
+
+  // A packet that is exactly one maximal COBS block long
+  std::vector<uint8_t> run(250, 0x5a);
+  seq = rpc_client_send(&client, 6, run.data(), run.size());
+  request = read_request(device);
+  check_crc(&request);
+  CHECK(request.size() == 2 + run.size());
+  CHECK(request[1] == seq);
+  CHECK(std::vector<uint8_t>(request.begin() + 2, request.end()) == run);
+
+  // A corrupt response is counted and skipped, and the next one is
+  // decoded, zeros and all
+  write_response(device, 6, seq, RPC_STATUS_OK, {1, 2, 3}, true);
+  write_response(device, 6, seq, RPC_STATUS_OK, {0, 1, 0});
+  rpc_response_t resp;
+  CHECK(rpc_client_receive(&client, &resp, 1000));
+  CHECK(client.bad_packets == 1);
+  CHECK(resp.command == 6);
+  CHECK(resp.seq == seq);
+  CHECK(resp.status == RPC_STATUS_OK);
+  CHECK((resp.payload == std::vector<uint8_t>{0, 1, 0}));
+
+  // rpc_client_call skips a late response to an earlier request
+  uint8_t next = client.next_seq;
+  write_response(device, 1, uint8_t(next - 1), RPC_STATUS_OK, {0xee});
+  write_response(device, 1, next, RPC_STATUS_BAD_REQUEST, {0x42});
+  std::vector<uint8_t> payload;
+  CHECK(
+      rpc_client_call(&client, 1, nullptr, 0, &payload, 1000, 0) ==
+      RPC_STATUS_BAD_REQUEST);
+  CHECK((payload == std::vector<uint8_t>{0x42}));
+  request = read_request(device);
+  check_crc(&request);
+  CHECK((request == std::vector<uint8_t>{1, next}));
+
+  // and retries once its timeout expires
+  next = client.next_seq;
+  CHECK(
+      rpc_client_call(&client, 2, nullptr, 0, nullptr, 10, 1) ==
+      RPC_STATUS_TIMEOUT);
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    request = read_request(device);
+    check_crc(&request);
+    CHECK((request == std::vector<uint8_t>{2, uint8_t(next + attempt)}));
+  }
+
+  printf("rpc_client_test: OK\n");
+  return 0;
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rpc_client.h"
+
+// A command line client for RpcServer:
+//
+//   target/rpcclient DEVICE COMMAND [HEXBYTE...]
+//     sends one request and prints the response payload in hex
+//
+//   target/rpcclient DEVICE --bench COMMAND COUNT
+//     pipelines COUNT requests to an echo handler and reports the rate
+//
+// DEVICE is a serial port, or the pty printed by `simrunner --pty`.
+// Set RPC_BAUD to override the default of 57600.
+
+static const int kTimeoutMs = 1000;
+// Keep this many requests in flight when benchmarking, so that
+// we don't overrun the receive buffer on the firmware side
+static const int kWindow = 2;
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(rpc_client_t* c, uint8_t command, int count) {
+  const uint8_t payload[] = {0xde, 0xad, 0xbe, 0xef};
+  int sent = 0;
+  int received = 0;
+  auto start = now_seconds();
+
+  while (received < count) {
+    while (sent < count && sent - received < kWindow) {
+      rpc_client_send(c, command, payload, sizeof(payload));
+      ++sent;
+    }
+    rpc_response_t resp;
+    if (!rpc_client_receive(c, &resp, kTimeoutMs)) {
+      fprintf(stderr, "timed out after %d responses\n", received);
+      return 1;
+    }
+    if (resp.status != RPC_STATUS_OK ||
+        resp.payload.size() != sizeof(payload) ||
+        memcmp(resp.payload.data(), payload, sizeof(payload))) {
+      fprintf(stderr, "bad response to seq %d\n", resp.seq);
+      return 1;
+    }
+    ++received;
+  }
+
+  auto elapsed = now_seconds() - start;
+  printf(
+      "%d requests in %.3fs: %.1f requests/s\n",
+      count,
+      elapsed,
+      count / elapsed);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(
+        stderr,
+        "usage: %s DEVICE COMMAND [HEXBYTE...]\n"
+        "       %s DEVICE --bench COMMAND COUNT\n",
+        argv[0],
+        argv[0]);
+    return 1;
+  }
+
+  auto baud = getenv("RPC_BAUD") ? atoi(getenv("RPC_BAUD")) : 57600;
+  int fd = rpc_open_serial(argv[1], baud);
+  if (fd < 0) {
+    perror(argv[1]);
+    return 1;
+  }
+  rpc_client_t client;
+  rpc_client_init(&client, fd);
+
+  if (!strcmp(argv[2], "--bench")) {
+    if (argc != 5) {
+      fprintf(stderr, "--bench needs COMMAND and COUNT\n");
+      return 1;
+    }
+    return bench(&client, strtoul(argv[3], nullptr, 0), atoi(argv[4]));
+  }
+
+  uint8_t command = strtoul(argv[2], nullptr, 0);
+  std::vector<uint8_t> payload;
+  for (int i = 3; i < argc; ++i) {
+    payload.push_back(strtoul(argv[i], nullptr, 16));
+  }
+
+  std::vector<uint8_t> response;
+  int status = rpc_client_call(
+      &client,
+      command,
+      payload.data(),
+      payload.size(),
+      &response,
+      kTimeoutMs,
+      2);
+  if (status == RPC_STATUS_TIMEOUT) {
+    fprintf(stderr, "timed out\n");
+    return 1;
+  }
+  printf("status %d:", status);
+  for (auto b : response) {
+    printf(" %02x", b);
+  }
+  printf("\n");
+  return status == RPC_STATUS_OK ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+#include <fcntl.h>
+#include <gelf.h>
+#include <libelf.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace_decode.h"
+
+static const char* kTraceSection = ".flutterby_trace";
+
+static uint32_t read_le(const uint8_t* p, uint8_t len) {
+  uint32_t v = 0;
+  for (uint8_t i = 0; i < len; ++i) {
+    v |= uint32_t(p[i]) << (8 * i);
+  }
+  return v;
+}
+
+static uint8_t signature_arg_bytes(uint32_t signature) {
+  uint8_t total = 0;
+  for (; signature; signature >>= 4) {
+    total += signature & 0x7;
+  }
+  return total;
+}
+
+// Parse the table entries; the layout is described in Trace.h
+static void parse_table(trace_decoder_t* d, const uint8_t* p, size_t len) {
+  const uint8_t* end = p + len;
+  while (end - p > 8) {
+    trace_site_t site;
+    site.id = read_le(p, 2);
+    site.signature = read_le(p + 2, 4);
+    site.line = read_le(p + 6, 2);
+    p += 8;
+
+    auto file_end = (const uint8_t*)memchr(p, 0, end - p);
+    if (!file_end) {
+      break;
+    }
+    site.file.assign((const char*)p, file_end - p);
+    p = file_end + 1;
+
+    auto fmt_end = (const uint8_t*)memchr(p, 0, end - p);
+    if (!fmt_end) {
+      break;
+    }
+    site.format.assign((const char*)p, fmt_end - p);
+    p = fmt_end + 1;
+
+    site.arg_bytes = signature_arg_bytes(site.signature);
+
+    auto existing = d->sites.find(site.id);
+    if (existing == d->sites.end()) {
+      d->sites[site.id] = site;
+      continue;
+    }
+    // Inlined call sites repeat their entry; only complain
+    // if two different call sites hashed to the same ID
+    auto& prior = existing->second;
+    if (prior.line != site.line || prior.file != site.file) {
+      fprintf(
+          stderr,
+          "trace: id 0x%04x is used by both %s:%d and %s:%d; "
+          "move one of them to another line\n",
+          site.id,
+          prior.file.c_str(),
+          prior.line,
+          site.file.c_str(),
+          site.line);
+    }
+  }
+}
+
+int trace_decoder_load(trace_decoder_t* d, const char* elf_filename) {
+  if (elf_version(EV_CURRENT) == EV_NONE) {
+    return -1;
+  }
+  int fd = open(elf_filename, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  Elf* elf = elf_begin(fd, ELF_C_READ, nullptr);
+  size_t shstrndx;
+  if (!elf || elf_getshdrstrndx(elf, &shstrndx) != 0) {
+    if (elf) {
+      elf_end(elf);
+    }
+    close(fd);
+    return -1;
+  }
+
+  Elf_Scn* scn = nullptr;
+  while ((scn = elf_nextscn(elf, scn)) != nullptr) {
+    GElf_Shdr shdr;
+    if (!gelf_getshdr(scn, &shdr)) {
+      continue;
+    }
+    auto name = elf_strptr(elf, shstrndx, shdr.sh_name);
+    if (!name || strcmp(name, kTraceSection)) {
+      continue;
+    }
+    Elf_Data* data = nullptr;
+    while ((data = elf_getdata(scn, data)) != nullptr) {
+      parse_table(d, (const uint8_t*)data->d_buf, data->d_size);
+    }
+  }
+
+  elf_end(elf);
+  close(fd);
+  return d->sites.size();
+}
+
+void trace_decoder_init(trace_decoder_t* d, trace_emit_fn emit, void* param) {
+  d->sites.clear();
+  d->pending.clear();
+  d->discarded = 0;
+  d->emit = emit;
+  d->param = param;
+}
+
+// Expand the format string, substituting {} and {:x} with the args
+static std::string format_site(const trace_site_t& site, const uint8_t* args) {
+  std::string out;
+  uint32_t signature = site.signature;
+  const char* f = site.format.c_str();
+  char buf[16];
+
+  while (*f) {
+    bool dec = !strncmp(f, "{}", 2);
+    bool hex = !strncmp(f, "{:x}", 4);
+    if ((!dec && !hex) || !signature) {
+      out += *f++;
+      continue;
+    }
+    f += dec ? 2 : 4;
+
+    uint8_t size = signature & 0x7;
+    bool is_signed = signature & 0x8;
+    signature >>= 4;
+    uint32_t v = read_le(args, size);
+    args += size;
+
+    if (hex) {
+      snprintf(buf, sizeof(buf), "0x%x", v);
+    } else if (is_signed) {
+      // sign extend from the argument size
+      int32_t sv = int32_t(v << (32 - 8 * size)) >> (32 - 8 * size);
+      snprintf(buf, sizeof(buf), "%d", sv);
+    } else {
+      snprintf(buf, sizeof(buf), "%u", v);
+    }
+    out += buf;
+  }
+  return out;
+}
+
+void trace_decoder_feed(trace_decoder_t* d, uint8_t b) {
+  d->pending.push_back(b);
+
+  while (d->pending.size() >= 2) {
+    uint16_t id = read_le(&d->pending[0], 2);
+    auto it = d->sites.find(id);
+    if (it == d->sites.end()) {
+      // Lost sync, or output that isn't from TRACE()
+      d->pending.erase(d->pending.begin());
+      ++d->discarded;
+      continue;
+    }
+    auto& site = it->second;
+    if (d->pending.size() < 2u + site.arg_bytes) {
+      return;
+    }
+    d->emit(d->param, site, format_site(site, &d->pending[2]));
+    d->pending.clear();
+  }
+}
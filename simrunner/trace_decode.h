@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Decodes the binary records emitted by TRACE() (see
+ * include/flutterby/Trace.h) using the call site table that the
+ * firmware leaves in its .flutterby_trace ELF section.
+ *
+ * This is shared by simrunner, which decodes USART0 output while
+ * the firmware runs, and tracedump, which decodes a capture taken
+ * from real hardware.
+ */
+
+struct trace_site_t {
+  uint16_t id;
+  uint32_t signature; // one type code per nibble, see Trace.h
+  uint16_t line;
+  std::string file;
+  std::string format;
+  uint8_t arg_bytes; // total size of the arguments on the wire
+};
+
+typedef void (*trace_emit_fn)(void* param, const trace_site_t& site,
+                              const std::string& message);
+
+struct trace_decoder_t {
+  std::map<uint16_t, trace_site_t> sites;
+
+  std::vector<uint8_t> pending;
+  uint32_t discarded; // bytes dropped while resyncing
+
+  trace_emit_fn emit;
+  void* param;
+};
+
+/*
+ * Load the call site table from the ELF file.
+ * Returns the number of call sites, which may be 0 if the firmware
+ * doesn't use TRACE(), or -1 if the file couldn't be read.
+ * Conflicting IDs are reported to stderr.
+ */
+int trace_decoder_load(trace_decoder_t* d, const char* elf_filename);
+
+void trace_decoder_init(trace_decoder_t* d, trace_emit_fn emit, void* param);
+
+/*
+ * Feed a byte from the wire.  emit is called for each complete record.
+ * Unknown IDs are skipped a byte at a time until the stream resyncs.
+ */
+void trace_decoder_feed(trace_decoder_t* d, uint8_t b);
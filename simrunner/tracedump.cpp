@@ -0,0 +1,53 @@
+#include <stdio.h>
+
+#include "trace_decode.h"
+
+// Decodes a capture of TRACE() output from real hardware:
+//
+//   target/tracedump firmware.elf < /dev/ttyUSB0
+//   target/tracedump firmware.elf capture.bin
+
+static void
+print_record(void*, const trace_site_t& site, const std::string& msg) {
+  printf("%s:%d: %s\n", site.file.c_str(), site.line, msg.c_str());
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s FIRMWARE.elf [CAPTURE]\n", argv[0]);
+    return 1;
+  }
+
+  trace_decoder_t decoder;
+  trace_decoder_init(&decoder, print_record, nullptr);
+  int sites = trace_decoder_load(&decoder, argv[1]);
+  if (sites < 0) {
+    fprintf(stderr, "failed to read %s\n", argv[1]);
+    return 1;
+  }
+  if (sites == 0) {
+    fprintf(stderr, "%s has no TRACE() call sites\n", argv[1]);
+    return 1;
+  }
+
+  FILE* input = stdin;
+  if (argc == 3) {
+    input = fopen(argv[2], "rb");
+    if (!input) {
+      perror(argv[2]);
+      return 1;
+    }
+  }
+
+  int c;
+  while ((c = fgetc(input)) != EOF) {
+    trace_decoder_feed(&decoder, c);
+  }
+
+  if (decoder.discarded) {
+    fprintf(stderr, "skipped %u bytes of unrecognized data\n",
+            decoder.discarded);
+  }
+  return 0;
+}
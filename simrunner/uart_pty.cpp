@@ -0,0 +1,107 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "simavr/avr_uart.h"
+#include "simavr/sim_time.h"
+#include "uart_pty.h"
+
+enum {
+  UART_PTY_IRQ_OUTPUT = 0, // from the AVR to the pty
+  UART_PTY_IRQ_INPUT, // from the pty to the AVR
+  UART_PTY_IRQ_COUNT
+};
+
+static const char* _uart_pty_irq_names[UART_PTY_IRQ_COUNT] = {
+    [UART_PTY_IRQ_OUTPUT] = "8<uart_pty.in",
+    [UART_PTY_IRQ_INPUT] = "8>uart_pty.out",
+};
+
+// How often we check the pty for input, in simulated time.
+// One byte at 115200 baud takes ~87us.
+static const uint32_t kPollUsec = 50;
+
+static void
+uart_pty_out_hook(struct avr_irq_t* irq, uint32_t value, void* param) {
+  auto p = (uart_pty_t*)param;
+  uint8_t b = value;
+  // Nobody may have the slave open yet; just drop the byte in that case
+  if (write(p->fd, &b, 1) != 1) {
+    return;
+  }
+}
+
+static void uart_pty_xon_hook(struct avr_irq_t* irq, uint32_t value, void* param) {
+  ((uart_pty_t*)param)->xon = 1;
+}
+
+static void
+uart_pty_xoff_hook(struct avr_irq_t* irq, uint32_t value, void* param) {
+  ((uart_pty_t*)param)->xon = 0;
+}
+
+static avr_cycle_count_t
+uart_pty_poll(struct avr_t* avr, avr_cycle_count_t when, void* param) {
+  auto p = (uart_pty_t*)param;
+  uint8_t b;
+  if (p->xon && read(p->fd, &b, 1) == 1) {
+    avr_raise_irq(p->irq + UART_PTY_IRQ_INPUT, b);
+  }
+  return when + avr_usec_to_cycles(avr, kPollUsec);
+}
+
+int uart_pty_init(struct avr_t* avr, uart_pty_t* p) {
+  memset(p, 0, sizeof(*p));
+  p->avr = avr;
+  p->xon = 1;
+
+  p->fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (p->fd < 0 || grantpt(p->fd) || unlockpt(p->fd)) {
+    perror("uart_pty");
+    return -1;
+  }
+  strncpy(p->slave_name, ptsname(p->fd), sizeof(p->slave_name) - 1);
+
+  // Binary data; no echo or line editing
+  struct termios tio;
+  tcgetattr(p->fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(p->fd, TCSANOW, &tio);
+  fcntl(p->fd, F_SETFL, fcntl(p->fd, F_GETFL) | O_NONBLOCK);
+
+  p->irq = avr_alloc_irq(
+      &avr->irq_pool, 0, UART_PTY_IRQ_COUNT, _uart_pty_irq_names);
+  avr_irq_register_notify(
+      p->irq + UART_PTY_IRQ_OUTPUT, uart_pty_out_hook, p);
+  return 0;
+}
+
+void uart_pty_connect(uart_pty_t* p, char uart) {
+  auto avr = p->avr;
+
+  // We handle the data; stop simavr from echoing it to stdout
+  uint32_t flags = 0;
+  avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS(uart), &flags);
+  flags &= ~AVR_UART_FLAG_STDIO;
+  avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS(uart), &flags);
+
+  avr_connect_irq(
+      avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ(uart), UART_IRQ_OUTPUT),
+      p->irq + UART_PTY_IRQ_OUTPUT);
+  avr_connect_irq(
+      p->irq + UART_PTY_IRQ_INPUT,
+      avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ(uart), UART_IRQ_INPUT));
+  avr_irq_register_notify(
+      avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ(uart), UART_IRQ_OUT_XON),
+      uart_pty_xon_hook,
+      p);
+  avr_irq_register_notify(
+      avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ(uart), UART_IRQ_OUT_XOFF),
+      uart_pty_xoff_hook,
+      p);
+
+  avr_cycle_timer_register_usec(avr, kPollUsec, uart_pty_poll, p);
+}
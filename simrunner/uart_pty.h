@@ -0,0 +1,30 @@
+#pragma once
+#include "simavr/sim_avr.h"
+#include "simavr/sim_irq.h"
+
+/*
+ * Connects an AVR UART to a pseudo terminal so that host programs,
+ * such as the RPC client (rpc_client.h), can talk to the firmware
+ * while it runs in simrunner.
+ *
+ * Bytes are only fed to the AVR while its receive FIFO has room,
+ * using the XON/XOFF notifications from the simavr UART.
+ */
+
+typedef struct uart_pty_t {
+  struct avr_t* avr;
+  avr_irq_t* irq;
+  int fd; // master side of the pty
+  uint8_t xon; // true if the AVR can accept more input
+  char slave_name[64]; // open this to talk to the AVR
+} uart_pty_t;
+
+/*
+ * Allocate the pty; returns 0 on success, -1 on failure
+ */
+int uart_pty_init(struct avr_t* avr, uart_pty_t* p);
+
+/*
+ * Connect the pty to the UART named by uart, eg: '0'
+ */
+void uart_pty_connect(uart_pty_t* p, char uart);
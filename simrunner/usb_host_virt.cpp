@@ -0,0 +1,382 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "simavr/avr_usb.h"
+#include "simavr/sim_time.h"
+#include "usb_host_virt.h"
+
+// The stages of a control transfer.  Each stage is retried on the
+// next tick while the firmware NAKs it.
+enum {
+  STAGE_SETUP,
+  STAGE_DATA_IN,
+  STAGE_DATA_OUT,
+  STAGE_STATUS_IN, // zero length read after a write
+  STAGE_STATUS_OUT, // zero length write after a read
+};
+
+enum {
+  STEP_DEVICE,
+  STEP_ADDRESS,
+  STEP_CONFIG_HEADER,
+  STEP_CONFIG,
+  STEP_SET_CONFIGURATION,
+  STEP_SET_IDLE, // once per HID interface
+  STEP_SET_LEDS,
+  STEP_DONE,
+};
+
+// How often we make progress on enumeration
+static const uint32_t kControlTickUs = 50;
+static const uint32_t kFrameUs = 1000;
+
+static uint64_t now_us(usb_host_virt_t* p) {
+  return avr_cycles_to_usec(p->avr, p->avr->cycle);
+}
+
+static void fail(usb_host_virt_t* p, const char* why) {
+  p->failed = 1;
+  fprintf(stderr, "usb_host: enumeration failed at step %u: %s\n", p->step, why);
+}
+
+static void start_request(
+    usb_host_virt_t* p,
+    uint8_t request_type,
+    uint8_t request,
+    uint16_t value,
+    uint16_t index,
+    uint16_t length) {
+  p->setup[0] = request_type;
+  p->setup[1] = request;
+  p->setup[2] = value & 0xff;
+  p->setup[3] = value >> 8;
+  p->setup[4] = index & 0xff;
+  p->setup[5] = index >> 8;
+  p->setup[6] = length & 0xff;
+  p->setup[7] = length >> 8;
+  p->stage = STAGE_SETUP;
+  p->pos = 0;
+}
+
+static uint16_t request_length(usb_host_virt_t* p) {
+  return p->setup[6] | (p->setup[7] << 8);
+}
+
+// Advance the control transfer by one stage.  Returns 1 when it has
+// completed, 0 if it is still in progress and -1 if the device stalled.
+static int run_control(usb_host_virt_t* p) {
+  struct avr_io_usb io;
+  uint16_t length = request_length(p);
+  int res;
+
+  switch (p->stage) {
+    case STAGE_SETUP:
+      io.pipe = 0;
+      io.sz = sizeof(p->setup);
+      io.buf = p->setup;
+      res = avr_ioctl(p->avr, AVR_IOCTL_USB_SETUP, &io);
+      if (res == AVR_IOCTL_USB_NAK) {
+        return 0;
+      }
+      if (res < 0) {
+        return -1;
+      }
+      if (length == 0) {
+        p->stage = STAGE_STATUS_IN;
+      } else {
+        p->stage = (p->setup[0] & 0x80) ? STAGE_DATA_IN : STAGE_DATA_OUT;
+      }
+      return 0;
+
+    case STAGE_DATA_IN: {
+      // Until the device descriptor has been read we only know that
+      // the packets are at least 8 bytes
+      uint8_t packet = p->device[7] ? p->device[7] : 8;
+      io.pipe = 0;
+      io.sz = sizeof(p->data) - p->pos;
+      io.buf = p->data + p->pos;
+      res = avr_ioctl(p->avr, AVR_IOCTL_USB_READ, &io);
+      if (res == AVR_IOCTL_USB_NAK) {
+        return 0;
+      }
+      if (res < 0) {
+        return -1;
+      }
+      p->pos += io.sz;
+      if (io.sz < packet || p->pos >= length) {
+        p->stage = STAGE_STATUS_OUT;
+      }
+      return 0;
+    }
+
+    case STAGE_DATA_OUT:
+      io.pipe = 0;
+      io.sz = length;
+      io.buf = p->data;
+      res = avr_ioctl(p->avr, AVR_IOCTL_USB_WRITE, &io);
+      if (res == AVR_IOCTL_USB_NAK) {
+        return 0;
+      }
+      if (res < 0) {
+        return -1;
+      }
+      p->stage = STAGE_STATUS_IN;
+      return 0;
+
+    case STAGE_STATUS_IN:
+      io.pipe = 0;
+      io.sz = 0;
+      io.buf = p->data;
+      res = avr_ioctl(p->avr, AVR_IOCTL_USB_READ, &io);
+      break;
+
+    case STAGE_STATUS_OUT:
+      io.pipe = 0;
+      io.sz = 0;
+      io.buf = p->data;
+      res = avr_ioctl(p->avr, AVR_IOCTL_USB_WRITE, &io);
+      break;
+
+    default:
+      return -1;
+  }
+  if (res == AVR_IOCTL_USB_NAK) {
+    return 0;
+  }
+  return res < 0 ? -1 : 1;
+}
+
+// Find the HID interfaces and the interrupt IN endpoints in the
+// configuration descriptor
+static void parse_config(usb_host_virt_t* p) {
+  uint8_t interface = 0;
+  p->hid_interfaces = 0;
+  p->keyboard_interface = 0xff;
+  p->num_endpoints = 0;
+
+  for (uint16_t pos = 0; pos + 2 <= p->config_len;) {
+    const uint8_t* desc = p->config + pos;
+    if (desc[0] < 2 || pos + desc[0] > p->config_len) {
+      break;
+    }
+    if (desc[1] == 4 && desc[0] >= 9) {
+      interface = desc[2];
+      if (desc[5] == 3) {
+        p->hid_interfaces |= 1 << interface;
+        if (desc[6] == 1 && desc[7] == 1 && p->keyboard_interface == 0xff) {
+          p->keyboard_interface = interface;
+        }
+      }
+    } else if (desc[1] == 5 && desc[0] >= 7) {
+      if ((desc[2] & 0x80) && (desc[3] & 3) == 3 &&
+          p->num_endpoints < USB_HOST_VIRT_MAX_ENDPOINTS) {
+        auto ep = &p->endpoints[p->num_endpoints++];
+        ep->ep = desc[2] & 0x0f;
+        ep->interface = interface;
+        ep->size = desc[4] | (desc[5] << 8);
+      }
+    }
+    pos += desc[0];
+  }
+}
+
+// Issue the request for the current step, skipping steps that
+// don't apply to this device
+static void start_step(usb_host_virt_t* p) {
+  for (;;) {
+    switch (p->step) {
+      case STEP_DEVICE:
+        start_request(p, 0x80, 0x06, 0x0100, 0, sizeof(p->device));
+        return;
+      case STEP_ADDRESS:
+        start_request(p, 0x00, 0x05, 1, 0, 0);
+        return;
+      case STEP_CONFIG_HEADER:
+        start_request(p, 0x80, 0x06, 0x0200, 0, 9);
+        return;
+      case STEP_CONFIG:
+        start_request(p, 0x80, 0x06, 0x0200, 0, p->config_len);
+        return;
+      case STEP_SET_CONFIGURATION:
+        start_request(p, 0x00, 0x09, p->config[5], 0, 0);
+        p->interface = 0;
+        return;
+      case STEP_SET_IDLE:
+        while (p->interface < 8 && !(p->hid_interfaces & (1 << p->interface))) {
+          p->interface++;
+        }
+        if (p->interface < 8) {
+          start_request(p, 0x21, 0x0a, 0, p->interface, 0);
+          return;
+        }
+        break;
+      case STEP_SET_LEDS:
+        if (p->keyboard_interface != 0xff) {
+          start_request(p, 0x21, 0x09, 0x0200, p->keyboard_interface, 1);
+          p->data[0] = p->leds;
+          return;
+        }
+        break;
+      default:
+        return;
+    }
+    p->step++;
+  }
+}
+
+// Called when the transfer for the current step has completed
+static void finish_step(usb_host_virt_t* p) {
+  switch (p->step) {
+    case STEP_DEVICE:
+      if (p->pos < sizeof(p->device) || p->data[1] != 1) {
+        fail(p, "bad device descriptor");
+        return;
+      }
+      memcpy(p->device, p->data, sizeof(p->device));
+      break;
+    case STEP_CONFIG_HEADER:
+      if (p->pos < 9 || p->data[1] != 2) {
+        fail(p, "bad configuration descriptor");
+        return;
+      }
+      p->config_len = p->data[2] | (p->data[3] << 8);
+      if (p->config_len > sizeof(p->config)) {
+        fail(p, "configuration descriptor is too large");
+        return;
+      }
+      break;
+    case STEP_CONFIG:
+      if (p->pos < p->config_len) {
+        fail(p, "short configuration descriptor");
+        return;
+      }
+      memcpy(p->config, p->data, p->config_len);
+      parse_config(p);
+      break;
+    case STEP_SET_IDLE:
+      // Stay on this step until every HID interface has been done
+      p->interface++;
+      p->step--;
+      break;
+  }
+  p->step++;
+  start_step(p);
+
+  if (p->step == STEP_DONE) {
+    p->configured = 1;
+    if (p->verbose) {
+      printf(
+          "usb_host: configured %04x:%04x with %u interrupt endpoints\n",
+          p->device[8] | (p->device[9] << 8),
+          p->device[10] | (p->device[11] << 8),
+          p->num_endpoints);
+    }
+  }
+}
+
+// Read a report from each interrupt endpoint, as the host would once
+// per frame
+static void poll_endpoints(usb_host_virt_t* p) {
+  for (uint8_t i = 0; i < p->num_endpoints; ++i) {
+    auto& ep = p->endpoints[i];
+    uint8_t report[USB_HOST_VIRT_MAX_REPORT];
+    struct avr_io_usb io;
+    io.pipe = ep.ep;
+    io.sz = sizeof(report);
+    io.buf = report;
+    if (avr_ioctl(p->avr, AVR_IOCTL_USB_READ, &io) != AVR_IOCTL_USB_OK) {
+      continue;
+    }
+
+    auto at = now_us(p);
+    p->reports++;
+    if (p->verbose) {
+      printf("usb_host: %" PRIu64 "us ep%u:", at, ep.ep);
+      for (uint32_t b = 0; b < io.sz; ++b) {
+        printf(" %02x", report[b]);
+      }
+      printf("\n");
+    }
+    if (p->on_report) {
+      p->on_report(p->on_report_param, ep.ep, report, io.sz, at);
+    }
+  }
+}
+
+static avr_cycle_count_t
+usb_host_virt_tick(struct avr_t* avr, avr_cycle_count_t when, void* param) {
+  auto p = (usb_host_virt_t*)param;
+  if (!p->attached || p->failed) {
+    return 0;
+  }
+  if (p->configured) {
+    poll_endpoints(p);
+    return when + avr_usec_to_cycles(avr, kFrameUs);
+  }
+
+  switch (run_control(p)) {
+    case 1:
+      finish_step(p);
+      break;
+    case -1:
+      fail(p, "the device stalled");
+      return 0;
+  }
+  return when + avr_usec_to_cycles(avr, kControlTickUs);
+}
+
+static avr_cycle_count_t
+usb_host_virt_reset(struct avr_t* avr, avr_cycle_count_t when, void* param) {
+  auto p = (usb_host_virt_t*)param;
+  if (!p->attached) {
+    return 0;
+  }
+  avr_ioctl(avr, AVR_IOCTL_USB_RESET, nullptr);
+  p->step = STEP_DEVICE;
+  start_step(p);
+  // Give the firmware time to set up its control endpoint
+  avr_cycle_timer_register_usec(avr, kFrameUs, usb_host_virt_tick, p);
+  return 0;
+}
+
+static void
+usb_host_virt_attach_hook(struct avr_irq_t* irq, uint32_t value, void* param) {
+  auto p = (usb_host_virt_t*)param;
+  if (p->verbose) {
+    printf("usb_host: device %s\n", value ? "attached" : "detached");
+  }
+  p->attached = value;
+  p->configured = 0;
+  p->failed = 0;
+  memset(p->device, 0, sizeof(p->device));
+  avr_cycle_timer_cancel(p->avr, usb_host_virt_tick, p);
+  avr_cycle_timer_cancel(p->avr, usb_host_virt_reset, p);
+  if (value) {
+    // Wait for the connection to settle, then reset the device
+    avr_cycle_timer_register_usec(p->avr, 10 * kFrameUs, usb_host_virt_reset, p);
+  }
+}
+
+int usb_host_virt_init(struct avr_t* avr, usb_host_virt_t* p) {
+  memset(p, 0, sizeof(*p));
+  p->avr = avr;
+  p->keyboard_interface = 0xff;
+
+  auto attach = avr_io_getirq(avr, AVR_IOCTL_USB_GETIRQ(), USB_IRQ_ATTACH);
+  if (!attach) {
+    return -1;
+  }
+  avr_irq_register_notify(attach, usb_host_virt_attach_hook, p);
+  // We supply bus power
+  avr_ioctl(avr, AVR_IOCTL_USB_VBUS, (void*)1);
+  return 0;
+}
+
+void usb_host_virt_on_report(
+    usb_host_virt_t* p,
+    usb_host_virt_report_t func,
+    void* param) {
+  p->on_report = func;
+  p->on_report_param = param;
+}
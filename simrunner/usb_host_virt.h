@@ -0,0 +1,77 @@
+#pragma once
+#include <stdint.h>
+#include "simavr/sim_avr.h"
+
+/*
+ * A stand-in for a USB host, attached to the USB device controller of
+ * parts such as the atmega32u4.
+ *
+ * Once the firmware attaches to the bus the host resets it and
+ * enumerates it: it reads the device and configuration descriptors,
+ * sets an address and the first configuration, sets the idle rate of
+ * each HID interface to 0 and sends the keyboard LED output report.
+ * From then on it polls every interrupt IN endpoint once per 1ms frame,
+ * as a real host would for an endpoint with a bInterval of 1.
+ *
+ * Each report that the firmware delivers is timestamped with the
+ * simulated time at which the host received it.  Reports are logged
+ * when verbose is set and passed to the report callback, if any.
+ */
+
+#define USB_HOST_VIRT_MAX_ENDPOINTS 4
+#define USB_HOST_VIRT_MAX_REPORT 64
+#define USB_HOST_VIRT_MAX_CONFIG 255
+
+typedef void (*usb_host_virt_report_t)(
+    void* param,
+    uint8_t ep,
+    const uint8_t* report,
+    uint32_t len,
+    uint64_t at_us);
+
+typedef struct usb_host_virt_endpoint_t {
+  uint8_t ep; // endpoint number, without the direction bit
+  uint8_t interface;
+  uint16_t size;
+} usb_host_virt_endpoint_t;
+
+typedef struct usb_host_virt_t {
+  struct avr_t* avr;
+  uint8_t verbose;
+  // The LED state that is sent to the keyboard once it is configured
+  uint8_t leds;
+
+  uint8_t attached;
+  uint8_t configured;
+  uint8_t failed;
+  uint8_t step; // enumeration step
+  uint8_t interface; // the interface that the step applies to
+
+  // The control transfer in progress
+  uint8_t setup[8];
+  uint8_t stage;
+  uint8_t data[USB_HOST_VIRT_MAX_CONFIG];
+  uint16_t pos;
+
+  uint8_t device[18];
+  uint16_t config_len;
+  uint8_t config[USB_HOST_VIRT_MAX_CONFIG];
+  uint8_t hid_interfaces; // bitmask
+  uint8_t keyboard_interface; // 0xff if there is no boot keyboard
+  uint8_t num_endpoints;
+  usb_host_virt_endpoint_t endpoints[USB_HOST_VIRT_MAX_ENDPOINTS];
+
+  uint32_t reports;
+  usb_host_virt_report_t on_report;
+  void* on_report_param;
+} usb_host_virt_t;
+
+/*
+ * Returns 0 on success, or -1 if the AVR has no USB controller
+ */
+int usb_host_virt_init(struct avr_t* avr, usb_host_virt_t* p);
+
+void usb_host_virt_on_report(
+    usb_host_virt_t* p,
+    usb_host_virt_report_t func,
+    void* param);
@@ -0,0 +1,71 @@
+#include "avr_autogen.h"
+#include "flutterby/CompressedProgmem.h"
+#include "flutterby/Debug.h"
+#include "flutterby/Test.h"
+
+using namespace flutterby;
+
+// Runs, repeats and literals, spanning more than one block.  The
+// original is kept in ProgMem too, to compare against.
+constexpr uint8_t kTable[] __attribute__((progmem)) = {
+    1,  2,  3,  1,  2,  3,  1,  2,  3,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    0,  9,  10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25,
+    26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43,
+    44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61,
+    62, 63, 64, 65, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79,
+    80, 81, 82, 83, 84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95, 96, 97,
+    98, 99, 0,  0,  0,  0,  0,  0,  0,  0,  5,  6,  5,  6,  5,  6,  5,  6,
+    5,  6,  5,  6,  5,  6,  5,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+};
+CompressedProgMem(Table, kTable);
+static_assert(sizeof(Table) < sizeof(kTable), "should compress");
+
+constexpr uint8_t kText[] __attribute__((progmem)) = {'a', 'b', 'a', 'b', 'a', 'b', '!'};
+CompressedProgMem(Text, kText);
+
+class BufferStream {
+ public:
+  static u8 buf[16];
+  static u8 len;
+
+  void operator()(uint8_t b) {
+    buf[len++] = b;
+  }
+};
+u8 BufferStream::buf[16];
+u8 BufferStream::len;
+
+int main() {
+  // Nothing needs to be copied to SRAM up front
+  EXPECT_EQ(data_segment_size(), 0);
+
+  // Iteration yields the original table
+  EXPECT_EQ(Table.size(), sizeof(kTable));
+  u16 i = 0;
+  for (auto b : Table) {
+    EXPECT_EQ(b, progmem_deref(&kTable[i]));
+    ++i;
+  }
+  EXPECT_EQ(i, sizeof(kTable));
+
+  // Seeking to any offset yields the same bytes
+  for (i = 0; i < sizeof(kTable); ++i) {
+    EXPECT_EQ(*Table.at(i), progmem_deref(&kTable[i]));
+  }
+  auto it = Table.at(130);
+  EXPECT_EQ(it.position(), 130);
+  ++it;
+  EXPECT_EQ(*it, progmem_deref(&kTable[131]));
+
+  // Compressed strings can be streamed out
+  {
+    FormatStream<BufferStream, kFormatStreamNone> stm;
+    stm << Text;
+  }
+  EXPECT_EQ(BufferStream::len, sizeof(kText));
+  for (i = 0; i < sizeof(kText); ++i) {
+    EXPECT_EQ(BufferStream::buf[i], progmem_deref(&kText[i]));
+  }
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/Debounce.h"
+
+using namespace flutterby;
+using namespace flutterby::debounce;
+
+static_assert(counter_bits(1) == 1, "");
+static_assert(counter_bits(2) == 2, "");
+static_assert(counter_bits(6) == 3, "");
+static_assert(counter_bits(8) == 4, "");
+
+// Each entry of the table below is one scan of the row, in the order
+// that the scans happen, and bit n is the state of key n.  Reading one
+// bit down the table gives the history of that key:
+//
+// key 0: a clean press at the first scan
+// key 1: a press that bounces
+// key 2: a single scan glitch
+// key 3: held from the start, then released with bounce
+static const u8 kRaw[] = {
+    0b1001,
+    0b1011,
+    0b1101,
+    0b1011,
+    0b1011,
+    0b0011,
+    0b1011,
+    0b0011,
+    0b0011,
+    0b0011,
+    0b0011,
+};
+
+int main() {
+  // Deferred reports a change once it has been stable for 3 scans
+  {
+    VerticalDebouncer<u8, 1, 3, Mode::Deferred> db;
+    static const u8 kExpected[] = {
+        0b0000,
+        0b0000,
+        0b1001,
+        0b1001,
+        0b1001,
+        0b1011,
+        0b1011,
+        0b1011,
+        0b1011,
+        0b0011,
+        0b0011,
+    };
+    for (u8 i = 0; i < sizeof(kRaw); ++i) {
+      EXPECT_EQ(db.update(0, kRaw[i]), kExpected[i]);
+    }
+  }
+
+  // Eager reports a change immediately and then holds it for 3 scans,
+  // so the glitch on key 2 is reported but the bounces are not
+  {
+    VerticalDebouncer<u8, 1, 3, Mode::Eager> db;
+    static const u8 kExpected[] = {
+        0b1001,
+        0b1011,
+        0b1111,
+        0b1111,
+        0b1111,
+        0b0011,
+        0b0011,
+        0b0011,
+        0b0011,
+        0b0011,
+        0b0011,
+    };
+    for (u8 i = 0; i < sizeof(kRaw); ++i) {
+      EXPECT_EQ(db.update(0, kRaw[i]), kExpected[i]);
+    }
+  }
+
+  // Rows are independent, and 16 keys are handled as easily as 8
+  {
+    VerticalDebouncer<u16, 2, 2, Mode::Deferred> db;
+    EXPECT_EQ(db.update(0, 0x8001), 0);
+    EXPECT_EQ(db.update(1, 0x0100), 0);
+    EXPECT_EQ(db.update(0, 0x8001), 0x8001);
+    EXPECT_EQ(db.update(1, 0x0000), 0);
+    EXPECT_EQ(db.stable(1), 0);
+  }
+
+  // A single scan debounce passes everything through
+  {
+    VerticalDebouncer<u8, 1, 1, Mode::Deferred> deferred;
+    VerticalDebouncer<u8, 1, 1, Mode::Eager> eager;
+    for (u8 i = 0; i < sizeof(kRaw); ++i) {
+      EXPECT_EQ(deferred.update(0, kRaw[i]), kRaw[i]);
+      EXPECT_EQ(eager.update(0, kRaw[i]), kRaw[i]);
+    }
+  }
+
+  return 0;
+}
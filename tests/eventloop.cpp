@@ -1,12 +1,35 @@
 #include "avr_autogen.h"
 #include "flutterby/Test.h"
 #include "flutterby/EventLoop.h"
+#include "flutterby/Timebase.h"
 
 using namespace flutterby;
 
 int main() {
   bool done = false;
 
+  {
+    // Leave a stale compare value behind, as a previous user of Timer1
+    // might; the first tick must still come after one tick interval
+    timebase::Timer::configure(
+        timebase::TickPeriod::kClockSelect, timer::Waveform::Normal);
+    timebase::Timer::set_compare<0>(0x9000);
+    timebase::Timer::stop();
+
+    timebase::start();
+    __builtin_avr_sei();
+    EXPECT_EQ(timebase::Timer::compare<0>(), timebase::TickPeriod::kTop);
+    // The tick ISR advances the compare value
+    while (timebase::Timer::compare<0>() == timebase::TickPeriod::kTop) {
+    }
+    auto first = timebase::now();
+    EXPECT(first >= timebase::TickPeriod::kTop);
+    EXPECT(first < timebase::kTickInterval + timebase::kTickInterval / 4);
+    EXPECT_EQ(
+        timebase::Timer::compare<0>(),
+        timebase::TickPeriod::kTop + timebase::kTickInterval);
+  }
+
   {
     auto timer = make_timer(10_u16, false, [&done] { done = true; }).value();
     eventloop::enable_timer(timer);
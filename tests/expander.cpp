@@ -0,0 +1,95 @@
+#include "avr_autogen.h"
+#include "flutterby/Mcp23018.h"
+#include "flutterby/Test.h"
+#include "flutterby/Timebase.h"
+
+using namespace flutterby;
+
+// Matches the virtual MCP23018 wired up by simrunner, which presses
+// and releases keys on a fixed schedule
+using Remote = Mcp23018Matrix<4, 6>;
+
+struct Seen {
+  KeyEvent event;
+  u32 at;
+};
+
+int main() {
+  timebase::start();
+  __builtin_avr_sei();
+  I2cMaster::enable(400000);
+
+  // Nothing answers on the other address
+  Mcp23018Matrix<4, 6, debounce::None, 0x21> missing;
+  EXPECT(missing.setup().is_err());
+  EXPECT(!missing.connected());
+
+  // A batch reports the first failure once the bus is idle again
+  u8 reg = 0;
+  I2cMaster::Transfer probe{0x21, 1, 0, &reg, nullptr};
+  EXPECT(I2cMaster::start_batch(&probe, 1));
+  Option<I2cMaster::I2cResult> result;
+  do {
+    result = I2cMaster::batch_result();
+  } while (result.is_none());
+  EXPECT(result.value().is_err());
+  EXPECT(result.value().error() == I2cMaster::Error::SlaveNotReady);
+
+  // scan() retries the set up in the background rather than waiting on
+  // the bus
+  for (u8 i = 0; i < mcp23018::kRetryScans; ++i) {
+    EXPECT(!missing.scan([](KeyEvent) {}));
+  }
+  EXPECT(I2cMaster::batch_result().is_none());
+  while (I2cMaster::batch_result().is_none()) {
+  }
+  EXPECT(!missing.scan([](KeyEvent) {}));
+  EXPECT(!missing.connected());
+
+  Remote remote;
+  EXPECT(remote.setup().is_ok());
+  EXPECT(remote.connected());
+
+  Seen seen[8];
+  u8 num_seen = 0;
+  u16 busy_scans = 0;
+
+  while (timebase::now() < 30000) {
+    auto start = timebase::now();
+    remote.scan([&](KeyEvent e) {
+      if (num_seen < 8) {
+        seen[num_seen++] = Seen{e, start};
+      }
+    });
+    // The batch runs in the background; we are free to do other work
+    // here, such as scanning the local half
+    if (I2cMaster::batch_result().is_none()) {
+      ++busy_scans;
+    }
+    if (timebase::now() < 25000 && timebase::now() > 24500) {
+      EXPECT(remote.is_pressed(1, 2));
+      EXPECT_EQ(remote.row(3), 0b100000);
+    }
+    while (timebase::now() - start < 1000) {
+    }
+  }
+
+  EXPECT(busy_scans > 0);
+  EXPECT(remote.connected());
+  EXPECT_EQ(num_seen, 4);
+
+  // Each event is seen by the scan after the one that sampled it
+  auto check = [&](u8 i, u8 row, u8 col, bool pressed, u32 at) {
+    EXPECT_EQ(seen[i].event.row, row);
+    EXPECT_EQ(seen[i].event.col, col);
+    EXPECT(seen[i].event.pressed == pressed);
+    EXPECT(seen[i].at >= at && seen[i].at < at + 2100);
+  };
+  check(0, 1, 2, true, 20500);
+  check(1, 3, 5, true, 22500);
+  check(2, 1, 2, false, 25500);
+  check(3, 3, 5, false, 26500);
+
+  timebase::Timer::stop();
+  return 0;
+}
@@ -0,0 +1,45 @@
+#include "avr_autogen.h"
+#include "flutterby/FarProgmem.h"
+#include "flutterby/Test.h"
+
+using namespace flutterby;
+
+struct Frame {
+  uint8_t duration;
+  uint16_t color;
+  uint8_t level;
+};
+
+static constexpr Frame kFrames[] = {{1, 0x1234, 10}, {2, 0x5678, 20}};
+FarProgMemTable(Frames, kFrames);
+
+int main() {
+  auto frames = FarArray(Frames);
+  EXPECT_EQ(frames.size(), 2);
+
+  // Element access yields a copy of the whole element
+  Frame frame = *frames[1];
+  EXPECT_EQ(frame.duration, 2);
+  EXPECT_EQ(frame.color, 0x5678);
+  EXPECT_EQ(frame.level, 20);
+
+  // Iteration visits each element in order
+  uint8_t total = 0;
+  for (Frame f : frames) {
+    total += f.level;
+  }
+  EXPECT_EQ(total, 30);
+
+  // The reader walks the fields in sequence
+  FarProgMemReader reader(frames.begin());
+  EXPECT_EQ(reader.next(), 1);
+  EXPECT_EQ(reader.read<uint16_t>(), 0x1234);
+  reader.skip(1);
+  EXPECT(reader.raw_address() == frames[1].raw_address());
+  uint8_t bytes[sizeof(Frame)];
+  reader.read_bytes(bytes, sizeof(bytes));
+  EXPECT_EQ(bytes[3], 20);
+  EXPECT(reader.raw_address() == frames.end().raw_address());
+
+  return 0;
+}
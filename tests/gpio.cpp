@@ -0,0 +1,72 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/Gpio.h"
+
+using namespace flutterby;
+using namespace flutterby::gpio;
+
+// The pins are spread across three ports and deliberately out of
+// order so that bits need to move in both directions.  Some of them
+// are shared with the virtual key matrix in simrunner, but it only
+// drives a pin that is an input with its pull-up enabled, and here
+// they are all outputs.
+using Out = OutputPins<
+    OutputPin<PortD, 6>,
+    OutputPin<PortB, 3>,
+    OutputPin<PortC, 1>,
+    OutputPin<PortD, 4>,
+    OutputPin<PortB, 4>,
+    OutputPin<PortC, 0>,
+    OutputPin<PortD, 7>,
+    OutputPin<PortD, 5>>;
+using In = InputPins<
+    InputPin<PortD, 6>,
+    InputPin<PortB, 3>,
+    InputPin<PortC, 1>,
+    InputPin<PortD, 4>,
+    InputPin<PortB, 4>,
+    InputPin<PortC, 0>,
+    InputPin<PortD, 7>,
+    InputPin<PortD, 5>>;
+
+// The mapping is constant, so it folds away at compile time
+static_assert(
+    unmap_bits_impl<
+        PortD,
+        InputPin<PortD, 6>,
+        InputPin<PortB, 3>,
+        InputPin<PortC, 1>,
+        InputPin<PortD, 4>,
+        InputPin<PortB, 4>,
+        InputPin<PortC, 0>,
+        InputPin<PortD, 7>,
+        InputPin<PortD, 5>>::unmap_bits(0xf0) == 0xc9,
+    "");
+
+int main() {
+  // The pins are read back while they are driven as outputs; the PIN
+  // registers reflect the output level.
+  Out::setup();
+
+  for (u8 bit = 0; bit < 8; ++bit) {
+    Out::write(1 << bit);
+    EXPECT_EQ(In::read(), 1 << bit);
+  }
+
+  Out::write(0xa5);
+  EXPECT_EQ(In::read(), 0xa5);
+  Out::write(0x5a);
+  EXPECT_EQ(In::read(), 0x5a);
+
+  // Pins that aren't part of the set are ignored
+  Out::write(0);
+  Port<PortD>::reg() |= 1 << 3;
+  EXPECT_EQ(In::read(), 0);
+
+  // A partial set leaves the upper bits clear
+  using Two = InputPins<InputPin<PortC, 0>, InputPin<PortB, 4>>;
+  Out::write(0x30);
+  EXPECT_EQ(Two::read(), 0x03);
+
+  return 0;
+}
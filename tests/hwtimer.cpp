@@ -0,0 +1,56 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/HwTimer.h"
+#include "flutterby/Sleep.h"
+
+using namespace flutterby;
+
+// The clock selection happens at compile time; these assume the
+// 8MHz clock that the tests are built for.
+static_assert(F_CPU == 8000000, "update the expectations below");
+
+// 1600 cycles: /8 is the finest divisor that fits in 8 bits
+static_assert(HwTimer<0>::Period<200>::kSelection.divisor == 8, "");
+static_assert(HwTimer<0>::Period<200>::kTop == 199, "");
+
+// 8000 cycles fit in 16 bits without prescaling
+static_assert(HwTimer<1>::Period<1000>::kSelection.divisor == 1, "");
+static_assert(HwTimer<1>::Period<1000>::kTop == 7999, "");
+
+// Phase correct mode counts up and back down.  4000 cycles
+// per pass can only be approximated with /64 (0.8% error).
+using Approx = HwTimer<0>::Period<1000, timer::Waveform::PhaseCorrectPwmTopA, 10000>;
+static_assert(Approx::kSelection.divisor == 64, "");
+static_assert(Approx::kTop == 63, "");
+static_assert(Approx::kSelection.error_ppm == 8000, "");
+
+static volatile u8 COMPARE_COUNT = 0;
+
+IRQ_TIMER0_COMPA {
+  ++COMPARE_COUNT;
+  set_event_pending();
+}
+
+int main() {
+  HwTimer<0>::configure_period<200>();
+  __builtin_avr_sei();
+
+  while (COMPARE_COUNT < 5) {
+    wait_for_event(SleepMode::Idle);
+  }
+
+  HwTimer<0>::stop();
+  u8 stopped_at = COMPARE_COUNT;
+
+  // A free running 16-bit timer should advance while we spin
+  HwTimer<1>::configure(1, timer::Waveform::Normal);
+  auto before = HwTimer<1>::count();
+  for (volatile u8 i = 0; i < 100; ++i) {
+  }
+  EXPECT(HwTimer<1>::count() > before);
+  HwTimer<1>::stop();
+
+  EXPECT_EQ(COMPARE_COUNT, stopped_at);
+
+  return 0;
+}
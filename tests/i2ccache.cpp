@@ -0,0 +1,73 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/I2cRegisterCache.h"
+
+// Exercises the register cache against the virtual ds1338 in simrunner
+
+using namespace flutterby;
+
+enum Ds1338Consts {
+  TWI_ADDR = 0x68,
+  CONTROL = 0x07,
+  NVRAM = 0x08,
+  NUM_REGS = 0x40,
+  // Control register flags
+  SQWE = 4,
+  OUT = 7,
+};
+
+int main() {
+  I2cMaster::enable(400000);
+
+  I2cMaster::RegisterCache<NUM_REGS> rtc(TWI_ADDR, 1000);
+  rtc.mark_cacheable(CONTROL, NUM_REGS - 1);
+
+  // The first update has to fetch the register from the device,
+  // but subsequent updates are a single write
+  auto before = I2cMaster::transactions();
+  EXPECT(rtc.update(CONTROL, 0, 1 << SQWE).is_ok());
+  EXPECT_EQ(u16(I2cMaster::transactions() - before), 2);
+  before = I2cMaster::transactions();
+  EXPECT(rtc.update(CONTROL, 1 << SQWE, 1 << OUT).is_ok());
+  EXPECT_EQ(u16(I2cMaster::transactions() - before), 1);
+
+  // and an update that changes nothing doesn't touch the bus
+  before = I2cMaster::transactions();
+  EXPECT(rtc.update(CONTROL, 0, 1 << OUT).is_ok());
+  EXPECT_EQ(I2cMaster::transactions(), before);
+
+  u8 control;
+  EXPECT(I2cMaster::read(TWI_ADDR, 1000, CONTROL, control).is_ok());
+  EXPECT_EQ(control, 1 << OUT);
+
+  // Stage several nvram bytes and send them in one burst
+  for (u8 i = 0; i < 4; ++i) {
+    rtc.stage(NVRAM + i, i + 1);
+  }
+  EXPECT(rtc.is_dirty());
+  before = I2cMaster::transactions();
+  EXPECT(rtc.flush().is_ok());
+  EXPECT_EQ(u16(I2cMaster::transactions() - before), 1);
+  EXPECT(!rtc.is_dirty());
+
+  u8 nvram[4];
+  EXPECT(I2cMaster::read(TWI_ADDR, 1000, NVRAM, nvram).is_ok());
+  for (u8 i = 0; i < 4; ++i) {
+    EXPECT_EQ(nvram[i], i + 1);
+  }
+
+  // Cached values agree with the device, and are read without
+  // touching the bus
+  before = I2cMaster::transactions();
+  EXPECT_EQ(rtc.read(NVRAM + 2).value(), 3);
+  EXPECT_EQ(rtc.read(CONTROL).value(), 1 << OUT);
+  EXPECT_EQ(I2cMaster::transactions(), before);
+
+  // Priming picks up changes made behind the cache's back
+  EXPECT(I2cMaster::write(TWI_ADDR, 1000, NVRAM, u8(42)).is_ok());
+  EXPECT_EQ(rtc.read(NVRAM).value(), 1);
+  EXPECT(rtc.prime(NVRAM, 4).is_ok());
+  EXPECT_EQ(rtc.read(NVRAM).value(), 42);
+
+  return 0;
+}
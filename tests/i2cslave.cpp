@@ -0,0 +1,41 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/I2cSlave.h"
+#include "flutterby/Sleep.h"
+
+// This test relies on the virtual bus master in simrunner, which
+// burst reads our registers and then writes them back into our mailbox.
+
+using namespace flutterby;
+
+static constexpr u8 kSlaveAddress = 0x10;
+static I2cSlave::RegisterMap<8, 8> regs;
+
+int main() {
+  I2cSlave::enable(kSlaveAddress, regs);
+
+  auto back = I2cSlave::back_buffer();
+  for (u8 i = 0; i < 8; ++i) {
+    back[i] = 0xa0 + i;
+  }
+  EXPECT(I2cSlave::publish());
+  // The back buffer is refreshed with the published snapshot
+  EXPECT_EQ(I2cSlave::back_buffer()[3], 0xa3);
+
+  __builtin_avr_sei();
+
+  auto write = I2cSlave::take_mailbox();
+  while (write.is_none()) {
+    wait_for_event(SleepMode::Idle);
+    write = I2cSlave::take_mailbox();
+  }
+
+  EXPECT_EQ(write.value().reg, 0);
+  EXPECT_EQ(write.value().len, 8);
+  for (u8 i = 0; i < 8; ++i) {
+    EXPECT_EQ(regs.rx[i], 0xa0 + i);
+  }
+
+  I2cSlave::disable();
+  return 0;
+}
@@ -0,0 +1,61 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/InputCapture.h"
+#include "flutterby/Rtc.h"
+#include "flutterby/Sleep.h"
+
+// simrunner also wires the square wave output of the virtual ds1338
+// to PB0, which is ICP1 on the atmega328p.
+
+using namespace flutterby;
+
+static u32 difference(u32 a, u32 b) {
+  return a > b ? a - b : b - a;
+}
+
+int main() {
+  I2cMaster::enable(400000);
+
+  // Start the oscillator and select the 4096Hz square wave
+  EXPECT(I2cMaster::write(rtc::Ds1338::kAddress, 1000, rtc::SECONDS, u8(0))
+             .is_ok());
+  EXPECT(I2cMaster::write(
+             rtc::Ds1338::kAddress,
+             1000,
+             rtc::Ds1338::kControl,
+             u8(rtc::Ds1338::kSquareWaveSet | 1))
+             .is_ok());
+
+  InputCapture::enable(capture::Edge::Both);
+  __builtin_avr_sei();
+
+  auto start = timebase::now();
+  auto pulses = InputCapture::pulses();
+  capture::Pulse first{0, 0};
+
+  for (u8 i = 0; i < 8;) {
+    auto p = pulses.poll_next();
+    if (p.is_none()) {
+      wait_for_event(SleepMode::Idle);
+      continue;
+    }
+    auto pulse = p.value().value();
+    if (i == 0) {
+      first = pulse;
+      EXPECT(first.period > 0);
+    }
+    // A square wave with a steady period
+    EXPECT(difference(pulse.period, first.period) <= first.period / 50);
+    EXPECT(difference(pulse.duty_permille(), 500) <= 30);
+    ++i;
+  }
+
+  // The timestamps keep increasing across the timer overflows
+  EXPECT(timebase::now() - start > 8 * first.period);
+  EXPECT_EQ(InputCapture::take_overruns(), 0);
+
+  InputCapture::disable();
+  timebase::Timer::stop();
+
+  return 0;
+}
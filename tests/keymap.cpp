@@ -0,0 +1,88 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+// Generated by keymapc from tests/keymap.keymap
+#include "keymaps/tests/keymap.h"
+
+using namespace flutterby;
+using namespace flutterby::keymap;
+
+static_assert(TestKeymapLayer::fn == 1, "");
+static_assert(TestKeymapLayer::nav == 2, "");
+
+static_assert(Keymap<3, 2, 3>::kSize == 18, "");
+static_assert(sizeof(Keymap<3, 2, 3>::Mask) == 1, "");
+static_assert(sizeof(Keymap<9, 2, 3>::Mask) == 2, "");
+static_assert(momentary(1) == 0x1001, "");
+static_assert(toggle(2) == 0x1102, "");
+
+int main() {
+  // The table lives in flash only
+  EXPECT_EQ(data_segment_size(), 0);
+
+  EXPECT_EQ(TestKeymap.action(0, 1, 1), 0x0007);
+  EXPECT_EQ(TestKeymap.action(1, 0, 1), kTransparent);
+
+  // Only the base layer
+  EXPECT_EQ(TestKeymap.lookup(0, 0, 0), 0x0004);
+  EXPECT_EQ(TestKeymap.lookup(0, 1, 2), 0x0008);
+
+  // Layer 1 overrides (0, 0), makes (1, 1) a dead key and falls through
+  // to the base layer elsewhere
+  EXPECT_EQ(TestKeymap.lookup(0b010, 0, 0), 0x001e);
+  EXPECT_EQ(TestKeymap.lookup(0b010, 1, 1), kNoAction);
+  EXPECT_EQ(TestKeymap.lookup(0b010, 0, 1), 0x0005);
+
+  // The highest active layer wins; inactive layers are skipped
+  EXPECT_EQ(TestKeymap.lookup(0b110, 0, 0), 0x003a);
+  EXPECT_EQ(TestKeymap.lookup(0b100, 1, 1), 0x0007);
+  EXPECT_EQ(TestKeymap.lookup(0b100, 1, 2), 0x0008);
+
+  EXPECT_EQ(TestKeymap.layer_for(0b110, 0, 0), 2);
+  EXPECT_EQ(TestKeymap.layer_for(0b110, 0, 1), 0);
+
+  LayerState<3, 6> layers;
+  auto press = [&](u8 row, u8 col, bool pressed) {
+    return layers.resolve(TestKeymap, row, col, pressed);
+  };
+
+  EXPECT_EQ(press(0, 2, true), momentary(1));
+  EXPECT_EQ(layers.active(), 0b010);
+  EXPECT_EQ(press(0, 0, true), 0x001e);
+  EXPECT_EQ(press(0, 0, false), 0x001e);
+
+  // Toggle layer 2 while layer 1 is held, then let go of layer 1
+  EXPECT_EQ(press(1, 2, true), toggle(2));
+  EXPECT_EQ(press(1, 2, false), toggle(2));
+  EXPECT_EQ(layers.active(), 0b110);
+  EXPECT_EQ(press(0, 2, false), momentary(1));
+  EXPECT_EQ(layers.active(), 0b100);
+  EXPECT(layers.is_active(2));
+  EXPECT_EQ(press(0, 0, true), 0x003a);
+
+  layers.clear();
+  EXPECT_EQ(press(0, 0, true), 0x0004);
+  EXPECT_EQ(press(0, 0, false), 0x0004);
+
+  // A key is released as the action that it was pressed as, even
+  // though the layer it was found in has gone by the release
+  EXPECT_EQ(press(0, 2, true), momentary(1));
+  EXPECT_EQ(press(0, 0, true), 0x001e);
+  EXPECT_EQ(press(0, 2, false), momentary(1));
+  EXPECT_EQ(layers.active(), 0);
+  EXPECT_EQ(press(0, 0, false), 0x001e);
+
+  // A release with no recorded press does nothing: a key held across
+  // clear(), or since reset
+  EXPECT_EQ(press(0, 2, true), momentary(1));
+  EXPECT_EQ(press(1, 2, true), toggle(2));
+  layers.clear();
+  EXPECT_EQ(press(1, 2, false), kNoAction);
+  EXPECT_EQ(press(0, 2, false), kNoAction);
+  EXPECT_EQ(press(0, 2, false), kNoAction);
+  EXPECT_EQ(layers.active(), 0);
+  LayerState<3, 6> fresh;
+  EXPECT_EQ(fresh.resolve(TestKeymap, 0, 2, false), kNoAction);
+  EXPECT_EQ(fresh.active(), 0);
+
+  return 0;
+}
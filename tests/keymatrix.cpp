@@ -0,0 +1,79 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/KeyMatrix.h"
+#include "flutterby/Timebase.h"
+
+using namespace flutterby;
+using namespace flutterby::gpio;
+
+// Matches the virtual matrix wired up by simrunner, which presses
+// and releases keys on a fixed schedule
+using Rows = OutputPins<
+    OutputPin<PortC, 0>,
+    OutputPin<PortC, 1>,
+    OutputPin<PortC, 2>,
+    OutputPin<PortC, 3>>;
+using Cols = InputPins<
+    InputPin<PortD, 4, kEnablePullUp>,
+    InputPin<PortD, 5, kEnablePullUp>,
+    InputPin<PortD, 6, kEnablePullUp>,
+    InputPin<PortD, 7, kEnablePullUp>,
+    InputPin<PortB, 4, kEnablePullUp>,
+    InputPin<PortB, 5, kEnablePullUp>>;
+using Matrix = KeyMatrix<Rows, Cols>;
+
+static_assert(Matrix::kRows == 4, "");
+static_assert(Matrix::kCols == 6, "");
+
+struct Seen {
+  KeyEvent event;
+  u32 at;
+};
+
+int main() {
+  timebase::start();
+  __builtin_avr_sei();
+
+  Matrix matrix;
+  matrix.setup();
+  EXPECT(!matrix.scan());
+
+  Seen seen[8];
+  u8 num_seen = 0;
+
+  while (timebase::now() < 10000) {
+    auto start = timebase::now();
+    matrix.scan([&](KeyEvent e) {
+      if (num_seen < 8) {
+        seen[num_seen++] = Seen{e, start};
+      }
+    });
+    if (timebase::now() < 5000 && timebase::now() > 4500) {
+      EXPECT(matrix.is_pressed(1, 2));
+      EXPECT_EQ(matrix.row(3), 0b100001);
+    }
+    while (timebase::now() - start < 250) {
+    }
+  }
+
+  EXPECT_EQ(num_seen, 6);
+
+  // Each event is seen within a scan interval of it happening
+  auto check = [&](u8 i, u8 row, u8 col, bool pressed, u32 at) {
+    EXPECT_EQ(seen[i].event.row, row);
+    EXPECT_EQ(seen[i].event.col, col);
+    EXPECT(seen[i].event.pressed == pressed);
+    EXPECT(seen[i].at >= at && seen[i].at < at + 300);
+  };
+  check(0, 1, 2, true, 2000);
+  check(1, 3, 0, true, 4000);
+  check(2, 3, 5, true, 4000);
+  check(3, 1, 2, false, 6000);
+  check(4, 3, 0, false, 8000);
+  check(5, 3, 5, false, 8000);
+
+  EXPECT(!matrix.any_pressed());
+
+  timebase::Timer::stop();
+  return 0;
+}
@@ -0,0 +1,104 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/EventLoop.h"
+#include "flutterby/KeyMatrix.h"
+#include "flutterby/Timebase.h"
+
+using namespace flutterby;
+using namespace flutterby::gpio;
+
+// The virtual matrix in simrunner presses its first key at 2ms, holds
+// at least one key until 8ms and then releases everything
+using Rows = OutputPins<
+    OutputPin<PortC, 0>,
+    OutputPin<PortC, 1>,
+    OutputPin<PortC, 2>,
+    OutputPin<PortC, 3>>;
+using Cols = InputPins<
+    InputPin<PortD, 4, kEnablePullUp>,
+    InputPin<PortD, 5, kEnablePullUp>,
+    InputPin<PortD, 6, kEnablePullUp>,
+    InputPin<PortD, 7, kEnablePullUp>,
+    InputPin<PortB, 4, kEnablePullUp>,
+    InputPin<PortB, 5, kEnablePullUp>>;
+using Matrix = KeyMatrix<Rows, Cols>;
+
+// Columns on PORTD and PORTB use two of the interrupt groups
+static_assert(PinChange<Cols>::kMasks.group[0] == 0x30, "");
+static_assert(PinChange<Cols>::kMasks.group[1] == 0, "");
+static_assert(PinChange<Cols>::kMasks.group[2] == 0xf0, "");
+
+// The first event reported, and when it was reported
+static KeyEvent FIRST{0xff, 0xff, false};
+static u32 FIRST_AT = 0;
+// run_forever stops the timebase when it returns, and restarting it
+// resets the count, so keep track of the time that went before
+static u32 EPOCH = 0;
+
+static u32 now() {
+  return EPOCH + timebase::now();
+}
+
+static void record(KeyEvent e) {
+  if (FIRST.row == 0xff) {
+    FIRST = e;
+    FIRST_AT = now();
+  }
+}
+
+// Scan until the deadline, or until the matrix goes to sleep; on a real
+// device the scan timer would stop at that point
+static void scan_every_100us(u32 until, LowPowerScan<Matrix, 4>& scanner) {
+  while (now() < until && !scanner.asleep()) {
+    auto start = now();
+    scanner.scan(record);
+    while (now() - start < 100) {
+    }
+  }
+}
+
+int main() {
+  timebase::start();
+  __builtin_avr_sei();
+
+  Matrix::setup();
+  LowPowerScan<Matrix, 4> scanner;
+
+  // Nothing is pressed, so after 4 scans the matrix goes to sleep
+  scan_every_100us(1000, scanner);
+  EXPECT(scanner.asleep());
+  EXPECT(now() < 600);
+  EXPECT(eventloop::idle_sleep_mode() == SleepMode::PowerDown);
+
+  // With no timers, the event loop runs only until the key press wakes
+  // the matrix and its pollable has scanned.  The simulator keeps
+  // Timer1 running in power down, but its interrupts find nothing to do.
+  eventloop::run_forever();
+  EXPECT(!scanner.asleep());
+  EXPECT(eventloop::idle_sleep_mode() == SleepMode::Idle);
+  EXPECT(!future::Pollable::have_pollables());
+
+  // The key that woke us was reported by the scan right after the wakeup
+  EXPECT(FIRST_AT >= 2000 && FIRST_AT < 2050);
+  EXPECT_EQ(FIRST.row, 1);
+  EXPECT_EQ(FIRST.col, 2);
+  EXPECT(FIRST.pressed);
+
+  // Carry on the timebase from the wakeup; the event loop returned
+  // straight after that scan
+  EPOCH = FIRST_AT;
+  timebase::start();
+
+  // Keys are held until 8ms, so it stays awake
+  scan_every_100us(8000, scanner);
+  EXPECT(!scanner.asleep());
+
+  // and then sleeps again once they are released
+  scan_every_100us(9000, scanner);
+  EXPECT(scanner.asleep());
+  EXPECT(now() > 8300);
+
+  Matrix::disarm_wake();
+  timebase::Timer::stop();
+  return 0;
+}
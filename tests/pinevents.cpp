@@ -0,0 +1,101 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/PinChange.h"
+#include "flutterby/Rtc.h"
+#include "flutterby/Timebase.h"
+
+// simrunner wires the square wave output of the virtual ds1338 to
+// PD2 (INT0) and PB0 (PCINT0) on the atmega328p.
+
+using namespace flutterby;
+using gpio::Edge;
+
+using Int0Pin = gpio::InputPin<gpio::PortD, 2>;
+using Pcint0Pin = gpio::InputPin<gpio::PortB, 0>;
+
+static_assert(pin_events::Source<Int0Pin>::kInt == 0, "");
+static_assert(pin_events::Source<Pcint0Pin>::kGroup == 0, "");
+static_assert(pin_events::Source<Pcint0Pin>::kMask == 1, "");
+
+static u32 difference(u32 a, u32 b) {
+  return a > b ? a - b : b - a;
+}
+
+template <typename Poll>
+static auto wait_for(Poll&& poll) {
+  while (true) {
+    auto result = poll();
+    if (result.is_some()) {
+      return result.value().value();
+    }
+    wait_for_event(SleepMode::Idle);
+  }
+}
+
+int main() {
+  I2cMaster::enable(400000);
+
+  // Start the oscillator and select the 4096Hz square wave
+  EXPECT(I2cMaster::write(rtc::Ds1338::kAddress, 1000, rtc::SECONDS, u8(0))
+             .is_ok());
+  EXPECT(I2cMaster::write(
+             rtc::Ds1338::kAddress,
+             1000,
+             rtc::Ds1338::kControl,
+             u8(rtc::Ds1338::kSquareWaveSet | 1))
+             .is_ok());
+
+  timebase::start();
+  __builtin_avr_sei();
+
+  // A Future for a single edge on INT0
+  auto falling = Int0Pin::wait_edge(Edge::Falling);
+  EXPECT(wait_for([&] { return falling.poll(); }) == Edge::Falling);
+  EXPECT(!Int0Pin::read());
+
+  // A Stream of edges, each one period apart
+  static constexpr u32 kPeriod = timebase::kTicksPerSecond / 4096;
+  auto falls = Int0Pin::edges(Edge::Falling);
+  u32 last = 0;
+  for (u8 i = 0; i < 5; ++i) {
+    EXPECT(wait_for([&] { return falls.poll_next(); }) == Edge::Falling);
+    auto now = timebase::now();
+    if (i > 0) {
+      EXPECT(difference(now - last, kPeriod) < kPeriod / 5);
+    }
+    last = now;
+  }
+  Int0Pin::disable_edges();
+
+  // The pin change interrupt reports both edges, alternately
+  auto edges = Pcint0Pin::edges(Edge::Both);
+  auto previous = wait_for([&] { return edges.poll_next(); });
+  for (u8 i = 0; i < 6; ++i) {
+    auto edge = wait_for([&] { return edges.poll_next(); });
+    EXPECT(edge != previous);
+    previous = edge;
+  }
+
+  // and can be filtered
+  auto rising = Pcint0Pin::wait_edge(Edge::Rising);
+  EXPECT(wait_for([&] { return rising.poll(); }) == Edge::Rising);
+
+  // Arming another pin in the group keeps an edge on an armed pin that
+  // is still waiting for the ISR
+  using Other = gpio::InputPin<gpio::PortB, 1>;
+  using Source = pin_events::Source<Pcint0Pin>;
+  __builtin_avr_cli();
+  while (!Pcint0Pin::read()) {
+  }
+  Source::take();
+  while (Pcint0Pin::read()) {
+  }
+  auto other = Other::edges(Edge::Both);
+  __builtin_avr_sei();
+  EXPECT(Source::take() & u8(Edge::Falling));
+  Other::disable_edges();
+  Pcint0Pin::disable_edges();
+
+  timebase::Timer::stop();
+  return 0;
+}
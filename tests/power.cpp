@@ -0,0 +1,55 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/HwTimer.h"
+#include "flutterby/I2c.h"
+#include "flutterby/Power.h"
+
+using namespace flutterby;
+using power::Peripheral;
+
+template <Peripheral P>
+static bool gated() {
+  static_assert(power::Gate<P>::kReg != 0, "not gateable on this device");
+  return *reinterpret_cast<volatile u8*>(power::Gate<P>::kReg) &
+      power::Gate<P>::kMask;
+}
+
+int main() {
+  EXPECT_EQ(power::live(), 0);
+
+  I2cMaster::enable(400000);
+  HwTimer<0>::configure(1, timer::Waveform::Normal);
+  EXPECT_EQ(power::refs(Peripheral::Twi), 1);
+  EXPECT_EQ(
+      power::live(),
+      (1 << u8(Peripheral::Twi)) | (1 << u8(Peripheral::Timer0)));
+
+  // Reconfiguring doesn't take another reference
+  HwTimer<0>::configure(2, timer::Waveform::Normal);
+  EXPECT_EQ(power::refs(Peripheral::Timer0), 1);
+
+  power::gate_unused();
+  EXPECT(!gated<Peripheral::Twi>());
+  EXPECT(!gated<Peripheral::Timer0>());
+  EXPECT(gated<Peripheral::Timer1>());
+  EXPECT(gated<Peripheral::Adc>());
+
+  // Sharing a peripheral keeps it clocked until the last release
+  power::acquire(Peripheral::Twi);
+  I2cMaster::disable();
+  EXPECT(!gated<Peripheral::Twi>());
+  power::release(Peripheral::Twi);
+  EXPECT(gated<Peripheral::Twi>());
+
+  HwTimer<0>::stop();
+  EXPECT(gated<Peripheral::Timer0>());
+  EXPECT_EQ(power::live(), 0);
+
+  // Starting a timer ungates it again
+  HwTimer<1>::configure(1, timer::Waveform::Normal);
+  EXPECT(!gated<Peripheral::Timer1>());
+  EXPECT(HwTimer<1>::running());
+  HwTimer<1>::stop();
+
+  return 0;
+}
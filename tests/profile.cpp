@@ -0,0 +1,51 @@
+#define FLUTTERBY_PROFILE 1
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/Profile.h"
+
+using namespace flutterby;
+
+static void spin() {
+  PROFILE_SCOPE("spin"_P);
+  __builtin_avr_delay_cycles(8000);
+}
+
+static void never_called() {
+  PROFILE_SCOPE("never_called"_P);
+}
+
+int main() {
+  timebase::start();
+  __builtin_avr_sei();
+
+  for (u8 i = 0; i < 3; ++i) {
+    spin();
+  }
+
+  // Only scopes that have run are in the table
+  auto entry = profile::first_entry();
+  EXPECT(entry != nullptr);
+  EXPECT(entry->next == nullptr);
+  EXPECT_EQ(entry->calls, 3);
+
+  // The probes cost something, but not much
+  EXPECT(profile::overhead() > 0);
+  EXPECT(profile::overhead() * profile::kCyclesPerTick < 200);
+
+  // Less that cost, the times are good to the timebase resolution
+  auto min = profile::cycles(entry->min);
+  auto max = profile::cycles(entry->max);
+  EXPECT(min >= 8000 - profile::kCyclesPerTick);
+  EXPECT(min <= 8000 + 2 * profile::kCyclesPerTick);
+  EXPECT(max <= 8000 + 400);
+  EXPECT(entry->total >= entry->min * 3);
+
+  profile::dump();
+
+  profile::reset();
+  EXPECT_EQ(entry->calls, 0);
+  EXPECT_EQ(entry->total, 0);
+
+  timebase::Timer::stop();
+  return 0;
+}
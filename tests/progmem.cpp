@@ -17,6 +17,8 @@ struct Foo {
 
 ProgMem(Food, Foo(123,321));
 
+const Foo Foods[] __attribute__((progmem)) = {Foo(1, 2), Foo(3, 4)};
+
 int main() {
   // We should have nothing to copy to SRAM
   EXPECT_EQ(data_segment_size(), 0);
@@ -39,5 +41,31 @@ int main() {
   EXPECT_EQ(*localRef, 321);
   EXPECT_EQ((Food->*(&Foo::baz)), 321);
 
+  // A reader advances through consecutive values
+  ProgMemReader reader(Foods);
+  EXPECT_EQ(reader.read<int>(), 1);
+  EXPECT_EQ(reader.read<uint16_t>(), 2);
+  local = reader.read<Foo>();
+  EXPECT_EQ(local.bar, 3);
+  EXPECT_EQ(local.baz, 4);
+  EXPECT(reader.raw_ptr() == &Foods[2]);
+
+  // Only the requested fields are loaded, but the whole struct is skipped
+  reader = ProgMemReader(Foods);
+  local = reader.read_struct<Foo>(&Foo::baz);
+  EXPECT_EQ(local.bar, 0);
+  EXPECT_EQ(local.baz, 2);
+  EXPECT(reader.raw_ptr() == &Foods[1]);
+  local = reader.read_struct<Foo>(&Foo::bar, &Foo::baz);
+  EXPECT_EQ(local.bar, 3);
+  EXPECT_EQ(local.baz, 4);
+  EXPECT(reader.raw_ptr() == &Foods[2]);
+
+  reader = ProgMemReader(&Food);
+  reader.skip(sizeof(int));
+  uint8_t bytes[2];
+  reader.read_bytes(bytes, sizeof(bytes));
+  EXPECT_EQ(bytes[0] | (bytes[1] << 8), 321);
+
   return 0;
 }
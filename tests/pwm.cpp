@@ -0,0 +1,80 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/Pwm.h"
+
+using namespace flutterby;
+
+static_assert(F_CPU == 8000000, "update the expectations below");
+
+// The 16-bit timer uses ICR1 as TOP: 400 cycles per period
+using Fast20k = PwmTimer<1, 20000>;
+static_assert(Fast20k::kSelection.divisor == 1, "");
+static_assert(Fast20k::kTop == 399, "");
+static_assert(Fast20k::kWaveform == timer::Waveform::FastPwmTopIcr, "");
+
+// Phase correct counts up and down, so TOP is half the period
+using Centered1k = PwmTimer<1, 1000, pwm::Mode::PhaseCorrect>;
+static_assert(Centered1k::kTop == 4000, "");
+
+// The 8-bit timers count to 0xff and only choose the prescaler
+static_assert(PwmTimer<0, 31250>::kSelection.error_ppm == 0, "");
+static_assert(PwmTimer<0, 4000>::kSelection.divisor == 8, "");
+static_assert(PwmTimer<0, 4000>::kSelection.error_ppm == 24000, "");
+static_assert(
+    PwmTimer<0, 15686, pwm::Mode::PhaseCorrect>::kSelection.divisor == 1,
+    "");
+
+using Desc = TimerDesc<1>;
+using Backlight = Fast20k::Channel<0>;
+
+static u8 com1a() {
+  return timer::reg8(Desc::kTccrA) >> 6;
+}
+
+static u8 pin_mask() {
+  return 1 << Desc::kOcBit[0];
+}
+
+int main() {
+  Fast20k::configure();
+  Backlight::enable();
+  EXPECT(timer::reg8(Desc::kOcDdr[0]) & pin_mask());
+  EXPECT_EQ(com1a(), 0);
+
+  Backlight::set_duty(Backlight::kTop / 2);
+  EXPECT_EQ(timer::reg16(Desc::kOcrA), 199);
+  EXPECT_EQ(com1a(), u8(timer::CompareOutput::Clear));
+
+  // The counter must wrap at TOP
+  for (u8 i = 0; i < 100; ++i) {
+    EXPECT(Fast20k::Timer::count() <= Fast20k::kTop);
+  }
+
+  Backlight::set_duty_scaled(255);
+  EXPECT_EQ(timer::reg16(Desc::kOcrA), Fast20k::kTop);
+
+  // Zero duty is produced with the pin rather than the timer
+  Backlight::set_duty(0);
+  EXPECT_EQ(com1a(), 0);
+  EXPECT_EQ(timer::reg8(Desc::kOcPort[0]) & pin_mask(), 0);
+
+  // Coming back from zero reconnects at the start of a period
+  Backlight::set_duty(1);
+  EXPECT_EQ(com1a(), u8(timer::CompareOutput::Clear));
+  EXPECT(Fast20k::Timer::count() < Fast20k::kTop / 2);
+
+  Backlight::disable();
+  EXPECT_EQ(timer::reg8(Desc::kOcDdr[0]) & pin_mask(), 0);
+  Fast20k::stop();
+
+  // Phase correct mode produces zero duty with the timer
+  using Centered = Centered1k::Channel<0>;
+  Centered1k::configure();
+  Centered::enable();
+  EXPECT_EQ(com1a(), u8(timer::CompareOutput::Clear));
+  EXPECT_EQ(timer::reg16(Desc::kOcrA), 0);
+  Centered::disable();
+  Centered1k::stop();
+
+  return 0;
+}
@@ -0,0 +1,124 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/Rpc.h"
+#include "flutterby/Serial0.h"
+#include "flutterby/Sleep.h"
+
+// simrunner loops USART0 back to itself, so the test plays the part
+// of the host: it sends requests, lets the server handle them and
+// then decodes the responses that come back around.
+
+using namespace flutterby;
+
+struct Add {
+  static constexpr u8 kCommand = 1;
+  static rpc::Status handle(const rpc::Request& req, rpc::Response& resp) {
+    auto a = req.get<u16>(0);
+    auto b = req.get<u16>(2);
+    if (a.is_none() || b.is_none()) {
+      return rpc::Status::BadRequest;
+    }
+    resp.put(u32(a.value()) + b.value());
+    return rpc::Status::Ok;
+  }
+};
+
+using Server = RpcServer<Serial0, 16, rpc::Echo<0>, Add>;
+
+static void send_request(u8 command, u8 seq, const u8* payload, u8 len) {
+  u8 frame[16 + rpc::kRequestOverhead];
+  frame[0] = command;
+  frame[1] = seq;
+  for (u8 i = 0; i < len; ++i) {
+    frame[2 + i] = payload[i];
+  }
+  u16 crc = crc16_ccitt(frame, len + 2);
+  frame[len + 2] = u8(crc);
+  frame[len + 3] = u8(crc >> 8);
+  cobs::encode(frame, len + 4, [](u8 b) { Serial0::write_byte_blocking(b); });
+  Serial0::write_byte_blocking(0);
+}
+
+static void serve_one() {
+  while (!Server::poll()) {
+    wait_for_event(SleepMode::Idle);
+  }
+}
+
+static u8 response[16 + rpc::kResponseOverhead];
+
+// Returns the decoded length of the next response
+static u8 read_response() {
+  cobs::Decoder decoder(response, sizeof(response));
+  while (true) {
+    auto b = Serial0::read_byte();
+    if (b.is_none()) {
+      wait_for_event(SleepMode::Idle);
+      continue;
+    }
+    if (decoder.feed(b.value()) == cobs::Decoder::Status::Complete) {
+      u8 len = decoder.length();
+      EXPECT(len >= rpc::kResponseOverhead);
+      u16 crc = response[len - 2] | (u16(response[len - 1]) << 8);
+      EXPECT_EQ(crc, crc16_ccitt(response, len - 2));
+      return len;
+    }
+  }
+}
+
+int main() {
+  // Reference value for CRC-16/CCITT-FALSE
+  const u8 check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+  EXPECT_EQ(crc16_ccitt(check, sizeof(check)), 0x29b1);
+
+  Serial0::configure(57600);
+  __builtin_avr_sei();
+
+  // The payload contains zeros to exercise the COBS encoding
+  const u8 hello[] = {'h', 0, 'i', 0};
+  send_request(0, 7, hello, sizeof(hello));
+  serve_one();
+  EXPECT_EQ(read_response(), sizeof(hello) + rpc::kResponseOverhead);
+  EXPECT_EQ(response[0], 0x80);
+  EXPECT_EQ(response[1], 7);
+  EXPECT_EQ(u8(response[2]), u8(rpc::Status::Ok));
+  for (u8 i = 0; i < sizeof(hello); ++i) {
+    EXPECT_EQ(response[3 + i], hello[i]);
+  }
+
+  const u8 operands[] = {0xff, 0xff, 0x02, 0x00};
+  send_request(Add::kCommand, 8, operands, sizeof(operands));
+  serve_one();
+  EXPECT_EQ(read_response(), 4 + rpc::kResponseOverhead);
+  EXPECT_EQ(response[1], 8);
+  EXPECT_EQ(response[3], 0x01);
+  EXPECT_EQ(response[4], 0x00);
+  EXPECT_EQ(response[5], 0x01);
+  EXPECT_EQ(response[6], 0x00);
+
+  send_request(Add::kCommand, 9, operands, 3);
+  serve_one();
+  EXPECT_EQ(read_response(), rpc::kResponseOverhead);
+  EXPECT_EQ(u8(response[2]), u8(rpc::Status::BadRequest));
+
+  send_request(0x42, 10, nullptr, 0);
+  serve_one();
+  read_response();
+  EXPECT_EQ(u8(response[2]), u8(rpc::Status::UnknownCommand));
+
+  // A request with a bad CRC is dropped without a response, so the
+  // next response we see belongs to the request that follows it.
+  // This is the encoding of {0, 1, 0x22, 0x33} plus the delimiter.
+  const u8 garbage[] = {0x01, 0x04, 0x01, 0x22, 0x33, 0x00};
+  for (auto b : garbage) {
+    Serial0::write_byte_blocking(b);
+  }
+  serve_one();
+  EXPECT_EQ(Server::bad_packets(), 1);
+  send_request(0, 11, hello, 1);
+  serve_one();
+  read_response();
+  EXPECT_EQ(response[1], 11);
+
+  return 0;
+}
@@ -0,0 +1,57 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/Rtc.h"
+
+// simrunner wires the square wave output of the virtual ds1338
+// to PD2, which is INT0 on the atmega328p.
+
+using namespace flutterby;
+
+using Clock = Rtc<rtc::Ds1338>;
+
+IRQ_INT0 {
+  Clock::on_edge();
+}
+
+int main() {
+  // 12 hour mode: 12AM, 1AM, 12PM, 11PM; then 24 hour mode
+  EXPECT_EQ(rtc::decode_hours(0x52), 0);
+  EXPECT_EQ(rtc::decode_hours(0x41), 1);
+  EXPECT_EQ(rtc::decode_hours(0x72), 12);
+  EXPECT_EQ(rtc::decode_hours(0x71), 23);
+  EXPECT_EQ(rtc::decode_hours(0x23), 23);
+
+  I2cMaster::enable(400000);
+
+  // Start the oscillator by clearing the clock halt bit
+  EXPECT(I2cMaster::write(rtc::Ds1338::kAddress, 1000, rtc::SECONDS, u8(0))
+             .is_ok());
+
+  EXPECT(Clock::begin(3).is_ok());
+  EXPECT(Clock::enable_square_wave_interrupt<0>().is_ok());
+  __builtin_avr_sei();
+
+  auto start = Clock::now();
+  EXPECT_EQ(start.hours, 0);
+
+  // Wait for a few ticks; the third should trigger a resync
+  u8 ticks = 0;
+  while (ticks < 3) {
+    auto generation = Clock::generation();
+    while (generation == Clock::generation()) {
+      wait_for_event(SleepMode::Idle);
+    }
+    ++ticks;
+    auto now = Clock::now();
+    EXPECT_EQ(now.seconds, start.seconds + ticks);
+  }
+
+  EXPECT(Clock::poll().is_ok());
+
+  // After the resync we should agree with the chip
+  auto chip = rtc::read_time<rtc::Ds1338>(1000);
+  EXPECT(chip.is_ok());
+  EXPECT_EQ(Clock::now().seconds, chip.value().seconds);
+
+  return 0;
+}
@@ -0,0 +1,85 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/Serial0.h"
+#include "flutterby/Sleep.h"
+
+// This test relies on simrunner looping the USART0 transmit line
+// back to its receive line.
+
+using namespace flutterby;
+
+static u8 read_blocking() {
+  auto b = Serial0::read_byte();
+  while (b.is_none()) {
+    wait_for_event(SleepMode::Idle);
+    b = Serial0::read_byte();
+  }
+  return b.value();
+}
+
+int main() {
+  Serial0::configure(57600);
+
+  // With interrupts disabled nothing drains the buffer, so we can
+  // see that a full buffer is reported rather than blocking
+  u8 queued = 0;
+  while (Serial0::write_byte(queued)) {
+    ++queued;
+  }
+  EXPECT_EQ(queued, SERIAL0_TX_BUFFER_SIZE);
+  EXPECT_EQ(Serial0::tx_space(), 0);
+
+  __builtin_avr_sei();
+
+  // Everything comes back in order, and we keep up with the
+  // receive side so nothing is dropped
+  for (u8 i = 0; i < queued; ++i) {
+    EXPECT_EQ(read_blocking(), i);
+  }
+  EXPECT_EQ(Serial0::take_overruns(), 0);
+
+  const u8 hello[] = {'h', 'i'};
+  EXPECT_EQ(Serial0::write(hello, sizeof(hello)), sizeof(hello));
+  Serial0::flush();
+  EXPECT_EQ(Serial0::tx_space(), SERIAL0_TX_BUFFER_SIZE);
+
+  auto fut = Serial0::read();
+  auto status = fut.poll();
+  while (status.is_none()) {
+    wait_for_event(SleepMode::Idle);
+    status = fut.poll();
+  }
+  EXPECT_EQ(status.value().value(), 'h');
+
+  u8 sum = 0;
+  auto summer = Serial0::bytes().for_each([&sum](u8 b) { sum += b; });
+  while (sum == 0) {
+    EXPECT(summer.poll().is_none());
+    wait_for_event(SleepMode::Idle);
+  }
+  EXPECT_EQ(sum, 'i');
+
+  // A byte sent immediately while the queue is draining goes out
+  // without clobbering any of the queued bytes
+  const u8 digits[] = {'1', '2', '3', '4'};
+  EXPECT_EQ(Serial0::write(digits, sizeof(digits)), sizeof(digits));
+  Serial0::write_byte_immediate('!');
+  u8 next = 0;
+  bool seen_bang = false;
+  for (u8 i = 0; i < sizeof(digits) + 1; ++i) {
+    auto b = read_blocking();
+    if (b == '!') {
+      EXPECT(!seen_bang);
+      seen_bang = true;
+    } else {
+      EXPECT(next < sizeof(digits));
+      EXPECT_EQ(b, digits[next]);
+      ++next;
+    }
+  }
+  EXPECT(seen_bang);
+  EXPECT_EQ(next, sizeof(digits));
+  EXPECT_EQ(Serial0::take_overruns(), 0);
+
+  return 0;
+}
@@ -0,0 +1,48 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/Sleep.h"
+#include "flutterby/Timebase.h"
+
+using namespace flutterby;
+
+int main() {
+  timebase::start();
+  __builtin_avr_sei();
+
+  // Sync up with the event loop tick
+  wait_for_event(SleepMode::Idle);
+  reset_sleep_stats();
+
+  // Each sleep lasts until the next event loop tick
+  for (u8 i = 0; i < 5; ++i) {
+    wait_for_event(SleepMode::Idle);
+    // Stay awake for about 100 timebase ticks
+    __builtin_avr_delay_cycles(100 * timebase::TickPeriod::kSelection.divisor);
+  }
+
+  auto stats = sleep_stats();
+  EXPECT_EQ(stats.wakeups, 5);
+  EXPECT(stats.asleep[u8(SleepMode::Idle)] > 4 * (timebase::kTickInterval - 200));
+  EXPECT_EQ(stats.asleep[u8(SleepMode::PowerDown)], 0);
+
+  // The first sleep has no preceding burst; the other four were
+  // 100 ticks plus some overhead, which lands them in the 64-127
+  // bucket unless the overhead is unexpectedly large
+  u16 bursts = 0;
+  for (auto count : stats.bursts) {
+    bursts += count;
+  }
+  EXPECT_EQ(bursts, 4);
+  EXPECT_EQ(stats.bursts[6] + stats.bursts[7], 4);
+  EXPECT(stats.awake >= 4 * 100);
+  EXPECT(stats.awake < 4 * 256);
+  EXPECT(stats.duty_permille() < 10);
+
+  // A pending event returns immediately and isn't a wakeup
+  set_event_pending();
+  wait_for_event(SleepMode::Idle);
+  EXPECT_EQ(sleep_stats().wakeups, 5);
+
+  timebase::Timer::stop();
+  return 0;
+}
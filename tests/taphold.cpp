@@ -0,0 +1,163 @@
+#include "avr_autogen.h"
+#include "flutterby/TapHold.h"
+#include "flutterby/Test.h"
+
+using namespace flutterby;
+using namespace flutterby::keymap;
+
+// A 1x5 board: shift when A is held, layer 1 when B is held, and Escape
+// for D and E together
+const Keymap<2, 1, 5> TestKeymap __attribute__((progmem))({
+    // layer 0
+    mod_tap(1, 0x04), layer_tap(1, 0x05), 0x0006, 0x0007, 0x0008,
+    // layer 1
+    0x0001, 0x0001, 0x001e, 0x0001, 0x0001,
+});
+
+const ProgMemArrayInst<Combo, 1> TestCombos __attribute__((progmem))({
+    {{3, 4, kNoKey, kNoKey}, key(0x29)},
+});
+
+static_assert(mod_tap(1, 0x04) == 0x2104, "");
+static_assert(hold_action(mod_tap(1, 0x04)) == 0x00e1, "");
+static_assert(hold_action(layer_tap(1, 0x05)) == momentary(1), "");
+static_assert(tap_action(layer_tap(1, 0x05)) == 0x0005, "");
+static_assert(!is_tap_hold(momentary(1)), "");
+
+struct Emitted {
+  Action action;
+  bool pressed;
+};
+
+static constexpr u32 kMs = timebase::us_to_ticks(1000);
+
+int main() {
+  TapHold<5> taphold(TestCombos);
+  LayerState<2> layers;
+  Emitted emitted[8];
+  u8 num_emitted = 0;
+
+  auto lookup = [&](u8 row, u8 col) {
+    return TestKeymap.lookup(layers.active(), row, col);
+  };
+  auto emit = [&](Action action, bool pressed) {
+    layers.apply(action, pressed);
+    if (num_emitted < 8) {
+      emitted[num_emitted++] = Emitted{action, pressed};
+    }
+  };
+  auto key_event = [&](u8 col, bool pressed, u32 at) {
+    taphold.process(KeyEvent{0, col, pressed}, at, lookup, emit);
+  };
+  auto poll = [&](u32 at) { taphold.poll(at, lookup, emit); };
+  auto check = [&](u8 i, Action action, bool pressed) {
+    EXPECT(i < num_emitted);
+    EXPECT_EQ(emitted[i].action, action);
+    EXPECT(emitted[i].pressed == pressed);
+  };
+
+  // A quick tap of A types an a, once it is released
+  key_event(0, true, 0);
+  EXPECT_EQ(num_emitted, 0);
+  EXPECT_EQ(taphold.deadline().value(), 200 * kMs);
+  key_event(0, false, 50 * kMs);
+  EXPECT_EQ(num_emitted, 2);
+  check(0, 0x0004, true);
+  check(1, 0x0004, false);
+  EXPECT(taphold.idle());
+  EXPECT(taphold.deadline().is_none());
+
+  // Holding A past the hold time is shift
+  num_emitted = 0;
+  key_event(0, true, 1000 * kMs);
+  poll(1199 * kMs);
+  EXPECT_EQ(num_emitted, 0);
+  poll(1200 * kMs);
+  EXPECT_EQ(num_emitted, 1);
+  check(0, 0x00e1, true);
+  key_event(2, true, 1300 * kMs);
+  key_event(2, false, 1350 * kMs);
+  key_event(0, false, 1400 * kMs);
+  EXPECT_EQ(num_emitted, 4);
+  check(1, 0x0006, true);
+  check(2, 0x0006, false);
+  check(3, 0x00e1, false);
+
+  // Pressing and releasing C while B is down holds B straight away,
+  // and C is looked up in layer 1
+  num_emitted = 0;
+  key_event(1, true, 2000 * kMs);
+  key_event(2, true, 2010 * kMs);
+  EXPECT_EQ(num_emitted, 0);
+  key_event(2, false, 2030 * kMs);
+  EXPECT_EQ(num_emitted, 3);
+  check(0, momentary(1), true);
+  check(1, 0x001e, true);
+  check(2, 0x001e, false);
+  key_event(1, false, 2040 * kMs);
+  check(3, momentary(1), false);
+  EXPECT_EQ(layers.active(), 0);
+
+  // Rolling off B before C is a tap, and the order is kept
+  num_emitted = 0;
+  key_event(1, true, 3000 * kMs);
+  key_event(2, true, 3010 * kMs);
+  key_event(1, false, 3020 * kMs);
+  key_event(2, false, 3030 * kMs);
+  EXPECT_EQ(num_emitted, 4);
+  check(0, 0x0005, true);
+  check(1, 0x0006, true);
+  check(2, 0x0005, false);
+  check(3, 0x0006, false);
+
+  // D and E together are Escape, which is released with the first of
+  // them
+  num_emitted = 0;
+  key_event(3, true, 4000 * kMs);
+  EXPECT_EQ(taphold.deadline().value(), 4050 * kMs);
+  key_event(4, true, 4020 * kMs);
+  EXPECT_EQ(num_emitted, 1);
+  check(0, 0x0029, true);
+  key_event(3, false, 4100 * kMs);
+  key_event(4, false, 4110 * kMs);
+  EXPECT_EQ(num_emitted, 2);
+  check(1, 0x0029, false);
+
+  // D alone is sent once the combo can no longer happen
+  num_emitted = 0;
+  key_event(3, true, 5000 * kMs);
+  poll(5050 * kMs);
+  EXPECT_EQ(num_emitted, 1);
+  check(0, 0x0007, true);
+  // E could still be the start of the combo until D is released
+  key_event(4, true, 5060 * kMs);
+  EXPECT_EQ(num_emitted, 1);
+  key_event(3, false, 5070 * kMs);
+  key_event(4, false, 5080 * kMs);
+  EXPECT_EQ(num_emitted, 4);
+  check(1, 0x0008, true);
+  check(2, 0x0007, false);
+  check(3, 0x0008, false);
+
+  // A combo with no room for its keys is ignored, along with its
+  // release, but plain keys still have room
+  TapHold<5, 8, 1> small(TestCombos);
+  auto small_event = [&](u8 col, bool pressed, u32 at) {
+    small.process(KeyEvent{0, col, pressed}, at, lookup, emit);
+  };
+  num_emitted = 0;
+  small_event(3, true, 6000 * kMs);
+  small_event(4, true, 6020 * kMs);
+  EXPECT_EQ(num_emitted, 0);
+  small_event(3, false, 6100 * kMs);
+  small_event(4, false, 6110 * kMs);
+  EXPECT_EQ(num_emitted, 0);
+  EXPECT(small.idle());
+  small_event(2, true, 6200 * kMs);
+  small_event(2, false, 6210 * kMs);
+  EXPECT_EQ(num_emitted, 2);
+  check(0, 0x0006, true);
+  check(1, 0x0006, false);
+
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/Trace.h"
+#include "flutterby/Sleep.h"
+
+// simrunner loops USART0 back to itself, so we can check the bytes
+// that TRACE() puts on the wire.  simrunner also decodes them and
+// prints the reconstructed messages.
+
+using namespace flutterby;
+
+static u8 read_blocking() {
+  auto b = Serial0::read_byte();
+  while (b.is_none()) {
+    wait_for_event(SleepMode::Idle);
+    b = Serial0::read_byte();
+  }
+  return b.value();
+}
+
+static u16 read_u16() {
+  u16 lo = read_blocking();
+  return lo | (u16(read_blocking()) << 8);
+}
+
+int main() {
+  Serial0::configure(57600);
+  __builtin_avr_sei();
+
+  static_assert(trace::Signature<>::value() == 0, "no args");
+  static_assert(
+      trace::Signature<u8, i16, u32>::value() == 0x4a1, "nibble per arg");
+
+  TRACE("tracing started");
+  u16 started_id = trace::make_id(__FILE__, __LINE__ - 1);
+  EXPECT_EQ(read_u16(), started_id);
+
+  u8 key = 42;
+  i16 delta = -2;
+  u32 magic = 0xdeadbeef;
+  TRACE("key {} moved by {} magic {:x}", key, delta, magic);
+  u16 args_id = trace::make_id(__FILE__, __LINE__ - 1);
+  EXPECT_EQ(read_u16(), args_id);
+  EXPECT_EQ(read_blocking(), 42);
+  EXPECT_EQ(read_u16(), 0xfffe);
+  EXPECT_EQ(read_u16(), 0xbeef);
+  EXPECT_EQ(read_u16(), 0xdead);
+
+  // Call sites on different lines get different IDs
+  EXPECT(started_id != args_id);
+
+  // With interrupts masked nothing drains the buffer.  Records that
+  // don't fit are dropped whole rather than waiting for the wire.
+  Serial0::flush();
+  __builtin_avr_cli();
+  u8 traced = 0;
+  while (Serial0::tx_space() >= 6) {
+    TRACE("fill {}", u32(traced));
+    ++traced;
+  }
+  u16 fill_id = trace::make_id(__FILE__, __LINE__ - 3);
+  EXPECT_EQ(trace::take_overruns(), 0);
+  TRACE("fill {}", u32(traced));
+  u16 dropped_id = trace::make_id(__FILE__, __LINE__ - 1);
+  EXPECT_EQ(trace::take_overruns(), 1);
+  EXPECT(dropped_id != fill_id);
+  __builtin_avr_sei();
+
+  for (u8 i = 0; i < traced; ++i) {
+    EXPECT_EQ(read_u16(), fill_id);
+    EXPECT_EQ(read_u16(), i);
+    EXPECT_EQ(read_u16(), 0);
+  }
+
+  Serial0::flush();
+  EXPECT(Serial0::read_byte().is_none());
+  EXPECT_EQ(Serial0::take_overruns(), 0);
+  return 0;
+}
@@ -0,0 +1,181 @@
+#include "avr_autogen.h"
+#include "flutterby/Test.h"
+#include "flutterby/Timebase.h"
+#include "flutterby/Usb.h"
+
+using namespace flutterby;
+
+// Needs a part with a USB controller, such as the atmega32u4;
+// simrunner's USB host enumerates us and sets the caps lock LED.
+// Elsewhere there is nothing to test.
+
+#ifdef HAVE_AVR_USB
+// Wait up to timeout_us for cond() to become true
+template <typename Func>
+static bool wait_for(u32 timeout_us, Func&& cond) {
+  auto start = timebase::now();
+  while (!cond()) {
+    if (timebase::now() - start > timeout_us) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Wait for the host to take another report
+static bool wait_report(u16 before) {
+  return wait_for(5000, [before]() { return usb::reports_sent() != before; });
+}
+
+static u8 nkro_report[usb::kNkroReportSize];
+static u8 boot_report[usb::kBootReportSize];
+
+// Refresh the copies of both reports
+static void take_reports() {
+  usb::copy_report(usb::kNkroEndpoint, nkro_report);
+  usb::copy_report(usb::kBootEndpoint, boot_report);
+}
+
+// Returns true if the boot report holds exactly the given keys,
+// in that order
+static bool boot_keys(
+    u8 k0 = 0,
+    u8 k1 = 0,
+    u8 k2 = 0,
+    u8 k3 = 0,
+    u8 k4 = 0,
+    u8 k5 = 0) {
+  const u8 keys[] = {k0, k1, k2, k3, k4, k5};
+  for (u8 i = 0; i < 6; ++i) {
+    if (boot_report[2 + i] != keys[i]) {
+      return false;
+    }
+  }
+  return boot_report[1] == 0;
+}
+#endif
+
+int main() {
+#ifdef HAVE_AVR_USB
+  timebase::start();
+  __builtin_avr_sei();
+
+  usb::attach();
+  EXPECT(wait_for(
+      200000, []() { return usb::configured() && usb::leds() == 0x02; }));
+  EXPECT(!usb::boot_protocol());
+
+  // Configuring the endpoints queues a report on each of them
+  EXPECT(wait_for(5000, []() { return usb::reports_sent() >= 2; }));
+
+  auto before = usb::reports_sent();
+  usb::key(0x04, true);
+  EXPECT(wait_report(before));
+  // A in the bitmap, and nothing on the boot interface
+  take_reports();
+  EXPECT_EQ(nkro_report[0], 0);
+  EXPECT_EQ(nkro_report[1], 0x10);
+  EXPECT(boot_keys());
+
+  // Repeating a key state is not a change and sends nothing
+  before = usb::reports_sent();
+  usb::key(0x04, true);
+  EXPECT(!wait_report(before));
+
+  // Usages below 4 aren't keys
+  usb::key(0x00, true);
+  usb::key(0x01, true);
+  EXPECT(!wait_report(before));
+  take_reports();
+  EXPECT_EQ(nkro_report[1], 0x10);
+
+  before = usb::reports_sent();
+  usb::key(0xe1, true);
+  EXPECT(wait_report(before));
+  take_reports();
+  EXPECT_EQ(nkro_report[0], 0x02);
+
+  // A key that is pressed and released while the bank is busy is
+  // still reported: its release is held back for a report
+  EXPECT(!wait_report(usb::reports_sent()));
+  before = usb::reports_sent();
+  usb::key(0xe5, true);
+  EXPECT(wait_report(before));
+  usb::key(0x05, true);
+  usb::key(0x05, false);
+  take_reports();
+  EXPECT_EQ(nkro_report[1], 0x30);
+  before = usb::reports_sent();
+  EXPECT(wait_report(before));
+  take_reports();
+  EXPECT_EQ(nkro_report[1], 0x10);
+  before = usb::reports_sent();
+  EXPECT(wait_report(before));
+  EXPECT(!wait_report(usb::reports_sent()));
+
+  before = usb::reports_sent();
+  usb::release_all();
+  EXPECT(wait_report(before));
+  take_reports();
+  EXPECT_EQ(nkro_report[0], 0);
+  EXPECT_EQ(nkro_report[1], 0);
+
+  // Switching to the boot interface releases everything on the NKRO
+  // interface and reports the current state on the boot interface
+  before = usb::reports_sent();
+  usb::set_nkro(false);
+  EXPECT(wait_for(5000, [before]() {
+    return u16(usb::reports_sent() - before) >= 2;
+  }));
+
+  // More than six keys roll over in the boot report, and recover as
+  // they are released
+  before = usb::reports_sent();
+  for (u8 k = 0x04; k < 0x0b; ++k) {
+    usb::key(k, true);
+  }
+  // The first press goes out at once and the rest together in the
+  // next frame
+  wait_for(5000, []() { return false; });
+  EXPECT_EQ(u16(usb::reports_sent() - before), 2);
+  take_reports();
+  EXPECT_EQ(nkro_report[1], 0);
+  EXPECT(boot_keys(1, 1, 1, 1, 1, 1));
+
+  // Releasing the key that didn't fit clears the ErrorRollOver
+  before = usb::reports_sent();
+  usb::key(0x0a, false);
+  EXPECT(wait_report(before));
+  take_reports();
+  EXPECT(boot_keys(0x04, 0x05, 0x06, 0x07, 0x08, 0x09));
+
+  // Roll over again, and then release a key that did fit; one of the
+  // others takes its place
+  before = usb::reports_sent();
+  usb::key(0x0b, true);
+  EXPECT(wait_report(before));
+  take_reports();
+  EXPECT(boot_keys(1, 1, 1, 1, 1, 1));
+  before = usb::reports_sent();
+  usb::key(0x04, false);
+  EXPECT(wait_report(before));
+  take_reports();
+  EXPECT(boot_keys(0x05, 0x06, 0x07, 0x08, 0x09, 0x0b));
+
+  for (u8 k = 0x05; k < 0x0c; ++k) {
+    if (k == 0x0a) {
+      continue;
+    }
+    before = usb::reports_sent();
+    usb::key(k, false);
+    EXPECT(wait_report(before));
+  }
+  take_reports();
+  EXPECT(boot_keys());
+
+  usb::detach();
+  EXPECT(!usb::configured());
+  timebase::Timer::stop();
+#endif
+  return 0;
+}